@@ -105,6 +105,20 @@
 #define SQL_DEFAULT_CONNECTION_TIMEOUT 30
 
 
+/**
+ * Default time in milliseconds the statement-level ConnectionPool methods
+ * wait for a connection
+ */
+#define SQL_DEFAULT_CHECKOUT_TIMEOUT 5000
+
+
+/**
+ * Size in bytes of the pieces a streamed large object is sent in, see
+ * PreparedStatement_setBlobStream()
+ */
+#define SQL_DEFAULT_LOB_CHUNK_SIZE 65536
+
+
 /**
  * Default TCP/IP Connection timeout in seconds, used when connecting to
  * a database server over a TCP/IP connection
@@ -67,5 +67,9 @@
 #define ThreadData_create(key, dtor) wrapper(pthread_key_create(&(key), dtor))
 #define ThreadData_set(key, value) pthread_setspecific((key), (value))
 #define ThreadData_get(key) pthread_getspecific((key))
+#define ThreadData_destroy(key) wrapper(pthread_key_delete(key))
+#define Atomic_add(var, value) __sync_add_and_fetch(&(var), (value))
+#define Atomic_get(var) __sync_add_and_fetch(&(var), 0)
+#define Atomic_cas(var, old, new) __sync_bool_compare_and_swap(&(var), (old), (new))
 
 #endif
@@ -26,7 +26,11 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
 
 #include "URL.h"
 #include "Vector.h"
@@ -36,6 +40,9 @@
 #include "Connection.h"
 #include "ConnectionPool.h"
 #include "ConnectionDelegate.h"
+#include "Statistics.h"
+#include "Trace.h"
+#include "Dispatch.h"
 
 
 /**
@@ -77,17 +84,47 @@ static const struct Cop_T *cops[] = {
         NULL
 };
 
+/* Maximum number of bytes of SQL text held in a Connection's statement cache */
+#define STATEMENT_CACHE_MEMORY 65536
+
+/* A cached prepared statement. The cache is in LRU order, least recently
+   used first. A statement handed out since the Connection was checked out
+   is in use and is not evicted until the Connection is returned */
+typedef struct statement_t {
+        char *sql;
+        int inUse;
+        PreparedStatement_T statement;
+} *statement_t;
+
 #define T Connection_T
+typedef enum {
+        Copy_None = 0,
+        Copy_In,
+        Copy_Out
+} Copy_Type;
 struct Connection_S {
         Cop_T op;
         URL_T url;
 	int maxRows;
 	int timeout;
+        int fetchSize;
 	int isAvailable;
         Vector_T prepared;
+        Vector_T statementCache;
+        long statementCacheMemory;
 	int isInTransaction;
-        time_t lastAccessedTime;
+        int isInPipeline;
+        Copy_Type copy;
+        struct {
+                void (*callback)(T C, ResultSet_T result, void *ctx);
+                void *ctx;
+        } async;
+        long long lastAccessed;         // Time_coarse() when the connection was checked out or returned
+        long long created;              // Time_coarse() when the connection was established
+        double lifetimeShare;           // Random share in [0, 1) of the pool's lifetime jitter
+        long long resultMemory;         // Bytes held by result sets, see ResultSet_charge()
         ResultSet_T resultSet;
+        Trace_T trace;
         ConnectionDelegate_T D;
         ConnectionPool_T parent;
 };
@@ -110,7 +147,7 @@ static int _setDelegate(T C, char **error) {
                 *error = Str_cat("database protocol '%s' not supported", URL_getProtocol(C->url));
                 return false;
         }
-        C->D = C->op->new(C->url, error);
+        C->D = COP(C)->new(C->url, ConnectionPool_getContext(C->parent), error);
         return (C->D != NULL);
 }
 
@@ -123,11 +160,229 @@ static void _freePrepared(T C) {
 }
 
 
+static void _freeCachedStatement(T C, int i) {
+        statement_t s = Vector_remove(C->statementCache, i);
+        C->statementCacheMemory -= strlen(s->sql) + 1;
+        PreparedStatement_free(&s->statement);
+        FREE(s->sql);
+        FREE(s);
+}
+
+
+/* Evict least recently used statements not in use until the cache is within its bounds */
+static void _evictStatements(T C, int size) {
+        for (int i = 0; (i < Vector_size(C->statementCache)) && ((Vector_size(C->statementCache) > size) || (C->statementCacheMemory > STATEMENT_CACHE_MEMORY));) {
+                statement_t s = Vector_get(C->statementCache, i);
+                if (s->inUse)
+                        i++;
+                else
+                        _freeCachedStatement(C, i);
+        }
+}
+
+
+/* Collapse white-space outside of quoted literals and comments and trim the SQL in place, so
+   trivially different SQL strings map to the same cached statement. The result is only used as
+   the cache key. A comment started with -- keeps the newline ending it. As escapes in literals
+   and dollar quoting differ between database systems, the rest of the SQL is copied unchanged
+   from a backslash in a literal or a '$' or '#' outside of one */
+static char *_normalize(char *sql) {
+        char quote = 0, *d = sql;
+        for (char *s = sql; *s; s++) {
+                if (quote) {
+                        if (*s == '\\') {
+                                memmove(d, s, strlen(s) + 1);
+                                return sql;
+                        }
+                        if (*s == quote)
+                                quote = 0;
+                } else if (*s == '\'' || *s == '"') {
+                        quote = *s;
+                } else if (*s == '$' || *s == '#') {
+                        memmove(d, s, strlen(s) + 1);
+                        return sql;
+                } else if (*s == '-' && s[1] == '-') {
+                        for (; *s && *s != '\n'; s++)
+                                *d++ = *s;
+                        if (! *s)
+                                break;
+                } else if (*s == '/' && s[1] == '*') {
+                        for (*d++ = *s++; *s && ! (*s == '*' && s[1] == '/'); s++)
+                                *d++ = *s;
+                        if (! *s)
+                                break;
+                        *d++ = *s++;
+                } else if (isspace((uchar_t)*s)) {
+                        if (d == sql || isspace((uchar_t)s[1]) || ! s[1])
+                                continue;
+                        *d++ = ' ';
+                        continue;
+                }
+                *d++ = *s;
+        }
+        *d = 0;
+        return sql;
+}
+
+
+static PreparedStatement_T _prepare(T C, const char *sql, ...) {
+        va_list ap;
+        va_start(ap, sql);
+        PreparedStatement_T p = COP(C)->prepareStatement(C->D, sql, ap);
+        va_end(ap);
+        return p;
+}
+
+
+static int _execute(T C, const char *sql, ...) {
+        va_list ap;
+        va_start(ap, sql);
+        int success = COP(C)->execute(C->D, sql, ap);
+        va_end(ap);
+        return success;
+}
+
+
+static ResultSet_T _executeQuery(T C, const char *sql, ...) {
+        va_list ap;
+        va_start(ap, sql);
+        ResultSet_T r = COP(C)->executeQuery(C->D, sql, ap);
+        va_end(ap);
+        return r;
+}
+
+
+/* Execute with the tracer and the slow query log. The tracer gets the SQL statement with the
+   arguments applied, for the slow query log it is only formatted if the statement is reported */
+static int _traceExecute(T C, const char *sql, va_list ap) {
+        span_t span;
+        va_list copy;
+        va_copy(copy, ap);
+        char *statement = Trace_isTracing(C->trace) ? Str_vcat(sql, ap) : NULL;
+        Trace_begin(&span, C->trace, "execute", statement);
+        int success = statement ? _execute(C, "%s", statement) : COP(C)->execute(C->D, sql, ap);
+        long long rows = success ? COP(C)->rowsChanged(C->D) : -1;
+        Trace_end(&span, rows, success ? NULL : Connection_getLastError(C));
+        if (Trace_isSlow(&span)) {
+                if (! statement)
+                        statement = Str_vcat(sql, copy);
+                Trace_logSlowQuery(&span, COP(C)->name, statement, rows);
+        }
+        va_end(copy);
+        FREE(statement);
+        return success;
+}
+
+
+static ResultSet_T _traceExecuteQuery(T C, const char *sql, va_list ap) {
+        span_t span;
+        va_list copy;
+        va_copy(copy, ap);
+        char *statement = Trace_isTracing(C->trace) ? Str_vcat(sql, ap) : NULL;
+        Trace_begin(&span, C->trace, "executeQuery", statement);
+        ResultSet_T r = statement ? _executeQuery(C, "%s", statement) : COP(C)->executeQuery(C->D, sql, ap);
+        Trace_end(&span, -1, r ? NULL : Connection_getLastError(C));
+        if (Trace_isSlow(&span)) {
+                if (! statement)
+                        statement = Str_vcat(sql, copy);
+                Trace_logSlowQuery(&span, COP(C)->name, statement, -1);
+        }
+        va_end(copy);
+        FREE(statement);
+        if (r)
+                ResultSet_setTrace(r, C->trace);
+        return r;
+}
+
+
+/* Return a cached statement for the sql string or prepare and cache a new statement. Statements
+   are looked up by the normalized sql string while the sql string is prepared as given. The sql
+   string is freed by this method */
+static PreparedStatement_T _getCachedStatement(T C, char *sql, int size) {
+        statement_t s;
+        char *key = _normalize(Str_dup(sql));
+        for (int i = Vector_size(C->statementCache) - 1; i >= 0; i--) {
+                s = Vector_get(C->statementCache, i);
+                if (Str_isByteEqual(s->sql, key)) {
+                        FREE(key);
+                        FREE(sql);
+                        Vector_remove(C->statementCache, i);
+                        Vector_push(C->statementCache, s);
+                        PreparedStatement_clear(s->statement);
+                        s->inUse = true;
+                        return s->statement;
+                }
+        }
+        PreparedStatement_T p = _prepare(C, "%s", sql);
+        FREE(sql);
+        if (! p) {
+                FREE(key);
+                return NULL;
+        }
+        NEW(s);
+        s->sql = key;
+        s->inUse = true;
+        s->statement = p;
+        Vector_push(C->statementCache, s);
+        C->statementCacheMemory += strlen(key) + 1;
+        _evictStatements(C, size);
+        return p;
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility push(hidden)
 #endif
 
 
+/* Leave pipeline mode, waiting for queued statements and ignoring their errors */
+static void _abortPipeline(T C) {
+        if (C->isInPipeline) {
+                C->isInPipeline = false;
+                COP(C)->endPipeline(C->D);
+        }
+}
+
+
+/* Abort a COPY in progress, ignoring errors */
+static void _abortCopy(T C) {
+        if (C->copy) {
+                C->copy = Copy_None;
+                COP(C)->endCopy(C->D, true);
+        }
+}
+
+
+/* Discard the result of an asynchronous query in progress without calling its callback */
+static void _abortAsync(T C) {
+        if (C->async.callback) {
+                C->async.callback = NULL;
+                C->resultSet = COP(C)->getResult(C->D);
+        }
+}
+
+
+/* Wait a random time between half of and the full delay, so transactions which collided are not run in lockstep */
+static void _backoff(T C, int delay, unsigned int *seed) {
+        if (! *seed)
+                *seed = (unsigned int)(Statistics_now() ^ (uintptr_t)C);
+        int half = delay / 2;
+        Time_usleep((half + rand_r(seed) % (delay - half + 1)) * USEC_PER_MSEC);
+}
+
+
+static void _checkCopy(T C) {
+        if (! COP(C)->beginCopy)
+                THROW(SQLException, "COPY is not supported by %s", COP(C)->name);
+        if (C->copy)
+                THROW(SQLException, "A COPY is already in progress");
+        if (C->isInPipeline)
+                THROW(SQLException, "COPY is not allowed in pipeline mode");
+        if (C->resultSet)
+                ResultSet_free(&C->resultSet);
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -139,9 +394,13 @@ T Connection_new(void *pool, char **error) {
         C->isAvailable = true;
         C->isInTransaction = false;
         C->prepared = Vector_new(4);
+        C->statementCache = Vector_new(4);
         C->timeout = SQL_DEFAULT_TIMEOUT;
         C->url = ConnectionPool_getURL(pool);
-        C->lastAccessedTime = Time_now();
+        C->trace = ConnectionPool_getTrace(pool);
+        C->lastAccessed = C->created = Time_coarse();
+        unsigned int seed = (unsigned int)(Statistics_now() ^ (uintptr_t)C);
+        C->lifetimeShare = rand_r(&seed) / ((double)RAND_MAX + 1);
         if (! _setDelegate(C, error))
                 Connection_free(&C);
 	return C;
@@ -151,17 +410,53 @@ T Connection_new(void *pool, char **error) {
 void Connection_free(T *C) {
         assert(C && *C);
         Connection_clear((*C));
+        while (! Vector_isEmpty((*C)->statementCache))
+                _freeCachedStatement((*C), Vector_size((*C)->statementCache) - 1);
+        Vector_free(&(*C)->statementCache);
         Vector_free(&(*C)->prepared);
         if ((*C)->D)
-                (*C)->op->free(&(*C)->D);
+                COP(*C)->free(&(*C)->D);
 	FREE(*C);
 }
 
 
+void *Connection_newContext(URL_T url) {
+        assert(url);
+        Cop_T op = _getOp(URL_getProtocol(url));
+        return (op && op->newContext) ? op->newContext(url) : NULL;
+}
+
+
+void Connection_freeContext(URL_T url, void **context) {
+        assert(url);
+        assert(context);
+        if (*context)
+                _getOp(URL_getProtocol(url))->freeContext(context);
+}
+
+
 void Connection_setAvailable(T C, int isAvailable) {
         assert(C);
         C->isAvailable = isAvailable;
-        C->lastAccessedTime = Time_now();
+        C->lastAccessed = Time_coarse();
+}
+
+
+void Connection_setLastAccessed(T C, long long lastAccessed) {
+        assert(C);
+        C->lastAccessed = lastAccessed;
+}
+
+
+long long Connection_getCreated(T C) {
+        assert(C);
+        return C->created;
+}
+
+
+double Connection_getLifetimeShare(T C) {
+        assert(C);
+        return C->lifetimeShare;
 }
 
 
@@ -173,7 +468,13 @@ int Connection_isAvailable(T C) {
 
 time_t Connection_getLastAccessedTime(T C) {
         assert(C);
-        return C->lastAccessedTime;
+        return Time_now() - (time_t)((Time_coarse() - C->lastAccessed) / 1000);
+}
+
+
+long long Connection_getLastAccessed(T C) {
+        assert(C);
+        return C->lastAccessed;
 }
 
 
@@ -182,6 +483,46 @@ int Connection_isInTransaction(T C) {
         return (C->isInTransaction > 0);
 }
 
+
+int Connection_chargeMemory(T C, long long bytes) {
+        assert(C);
+        C->resultMemory += bytes;
+        return ConnectionPool_chargeMemory(C->parent, bytes);
+}
+
+
+void Connection_vexecute(T C, const char *sql, va_list ap) {
+        assert(C);
+        assert(sql);
+        if (C->async.callback)
+                THROW(SQLException, "Connection_execute is not allowed while an asynchronous query is in progress");
+        if (C->resultSet)
+                ResultSet_free(&C->resultSet);
+        long long start = Statistics_start();
+        int success = Trace_isEnabled(C->trace) ? _traceExecute(C, sql, ap) : COP(C)->execute(C->D, sql, ap);
+        if (! success) THROW(SQLException, "%s", Connection_getLastError(C));
+        Statistics_record(COP(C)->name, Statistics_Execute, start);
+}
+
+
+ResultSet_T Connection_vexecuteQuery(T C, const char *sql, va_list ap) {
+        assert(C);
+        assert(sql);
+        if (C->isInPipeline)
+                THROW(SQLException, "Connection_executeQuery is not allowed in pipeline mode");
+        if (C->async.callback)
+                THROW(SQLException, "Connection_executeQuery is not allowed while an asynchronous query is in progress");
+        if (C->resultSet)
+                ResultSet_free(&C->resultSet);
+        long long start = Statistics_start();
+        C->resultSet = Trace_isEnabled(C->trace) ? _traceExecuteQuery(C, sql, ap) : COP(C)->executeQuery(C->D, sql, ap);
+        if (! C->resultSet)
+                THROW(SQLException, "%s", Connection_getLastError(C));
+        Statistics_record(COP(C)->name, Statistics_ExecuteQuery, start);
+        ResultSet_charge(&C->resultSet, C);
+        return C->resultSet;
+}
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -194,7 +535,7 @@ void Connection_setQueryTimeout(T C, int ms) {
         assert(C);
         assert(ms >= 0);
         C->timeout = ms;
-        C->op->setQueryTimeout(C->D, ms);
+        COP(C)->setQueryTimeout(C->D, ms);
 }
 
 
@@ -207,7 +548,7 @@ int Connection_getQueryTimeout(T C) {
 void Connection_setMaxRows(T C, int max) {
         assert(C);
 	C->maxRows = max;
-        C->op->setMaxRows(C->D, max);
+        COP(C)->setMaxRows(C->D, max);
 }
 
 
@@ -217,6 +558,27 @@ int Connection_getMaxRows(T C) {
 }
 
 
+void Connection_setFetchSize(T C, int rows) {
+        assert(C);
+        assert(rows >= 0);
+        C->fetchSize = rows;
+        if (COP(C)->setFetchSize)
+                COP(C)->setFetchSize(C->D, rows);
+}
+
+
+int Connection_getFetchSize(T C) {
+        assert(C);
+        return C->fetchSize;
+}
+
+
+long long Connection_getResultMemory(T C) {
+        assert(C);
+        return C->resultMemory;
+}
+
+
 URL_T Connection_getURL(T C) {
         assert(C);
         return C->url;
@@ -228,19 +590,33 @@ URL_T Connection_getURL(T C) {
 
 int Connection_ping(T C) {
         assert(C);
-        return C->op->ping(C->D);
+        TRACE_BEGIN(C->trace, "ping", NULL);
+        int alive = COP(C)->ping(C->D);
+        TRACE_END(-1, alive ? NULL : Connection_getLastError(C));
+        return alive;
 }
 
 
 void Connection_clear(T C) {
         assert(C);
+        _abortCopy(C);
+        _abortPipeline(C);
+        _abortAsync(C);
         if (C->resultSet)
                 ResultSet_free(&C->resultSet);
         if (C->maxRows)
                 Connection_setMaxRows(C, 0);
+        if (C->fetchSize)
+                Connection_setFetchSize(C, 0);
         if (C->timeout != SQL_DEFAULT_TIMEOUT)
                 Connection_setQueryTimeout(C, SQL_DEFAULT_TIMEOUT);
         _freePrepared(C);
+        for (int i = 0; i < Vector_size(C->statementCache); i++) {
+                statement_t s = Vector_get(C->statementCache, i);
+                PreparedStatement_clear(s->statement);
+                s->inUse = false;
+        }
+        _evictStatements(C, ConnectionPool_getStatementCacheSize(C->parent));
 }
 
 
@@ -251,8 +627,17 @@ void Connection_close(T C) {
 
 
 void Connection_beginTransaction(T C) {
+        Connection_beginTransactionType(C, Transaction_Default);
+}
+
+
+void Connection_beginTransactionType(T C, int type) {
         assert(C);
-        if (! C->op->beginTransaction(C->D)) 
+        assert((type & ~(Transaction_ReadOnly | Transaction_Deferred)) <= Transaction_Serializable);
+        TRACE_BEGIN(C->trace, "beginTransaction", NULL);
+        int success = COP(C)->beginTransaction(C->D, type);
+        TRACE_END(-1, success ? NULL : Connection_getLastError(C));
+        if (! success)
                 THROW(SQLException, "%s", Connection_getLastError(C));
         C->isInTransaction++;
 }
@@ -263,82 +648,310 @@ void Connection_commit(T C) {
         if (C->isInTransaction)
                 C->isInTransaction = 0;
         // Even if we are not in a transaction, call the delegate anyway and propagate any errors
-        if (! C->op->commit(C->D)) 
+        TRACE_BEGIN(C->trace, "commit", NULL);
+        int success = COP(C)->commit(C->D);
+        TRACE_END(-1, success ? NULL : Connection_getLastError(C));
+        if (! success)
                 THROW(SQLException, "%s", Connection_getLastError(C));
 }
 
 
 void Connection_rollback(T C) {
         assert(C);
+        _abortCopy(C);
+        _abortPipeline(C);
+        _abortAsync(C);
         if (C->isInTransaction) {
                 // Clear any pending resultset statements first
                 Connection_clear(C);
                 C->isInTransaction = 0;
         }
         // Even if we are not in a transaction, call the delegate anyway and propagate any errors
-        if (! C->op->rollback(C->D))
+        TRACE_BEGIN(C->trace, "rollback", NULL);
+        int success = COP(C)->rollback(C->D);
+        TRACE_END(-1, success ? NULL : Connection_getLastError(C));
+        if (! success)
                 THROW(SQLException, "%s", Connection_getLastError(C));
 }
 
 
-long long Connection_lastRowId(T C) {
+void Connection_runTransaction(T C, void (*callback)(T C, void *ctx), void *ctx, const Connection_RetryPolicy_T *policy) {
         assert(C);
-        return C->op->lastRowId(C->D);
+        assert(callback);
+        Connection_RetryPolicy_T p = policy ? *policy : (Connection_RetryPolicy_T){.maxAttempts = 5, .initialDelay = 10, .maxDelay = 1000};
+        assert(p.maxAttempts > 0);
+        assert(p.initialDelay >= 0 && p.maxDelay >= p.initialDelay);
+        unsigned int seed = 0;
+        int delay = p.initialDelay;
+        for (int attempt = 1; ; attempt++) {
+                volatile int retry = false;
+                TRY
+                {
+                        Connection_beginTransactionType(C, p.type);
+                        callback(C, ctx);
+                        Connection_commit(C);
+                }
+                ELSE
+                {
+                        // Classify the error before the rollback replaces it
+                        retry = attempt < p.maxAttempts && COP(C)->isRetryable && COP(C)->isRetryable(C->D);
+                        if (C->isInTransaction) {
+                                TRY Connection_rollback(C); ELSE END_TRY;
+                        }
+                        if (! retry)
+                                RETHROW;
+                        DEBUG("Retrying transaction after -- %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                if (! retry)
+                        return;
+                _backoff(C, delay, &seed);
+                delay = delay > p.maxDelay / 2 ? p.maxDelay : delay * 2;
+        }
 }
 
 
-long long Connection_rowsChanged(T C) {
+void Connection_beginPipeline(T C) {
         assert(C);
-        return C->op->rowsChanged(C->D);
+        if (C->isInPipeline)
+                return;
+        if (! COP(C)->beginPipeline)
+                THROW(SQLException, "Pipeline mode is not supported by %s", COP(C)->name);
+        if (C->resultSet)
+                ResultSet_free(&C->resultSet);
+        if (! COP(C)->beginPipeline(C->D))
+                THROW(SQLException, "%s", Connection_getLastError(C));
+        C->isInPipeline = true;
 }
 
 
-void Connection_execute(T C, const char *sql, ...) {
+void Connection_endPipeline(T C) {
+        assert(C);
+        if (! C->isInPipeline)
+                return;
+        C->isInPipeline = false;
+        if (! COP(C)->endPipeline(C->D))
+                THROW(SQLException, "%s", Connection_getLastError(C));
+}
+
+
+int Connection_isInPipeline(T C) {
+        assert(C);
+        return C->isInPipeline;
+}
+
+
+void Connection_copyIn(T C, const char *sql, ...) {
+        assert(C);
+        assert(sql);
+        _checkCopy(C);
+        va_list ap;
+        va_start(ap, sql);
+        int success = COP(C)->beginCopy(C->D, true, sql, ap);
+        va_end(ap);
+        if (success < 0) THROW(SQLException, "Statement is not a COPY FROM STDIN");
+        if (! success) THROW(SQLException, "%s", Connection_getLastError(C));
+        C->copy = Copy_In;
+}
+
+
+void Connection_copyOut(T C, const char *sql, ...) {
+        assert(C);
+        assert(sql);
+        _checkCopy(C);
+        va_list ap;
+        va_start(ap, sql);
+        int success = COP(C)->beginCopy(C->D, false, sql, ap);
+        va_end(ap);
+        if (success < 0) THROW(SQLException, "Statement is not a COPY TO STDOUT");
+        if (! success) THROW(SQLException, "%s", Connection_getLastError(C));
+        C->copy = Copy_Out;
+}
+
+
+void Connection_copyWrite(T C, const void *data, int size) {
+        assert(C);
+        assert(data || size == 0);
+        if (C->copy != Copy_In)
+                THROW(SQLException, "No COPY FROM STDIN in progress");
+        if (size > 0 && ! COP(C)->writeCopy(C->D, data, size))
+                THROW(SQLException, "%s", Connection_getLastError(C));
+}
+
+
+const void *Connection_copyRead(T C, int *size) {
+        assert(C);
+        assert(size);
+        const void *data = NULL;
+        if (C->copy != Copy_Out)
+                THROW(SQLException, "No COPY TO STDOUT in progress");
+        *size = COP(C)->readCopy(C->D, &data);
+        if (*size < 0) {
+                *size = 0;
+                THROW(SQLException, "%s", Connection_getLastError(C));
+        }
+        return *size ? data : NULL;
+}
+
+
+long long Connection_copyEnd(T C) {
+        assert(C);
+        if (! C->copy)
+                THROW(SQLException, "No COPY in progress");
+        C->copy = Copy_None;
+        long long rows = COP(C)->endCopy(C->D, false);
+        if (rows < 0)
+                THROW(SQLException, "%s", Connection_getLastError(C));
+        return rows;
+}
+
+
+void Connection_executeQueryAsync(T C, const char *sql, void (*callback)(T C, ResultSet_T result, void *ctx), void *ctx) {
         assert(C);
         assert(sql);
+        assert(callback);
+        if (! COP(C)->sendQuery)
+                THROW(SQLException, "Asynchronous queries are not supported by %s", COP(C)->name);
+        if (C->async.callback)
+                THROW(SQLException, "An asynchronous query is already in progress");
+        if (C->isInPipeline || C->copy)
+                THROW(SQLException, "Connection_executeQueryAsync is not allowed in pipeline mode or during COPY");
         if (C->resultSet)
                 ResultSet_free(&C->resultSet);
+        if (! COP(C)->sendQuery(C->D, sql))
+                THROW(SQLException, "%s", Connection_getLastError(C));
+        C->async.callback = callback;
+        C->async.ctx = ctx;
+}
+
+
+int Connection_getSocket(T C) {
+        assert(C);
+        return COP(C)->getSocket ? COP(C)->getSocket(C->D) : -1;
+}
+
+
+int Connection_processAsync(T C) {
+        assert(C);
+        if (! C->async.callback)
+                return true;
+        if (COP(C)->isBusy(C->D))
+                return false;
+        void (*callback)(T C, ResultSet_T result, void *ctx) = C->async.callback;
+        C->async.callback = NULL;
+        C->resultSet = COP(C)->getResult(C->D);
+        if (C->resultSet)
+                ResultSet_charge(&C->resultSet, C);
+        callback(C, C->resultSet, C->async.ctx);
+        return true;
+}
+
+
+int Connection_isAsyncPending(T C) {
+        assert(C);
+        return C->async.callback != NULL;
+}
+
+
+long long Connection_lastRowId(T C) {
+        assert(C);
+        return COP(C)->lastRowId(C->D);
+}
+
+
+long long Connection_rowsChanged(T C) {
+        assert(C);
+        return COP(C)->rowsChanged(C->D);
+}
+
+
+void Connection_execute(T C, const char *sql, ...) {
         va_list ap;
 	va_start(ap, sql);
-        int success = C->op->execute(C->D, sql, ap);
+        Connection_vexecute(C, sql, ap);
         va_end(ap);
-        if (! success) THROW(SQLException, "%s", Connection_getLastError(C));
 }
 
 
 ResultSet_T Connection_executeQuery(T C, const char *sql, ...) {
+        va_list ap;
+	va_start(ap, sql);
+        ResultSet_T r = Connection_vexecuteQuery(C, sql, ap);
+        va_end(ap);
+        return r;
+}
+
+
+int Connection_tryExecute(T C, const char *sql, ...) {
         assert(C);
         assert(sql);
+        if (C->async.callback)
+                return false;
         if (C->resultSet)
                 ResultSet_free(&C->resultSet);
+        long long start = Statistics_start();
         va_list ap;
 	va_start(ap, sql);
-        C->resultSet = C->op->executeQuery(C->D, sql, ap);
+        int success = Trace_isEnabled(C->trace) ? _traceExecute(C, sql, ap) : COP(C)->execute(C->D, sql, ap);
         va_end(ap);
-        if (! C->resultSet)
-                THROW(SQLException, "%s", Connection_getLastError(C));
-        return C->resultSet;
+        if (success)
+                Statistics_record(COP(C)->name, Statistics_Execute, start);
+        return success;
+}
+
+
+void Connection_executeRaw(T C, const char *sql, int length) {
+        assert(sql);
+        // StringBuffer copies a "%.*s" argument directly, without vsnprintf
+        Connection_execute(C, "%.*s", length, sql);
+}
+
+
+ResultSet_T Connection_executeQueryRaw(T C, const char *sql, int length) {
+        assert(sql);
+        return Connection_executeQuery(C, "%.*s", length, sql);
 }
 
 
 PreparedStatement_T Connection_prepareStatement(T C, const char *sql, ...) {
         assert(C);
         assert(sql);
+        if (C->isInPipeline)
+                THROW(SQLException, "Connection_prepareStatement is not allowed in pipeline mode");
+        PreparedStatement_T p;
+        int size = ConnectionPool_getStatementCacheSize(C->parent);
         va_list ap;
         va_start(ap, sql);
-        PreparedStatement_T p = C->op->prepareStatement(C->D, sql, ap);
+        if (Trace_isEnabled(C->trace)) {
+                char *statement = Str_vcat(sql, ap);
+                TRACE_BEGIN(C->trace, "prepareStatement", statement);
+                if (size > 0) {
+                        p = _getCachedStatement(C, Str_dup(statement), size);
+                } else if ((p = _prepare(C, "%s", statement))) {
+                        Vector_push(C->prepared, p);
+                }
+                TRACE_END(-1, p ? NULL : Connection_getLastError(C));
+                if (p)
+                        PreparedStatement_setTrace(p, C->trace, statement);
+                FREE(statement);
+        } else if (size > 0) {
+                p = _getCachedStatement(C, Str_vcat(sql, ap), size);
+        } else {
+                p = COP(C)->prepareStatement(C->D, sql, ap);
+                if (p)
+                        Vector_push(C->prepared, p);
+        }
         va_end(ap);
-        if (p)
-                Vector_push(C->prepared, p);
-        else
+        if (! p)
                 THROW(SQLException, "%s", Connection_getLastError(C));
+        PreparedStatement_setConnection(p, C);
         return p;
 }
 
 
 const char *Connection_getLastError(T C) {
 	assert(C);
-	const char *s = C->op->getLastError(C->D);
+	const char *s = COP(C)->getLastError(C->D);
         return STR_DEF(s) ? s : "?";
 }
 
@@ -25,6 +25,7 @@
 
 #ifndef CONNECTION_INCLUDED
 #define CONNECTION_INCLUDED
+#include <stdarg.h>
 
 
 /**
@@ -57,6 +58,81 @@
  * A transaction will also rollback if the database is closed or if an 
  * error occurs. Nested transactions are not allowed.
  *
+ * Connection_beginTransactionType() starts a transaction with an
+ * isolation level, as read-only, or deferred. A deferred BEGIN is not
+ * sent at once, but with the first statement of the transaction, which
+ * saves a network round trip per transaction:
+ * <pre>
+ * Connection_beginTransactionType(con, Transaction_ReadOnly | Transaction_Deferred);
+ * ResultSet_T r = Connection_executeQuery(con, "select balance from accounts where id = %d;", id);
+ * ..
+ * Connection_commit(con);
+ * </pre>
+ *
+ * <h2 class="desc">Pipeline mode</h2>
+ * On databases which support it (currently PostgreSQL with libpq 14 or
+ * later), Connection_beginPipeline() puts the Connection in pipeline
+ * mode. In this mode Connection_execute() and the transaction methods
+ * send their statement to the server without waiting for the result,
+ * so many statements can be issued in one network round trip. Results
+ * are collected and the first error, if any, is thrown by
+ * Connection_endPipeline():
+ * <pre>
+ * Connection_beginPipeline(con);
+ * for (int i = 0; i < 100; i++)
+ *         Connection_execute(con, "update counter set n = n + 1 where id = %d;", i);
+ * Connection_endPipeline(con);
+ * </pre>
+ * Statements which return a ResultSet cannot be used in pipeline mode.
+ * Connection_rollback() and Connection_clear() will end a pipeline in
+ * progress and discard any errors.
+ *
+ * <h2 class="desc">Bulk copy</h2>
+ * On PostgreSQL, data can be loaded into or unloaded from a table
+ * with the COPY statement, which is much faster than executing an
+ * INSERT per row. Connection_copyIn() starts a <code>COPY .. FROM
+ * STDIN</code> statement, data in the format given by the COPY options
+ * is then written with Connection_copyWrite(). Connection_copyOut()
+ * starts a <code>COPY .. TO STDOUT</code> statement and
+ * Connection_copyRead() returns the data, one row at the time. A COPY
+ * is concluded with Connection_copyEnd():
+ * <pre>
+ * Connection_copyIn(con, "copy employee (name, salary) from stdin;");
+ * for (int i = 0; i < 100000; i++) {
+ *         int n = snprintf(row, sizeof(row), "employee %d\t%d\n", i, 1000 + i);
+ *         Connection_copyWrite(con, row, n);
+ * }
+ * printf("%lld rows loaded\n", Connection_copyEnd(con));
+ * </pre>
+ *
+ * <h2 class="desc">Asynchronous queries</h2>
+ * On PostgreSQL, Connection_executeQueryAsync() sends a query to the
+ * server and returns without waiting for the result. The application
+ * watches the socket returned by Connection_getSocket() for
+ * readability in its own event loop, e.g. with epoll, and calls
+ * Connection_processAsync() when it is readable. Once the result has
+ * arrived, Connection_processAsync() calls the completion callback with
+ * the ResultSet, or with NULL if the query failed, in which case
+ * Connection_getLastError() describes the error. The ResultSet lives
+ * until the next query on the Connection as usual. One thread can so
+ * have many queries in flight, one per Connection:
+ * <pre>
+ * static void done(Connection_T con, ResultSet_T r, void *ctx) {
+ *         if (r && ResultSet_next(r))
+ *                 printf("%s\n", ResultSet_getString(r, 1));
+ * }
+ * [..]
+ * Connection_executeQueryAsync(con, "select name from employee where id = 1", done, NULL);
+ * // add Connection_getSocket(con) to the event loop, and when readable:
+ * if (Connection_processAsync(con))
+ *         Connection_close(con);
+ * </pre>
+ * Other queries cannot be executed on the Connection while an
+ * asynchronous query is in progress. Connection_rollback(),
+ * Connection_clear() and returning the Connection to the pool wait for
+ * the query to complete and discard its result without calling the
+ * callback.
+ *
  * <i>A Connection is reentrant, but not thread-safe and should only be used by one thread (at the time).</i>
  *
  * @see ResultSet.h PreparedStatement.h SQLException.h
@@ -67,6 +143,29 @@
 #define T Connection_T
 typedef struct Connection_S *T;
 
+/**
+ * Transaction types for Connection_beginTransactionType(). One isolation
+ * level may be combined with Transaction_ReadOnly and Transaction_Deferred
+ */
+typedef enum {
+        Transaction_Default = 0,                ///< The database's default isolation level
+        Transaction_ReadCommitted = 1,          ///< Read committed isolation
+        Transaction_RepeatableRead = 2,         ///< Repeatable read isolation
+        Transaction_Serializable = 3,           ///< Serializable isolation
+        Transaction_ReadOnly = 0x10,            ///< The transaction does not change the database
+        Transaction_Deferred = 0x20             ///< Send BEGIN with the first statement of the transaction
+} Transaction_Type;
+
+/**
+ * How Connection_runTransaction() retries a transaction
+ */
+typedef struct Connection_RetryPolicy_T {
+        int maxAttempts;        ///< Number of times the transaction is run, including the first
+        int initialDelay;       ///< Milliseconds to wait before the first retry
+        int maxDelay;           ///< Upper bound in milliseconds of the wait, which doubles with each retry
+        int type;               ///< Transaction type, see Connection_beginTransactionType()
+} Connection_RetryPolicy_T;
+
 //<< Protected methods
 
 /**
@@ -85,6 +184,24 @@ T Connection_new(void *pool, char **error);
 void Connection_free(T *C);
 
 
+/**
+ * Create the connect settings shared by the Connections of a pool. The
+ * settings are derived from the URL once, instead of for each Connection,
+ * and may hold state such as a TLS session the next connect can resume.
+ * @param url The connection URL of the pool
+ * @return The connect settings or NULL if the backend has none
+ */
+void *Connection_newContext(URL_T url);
+
+
+/**
+ * Free connect settings created with Connection_newContext()
+ * @param url The connection URL the settings were created from
+ * @param context A reference to the settings, which may be NULL
+ */
+void Connection_freeContext(URL_T url, void **context);
+
+
 /**
  * Set if this Connection is available and not already in use.
  * @param C A Connection object
@@ -93,6 +210,36 @@ void Connection_free(T *C);
 void Connection_setAvailable(T C, int isAvailable);
 
 
+/**
+ * Set the last time this Connection was accessed from the Connection Pool,
+ * on the clock of Connection_getLastAccessed(). Used by the pool to keep
+ * the time of a connection it only moved, see Connection_setAvailable()
+ * @param C A Connection object
+ * @param lastAccessed The time (milliseconds) this Connection was accessed
+ */
+void Connection_setLastAccessed(T C, long long lastAccessed);
+
+
+/**
+ * Return the time this Connection was established on the monotonic
+ * clock of Time_coarse(), used by the pool for the maximum lifetime
+ * @param C A Connection object
+ * @return The time (milliseconds) this Connection was created
+ */
+long long Connection_getCreated(T C);
+
+
+/**
+ * Return the share of the pool's lifetime jitter this Connection's
+ * maximum lifetime is shortened by. The share is drawn at random when
+ * the Connection is established, so connections created together
+ * expire at different times
+ * @param C A Connection object
+ * @return A value in the range [0, 1)
+ */
+double Connection_getLifetimeShare(T C);
+
+
 /**
  * Get the availablity of this Connection.
  * @param C A Connection object
@@ -112,6 +259,17 @@ int Connection_isAvailable(T C);
 time_t Connection_getLastAccessedTime(T C);
 
 
+/**
+ * Return the last time this Connection was accessed from the Connection
+ * Pool on the monotonic clock of Time_coarse(). Unlike the time returned
+ * by Connection_getLastAccessedTime() it does not change if the system
+ * time is set, and is what the pool uses for idle timeouts.
+ * @param C A Connection object
+ * @return The last time (milliseconds) this Connection was accessed
+ */
+long long Connection_getLastAccessed(T C);
+
+
 /**
  * Return true if this Connection is in a transaction that has not
  * been committed.
@@ -121,6 +279,37 @@ time_t Connection_getLastAccessedTime(T C);
 int Connection_isInTransaction(T C);
 
 
+/**
+ * Add bytes to the memory held by the result sets of this Connection
+ * and of its pool, see ResultSet_charge()
+ * @param C A Connection object
+ * @param bytes The change in bytes held, negative if memory is released
+ * @return false if the pool's result memory limit is exceeded
+ */
+int Connection_chargeMemory(T C, long long bytes);
+
+
+/**
+ * Connection_execute() with a va_list
+ * @param C A Connection object
+ * @param sql A SQL statement
+ * @param ap The statement's arguments
+ * @exception SQLException If a database error occurs
+ */
+void Connection_vexecute(T C, const char *sql, va_list ap);
+
+
+/**
+ * Connection_executeQuery() with a va_list
+ * @param C A Connection object
+ * @param sql A SQL select statement
+ * @param ap The statement's arguments
+ * @return A ResultSet object
+ * @exception SQLException If a database error occurs
+ */
+ResultSet_T Connection_vexecuteQuery(T C, const char *sql, va_list ap);
+
+
 //>> End Protected methods
 
 /** @name Properties */
@@ -131,7 +320,12 @@ int Connection_isInTransaction(T C);
  * SQL statement to finish if the database is busy. If the limit is
  * exceeded, then the <code>execute</code> methods will return
  * immediately with an error. The default timeout is <code>3
- * seconds</code>.
+ * seconds</code>, and a Connection is set back to the default when
+ * it is returned to the pool. On MySQL a statement exceeding the
+ * timeout is killed with <code>KILL QUERY</code> from a separate
+ * connection to the server. On PostgreSQL the timeout is sent to the
+ * server with the next statement executed, the call itself does not
+ * block.
  * @param C A Connection object
  * @param ms The query timeout limit in milliseconds; zero means
  * there is no limit
@@ -169,6 +363,41 @@ void Connection_setMaxRows(T C, int max);
 int Connection_getMaxRows(T C);
 
 
+/**
+ * Sets the number of rows to fetch from the database server in each
+ * round trip when rows of a ResultSet are read. A larger value use
+ * more memory, but fewer network round trips for large result sets.
+ * This is a hint used by Oracle, by MySQL in cursor result mode and by
+ * PostgreSQL in stream result mode, it is ignored otherwise. The initial value is given by
+ * the <code>prefetch-rows</code> URL option or the backend default.
+ * The fetch size is reset when the Connection is returned to the pool.
+ * @param C A Connection object
+ * @param rows Number of rows to fetch per round trip; 0 means the
+ * default of the Connection URL
+ */
+void Connection_setFetchSize(T C, int rows);
+
+
+/**
+ * Retrieves the number of rows fetched in each round trip as set by
+ * Connection_setFetchSize()
+ * @param C A Connection object
+ * @return The fetch size; 0 means the default of the Connection URL
+ */
+int Connection_getFetchSize(T C);
+
+
+/**
+ * Returns the memory held by the result sets of this Connection, such
+ * as rows read into memory by the backend and column buffers. The
+ * result sets of the Connection's pool are limited with
+ * ConnectionPool_setResultMemoryLimit()
+ * @param C A Connection object
+ * @return The number of bytes held by the Connection's result sets
+ */
+long long Connection_getResultMemory(T C);
+
+
 /**
  * Returns this Connection URL
  * @param C A Connection object
@@ -216,6 +445,33 @@ void Connection_close(T C);
 void Connection_beginTransaction(T C);
 
 
+/**
+ * Start a transaction of the given type. <code>type</code> is
+ * Transaction_Default or one of the isolation levels, optionally
+ * or'ed with Transaction_ReadOnly and Transaction_Deferred. A read-only
+ * transaction lets the database skip the work needed to track changes
+ * and fails on statements which change the database.
+ *
+ * With Transaction_Deferred, MySQL and PostgreSQL queue the BEGIN and
+ * send it with the next statement of the Connection, or its prepared
+ * statements, in the same round trip. If the transaction is committed
+ * or rolled back before a statement is executed, nothing is sent. As
+ * the BEGIN is not sent by this method, an error starting the
+ * transaction is reported by the first statement. In pipeline mode
+ * BEGIN is queued in the pipeline as usual.
+ *
+ * Oracle starts a deferred transaction with the first statement, and
+ * supports Transaction_ReadOnly and Transaction_Serializable. SQLite
+ * transactions are serializable and always deferred until the first
+ * statement, the type is ignored.
+ * @param C A Connection object
+ * @param type The transaction type
+ * @exception SQLException If a database error occurs
+ * @see SQLException.h
+ */
+void Connection_beginTransactionType(T C, int type);
+
+
 /**
  * Makes all changes made since the previous commit/rollback permanent
  * and releases any database locks currently held by this Connection
@@ -239,6 +495,212 @@ void Connection_commit(T C);
 void Connection_rollback(T C);
 
 
+/**
+ * Run <code>callback</code> in a transaction and commit it, retrying
+ * the transaction if it failed because of contention with other
+ * transactions. The transaction is retried if the SQLException thrown
+ * by the callback or the commit is caused by a deadlock, a
+ * serialization failure or a lock wait timeout:
+ * <ul>
+ * <li>MySQL: errors 1213 (deadlock) and 1205 (lock wait timeout)</li>
+ * <li>PostgreSQL: SQLSTATE 40001 (serialization failure) and 40P01 (deadlock)</li>
+ * <li>Oracle: ORA-00060 (deadlock) and ORA-08177 (cannot serialize access)</li>
+ * <li>SQLite: SQLITE_BUSY and SQLITE_LOCKED</li>
+ * </ul>
+ * Before a retry the transaction is rolled back and the calling thread
+ * sleeps a random time between half of and the full delay, which starts
+ * at <code>initialDelay</code> and doubles with each retry up to
+ * <code>maxDelay</code>. The jitter keeps transactions which collided
+ * from colliding again. Other exceptions, and the last one if the
+ * transaction failed <code>maxAttempts</code> times, are rethrown after
+ * the rollback. As the callback may be called more than once, it
+ * should not have side effects outside the transaction.
+ * <pre>
+ * static void transfer(Connection_T con, void *ctx) {
+ *         Connection_execute(con, "update accounts set balance = balance - 100 where id = 1;");
+ *         Connection_execute(con, "update accounts set balance = balance + 100 where id = 2;");
+ * }
+ * [..]
+ * Connection_runTransaction(con, transfer, NULL, NULL);
+ * </pre>
+ * @param C A Connection object
+ * @param callback Executes the statements of the transaction, it must
+ * not commit or roll back the transaction
+ * @param ctx Passed to the callback
+ * @param policy The retry policy or NULL, which retries up to 5 times
+ * from 10 to 1000 milliseconds in a default transaction
+ * @exception SQLException If the transaction failed and was not retried
+ * @see SQLException.h
+ */
+void Connection_runTransaction(T C, void (*callback)(T C, void *ctx), void *ctx, const Connection_RetryPolicy_T *policy);
+
+
+/**
+ * Put this Connection in pipeline mode. Subsequent calls to
+ * Connection_execute(), Connection_beginTransaction() and
+ * Connection_commit() are queued and sent to the server without
+ * waiting for the result of previous statements. The results are
+ * collected by Connection_endPipeline(). Connection_rollback() is not
+ * queued, it ends the pipeline, discarding any errors of the queued
+ * statements, and then rolls back the transaction. While in
+ * pipeline mode, Connection_executeQuery() and
+ * Connection_prepareStatement() are not allowed and will throw an
+ * SQLException. Each Connection_execute() call should contain only one
+ * SQL statement. Calling this method when the Connection is already in
+ * pipeline mode has no effect.
+ * @param C A Connection object
+ * @exception SQLException If the database does not support pipeline
+ * mode or if a database error occurs
+ * @see SQLException.h
+ */
+void Connection_beginPipeline(T C);
+
+
+/**
+ * Wait for all statements queued since Connection_beginPipeline() to
+ * complete and leave pipeline mode. If one of the statements failed,
+ * an SQLException with the first error is thrown and statements queued
+ * after the failed statement are skipped by the server. Calling this method when the
+ * Connection is not in pipeline mode has no effect.
+ * @param C A Connection object
+ * @exception SQLException If a queued statement failed
+ * @see SQLException.h
+ */
+void Connection_endPipeline(T C);
+
+
+/**
+ * Return true if this Connection is in pipeline mode
+ * @param C A Connection object
+ * @return true if Connection_beginPipeline() was called and
+ * Connection_endPipeline() has not yet been called, otherwise false
+ */
+int Connection_isInPipeline(T C);
+
+
+/**
+ * Start a <code>COPY .. FROM STDIN</code> statement. The data to be
+ * copied is sent with Connection_copyWrite() and the copy is concluded
+ * or aborted with Connection_copyEnd() and Connection_clear()
+ * respectively. Example:
+ * <pre>
+ * Connection_copyIn(con, "copy zild_t (name, percent) from stdin with (format csv);");
+ * </pre>
+ * @param C A Connection object
+ * @param sql A COPY FROM STDIN statement
+ * @exception SQLException If the database does not support COPY, if
+ * the statement is not a COPY FROM STDIN or if a database error occurs
+ * @see SQLException.h
+ */
+void Connection_copyIn(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
+
+
+/**
+ * Start a <code>COPY .. TO STDOUT</code> statement. The copied data
+ * is read with Connection_copyRead() and the copy is concluded with
+ * Connection_copyEnd().
+ * @param C A Connection object
+ * @param sql A COPY TO STDOUT statement
+ * @exception SQLException If the database does not support COPY, if
+ * the statement is not a COPY TO STDOUT or if a database error occurs
+ * @see SQLException.h
+ */
+void Connection_copyOut(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
+
+
+/**
+ * Write <code>size</code> bytes of COPY data. Data does not need to be
+ * written in whole rows. Writes are gathered in a buffer and sent to
+ * the server when the buffer is full or at Connection_copyEnd().
+ * @param C A Connection object
+ * @param data The data to write in the format expected by the COPY
+ * statement
+ * @param size Number of bytes in data
+ * @exception SQLException If no COPY FROM STDIN is in progress or if
+ * a database error occurs
+ * @see SQLException.h
+ */
+void Connection_copyWrite(T C, const void *data, int size);
+
+
+/**
+ * Read the next row of a COPY TO STDOUT. The returned data is only
+ * valid until the next call to this method or to Connection_copyEnd().
+ * @param C A Connection object
+ * @param size Is set to the number of bytes returned
+ * @return The next row of data including the terminating newline or
+ * NULL when there is no more data
+ * @exception SQLException If no COPY TO STDOUT is in progress or if
+ * a database error occurs
+ * @see SQLException.h
+ */
+const void *Connection_copyRead(T C, int *size);
+
+
+/**
+ * Conclude a COPY started with Connection_copyIn() or
+ * Connection_copyOut(). Any remaining data is sent to the server or
+ * skipped respectively.
+ * @param C A Connection object
+ * @return The number of rows copied
+ * @exception SQLException If no COPY is in progress or if the COPY
+ * failed
+ * @see SQLException.h
+ */
+long long Connection_copyEnd(T C);
+
+
+/**
+ * Send the given SQL query to the server without waiting for the
+ * result. The SQL is used as-is, without printf-style formatting. The
+ * callback is called by Connection_processAsync() when the result has
+ * arrived, with the ResultSet or NULL if the query failed. See the
+ * asynchronous queries section above. Only PostgreSQL supports
+ * asynchronous queries.
+ * @param C A Connection object
+ * @param sql A SQL statement
+ * @param callback The function to call with the result
+ * @param ctx Context given to the callback function
+ * @exception SQLException If the query could not be sent, if an
+ * asynchronous query is already in progress or if the database does
+ * not support asynchronous queries
+ * @see SQLException.h
+ */
+void Connection_executeQueryAsync(T C, const char *sql, void (*callback)(T C, ResultSet_T result, void *ctx), void *ctx);
+
+
+/**
+ * Returns the socket of the connection to the database server, for
+ * use with poll, epoll or another event loop while an asynchronous
+ * query is in progress. The socket should only be watched for
+ * readability and not be read or written directly.
+ * @param C A Connection object
+ * @return The socket file descriptor or -1 if not available
+ */
+int Connection_getSocket(T C);
+
+
+/**
+ * Read available input for an asynchronous query in progress without
+ * blocking. If the query has completed, its callback is called before
+ * this method returns. Call this method when the socket returned by
+ * Connection_getSocket() becomes readable.
+ * @param C A Connection object
+ * @return true if the query has completed and its callback was called
+ * or if no asynchronous query is in progress, otherwise false
+ */
+int Connection_processAsync(T C);
+
+
+/**
+ * Returns true if an asynchronous query is in progress
+ * @param C A Connection object
+ * @return true if an asynchronous query has been sent and its callback
+ * not yet called, otherwise false
+ */
+int Connection_isAsyncPending(T C);
+
+
 /**
  * Returns the value for the most recent INSERT statement into a 
  * table with an AUTO_INCREMENT or INTEGER PRIMARY KEY column.
@@ -274,6 +736,18 @@ long long Connection_rowsChanged(T C);
 void Connection_execute(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
 
 
+/**
+ * Executes the given SQL statement like Connection_execute(), but
+ * returns false instead of throwing an SQLException if the statement
+ * failed, so it can be used in a loop without a TRY block. Use
+ * Connection_getLastError() to get the error.
+ * @param C A Connection object
+ * @param sql A SQL statement
+ * @return true if the statement was executed, otherwise false
+ */
+int Connection_tryExecute(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
+
+
 /**
  * Executes the given SQL statement, which returns a single ResultSet
  * object. You may <b>only</b> use one SQL statement with this method.
@@ -296,6 +770,38 @@ void Connection_execute(T C, const char *sql, ...) __attribute__((format (printf
 ResultSet_T Connection_executeQuery(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
 
 
+/**
+ * Executes the given SQL statement as-is, like Connection_execute()
+ * but without printf-style formatting. The SQL is passed to the
+ * database driver without being scanned for format conversions, so
+ * a <code>%</code> character does not need to be escaped. Use this
+ * method for SQL that is generated or contains no parameters.
+ * @param C A Connection object
+ * @param sql A SQL statement
+ * @param length The number of bytes in sql to execute or -1 if sql
+ * is NUL terminated
+ * @exception SQLException If a database error occurs.
+ * @see SQLException.h
+ */
+void Connection_executeRaw(T C, const char *sql, int length);
+
+
+/**
+ * Executes the given SQL query as-is, like Connection_executeQuery()
+ * but without printf-style formatting. See Connection_executeRaw().
+ * @param C A Connection object
+ * @param sql A SQL statement
+ * @param length The number of bytes in sql to execute or -1 if sql
+ * is NUL terminated
+ * @return A ResultSet object that contains the data produced by the
+ * given query.
+ * @exception SQLException If a database error occurs.
+ * @see ResultSet.h
+ * @see SQLException.h
+ */
+ResultSet_T Connection_executeQueryRaw(T C, const char *sql, int length);
+
+
 /**
  * Creates a PreparedStatement object for sending parameterized SQL 
  * statements to the database. The <code>sql</code> parameter may 
@@ -305,7 +811,10 @@ ResultSet_T Connection_executeQuery(T C, const char *sql, ...) __attribute__((fo
  * setXXX methods. Only <i>one</i> SQL statement may be used in the sql 
  * parameter, this in difference to Connection_execute() which may 
  * take several statements. A PreparedStatement "lives" until the 
- * Connection is returned to the Connection Pool. 
+ * Connection is returned to the Connection Pool. If the pool has a 
+ * statement cache, see ConnectionPool_setStatementCacheSize(), the 
+ * statement is cached with the Connection and reused the next time the
+ * same SQL statement is prepared. 
  * @param C A Connection object
  * @param sql A single SQL statement that may contain one or more '?' 
  * IN parameter placeholders
@@ -40,12 +40,12 @@ typedef struct T *T;
 typedef struct Cop_T {
         const char *name;
         // Methods
-	T (*new)(URL_T url, char **error);
+	T (*new)(URL_T url, void *context, char **error);
 	void (*free)(T *C);
 	void (*setQueryTimeout)(T C, int ms);
         void (*setMaxRows)(T C, int max);
         int (*ping)(T C);
-        int (*beginTransaction)(T C);
+        int (*beginTransaction)(T C, int type);
         int (*commit)(T C);
 	int (*rollback)(T C);
 	long long (*lastRowId)(T C);
@@ -54,6 +54,27 @@ typedef struct Cop_T {
 	ResultSet_T (*executeQuery)(T C, const char *sql, va_list ap);
         PreparedStatement_T (*prepareStatement)(T C, const char *sql, va_list ap);
         const char *(*getLastError)(T C);
+        // Optional methods
+        void (*setFetchSize)(T C, int rows);
+        int (*beginPipeline)(T C);
+        int (*endPipeline)(T C);
+        int (*beginCopy)(T C, int in, const char *sql, va_list ap);
+        int (*writeCopy)(T C, const void *data, int size);
+        int (*readCopy)(T C, const void **data);
+        long long (*endCopy)(T C, int abort);
+        int (*getSocket)(T C);
+        int (*sendQuery)(T C, const char *sql);
+        int (*isBusy)(T C);
+        ResultSet_T (*getResult)(T C);
+        /* Optional. Returns true if the last error of the connection or its prepared statements
+         was a deadlock, serialization failure or lock timeout, after which the transaction may
+         succeed if it is run again */
+        int (*isRetryable)(T C);
+        /* Optional. Connect settings derived from the URL once per pool and passed to new,
+         which gets NULL if the backend has no newContext. The context is shared by the
+         connections of the pool and may be used from several threads at once */
+        void *(*newContext)(URL_T url);
+        void (*freeContext)(void **context);
 } *Cop_T;
 
 #undef T
@@ -26,6 +26,7 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "URL.h"
@@ -36,6 +37,10 @@
 #include "PreparedStatement.h"
 #include "Connection.h"
 #include "ConnectionPool.h"
+#include "Statistics.h"
+#include "Trace.h"
+#include "Snapshot.h"
+#include "ResultCache.h"
 
 
 /**
@@ -48,6 +53,56 @@
 /* ----------------------------------------------------------- Definitions */
 
 
+/* Number of idle connection stacks. Threads are spread over the stacks so
+   checkout and return seldom compete for the same lock */
+#define SHARDS 8
+
+/* Maximum number of connections being established concurrently, outside
+   the pool lock */
+#define MAX_CONNECTING 4
+
+/* Milliseconds a checkout waits for a connect in flight before checking the pool again */
+#define CONNECT_WAIT 1000
+
+/* Maximum number of idle connections the reaper detach from the pool at a
+   time. The pool lock is not held while detached connections are pinged or closed */
+#define REAP_BATCH 8
+
+/* Number of thread affinity slots. Each thread is assigned a slot where
+   the connection it returns is parked, so it gets the same connection back */
+#define AFFINITY_SLOTS 64
+
+/* Milliseconds a read replica is skipped after a failed connect */
+#define REPLICA_RETRY_INTERVAL 10000
+
+/* Milliseconds between checks of the scaler thread when it is not woken up */
+#define SCALE_INTERVAL 1000
+
+/* Number of consecutive calm checks before the scaler closes an idle connection */
+#define SCALE_CALM_CHECKS 3
+
+typedef struct shard_t {
+        Mutex_T mutex;
+        Vector_T idle;
+} *shard_t;
+
+/* A thread waiting for a connection. Waiters are queued in FIFO order and
+   a returned connection is handed directly to the first waiter */
+typedef struct waiter_t {
+        Sem_T sem;
+        int queued;
+        Connection_T con;
+        long long lastAccessed;
+        struct waiter_t *next;
+} *waiter_t;
+
+/* A read replica is a pool of its own, configured like the primary pool when started */
+typedef struct replica_t {
+        int weight;
+        volatile long long downUntil;
+        ConnectionPool_T pool;
+} *replica_t;
+
 #define T ConnectionPool_T
 struct ConnectionPool_S {
         URL_T url;
@@ -57,12 +112,50 @@ struct ConnectionPool_S {
         Sem_T alarm;
 	Mutex_T mutex;
 	Vector_T pool;
+        Vector_T replicas;
+        int readConnections;
+        shard_t shards;
+        Connection_T *slots;
+        ThreadData_T slotKey;
+        int nextSlot;
+        waiter_t waitHead;
+        waiter_t waitTail;
+        volatile int waiting;
+        int idle;
+        long long created;
+        long long destroyed;
+        int connecting;
+        int filling;
+        int fillThreads;
+        int fillers;
+        Thread_T *filler;
         Thread_T reaper;
         int sweepInterval;
+        int healthInterval;
+        long long resultMemory;         // Bytes held by result sets
+        long long resultMemoryLimit;
+        int maxLifetime;
+        int lifetimeJitter;
+        Sem_T scale;
+        Thread_T scaler;
+        int scaleThreshold;
+        volatile int scaleRequested;
+        int breakerFailures;
+        int breakerCooldown;
+        int failures;
+        int probing;
+        long long openUntil;
 	int maxConnections;
         volatile int stopped;
         int connectionTimeout;
+        int validationInterval;
+        int statementCacheSize;
 	int initialConnections;
+        int checkoutTimeout;
+        ResultCache_T cache;
+        int slowQueryThreshold;
+        struct Trace_S trace;
+        void *context;
 };
 
 int ZBDEBUG = false;
@@ -78,16 +171,505 @@ void(*AbortHandler)(const char *error) = NULL;
 /* ------------------------------------------------------- Private methods */
 
 
+static inline shard_t _getShard(T P) {
+        unsigned long h = (unsigned long)Thread_self();
+        h ^= h >> 16;
+        h *= 0x45d9f3b;
+        h ^= h >> 16;
+        return P->shards + (h % SHARDS);
+}
+
+
+/* Returns the calling thread's affinity slot. Threads are assigned slots
+   round-robin so more threads than slots share slots */
+static inline Connection_T *_getSlot(T P) {
+        long slot = (long)ThreadData_get(P->slotKey);
+        if (! slot) {
+                slot = (Atomic_add(P->nextSlot, 1) - 1) % AFFINITY_SLOTS + 1;
+                ThreadData_set(P->slotKey, (void *)slot);
+        }
+        return P->slots + slot - 1;
+}
+
+
+/* Take the connection parked in slot, if any, without locking */
+static inline Connection_T _takeSlot(T P, Connection_T *slot, long long *lastAccessed) {
+        Connection_T con = *slot;
+        if (con && Atomic_cas(*slot, con, NULL)) {
+                *lastAccessed = Connection_getLastAccessed(con);
+                Connection_setAvailable(con, false);
+                Atomic_add(P->idle, -1);
+                return con;
+        }
+        return NULL;
+}
+
+
+static void _pushIdle(T P, shard_t shard, Connection_T con) {
+        LOCK(shard->mutex)
+        {
+                Connection_setAvailable(con, true);
+                Vector_push(shard->idle, con);
+        }
+        END_LOCK;
+        Atomic_add(P->idle, 1);
+}
+
+
+/* Put a connection detached by the reaper back in the shard's idle stack, keeping
+   its last accessed time. It is inserted below connections accessed later, so the
+   stack stays ordered oldest first */
+static void _restoreIdle(T P, shard_t shard, Connection_T con, long long lastAccessed) {
+        LOCK(shard->mutex)
+        {
+                int i = Vector_size(shard->idle);
+                while (i > 0 && Connection_getLastAccessed(Vector_get(shard->idle, i - 1)) > lastAccessed)
+                        i--;
+                Connection_setAvailable(con, true);
+                Connection_setLastAccessed(con, lastAccessed);
+                Vector_insert(shard->idle, i, con);
+        }
+        END_LOCK;
+        Atomic_add(P->idle, 1);
+}
+
+
+/* Move the connections parked for thread affinity to the idle stacks, so they are
+   reaped and recycled like other idle connections. Must be called with the pool
+   mutex unlocked */
+static void _drainSlots(T P) {
+        for (int i = 0; P->slots && i < AFFINITY_SLOTS; i++) {
+                long long lastAccessed;
+                Connection_T con = _takeSlot(P, P->slots + i, &lastAccessed);
+                if (con)
+                        _restoreIdle(P, P->shards + (i % SHARDS), con, lastAccessed);
+        }
+}
+
+
+/* Pop an idle connection, starting with the calling thread's own stack and
+   stealing from the other stacks if it is empty. Returns NULL if no
+   connection is idle, otherwise lastAccessed is set to the time the
+   connection was returned to the pool */
+static Connection_T _popIdle(T P, long long *lastAccessed) {
+        Connection_T con = NULL;
+        if (P->slots && (con = _takeSlot(P, _getSlot(P), lastAccessed)))
+                return con;
+        shard_t start = _getShard(P);
+        for (int i = 0; i < SHARDS && ! con; i++) {
+                shard_t shard = P->shards + ((start - P->shards + i) % SHARDS);
+                LOCK(shard->mutex)
+                {
+                        if (! Vector_isEmpty(shard->idle)) {
+                                con = Vector_pop(shard->idle);
+                                *lastAccessed = Connection_getLastAccessed(con);
+                                Connection_setAvailable(con, false);
+                                Atomic_add(P->idle, -1);
+                        }
+                }
+                END_LOCK;
+        }
+        // Steal a connection parked by another thread before a new connection is made
+        for (int i = 0; P->slots && i < AFFINITY_SLOTS && ! con; i++)
+                con = _takeSlot(P, P->slots + i, lastAccessed);
+        return con;
+}
+
+
+static inline int _getSize(T P) {
+        return (int)(Atomic_get(P->created) - Atomic_get(P->destroyed));
+}
+
+
+static inline int _getActive(T P) {
+        int n = _getSize(P) - Atomic_get(P->idle);
+        return (n > 0) ? n : 0;
+}
+
+
+/* Returns true if the connection must be pinged before it is handed out,
+   that is, if it has been idle longer than the validation interval. With
+   health checks idle connections are pinged by the reaper instead */
+static inline int _needValidation(T P, long long lastAccessed) {
+        if (P->healthInterval > 0)
+                return false;
+        if (P->validationInterval <= 0)
+                return true;
+        return (Time_coarse() - lastAccessed) > P->validationInterval;
+}
+
+
+/* Returns true if there is room in the pool for another connection. Must be
+   called with the pool mutex locked */
+static inline int _hasRoom(T P) {
+        return (Vector_size(P->pool) + P->connecting + P->filling) < P->maxConnections;
+}
+
+
+/* Returns true if there is room in the pool for another connection and the
+   number of connects in flight is below the limit. Must be called with the
+   pool mutex locked */
+static inline int _canConnect(T P) {
+        return _hasRoom(P) && (P->connecting < MAX_CONNECTING);
+}
+
+
+/* Returns true if the circuit breaker is open. Must be called with the pool mutex locked */
+static inline int _isBroken(T P) {
+        return P->breakerFailures && (P->failures >= P->breakerFailures);
+}
+
+
+/* Returns true if the circuit breaker lets a connect through. While the breaker
+   is open connects fail fast until the cooldown has passed, then a single probe
+   is let through. Must be called with the pool mutex locked */
+static inline int _allowConnect(T P) {
+        if (! _isBroken(P))
+                return true;
+        if (P->probing || (Time_monotonic() < P->openUntil))
+                return false;
+        P->probing = true;
+        return true;
+}
+
+
+/* Record the outcome of a connect for the circuit breaker. Must be called with the
+   pool mutex locked */
+static void _connected(T P, int success) {
+        if (success) {
+                if (_isBroken(P))
+                        DEBUG("Circuit breaker closed, %s is reachable again\n", URL_toString(P->url));
+                P->failures = 0;
+                P->probing = false;
+        } else {
+                P->failures++;
+                if (_isBroken(P)) {
+                        if (! P->probing)
+                                DEBUG("Circuit breaker opened after %d failed connects\n", P->failures);
+                        P->openUntil = Time_monotonic() + P->breakerCooldown;
+                        P->probing = false;
+                }
+        }
+}
+
+
+/* Wake up the first waiter so it can check for an idle connection or room
+   in the pool. Must be called with the pool mutex locked */
+static inline void _notifyWaiter(T P) {
+        if (P->waitHead)
+                Sem_signal(P->waitHead->sem);
+}
+
+
+static void _enqueueWaiter(T P, waiter_t w) {
+        w->queued = true;
+        w->next = NULL;
+        if (P->waitTail)
+                P->waitTail->next = w;
+        else
+                P->waitHead = w;
+        P->waitTail = w;
+        P->waiting++;
+        // A thread waiting for a connection means the pool is already too small
+        if (P->scaleThreshold) {
+                P->scaleRequested = true;
+                Sem_signal(P->scale);
+        }
+}
+
+
+static void _dequeueWaiter(T P, waiter_t w) {
+        if (! w->queued)
+                return;
+        waiter_t prev = NULL;
+        for (waiter_t p = P->waitHead; p; prev = p, p = p->next) {
+                if (p == w) {
+                        if (prev)
+                                prev->next = w->next;
+                        else
+                                P->waitHead = w->next;
+                        if (P->waitTail == w)
+                                P->waitTail = prev;
+                        break;
+                }
+        }
+        w->queued = false;
+        w->next = NULL;
+        P->waiting--;
+}
+
+
+/* Hand the connection to the first waiter. Must be called with the pool mutex locked */
+static void _handOff(T P, Connection_T con) {
+        waiter_t w = P->waitHead;
+        w->lastAccessed = Connection_getLastAccessed(con);
+        Connection_setAvailable(con, false);
+        w->con = con;
+        _dequeueWaiter(P, w);
+        Sem_signal(w->sem);
+}
+
+
+/* Wait until a connection is handed to us, an idle connection can be taken
+   or there is room for a new connection in the pool. Returns false if the
+   deadline was reached or the pool was stopped */
+static int _waitConnection(T P, long long deadline, Connection_T *con, long long *lastAccessed) {
+        int status = true;
+        struct waiter_t w = {.con = NULL};
+        Sem_init(w.sem);
+        LOCK(P->mutex)
+        {
+                _enqueueWaiter(P, &w);
+                while (! w.con) {
+                        long long remaining = deadline - Time_monotonic();
+                        if (P->stopped || (remaining <= 0)) {
+                                status = false;
+                                break;
+                        }
+                        if (P->waitHead == &w) {
+                                // A connection may have been returned or closed before we were queued
+                                if ((w.con = _popIdle(P, &w.lastAccessed)))
+                                        break;
+                                if (_canConnect(P))
+                                        break;
+                        }
+                        // The condition waits on the wall-clock, so the deadline is converted on each wait
+                        long long until = Time_milli() + remaining;
+                        struct timespec wait = {.tv_sec = until / 1000, .tv_nsec = (until % 1000) * 1000000};
+                        Sem_timeWait(w.sem, P->mutex, wait);
+                }
+                _dequeueWaiter(P, &w);
+                _notifyWaiter(P);
+        }
+        END_LOCK;
+        Sem_destroy(w.sem);
+        *con = w.con;
+        *lastAccessed = w.lastAccessed;
+        return status;
+}
+
+
+/* Add a new connection to the pool. Must be called with the pool mutex locked */
+static inline void _addConnection(T P, Connection_T con) {
+        Vector_push(P->pool, con);
+        Atomic_add(P->created, 1);
+}
+
+
+/* Remove the connection from the pool. Must be called with the pool mutex locked */
+static void _removeConnection(T P, Connection_T con) {
+        for (int i = 0; i < Vector_size(P->pool); i++) {
+                if (Vector_get(P->pool, i) == con) {
+                        Vector_remove(P->pool, i);
+                        Atomic_add(P->destroyed, 1);
+                        break;
+                }
+        }
+        _notifyWaiter(P);
+}
+
+
+/* Create a new connection if there is room in the pool. A slot is reserved
+   under the pool lock while the connection is established without the lock so
+   other threads are not blocked by a slow server. The failed flag is set if
+   there was room, but connecting failed. The throttled flag is set if there
+   was room, but MAX_CONNECTING connects were in flight */
+static Connection_T _newConnection(T P, int *failed, int *throttled) {
+        int reserved = false;
+        Connection_T con = NULL;
+        *failed = false;
+        *throttled = false;
+        LOCK(P->mutex)
+        {
+                if (P->connecting >= MAX_CONNECTING) {
+                        *throttled = _hasRoom(P);
+                } else if (_hasRoom(P)) {
+                        if (_allowConnect(P)) {
+                                P->connecting++;
+                                reserved = true;
+                        } else {
+                                *failed = true;
+                        }
+                }
+        }
+        END_LOCK;
+        if (reserved) {
+                char *error = NULL;
+                con = Connection_new(P, &error);
+                if (! con) {
+                        DEBUG("Failed to create connection -- %s\n", error);
+                        FREE(error);
+                        *failed = true;
+                }
+                LOCK(P->mutex)
+                {
+                        P->connecting--;
+                        _connected(P, con != NULL);
+                        if (con) {
+                                Connection_setAvailable(con, false);
+                                _addConnection(P, con);
+                        }
+                        _notifyWaiter(P);
+                }
+                END_LOCK;
+        }
+        return con;
+}
+
+
+/* Wake up the scaler thread if utilization reached the scaling threshold, so
+   connections are established ahead of demand and not on the request path */
+static inline void _checkUtilization(T P) {
+        if (P->scaleThreshold && ! P->scaleRequested) {
+                if ((long long)_getActive(P) * 100 >= (long long)_getSize(P) * P->scaleThreshold) {
+                        if (Atomic_cas(P->scaleRequested, false, true)) {
+                                LOCK(P->mutex)
+                                {
+                                        Sem_signal(P->scale);
+                                }
+                                END_LOCK;
+                        }
+                }
+        }
+}
+
+
+/* Returns con if it is valid, otherwise it is removed from the pool and freed */
+static Connection_T _validate(T P, Connection_T con, long long lastAccessed) {
+        if (! _needValidation(P, lastAccessed) || Connection_ping(con))
+                return con;
+        DEBUG("Removing stale connection from the pool\n");
+        LOCK(P->mutex)
+        {
+                _removeConnection(P, con);
+        }
+        END_LOCK;
+        Connection_free(&con);
+        return NULL;
+}
+
+
+/* Get an idle connection, validated if needed, or create a new connection. If the
+   pool has room but the connects in flight are at the limit, wait for one of them */
+static Connection_T _getConnection(T P, int *failed) {
+        Connection_T con;
+        long long lastAccessed;
+        int throttled;
+        do {
+                while ((con = _popIdle(P, &lastAccessed))) {
+                        if ((con = _validate(P, con, lastAccessed))) {
+                                _checkUtilization(P);
+                                return con;
+                        }
+                }
+                if ((con = _newConnection(P, failed, &throttled))) {
+                        _checkUtilization(P);
+                        return con;
+                }
+                if (throttled && _waitConnection(P, Time_monotonic() + CONNECT_WAIT, &con, &lastAccessed) && con) {
+                        if ((con = _validate(P, con, lastAccessed))) {
+                                _checkUtilization(P);
+                                return con;
+                        }
+                }
+        } while (throttled && ! P->stopped);
+        return NULL;
+}
+
+
 static void _drainPool(T P) {
+        for (int i = 0; P->slots && i < AFFINITY_SLOTS; i++) {
+                if (P->slots[i]) {
+                        P->slots[i] = NULL;
+                        Atomic_add(P->idle, -1);
+                }
+        }
+        for (int i = 0; i < SHARDS; i++) {
+                LOCK(P->shards[i].mutex)
+                {
+                        while (! Vector_isEmpty(P->shards[i].idle)) {
+                                Vector_pop(P->shards[i].idle);
+                                Atomic_add(P->idle, -1);
+                        }
+                }
+                END_LOCK;
+        }
         while (! Vector_isEmpty(P->pool)) {
 		Connection_T con = Vector_pop(P->pool);
 		Connection_free(&con);
+                Atomic_add(P->destroyed, 1);
 	}
 }
 
 
-static int _fillPool(T P) {
+/* Filler thread, establish initial connections until the pool is filled */
+static void *_doFill(void *args) {
+        T P = args;
+        while (true) {
+                int reserved = false;
+                LOCK(P->mutex)
+                {
+                        if (! P->stopped && P->filling > 0) {
+                                P->filling--;
+                                P->connecting++;
+                                reserved = true;
+                        }
+                }
+                END_LOCK;
+                if (! reserved)
+                        break;
+                char *error = NULL;
+                Connection_T con = Connection_new(P, &error);
+                if (! con) {
+                        DEBUG("Failed to fill the pool with initial connections -- %s\n", error);
+                        FREE(error);
+                }
+                LOCK(P->mutex)
+                {
+                        P->connecting--;
+                        _connected(P, con != NULL);
+                        if (con && P->stopped) {
+                                Connection_free(&con);
+                        } else if (con) {
+                                _addConnection(P, con);
+                                _pushIdle(P, _getShard(P), con);
+                        }
+                        _notifyWaiter(P);
+                }
+                END_LOCK;
+        }
+        return NULL;
+}
+
+
+/* Start filler threads for the remaining initial connections. Must be called
+   with the pool mutex locked */
+static void _startFillers(T P, int connections) {
+        P->filling = connections;
+        P->fillers = (P->fillThreads < connections) ? P->fillThreads : connections;
+        P->filler = CALLOC(P->fillers, sizeof(Thread_T));
+        for (int i = 0; i < P->fillers; i++)
+                Thread_create(P->filler[i], _doFill, P);
+}
+
+
+static void _joinFillers(T P) {
+        for (int i = 0; i < P->fillers; i++)
+                Thread_join(P->filler[i]);
+        P->fillers = 0;
+        FREE(P->filler);
+}
+
+
+/* Fill the pool with initial connections. The first connection is always established 
+   by the calling thread so an error can be reported and so the client library 
+   is initialized before filler threads are started */
+static int _fillPool(T P, int async) {
 	for (int i = 0; i < P->initialConnections; i++) {
+                if (i > 0 && (async || P->fillThreads > 1)) {
+                        _startFillers(P, P->initialConnections - i);
+                        break;
+                }
                 Connection_T con = Connection_new(P, &P->error);
 		if (! con) {
                         if (i > 0) {
@@ -97,49 +679,290 @@ static int _fillPool(T P) {
                         }
                         return false;
                 }
-		Vector_push(P->pool, con);
+		_addConnection(P, con);
+                _pushIdle(P, P->shards + (i % SHARDS), con);
 	}
 	return true;
 }
 
 
-static int _getActive(T P){
-        int i, n = 0, size = Vector_size(P->pool);
-        for (i = 0; i < size; i++)
-                if (! Connection_isAvailable(Vector_get(P->pool, i))) 
-                        n++; 
-        return n; 
+/* Reap idle connections, oldest first, from the bottom of each idle stack and
+   down to initial connections. Candidates are detached from their stack in
+   batches and are pinged or closed without holding any lock. Connections
+   passing the test are put back where they were, keeping their last accessed
+   time. Must be called with the pool mutex unlocked */
+static int _reapConnections(T P) {
+        int n = 0;
+        _drainSlots(P);
+        for (int s = 0; s < SHARDS; s++) {
+                int i = 0, k;
+                shard_t shard = P->shards + s;
+                do {
+                        Connection_T batch[REAP_BATCH];
+                        long long timedout = Time_coarse() - P->connectionTimeout * 1000LL;
+                        k = 0;
+                        LOCK(shard->mutex)
+                        {
+                                int x = Atomic_get(P->idle) - P->initialConnections;
+                                while ((k < x) && (k < REAP_BATCH) && (i < Vector_size(shard->idle))) {
+                                        batch[k++] = Vector_remove(shard->idle, i);
+                                        Atomic_add(P->idle, -1);
+                                }
+                        }
+                        END_LOCK;
+                        int kept = 0;
+                        for (int j = 0; j < k; j++) {
+                                Connection_T con = batch[j];
+                                if ((Connection_getLastAccessed(con) < timedout) || (! Connection_ping(con))) {
+                                        LOCK(P->mutex)
+                                        {
+                                                _removeConnection(P, con);
+                                        }
+                                        END_LOCK;
+                                        Connection_free(&con);
+                                        n++;
+                                } else {
+                                        batch[kept++] = con;
+                                }
+                        }
+                        if (kept) {
+                                LOCK(shard->mutex)
+                                {
+                                        int position = (i < Vector_size(shard->idle)) ? i : Vector_size(shard->idle);
+                                        for (int j = 0; j < kept; j++)
+                                                Vector_insert(shard->idle, position + j, batch[j]);
+                                }
+                                END_LOCK;
+                                Atomic_add(P->idle, kept);
+                                i += kept;
+                        }
+                } while (k == REAP_BATCH);
+        }
+        return n;
+}
+
+
+/* Time_coarse() when the connection has reached its maximum lifetime. Each connection's
+   lifetime is shortened by its own share of the jitter, drawn when it was established, so
+   connections established together are not all replaced together */
+static inline long long _expires(T P, Connection_T con) {
+        long long share = (long long)(P->lifetimeJitter * 1000LL * Connection_getLifetimeShare(con));
+        return Connection_getCreated(con) + P->maxLifetime * 1000LL - share;
 }
 
 
-static int _reapConnections(T P) {
+/* Reserve room for a connection established outside the pool lock. Returns false
+   if the pool is full or the circuit breaker is open. Must be called with the pool
+   mutex unlocked */
+static int _reserve(T P) {
+        int reserved = false;
+        LOCK(P->mutex)
+        {
+                if (_canConnect(P) && _allowConnect(P)) {
+                        P->connecting++;
+                        reserved = true;
+                }
+        }
+        END_LOCK;
+        return reserved;
+}
+
+
+/* Establish a connection reserved with _reserve() and push it to the shard's idle
+   stack. Returns false if the connect failed */
+static int _connectIdle(T P, shard_t shard) {
+        char *error = NULL;
+        Connection_T con = Connection_new(P, &error);
+        if (! con) {
+                DEBUG("Failed to replace connection -- %s\n", error);
+                FREE(error);
+        }
+        LOCK(P->mutex)
+        {
+                P->connecting--;
+                _connected(P, con != NULL);
+                if (con) {
+                        _addConnection(P, con);
+                        _pushIdle(P, shard, con);
+                }
+                _notifyWaiter(P);
+        }
+        END_LOCK;
+        return con != NULL;
+}
+
+
+/* Replace idle connections which reached their maximum lifetime, one at a time. The
+   aged connection is detached from its idle stack, so it cannot be handed out, and
+   the replacement is established before it is closed, unless the pool is full.
+   Returns the number of connections replaced. Must be called with the pool mutex
+   unlocked */
+static int _recycleConnections(T P) {
         int n = 0;
-        int x = Vector_size(P->pool) - _getActive(P) - P->initialConnections;
-        time_t timedout = Time_now() - P->connectionTimeout;
-        for (int i = 0; ((n < x) && (i < Vector_size(P->pool))); i++) {
-                Connection_T con = Vector_get(P->pool, i);
-                if (Connection_isAvailable(con)) {
-                        if ((Connection_getLastAccessedTime(con) < timedout) || (! Connection_ping(con))) {
-                                Vector_remove(P->pool, i);
-                                Connection_free(&con);
-                                n++;
-                                i--;
+        _drainSlots(P);
+        for (int s = 0; s < SHARDS; s++) {
+                shard_t shard = P->shards + s;
+                while (! P->stopped) {
+                        Connection_T aged = NULL;
+                        LOCK(shard->mutex)
+                        {
+                                long long now = Time_coarse();
+                                for (int i = 0; i < Vector_size(shard->idle) && ! aged; i++) {
+                                        if (_expires(P, Vector_get(shard->idle, i)) <= now) {
+                                                aged = Vector_remove(shard->idle, i);
+                                                Atomic_add(P->idle, -1);
+                                        }
+                                }
+                        }
+                        END_LOCK;
+                        if (! aged)
+                                break;
+                        int reserved = _reserve(P);
+                        if (reserved && ! _connectIdle(P, shard)) {
+                                _restoreIdle(P, shard, aged, Connection_getLastAccessed(aged));
+                                return n;
                         }
-                } 
+                        LOCK(P->mutex)
+                        {
+                                _removeConnection(P, aged);
+                        }
+                        END_LOCK;
+                        Connection_free(&aged);
+                        // Without room for another connection the aged connection made room
+                        if (! reserved && ! (_reserve(P) && _connectIdle(P, shard)))
+                                return n;
+                        n++;
+                }
         }
+        if (n)
+                DEBUG("Replaced %d aged connections\n", n);
         return n;
 }
 
 
+/* Ping connections which have been idle longer than half the health interval. As
+   the reaper checks every interval, each idle connection is used about once per
+   interval and is not dropped by firewalls for being idle. Connections are detached
+   while they are pinged, like in _reapConnections(), so they cannot be handed out.
+   They keep their last accessed time, the sweep does not refresh them, so they
+   still time out when idle. Broken connections are closed and replaced. Returns
+   the number of broken connections found. Must be called with the pool mutex
+   unlocked */
+static int _checkHealth(T P) {
+        int broken = 0;
+        long long stale = Time_coarse() - P->healthInterval / 2;
+        // Connections parked for thread affinity are moved to the idle stacks when checked
+        for (int i = 0; P->slots && i < AFFINITY_SLOTS; i++) {
+                long long lastAccessed;
+                // Claim the connection before reading it, another thread may take it from the slot
+                Connection_T con = _takeSlot(P, P->slots + i, &lastAccessed);
+                if (con) {
+                        shard_t shard = P->shards + (i % SHARDS);
+                        if (lastAccessed >= stale) {
+                                // Not stale, put it back or move it to the idle stack if the slot was refilled
+                                Connection_setAvailable(con, true);
+                                Connection_setLastAccessed(con, lastAccessed);
+                                Atomic_add(P->idle, 1);
+                                if (! Atomic_cas(P->slots[i], NULL, con)) {
+                                        Atomic_add(P->idle, -1);
+                                        _restoreIdle(P, shard, con, lastAccessed);
+                                }
+                                continue;
+                        }
+                        if (Connection_ping(con)) {
+                                _restoreIdle(P, shard, con, lastAccessed);
+                                continue;
+                        }
+                        LOCK(P->mutex)
+                        {
+                                _removeConnection(P, con);
+                        }
+                        END_LOCK;
+                        Connection_free(&con);
+                        broken++;
+                        if (_reserve(P))
+                                _connectIdle(P, shard);
+                }
+        }
+        for (int s = 0; s < SHARDS; s++) {
+                int i = 0, k, failed = 0;
+                shard_t shard = P->shards + s;
+                do {
+                        Connection_T batch[REAP_BATCH];
+                        k = 0;
+                        LOCK(shard->mutex)
+                        {
+                                while ((k < REAP_BATCH) && (i < Vector_size(shard->idle)) && (Connection_getLastAccessed(Vector_get(shard->idle, i)) < stale)) {
+                                        batch[k++] = Vector_remove(shard->idle, i);
+                                        Atomic_add(P->idle, -1);
+                                }
+                        }
+                        END_LOCK;
+                        int kept = 0;
+                        for (int j = 0; j < k; j++) {
+                                Connection_T con = batch[j];
+                                if (Connection_ping(con)) {
+                                        batch[kept++] = con;
+                                } else {
+                                        LOCK(P->mutex)
+                                        {
+                                                _removeConnection(P, con);
+                                        }
+                                        END_LOCK;
+                                        Connection_free(&con);
+                                        failed++;
+                                }
+                        }
+                        if (kept) {
+                                LOCK(shard->mutex)
+                                {
+                                        int position = (i < Vector_size(shard->idle)) ? i : Vector_size(shard->idle);
+                                        for (int j = 0; j < kept; j++)
+                                                Vector_insert(shard->idle, position + j, batch[j]);
+                                }
+                                END_LOCK;
+                                Atomic_add(P->idle, kept);
+                                i += kept;
+                        }
+                } while (k == REAP_BATCH);
+                broken += failed;
+                while (failed-- > 0 && ! P->stopped && _reserve(P))
+                        if (! _connectIdle(P, shard))
+                                break;
+        }
+        if (broken)
+                DEBUG("Health check closed %d broken connections\n", broken);
+        return broken;
+}
+
+
+/* Reaper thread. Reaps, recycles and health checks idle connections. With health
+   checks the thread wakes up every health interval and sweeps when the sweep
+   interval has passed. The schedule is kept on the monotonic clock so a wall-clock
+   step does not skip or repeat sweeps; only the wait is converted to the wall-clock */
 static void *_doSweep(void *args) {
         T P = args;
-        struct timespec wait = {0, 0};
+        long long nextSweep = Time_monotonic() + P->sweepInterval * 1000LL;
         Mutex_lock(P->mutex);
         while (! P->stopped) {
-                wait.tv_sec = Time_now() + P->sweepInterval;
+                long long now = Time_monotonic();
+                long long deadline = P->doSweep ? nextSweep : now + P->healthInterval;
+                if (P->healthInterval && now + P->healthInterval < deadline)
+                        deadline = now + P->healthInterval;
+                long long until = Time_milli() + (deadline > now ? deadline - now : 0);
+                struct timespec wait = {.tv_sec = until / 1000, .tv_nsec = (until % 1000) * 1000000};
                 Sem_timeWait(P->alarm,  P->mutex, wait);
                 if (P->stopped) break;
-                _reapConnections(P);
+                Mutex_unlock(P->mutex);
+                if (P->healthInterval)
+                        _checkHealth(P);
+                if (P->doSweep && Time_monotonic() >= nextSweep) {
+                        _reapConnections(P);
+                        if (P->maxLifetime)
+                                _recycleConnections(P);
+                        nextSweep = Time_monotonic() + P->sweepInterval * 1000LL;
+                }
+                Mutex_lock(P->mutex);
         }
         Mutex_unlock(P->mutex);
         DEBUG("Reaper thread stopped\n");
@@ -147,6 +970,230 @@ static void *_doSweep(void *args) {
 }
 
 
+/* Returns the pool size needed to keep utilization below the scaling threshold,
+   counting waiting threads as active. Must be called with the pool mutex locked */
+static inline int _scaleTarget(T P) {
+        int demand = _getActive(P) + P->waiting;
+        return (int)(((long long)demand * 100 + P->scaleThreshold - 1) / P->scaleThreshold);
+}
+
+
+/* Close the oldest idle connection found. Must be called with the pool mutex locked */
+static void _shrinkPool(T P) {
+        Connection_T con = NULL;
+        for (int i = 0; i < SHARDS && ! con; i++) {
+                shard_t shard = P->shards + i;
+                LOCK(shard->mutex)
+                {
+                        if (! Vector_isEmpty(shard->idle)) {
+                                con = Vector_remove(shard->idle, 0);
+                                Atomic_add(P->idle, -1);
+                        }
+                }
+                END_LOCK;
+        }
+        if (con) {
+                DEBUG("Scaler closing idle connection\n");
+                _removeConnection(P, con);
+                Mutex_unlock(P->mutex);
+                Connection_free(&con);
+                Mutex_lock(P->mutex);
+        }
+}
+
+
+/* Scaler thread. Establishes connections in the background while the pool is
+   below its scale target and closes idle connections, one at a time and down to
+   initial connections, after utilization has stayed below half the threshold
+   for SCALE_CALM_CHECKS checks in a row */
+static void *_doScale(void *args) {
+        T P = args;
+        int calm = 0;
+        Mutex_lock(P->mutex);
+        while (! P->stopped) {
+                if (! P->scaleRequested) {
+                        long long until = Time_milli() + SCALE_INTERVAL;
+                        struct timespec wait = {.tv_sec = until / 1000, .tv_nsec = (until % 1000) * 1000000};
+                        Sem_timeWait(P->scale, P->mutex, wait);
+                        if (P->stopped) break;
+                }
+                P->scaleRequested = false;
+                int size = Vector_size(P->pool) + P->connecting + P->filling;
+                if (size < _scaleTarget(P) && _canConnect(P) && _allowConnect(P)) {
+                        calm = 0;
+                        P->connecting++;
+                        Mutex_unlock(P->mutex);
+                        char *error = NULL;
+                        Connection_T con = Connection_new(P, &error);
+                        if (! con) {
+                                DEBUG("Scaler failed to create connection -- %s\n", error);
+                                FREE(error);
+                        }
+                        Mutex_lock(P->mutex);
+                        P->connecting--;
+                        _connected(P, con != NULL);
+                        if (con && P->stopped) {
+                                Connection_free(&con);
+                        } else if (con) {
+                                _addConnection(P, con);
+                                _pushIdle(P, _getShard(P), con);
+                                // Check again at once in case the pool is still below target
+                                P->scaleRequested = true;
+                        }
+                        _notifyWaiter(P);
+                } else if ((long long)_getActive(P) * 200 < (long long)_getSize(P) * P->scaleThreshold && ! P->waiting) {
+                        if (++calm >= SCALE_CALM_CHECKS && _getSize(P) > P->initialConnections)
+                                _shrinkPool(P);
+                } else {
+                        calm = 0;
+                }
+        }
+        Mutex_unlock(P->mutex);
+        DEBUG("Scaler thread stopped\n");
+        return NULL;
+}
+
+
+static void _start(T P, int async) {
+        LOCK(P->mutex)
+        {
+                P->stopped = false;
+                if (! P->filled) {
+                        if (! P->context)
+                                P->context = Connection_newContext(P->url);
+                        P->filled = _fillPool(P, async);
+                        if (P->filled && (P->doSweep || P->healthInterval)) {
+                                DEBUG("Starting Database reaper thread\n");
+                                Thread_create(P->reaper, _doSweep, P);
+                        }
+                        if (P->filled && P->scaleThreshold) {
+                                DEBUG("Starting scaler thread\n");
+                                Thread_create(P->scaler, _doScale, P);
+                        }
+                }
+        }
+        END_LOCK;
+        if (! P->filled)
+                THROW(SQLException, "Failed to start connection pool -- %s", P->error);
+}
+
+
+/* Start the replica pools with the same properties as the primary pool. A replica
+   which cannot be started is skipped for a while instead of failing the start */
+static void _startReplicas(T P, int async) {
+        for (int i = 0; i < Vector_size(P->replicas); i++) {
+                replica_t r = Vector_get(P->replicas, i);
+                r->pool->maxConnections = P->readConnections ? P->readConnections : P->maxConnections;
+                r->pool->initialConnections = (P->initialConnections < r->pool->maxConnections) ? P->initialConnections : r->pool->maxConnections;
+                r->pool->connectionTimeout = P->connectionTimeout;
+                r->pool->validationInterval = P->validationInterval;
+                r->pool->statementCacheSize = P->statementCacheSize;
+                r->pool->fillThreads = P->fillThreads;
+                r->pool->doSweep = P->doSweep;
+                r->pool->sweepInterval = P->sweepInterval;
+                r->pool->healthInterval = P->healthInterval;
+                r->pool->resultMemoryLimit = P->resultMemoryLimit;
+                r->pool->maxLifetime = P->maxLifetime;
+                r->pool->lifetimeJitter = P->lifetimeJitter;
+                r->pool->scaleThreshold = P->scaleThreshold;
+                r->pool->breakerFailures = P->breakerFailures;
+                r->pool->breakerCooldown = P->breakerCooldown;
+                r->pool->trace = P->trace;
+                TRY
+                {
+                        _start(r->pool, async);
+                        if (! async)
+                                _joinFillers(r->pool);
+                }
+                ELSE
+                {
+                        DEBUG("Failed to start replica %s -- %s\n", URL_toString(r->pool->url), Exception_frame.message);
+                        r->downUntil = Time_monotonic() + REPLICA_RETRY_INTERVAL;
+                }
+                END_TRY;
+        }
+}
+
+
+/* Get a connection for the statement-level methods, which throw instead of returning NULL */
+static Connection_T _borrowConnection(T P) {
+        Connection_T con = ConnectionPool_getConnectionWithTimeout(P, P->checkoutTimeout);
+        if (! con) {
+                if (ConnectionPool_snapshot(P).broken)
+                        THROW(SQLException, "Database unavailable -- %d connects failed in a row", P->failures);
+                THROW(SQLException, "No connection available within %d ms", P->checkoutTimeout);
+        }
+        return con;
+}
+
+
+/* Run a query on a borrowed connection and return a Snapshot of the result, the
+   connection is returned before the rows are used */
+static Snapshot_T _query(T P, const char *statement) {
+        Snapshot_T volatile S = NULL;
+        Connection_T con = _borrowConnection(P);
+        TRY
+        {
+                S = Snapshot_new(Connection_executeQueryRaw(con, statement, (int)strlen(statement)));
+        }
+        FINALLY
+        {
+                Connection_close(con);
+        }
+        END_TRY;
+        return S;
+}
+
+
+/* Select the available replica with the fewest active connections relative to its weight */
+static replica_t _selectReplica(T P, long long now) {
+        replica_t selected = NULL;
+        int selectedActive = 0;
+        for (int i = 0; i < Vector_size(P->replicas); i++) {
+                replica_t r = Vector_get(P->replicas, i);
+                if (r->downUntil > now)
+                        continue;
+                int active = _getActive(r->pool);
+                if (! selected || (long long)active * selected->weight < (long long)selectedActive * r->weight) {
+                        selected = r;
+                        selectedActive = active;
+                }
+        }
+        return selected;
+}
+
+
+
+/* ----------------------------------------------------- Protected methods */
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility push(hidden)
+#endif
+
+Trace_T ConnectionPool_getTrace(T P) {
+        assert(P);
+        return &P->trace;
+}
+
+
+void *ConnectionPool_getContext(T P) {
+        assert(P);
+        return P->context;
+}
+
+
+int ConnectionPool_chargeMemory(T P, long long bytes) {
+        assert(P);
+        long long memory = Atomic_add(P->resultMemory, bytes);
+        return bytes <= 0 || ! P->resultMemoryLimit || memory <= P->resultMemoryLimit;
+}
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility pop
+#endif
+
+
 /* ---------------------------------------------------------------- Public */
 
 
@@ -159,11 +1206,21 @@ T ConnectionPool_new(URL_T url) {
 	NEW(P);
         P->url = url;
         Sem_init(P->alarm);
+        Sem_init(P->scale);
 	Mutex_init(P->mutex);
 	P->maxConnections = SQL_DEFAULT_MAX_CONNECTIONS;
         P->pool = Vector_new(SQL_DEFAULT_MAX_CONNECTIONS);
+        P->replicas = Vector_new(4);
+        P->shards = CALLOC(SHARDS, sizeof(struct shard_t));
+        for (int i = 0; i < SHARDS; i++) {
+                Mutex_init(P->shards[i].mutex);
+                P->shards[i].idle = Vector_new(SQL_DEFAULT_MAX_CONNECTIONS / SHARDS + 1);
+        }
 	P->initialConnections = SQL_DEFAULT_INIT_CONNECTIONS;
         P->connectionTimeout = SQL_DEFAULT_CONNECTION_TIMEOUT;
+        P->checkoutTimeout = SQL_DEFAULT_CHECKOUT_TIMEOUT;
+        P->fillThreads = 1;
+        P->trace.sampling = 1;
 	return P;
 }
 
@@ -174,9 +1231,28 @@ void ConnectionPool_free(T *P) {
         pool = (*P)->pool;
         if (! (*P)->stopped)
                 ConnectionPool_stop((*P));
+        while (! Vector_isEmpty((*P)->replicas)) {
+                replica_t r = Vector_pop((*P)->replicas);
+                ConnectionPool_free(&r->pool);
+                FREE(r);
+        }
+        Vector_free(&(*P)->replicas);
         Vector_free(&pool);
+        if ((*P)->cache)
+                ResultCache_free(&(*P)->cache);
+        Connection_freeContext((*P)->url, &(*P)->context);
+        for (int i = 0; i < SHARDS; i++) {
+                Vector_free(&(*P)->shards[i].idle);
+                Mutex_destroy((*P)->shards[i].mutex);
+        }
+        FREE((*P)->shards);
+        if ((*P)->slots) {
+                ThreadData_destroy((*P)->slotKey);
+                FREE((*P)->slots);
+        }
 	Mutex_destroy((*P)->mutex);
         Sem_destroy((*P)->alarm);
+        Sem_destroy((*P)->scale);
         FREE((*P)->error);
 	FREE(*P);
 }
@@ -214,6 +1290,7 @@ void ConnectionPool_setMaxConnections(T P, int maxConnections) {
         LOCK(P->mutex)
         {
                 P->maxConnections = maxConnections;
+                _notifyWaiter(P);
         }
         END_LOCK;
 }
@@ -238,12 +1315,173 @@ int ConnectionPool_getConnectionTimeout(T P) {
 }
 
 
+void ConnectionPool_setValidationInterval(T P, int ms) {
+        assert(P);
+        assert(ms >= 0);
+        P->validationInterval = ms;
+}
+
+
+int ConnectionPool_getValidationInterval(T P) {
+        assert(P);
+        return P->validationInterval;
+}
+
+
+void ConnectionPool_setStatementCacheSize(T P, int size) {
+        assert(P);
+        assert(size >= 0);
+        P->statementCacheSize = size;
+}
+
+
+int ConnectionPool_getStatementCacheSize(T P) {
+        assert(P);
+        return P->statementCacheSize;
+}
+
+
+void ConnectionPool_setFillThreads(T P, int threads) {
+        assert(P);
+        assert(threads > 0);
+        P->fillThreads = threads;
+}
+
+
+int ConnectionPool_getFillThreads(T P) {
+        assert(P);
+        return P->fillThreads;
+}
+
+
+void ConnectionPool_setThreadAffinity(T P, int affinity) {
+        assert(P);
+        assert(! P->filled);
+        if (affinity && ! P->slots) {
+                ThreadData_create(P->slotKey, NULL);
+                P->slots = CALLOC(AFFINITY_SLOTS, sizeof *P->slots);
+        } else if (! affinity && P->slots) {
+                ThreadData_destroy(P->slotKey);
+                FREE(P->slots);
+        }
+}
+
+
+int ConnectionPool_getThreadAffinity(T P) {
+        assert(P);
+        return P->slots != NULL;
+}
+
+
+void ConnectionPool_setCheckoutTimeout(T P, int ms) {
+        assert(P);
+        assert(ms >= 0);
+        P->checkoutTimeout = ms;
+}
+
+
+int ConnectionPool_getCheckoutTimeout(T P) {
+        assert(P);
+        return P->checkoutTimeout;
+}
+
+
+void ConnectionPool_setResultCacheSize(T P, long long bytes) {
+        assert(P);
+        assert(bytes >= 0);
+        assert(! P->filled);
+        if (P->cache)
+                ResultCache_free(&P->cache);
+        if (bytes > 0)
+                P->cache = ResultCache_new(bytes);
+}
+
+
+long long ConnectionPool_getResultCacheSize(T P) {
+        assert(P);
+        return P->cache ? ResultCache_getSize(P->cache) : 0;
+}
+
+
+void ConnectionPool_setTracer(T P, const ConnectionPool_Tracer_T *tracer) {
+        assert(P);
+        assert(! P->filled);
+        P->trace.tracer = tracer ? *tracer : (ConnectionPool_Tracer_T){};
+}
+
+
+void ConnectionPool_setSlowQueryThreshold(T P, int ms) {
+        assert(P);
+        assert(ms >= 0);
+        assert(! P->filled);
+        P->slowQueryThreshold = ms;
+        // The log is off without a handler, so statements are not timed for nothing
+        P->trace.slowMicros = P->trace.slowQueryHandler ? ms * 1000LL : 0;
+}
+
+
+int ConnectionPool_getSlowQueryThreshold(T P) {
+        assert(P);
+        return P->slowQueryThreshold;
+}
+
+
+void ConnectionPool_setSlowQueryHandler(T P, void (*handler)(const ConnectionPool_SlowQuery_T *query, void *context), void *context) {
+        assert(P);
+        assert(! P->filled);
+        P->trace.slowQueryHandler = handler;
+        P->trace.slowQueryContext = context;
+        ConnectionPool_setSlowQueryThreshold(P, P->slowQueryThreshold);
+}
+
+
+void ConnectionPool_setSlowQuerySampling(T P, int sampling, int normalize) {
+        assert(P);
+        assert(sampling > 0);
+        P->trace.sampling = sampling;
+        P->trace.normalize = normalize;
+}
+
+
 void ConnectionPool_setAbortHandler(T P, void(*abortHandler)(const char *error)) {
         assert(P); 
         AbortHandler = abortHandler;
 }
 
 
+void ConnectionPool_addReplica(T P, URL_T url, int weight) {
+        assert(P);
+        assert(url);
+        assert(weight > 0);
+        assert(! P->filled);
+        replica_t r;
+        NEW(r);
+        r->weight = weight;
+        r->pool = ConnectionPool_new(url);
+        Vector_push(P->replicas, r);
+}
+
+
+int ConnectionPool_getReplicaCount(T P) {
+        assert(P);
+        return Vector_size(P->replicas);
+}
+
+
+void ConnectionPool_setReadConnections(T P, int maxConnections) {
+        assert(P);
+        assert(maxConnections >= 0);
+        assert(! P->filled);
+        P->readConnections = maxConnections;
+}
+
+
+int ConnectionPool_getReadConnections(T P) {
+        assert(P);
+        return P->readConnections ? P->readConnections : P->maxConnections;
+}
+
+
 void ConnectionPool_setReaper(T P, int sweepInterval) {
         assert(P);
         assert(sweepInterval>0);
@@ -256,21 +1494,114 @@ void ConnectionPool_setReaper(T P, int sweepInterval) {
 }
 
 
-int ConnectionPool_size(T P) {
+void ConnectionPool_setAutoScaling(T P, int utilization) {
         assert(P);
-        return Vector_size(P->pool);
+        assert(utilization >= 0 && utilization <= 100);
+        assert(! P->filled);
+        P->scaleThreshold = utilization;
 }
 
 
-int ConnectionPool_active(T P) {
-        int n = 0;
+int ConnectionPool_getAutoScaling(T P) {
+        assert(P);
+        return P->scaleThreshold;
+}
+
+
+void ConnectionPool_setCircuitBreaker(T P, int failures, int cooldown) {
         assert(P);
+        assert(failures >= 0);
+        assert(cooldown > 0);
         LOCK(P->mutex)
         {
-                n = _getActive(P);
+                P->breakerFailures = failures;
+                P->breakerCooldown = cooldown;
         }
         END_LOCK;
-        return n;
+}
+
+
+int ConnectionPool_getCircuitBreaker(T P) {
+        assert(P);
+        return P->breakerFailures;
+}
+
+
+void ConnectionPool_setMaxLifetime(T P, int seconds, int jitter) {
+        assert(P);
+        assert(seconds >= 0);
+        assert(jitter >= 0 && (jitter < seconds || jitter == 0));
+        P->maxLifetime = seconds;
+        P->lifetimeJitter = jitter;
+}
+
+
+int ConnectionPool_getMaxLifetime(T P) {
+        assert(P);
+        return P->maxLifetime;
+}
+
+
+void ConnectionPool_setHealthCheck(T P, int ms) {
+        assert(P);
+        assert(ms >= 0);
+        assert(! P->filled);
+        P->healthInterval = ms;
+}
+
+
+int ConnectionPool_getHealthCheck(T P) {
+        assert(P);
+        return P->healthInterval;
+}
+
+
+void ConnectionPool_setResultMemoryLimit(T P, long long bytes) {
+        assert(P);
+        assert(bytes >= 0);
+        P->resultMemoryLimit = bytes;
+}
+
+
+long long ConnectionPool_getResultMemoryLimit(T P) {
+        assert(P);
+        return P->resultMemoryLimit;
+}
+
+
+long long ConnectionPool_getResultMemory(T P) {
+        assert(P);
+        return Atomic_get(P->resultMemory);
+}
+
+
+int ConnectionPool_size(T P) {
+        assert(P);
+        return _getSize(P);
+}
+
+
+int ConnectionPool_active(T P) {
+        assert(P);
+        return _getActive(P);
+}
+
+
+ConnectionPool_Snapshot_T ConnectionPool_snapshot(T P) {
+        assert(P);
+        ConnectionPool_Snapshot_T s = {
+                .idle = Atomic_get(P->idle),
+                .waiting = P->waiting,
+                .created = Atomic_get(P->created),
+                .destroyed = Atomic_get(P->destroyed),
+                .resultMemory = Atomic_get(P->resultMemory)
+        };
+        // The breaker state is read as the other counters, without the pool lock
+        int breakerFailures = Atomic_get(P->breakerFailures);
+        s.broken = breakerFailures && (Atomic_get(P->failures) >= breakerFailures);
+        s.size = (int)(s.created - s.destroyed);
+        s.active = (s.size > s.idle) ? s.size - s.idle : 0;
+        return s;
 }
 
 
@@ -279,72 +1610,111 @@ int ConnectionPool_active(T P) {
 
 void ConnectionPool_start(T P) {
         assert(P);
-        LOCK(P->mutex)
-        {
-                P->stopped = false;
-                if (! P->filled) {
-                        P->filled = _fillPool(P);
-                        if (P->filled && P->doSweep) {
-                                DEBUG("Starting Database reaper thread\n");
-                                Thread_create(P->reaper, _doSweep, P);
-                        }
-                }
-        }
-        END_LOCK;
-        if (! P->filled)
-                THROW(SQLException, "Failed to start connection pool -- %s", P->error);
+        _start(P, false);
+        _joinFillers(P);
+        _startReplicas(P, false);
+}
+
+
+void ConnectionPool_startAsync(T P) {
+        assert(P);
+        _start(P, true);
+        _startReplicas(P, true);
 }
 
 
 void ConnectionPool_stop(T P) {
-        int stopSweep = false;
+        int stopSweep = false, stopScale = false;
         assert(P);
         LOCK(P->mutex)
         {
                 P->stopped = true;
+                P->filling = 0;
+                for (waiter_t w = P->waitHead; w; w = w->next)
+                        Sem_signal(w->sem);
+                stopSweep = (P->filled && (P->doSweep || P->healthInterval) && P->reaper);
+                stopScale = (P->filled && P->scaleThreshold);
+                if (stopScale)
+                        Sem_signal(P->scale);
+        }
+        END_LOCK;
+        _joinFillers(P);
+        if (stopScale)
+                Thread_join(P->scaler);
+        // Stop the reaper before draining the pool as it may hold detached connections
+        if (stopSweep) {
+                DEBUG("Stopping Database reaper thread...\n");
+                LOCK(P->mutex)
+                {
+                        Sem_signal(P->alarm);
+                }
+                END_LOCK;
+                Thread_join(P->reaper);
+        }
+        LOCK(P->mutex)
+        {
                 if (P->filled) {
                         _drainPool(P);
                         P->filled = false;
-                        stopSweep = (P->doSweep && P->reaper);
                 }
         }
         END_LOCK;
-        if (stopSweep) {
-                DEBUG("Stopping Database reaper thread...\n");
-                Sem_signal(P->alarm);
-                Thread_join(P->reaper);
+        for (int i = 0; i < Vector_size(P->replicas); i++) {
+                replica_t r = Vector_get(P->replicas, i);
+                ConnectionPool_stop(r->pool);
         }
 }
 
 
 Connection_T ConnectionPool_getConnection(T P) {
-	Connection_T con = NULL;
+        int failed;
 	assert(P);
-	LOCK(P->mutex) 
-        {
-                int size = Vector_size(P->pool);
-                for (int i = 0; i < size; i++) {
-                        con = Vector_get(P->pool, i);
-                        if (Connection_isAvailable(con) && Connection_ping(con)) {
-                                Connection_setAvailable(con, false);
-                                goto done;
-                        } 
-                }
-                con = NULL;
-                if (size < P->maxConnections) {
-                        con = Connection_new(P, &P->error);
-                        if (con) {
-                                Connection_setAvailable(con, false);
-                                Vector_push(P->pool, con);
-                        } else {
-                                DEBUG("Failed to create connection -- %s\n", P->error);
-                                FREE(P->error);
-                        }
-                }
+        long long start = Statistics_start();
+        Connection_T con = _getConnection(P, &failed);
+        if (con)
+                Statistics_record(URL_getProtocol(P->url), Statistics_Checkout, start);
+        return con;
+}
+
+
+Connection_T ConnectionPool_getReadConnection(T P) {
+        assert(P);
+        long long now = Time_monotonic();
+        // A replica which fails to connect is marked down and the next one tried. If the
+        // selected replica is full or no replica is available, use the primary pool
+        for (replica_t r; (r = _selectReplica(P, now)); ) {
+                int failed;
+                Connection_T con = _getConnection(r->pool, &failed);
+                if (con)
+                        return con;
+                if (! failed)
+                        break;
+                DEBUG("Replica %s is unavailable\n", URL_toString(r->pool->url));
+                r->downUntil = now + REPLICA_RETRY_INTERVAL;
         }
-done: 
-        END_LOCK;
-	return con;
+        return ConnectionPool_getConnection(P);
+}
+
+
+Connection_T ConnectionPool_getConnectionWithTimeout(T P, int ms) {
+        Connection_T con;
+        long long lastAccessed;
+        assert(P);
+        assert(ms >= 0);
+        long long deadline = Time_monotonic() + ms;
+        long long start = Statistics_start();
+        int failed;
+        while (! (con = _getConnection(P, &failed))) {
+                if (failed)
+                        break;
+                if (! _waitConnection(P, deadline, &con, &lastAccessed))
+                        break;
+                if (con && (con = _validate(P, con, lastAccessed)))
+                        break;
+        }
+        if (con)
+                Statistics_record(URL_getProtocol(P->url), Statistics_Checkout, start);
+        return con;
 }
 
 
@@ -359,26 +1729,169 @@ void ConnectionPool_returnConnection(T P, Connection_T connection) {
                 END_TRY;
 	}
 	Connection_clear(connection);
-	LOCK(P->mutex)
-        {
-		Connection_setAvailable(connection, true);
+        if (P->waiting) {
+                LOCK(P->mutex)
+                {
+                        if (P->waitHead) {
+                                _handOff(P, connection);
+                                connection = NULL;
+                        }
+                }
+                END_LOCK;
+        }
+        if (connection) {
+                // With thread affinity, park the connection in the thread's slot if it is free
+                int parked = false;
+                if (P->slots) {
+                        Connection_T *slot = _getSlot(P);
+                        if (! *slot) {
+                                Connection_setAvailable(connection, true);
+                                Atomic_add(P->idle, 1);
+                                if (! (parked = Atomic_cas(*slot, NULL, connection)))
+                                        Atomic_add(P->idle, -1);
+                        }
+                }
+                if (! parked)
+                        _pushIdle(P, _getShard(P), connection);
+                // A thread may have started waiting after we checked above
+                if (P->waiting) {
+                        LOCK(P->mutex)
+                        {
+                                _notifyWaiter(P);
+                        }
+                        END_LOCK;
+                }
         }
-	END_LOCK;
 }
 
 
 int ConnectionPool_reapConnections(T P) {
-        int n = 0;
         assert(P);
-        LOCK(P->mutex)
+        int n = _reapConnections(P);
+        if (P->maxLifetime)
+                _recycleConnections(P);
+        return n;
+}
+
+
+long long ConnectionPool_execute(T P, const char *sql, ...) {
+        assert(P);
+        assert(sql);
+        volatile long long rows = 0;
+        Connection_T con = _borrowConnection(P);
+        va_list ap;
+        va_start(ap, sql);
+        TRY
         {
-                n = _reapConnections(P);
+                Connection_vexecute(con, sql, ap);
+                rows = Connection_rowsChanged(con);
         }
-        END_LOCK;
-        return n;
+        FINALLY
+        {
+                va_end(ap);
+                Connection_close(con);
+        }
+        END_TRY;
+        return rows;
+}
+
+
+void ConnectionPool_executeQuery(T P, void (*callback)(ResultSet_T r, void *ctx), void *ctx, const char *sql, ...) {
+        assert(P);
+        assert(callback);
+        assert(sql);
+        Connection_T con = _borrowConnection(P);
+        va_list ap;
+        va_start(ap, sql);
+        TRY
+        {
+                ResultSet_T r = Connection_vexecuteQuery(con, sql, ap);
+                callback(r, ctx);
+        }
+        FINALLY
+        {
+                va_end(ap);
+                Connection_close(con);
+        }
+        END_TRY;
+}
+
+
+void ConnectionPool_executeCachedQuery(T P, int ttl, void (*callback)(ResultSet_T r, void *ctx), void *ctx, const char *sql, ...) {
+        assert(P);
+        assert(ttl >= 0);
+        assert(callback);
+        assert(sql);
+        va_list ap;
+        va_start(ap, sql);
+        char *statement = Str_vcat(sql, ap);
+        va_end(ap);
+        char * volatile key = NULL;
+        ResultSet_T volatile r = NULL;
+        TRY
+        {
+                Snapshot_T S = NULL;
+                if (P->cache && ttl > 0) {
+                        key = ResultCache_newKey(statement);
+                        S = ResultCache_get(P->cache, key);
+                }
+                if (! S) {
+                        S = _query(P, statement);
+                        if (key)
+                                ResultCache_put(P->cache, key, S, ttl);
+                }
+                r = Snapshot_toResultSet(S);
+                Snapshot_free(&S);
+                callback(r, ctx);
+        }
+        FINALLY
+        {
+                if (r) {
+                        ResultSet_T R = r;
+                        ResultSet_free(&R);
+                }
+                FREE(key);
+                FREE(statement);
+        }
+        END_TRY;
+}
+
+
+int ConnectionPool_invalidateCache(T P, const char *prefix) {
+        assert(P);
+        if (! P->cache)
+                return 0;
+        char *key = prefix ? ResultCache_newKey(prefix) : NULL;
+        int removed = ResultCache_invalidate(P->cache, key);
+        FREE(key);
+        return removed;
+}
+
+
+void ConnectionPool_executeTransaction(T P, void (*callback)(Connection_T con, void *ctx), void *ctx) {
+        assert(P);
+        assert(callback);
+        Connection_T con = _borrowConnection(P);
+        TRY
+        {
+                Connection_beginTransaction(con);
+                callback(con, ctx);
+                Connection_commit(con);
+        }
+        FINALLY
+        {
+                // Rolls back the transaction if the callback threw
+                Connection_close(con);
+        }
+        END_TRY;
 }
 
 
 const char *ConnectionPool_version(void) {
         return ABOUT;
 }
+
+
+void ConnectionPool_setAllocator(void *(*mallocFunc)(size_t size), void *(*callocFunc)(size_t count, size_t size), void *(*reallocFunc)(void *p, size_t size), void (*freeFunc)(void *p)) {
+        Mem_setAllocator(mallocFunc, callocFunc, reallocFunc, freeFunc);
+}
@@ -26,6 +26,8 @@
 #ifndef CONNECTIONPOOL_INCLUDED
 #define CONNECTIONPOOL_INCLUDED
 
+#include <stddef.h>
+
 
 /**
  * A <b>ConnectionPool</b> represent a database connection pool.
@@ -44,7 +46,9 @@
  * connection from the pool. If there are no connections available a new
  * connection is created and returned. If the pool has already handed out
  * <i>maxConnections</i> Connections, the next call to 
- * ConnectionPool_getConnection() will return NULL. Use Connection_close()
+ * ConnectionPool_getConnection() will return NULL. Use 
+ * ConnectionPool_getConnectionWithTimeout() to instead wait for a 
+ * connection to be returned. Use Connection_close()
  * to return a connection to the pool so it can be reused.
  *
  * A connection pool is created default with 5 initial connections and 
@@ -108,7 +112,9 @@
  * \endhtmlonly
  *
  * See <a href="mysqloptions.html">mysql options</a> for all properties that
- * can be set for a mysql connection URL.
+ * can be set for a mysql connection URL. With <code>use-ssl=true</code> and
+ * MySQL Connector/C 8.0.29 or later, a new Connection resumes the TLS
+ * session of the pool's last Connection, which saves a full handshake.
  *
  * <h4>SQLite:</h4>
  *
@@ -123,6 +129,15 @@
  * <ul>
  * <li><code>heap_limit=value</code> - Make SQLite auto-release unused memory 
  * if memory usage goes above the specified value [KB].</li> 
+ * <li><code>profile=performance</code> - Set WAL journal mode, synchronous=normal,
+ * a 256MB mmap_size, a 16MB cache_size and temp_store=memory. Pragmas given in
+ * the URL take precedence over the profile.</li>
+ * <li><code>mode=ro</code> - Open the database read-only. The default,
+ * <code>mode=rw</code>, opens the database for reading and writing and
+ * creates it if it does not exist.</li>
+ * <li><code>cache=private</code> - Give each Connection its own page cache.
+ * By default Connections share a page cache per database and table locks
+ * make readers wait for writers, see also the read replicas section below.</li>
  * </ul>
  * An URL for 
  * connecting to a SQLite database might look like:
@@ -133,6 +148,9 @@
  * </code></dd></dt>
  * \endhtmlonly
  *
+ * The path <code>/:memory:</code> gives each Connection its own private
+ * in-memory database, e.g. <code>sqlite:///:memory:</code>
+ *
  * <h4>PostgreSQL:</h4>
  *
  * The URL for connecting to a <a href="http://www.postgresql.org/">
@@ -182,6 +200,21 @@
  * oracle:///servicename?user=scott&password=tiger
  * </code></dd></dt>
  * \endhtmlonly
+ *
+ * In addition to the user and password, the following properties are supported:
+ * <ul>
+ * <li><code>prefetch-rows=value</code> - Number of rows the client fetch from
+ * the server in one round trip when a ResultSet is read. Default is 100.
+ * Can be changed per Connection with Connection_setFetchSize().</li>
+ * <li><code>prefetch-memory=value</code> - Limit the memory used for
+ * prefetched rows per statement [bytes]. Default is no limit.</li>
+ * <li><code>session-pool=true</code> - Share one OCI environment between
+ * the connections of the pool and get their sessions from an OCI session
+ * pool. Connecting is faster and each connection uses less memory.</li>
+ * <li><code>statement-cache=value</code> - Number of statements OCI keeps
+ * prepared per session. Default is 20 with session-pool=true and 0
+ * otherwise.</li>
+ * </ul>
  *  
  * <h2>Example:</h2>
  * To obtain a connection pool for a MySQL database, the code below can be
@@ -230,6 +263,42 @@
  * Clients can also call the method, ConnectionPool_reapConnections(), to
  * bonsai the pool directly if the reaper thread is not activated.
  *
+ * Without the reaper, the pool grows only when a thread asks for a
+ * Connection and none is idle, and the thread pays the cost of connecting.
+ * With ConnectionPool_setAutoScaling() a scaler thread is started which
+ * establishes Connections in the background as soon as the share of
+ * active Connections reaches a given percentage, or a thread has to wait
+ * for a Connection, so a sudden increase in load finds Connections ready.
+ * When utilization has stayed below half the threshold for a few seconds,
+ * the scaler closes idle Connections one at a time, down to the initial
+ * number of Connections.
+ *
+ * Long-lived Connections accumulate memory on the server, and if they
+ * all break at once, e.g. on a failover, they are all re-established at
+ * once. With ConnectionPool_setMaxLifetime() the reaper replaces idle
+ * Connections older than a maximum lifetime one at a time, and connects
+ * the replacement before the old Connection is closed. A random jitter
+ * spreads the lifetimes, so Connections established together are
+ * replaced at different times.
+ *
+ * By default an idle Connection is pinged when it is checked out, see
+ * ConnectionPool_setValidationInterval(). With ConnectionPool_setHealthCheck()
+ * the reaper thread pings idle Connections in the background instead,
+ * which keeps them from being dropped by firewalls and NAT gateways for
+ * being idle. Broken Connections are closed and replaced before a thread
+ * asks for them, and checkout does no I/O.
+ *
+ * <h2>Circuit breaker:</h2>
+ * If the database goes down, every thread which finds no idle Connection
+ * tries to connect and blocks until the connect times out. With
+ * ConnectionPool_setCircuitBreaker() the pool stops connecting after a
+ * number of consecutive failed connects, and for a cooldown period the
+ * pool fails fast; ConnectionPool_getConnection() returns NULL at once
+ * unless an idle Connection is available. When the cooldown has passed,
+ * one thread is let through to probe the database. If it connects the
+ * breaker is closed, otherwise the breaker stays open for another cooldown.
+ * ConnectionPool_snapshot() reports if the breaker is open.
+ *
  * It is recommended to start the pool with a reaper-thread, especially if
  * the pool maintains TCP/IP Connections.
  *
@@ -240,6 +309,89 @@
  * returns the number of active connections, i.e. those connections in 
  * current use by your application. 
  *
+ * <h2>Read replicas:</h2>
+ * Read-only replicas of the database can be added to the pool with
+ * ConnectionPool_addReplica() before the pool is started. Each replica
+ * is served by a pool of its own, started with the same properties as
+ * this pool. ConnectionPool_getReadConnection() returns a Connection to
+ * the replica with the fewest active connections relative to its weight,
+ * so read load is spread over the replicas. A replica which cannot be
+ * connected to, either at start or when a stale connection is replaced,
+ * is skipped for 10 seconds. If no replica is available or the selected
+ * replica is full, a Connection to the primary database is returned
+ * instead. ConnectionPool_getConnection() always return a Connection to
+ * the primary database and should be used for writes.
+ *
+ * \htmlonly
+ * <dt><dd><code>
+ * <pre>
+ * ConnectionPool_T pool = ConnectionPool_new(URL_new("postgresql://primary/db?user=app"));
+ * ConnectionPool_addReplica(pool, URL_new("postgresql://replica1/db?user=app"), 1);
+ * ConnectionPool_addReplica(pool, URL_new("postgresql://replica2/db?user=app"), 2);
+ * ConnectionPool_start(pool);
+ * [..]
+ * Connection_T con = ConnectionPool_getReadConnection(pool);
+ * ResultSet_T r = Connection_executeQuery(con, "select name from employee");
+ * [..]
+ * Connection_close(con);
+ * </pre>
+ * </code></dd></dt>
+ * \endhtmlonly
+ *
+ * A SQLite database in WAL mode can be read by many Connections while one
+ * Connection writes to it, provided the Connections do not share a cache.
+ * Use the database as a read replica of itself, with private cache
+ * read-only Connections for reads and a single writer Connection:
+ *
+ * \htmlonly
+ * <dt><dd><code>
+ * <pre>
+ * ConnectionPool_T pool = ConnectionPool_new(URL_new("sqlite:///var/app.db?journal_mode=wal&cache=private"));
+ * ConnectionPool_setInitialConnections(pool, 1);
+ * ConnectionPool_setMaxConnections(pool, 1);
+ * ConnectionPool_addReplica(pool, URL_new("sqlite:///var/app.db?mode=ro&cache=private"), 1);
+ * ConnectionPool_setReadConnections(pool, 8);
+ * ConnectionPool_start(pool);
+ * </pre>
+ * </code></dd></dt>
+ * \endhtmlonly
+ *
+ * <h2>Statement-level pooling:</h2>
+ * Many short autocommit statements do not need a Connection held by the
+ * caller. ConnectionPool_execute() and ConnectionPool_executeQuery() borrow
+ * a Connection for one statement and ConnectionPool_executeTransaction()
+ * for one transaction, and return it to the pool as soon as the statement
+ * or transaction is done, even if it throws. Since a Connection is only
+ * held while the database works, a few connections can serve many more
+ * threads. A thread waits up to ConnectionPool_setCheckoutTimeout()
+ * milliseconds for a Connection if all are in use. A ResultSet is only
+ * valid in the callback given to ConnectionPool_executeQuery():
+ *
+ * \htmlonly
+ * <dt><dd><code>
+ * <pre>
+ * static void employee(ResultSet_T r, void *ctx) {
+ *         while (ResultSet_next(r))
+ *                 printf("%s\n", ResultSet_getString(r, 1));
+ * }
+ * [..]
+ * ConnectionPool_execute(pool, "update employee set salary = salary * 1.1 where id = %d", id);
+ * ConnectionPool_executeQuery(pool, employee, NULL, "select name from employee where salary > %d", anumber);
+ * </pre>
+ * </code></dd></dt>
+ * \endhtmlonly
+ *
+ * <h2>Result cache:</h2>
+ * Results of queries which are repeated often and can be a little stale,
+ * e.g. configuration lookups, can be cached in the pool. Enable the cache
+ * with ConnectionPool_setResultCacheSize() and run the queries with
+ * ConnectionPool_executeCachedQuery(). A cache hit is served from memory
+ * without getting a Connection from the pool. Results are cached by the
+ * SQL statement with its arguments and expire after the time to live
+ * given with the query. The cache is bounded in bytes and the least
+ * recently used result is evicted first. Invalidate results explicitly
+ * with ConnectionPool_invalidateCache() when the underlying data changes.
+ *
  * <i>This ConnectionPool is thread-safe.</i>
  *
  * @see Connection.h ResultSet.h URL.h PreparedStatement.h SQLException.h
@@ -250,12 +402,83 @@
 #define T ConnectionPool_T
 typedef struct ConnectionPool_S *T;
 
+/**
+ * A point-in-time view of the pool counters, see ConnectionPool_snapshot()
+ */
+typedef struct ConnectionPool_Snapshot_T {
+        int size;                 ///< Number of connections in the pool
+        int active;               ///< Number of connections in use by clients
+        int idle;                 ///< Number of connections available for checkout
+        int waiting;              ///< Number of threads waiting for a connection
+        long long created;        ///< Total number of connections established
+        long long destroyed;      ///< Total number of connections closed
+        int broken;               ///< true if the circuit breaker is open and connects fail fast
+        long long resultMemory;   ///< Bytes held by result sets, see ConnectionPool_setResultMemoryLimit()
+} ConnectionPool_Snapshot_T;
+
+/**
+ * Callbacks invoked around database operations, see ConnectionPool_setTracer()
+ */
+typedef struct ConnectionPool_Tracer_T {
+        /** Called before an operation with its SQL statement, or NULL if none. The value
+            returned, e.g. a span, is passed to end */
+        void *(*begin)(void *context, const char *operation, const char *sql);
+        /** Called after the operation with the number of rows affected or -1 if not
+            known, the elapsed time in microseconds and an error message or NULL */
+        void (*end)(void *context, void *span, const char *operation, long long rows, long long micros, const char *error);
+        void *context;          ///< Passed to the callbacks
+} ConnectionPool_Tracer_T;
+
+/**
+ * A statement reported by the slow query log, see ConnectionPool_setSlowQueryThreshold()
+ */
+typedef struct ConnectionPool_SlowQuery_T {
+        const char *sql;        ///< The SQL statement, with literals replaced by '?' if normalized
+        const char *backend;    ///< The backend name, e.g. "postgresql"
+        long long micros;       ///< Execution time in microseconds
+        long long rows;         ///< Number of rows affected or -1 if not known
+} ConnectionPool_SlowQuery_T;
+
 /**
  * Library Debug flag. If set to true, emit debug output 
  */
 extern int ZBDEBUG;
 
 
+//<< Protected methods
+
+struct Trace_S;
+
+/**
+ * Returns the pool's tracer and slow query log settings, see Trace.h
+ * @param P A ConnectionPool object
+ * @return The trace settings of the pool
+ */
+struct Trace_S *ConnectionPool_getTrace(T P);
+
+
+/**
+ * Returns the connect settings shared by the pool's Connections, see
+ * Connection_newContext(). Created when the pool is started
+ * @param P A ConnectionPool object
+ * @return The connect settings or NULL if the backend has none
+ */
+void *ConnectionPool_getContext(T P);
+
+
+/**
+ * Add bytes to the memory held by the result sets of the pool. Bytes
+ * are negative when a result set releases memory
+ * @param P A ConnectionPool object
+ * @param bytes The change in bytes held
+ * @return false if bytes is positive and the pool now holds more than
+ * its result memory limit, otherwise true
+ */
+int ConnectionPool_chargeMemory(T P, long long bytes);
+
+//>> End Protected methods
+
+
 /**
  * Create a new ConnectionPool. The pool is created with default 5
  * initial connections. Maximum connections is set to 20. Property
@@ -351,6 +574,219 @@ void ConnectionPool_setConnectionTimeout(T P, int connectionTimeout);
 int ConnectionPool_getConnectionTimeout(T P);
 
 
+/**
+ * Set the validation interval in milliseconds. An idle Connection is
+ * tested with Connection_ping() before it is handed out by
+ * ConnectionPool_getConnection() only if it has been idle longer than
+ * <code>ms</code> milliseconds. The ping is done without holding the pool
+ * lock. The default value, 0, means that a Connection is pinged on every
+ * checkout. Idle time is measured from the Connection's last accessed 
+ * time which has second resolution. It is a checked runtime error for
+ * <code>ms</code> to be less than zero.
+ * @param P A ConnectionPool object
+ * @param ms The number of milliseconds a Connection can be idle before it
+ * is validated on checkout (value >= 0)
+ * @see ConnectionPool_setHealthCheck()
+ */
+void ConnectionPool_setValidationInterval(T P, int ms);
+
+
+/**
+ * Returns the validation interval in milliseconds.
+ * @param P A ConnectionPool object
+ * @return The time an idle Connection may be handed out without being pinged
+ * @see ConnectionPool_setValidationInterval()
+ */
+int ConnectionPool_getValidationInterval(T P);
+
+
+/**
+ * Set the maximum number of prepared statements cached per Connection.
+ * With a statement cache, Connection_prepareStatement() returns a cached
+ * PreparedStatement if the same SQL statement was prepared before on the
+ * Connection, also in a previous checkout, and no server round trip is
+ * needed. SQL statements are compared with white-space outside of
+ * quoted literals collapsed. Preparing the same SQL statement twice 
+ * before the Connection is returned to the pool, returns the same 
+ * PreparedStatement object. Least recently used statements are closed
+ * when the cache is full or hold more than 64KB worth of SQL text. 
+ * The default value, 0, disables the cache and a PreparedStatement
+ * lives until the Connection is returned to the pool. It is a checked
+ * runtime error for <code>size</code> to be less than zero.
+ * @param P A ConnectionPool object
+ * @param size The number of prepared statements to cache per Connection
+ * (value >= 0)
+ */
+void ConnectionPool_setStatementCacheSize(T P, int size);
+
+
+/**
+ * Returns the maximum number of prepared statements cached per Connection
+ * @param P A ConnectionPool object
+ * @return The size of the statement cache, 0 if the cache is disabled
+ */
+int ConnectionPool_getStatementCacheSize(T P);
+
+
+/**
+ * Turn thread affinity on or off. With thread affinity each thread
+ * has a slot where the connection it returns to the pool is parked and
+ * the thread's next checkout takes that connection back without
+ * locking the pool. A thread that checks out and returns connections
+ * in a loop therefore keeps using the same warm connection and driver
+ * buffers. Connections parked by other threads are taken before a new
+ * connection is established, so parking does not grow the pool.
+ * Parked connections are not closed by the reaper thread. Thread
+ * affinity is off by default and must be set <i>before</i>
+ * ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param affinity true to turn on thread affinity, false to turn it off
+ */
+void ConnectionPool_setThreadAffinity(T P, int affinity);
+
+
+/**
+ * Returns true if thread affinity is turned on
+ * @param P A ConnectionPool object
+ * @return true if thread affinity is on, otherwise false
+ */
+int ConnectionPool_getThreadAffinity(T P);
+
+
+/**
+ * Set the number of threads used to establish the initial connections
+ * when the pool is started. The default is 1, which means that initial
+ * connections are established one after another by the thread calling
+ * ConnectionPool_start(). With more than one thread, the first 
+ * connection is still established by the calling thread and the
+ * remaining connections are established in parallel. It is a checked
+ * runtime error for <code>threads</code> to be less than one.
+ * @param P A ConnectionPool object
+ * @param threads The number of threads used to fill the pool (value > 0)
+ * @see ConnectionPool_start() 
+ * @see ConnectionPool_startAsync()
+ */
+void ConnectionPool_setFillThreads(T P, int threads);
+
+
+/**
+ * Returns the number of threads used to establish initial connections
+ * @param P A ConnectionPool object
+ * @return The number of threads used to fill the pool
+ */
+int ConnectionPool_getFillThreads(T P);
+
+
+/**
+ * Set the number of milliseconds ConnectionPool_execute(),
+ * ConnectionPool_executeQuery() and ConnectionPool_executeTransaction()
+ * wait for a Connection if all connections are in use. The default is
+ * 5000 milliseconds. It is a checked runtime error for <code>ms</code> to
+ * be less than zero.
+ * @param P A ConnectionPool object
+ * @param ms The maximum number of milliseconds to wait for a connection
+ */
+void ConnectionPool_setCheckoutTimeout(T P, int ms);
+
+
+/**
+ * Returns the checkout timeout in milliseconds
+ * @param P A ConnectionPool object
+ * @return The time the statement-level methods wait for a connection
+ */
+int ConnectionPool_getCheckoutTimeout(T P);
+
+
+/**
+ * Enable the result cache used by ConnectionPool_executeCachedQuery()
+ * and set the maximum number of bytes it may use. The cache is disabled
+ * by default. This method must be called before ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param bytes The size of the cache in bytes, 0 disables the cache
+ * @see ConnectionPool_executeCachedQuery()
+ */
+void ConnectionPool_setResultCacheSize(T P, long long bytes);
+
+
+/**
+ * Returns the number of bytes currently used by the result cache
+ * @param P A ConnectionPool object
+ * @return Bytes used by cached results, 0 if the cache is disabled
+ */
+long long ConnectionPool_getResultCacheSize(T P);
+
+
+/**
+ * Register tracing callbacks, e.g. to create OpenTelemetry spans. The
+ * <code>begin</code> callback is called before, and <code>end</code>
+ * after, each of Connection_execute(), Connection_executeQuery(),
+ * Connection_prepareStatement(), Connection_beginTransaction(),
+ * Connection_commit(), Connection_rollback(), Connection_ping(),
+ * PreparedStatement_execute(), PreparedStatement_executeQuery() and
+ * ResultSet_next() on connections from the pool. The operation is
+ * named after the method, e.g. "executeQuery" or "next", and the SQL
+ * statement given is the one sent to the server, after any format
+ * arguments are applied. The callbacks are called from the thread
+ * using the connection. The tracer is copied and must be set
+ * <i>before</i> ConnectionPool_start(). Without a tracer, the cost is
+ * one test per operation.
+ * @param P A ConnectionPool object
+ * @param tracer The callbacks to call or NULL to remove a tracer
+ */
+void ConnectionPool_setTracer(T P, const ConnectionPool_Tracer_T *tracer);
+
+
+/**
+ * Set the slow query threshold. Statements executed with
+ * Connection_execute(), Connection_executeQuery(),
+ * PreparedStatement_execute() or PreparedStatement_executeQuery() which
+ * take <code>ms</code> milliseconds or more are reported to the handler
+ * set with ConnectionPool_setSlowQueryHandler(). The SQL statement is
+ * only formatted for statements which are reported. The default value,
+ * 0, turns the slow query log off. The threshold must be set
+ * <i>before</i> ConnectionPool_start(). It is a checked runtime error
+ * for <code>ms</code> to be less than zero.
+ * @param P A ConnectionPool object
+ * @param ms The slow query threshold in milliseconds (value >= 0)
+ */
+void ConnectionPool_setSlowQueryThreshold(T P, int ms);
+
+
+/**
+ * Returns the slow query threshold
+ * @param P A ConnectionPool object
+ * @return The slow query threshold in milliseconds, 0 if off
+ */
+int ConnectionPool_getSlowQueryThreshold(T P);
+
+
+/**
+ * Set the function called with each slow query reported. The handler
+ * is called from the thread which executed the statement, and the
+ * query and its strings are only valid during the call. No slow
+ * queries are reported without a handler.
+ * @param P A ConnectionPool object
+ * @param handler The function to call with the slow query or NULL
+ * @param context Passed to the handler
+ */
+void ConnectionPool_setSlowQueryHandler(T P, void (*handler)(const ConnectionPool_SlowQuery_T *query, void *context), void *context);
+
+
+/**
+ * Sample the slow query log. Only one of every <code>sampling</code>
+ * slow queries is reported to the handler, starting with the first,
+ * so a busy server can capture outliers without reporting every slow
+ * query. The default is 1, every slow query is reported. If
+ * <code>normalize</code> is true, string and numeric literals in the
+ * reported SQL statement are replaced with '?'. It is a checked
+ * runtime error for <code>sampling</code> to be less than one.
+ * @param P A ConnectionPool object
+ * @param sampling Report one of this many slow queries (value > 0)
+ * @param normalize true to replace literals in reported statements
+ */
+void ConnectionPool_setSlowQuerySampling(T P, int sampling, int normalize);
+
+
 /**
  * Set the function to call if a fatal error occurs in the library. In 
  * practice this means Out-Of-Memory errors or uncatched exceptions.
@@ -388,6 +824,202 @@ void ConnectionPool_setAbortHandler(T P, void(*abortHandler)(const char *error))
 void ConnectionPool_setReaper(T P, int sweepInterval);
 
 
+/**
+ * Turn on autoscaling. A scaler thread is started with the pool and
+ * grows the pool in the background, up to max connections, so that no
+ * more than <code>utilization</code> percent of the Connections are
+ * active, counting waiting threads as active. Idle Connections are
+ * closed gradually when utilization stays below half the threshold.
+ * Autoscaling is off by default and must be set <i>before</i>
+ * ConnectionPool_start(). It is a checked runtime error for
+ * <code>utilization</code> to be less than 0 or greater than 100.
+ * @param P A ConnectionPool object
+ * @param utilization Percentage of active Connections which triggers
+ * growth of the pool, or 0 to turn off autoscaling
+ */
+void ConnectionPool_setAutoScaling(T P, int utilization);
+
+
+/**
+ * Returns the autoscaling threshold
+ * @param P A ConnectionPool object
+ * @return The utilization percentage which triggers growth of the
+ * pool, 0 if autoscaling is off
+ */
+int ConnectionPool_getAutoScaling(T P);
+
+
+/**
+ * Turn on the circuit breaker, see the circuit breaker section above.
+ * After <code>failures</code> consecutive failed connects, Connections
+ * are not established for <code>cooldown</code> milliseconds and
+ * requests for a new Connection fail at once. The circuit breaker is
+ * off by default. It is a checked runtime error for <code>failures</code>
+ * to be less than 0 or for <code>cooldown</code> to be less than 1.
+ * @param P A ConnectionPool object
+ * @param failures Number of consecutive failed connects which opens the
+ * breaker, or 0 to turn it off
+ * @param cooldown Milliseconds before a probe connect is let through
+ */
+void ConnectionPool_setCircuitBreaker(T P, int failures, int cooldown);
+
+
+/**
+ * Returns the number of consecutive failed connects which opens the
+ * circuit breaker
+ * @param P A ConnectionPool object
+ * @return The circuit breaker threshold, 0 if the breaker is off
+ */
+int ConnectionPool_getCircuitBreaker(T P);
+
+
+/**
+ * Set the maximum lifetime of Connections, see the section on optimizing
+ * the pool size above. Idle Connections established more than
+ * <code>seconds</code> ago, less a share of up to <code>jitter</code>
+ * seconds which differs between Connections, are replaced by the reaper
+ * thread or ConnectionPool_reapConnections(). A new Connection is
+ * established before the old one is closed, unless the pool is at
+ * ConnectionPool_setMaxConnections(). Active Connections are replaced
+ * when they are idle at a later sweep. Connections live until they time
+ * out or fail by default. It is a checked runtime error for
+ * <code>seconds</code> or <code>jitter</code> to be less than 0 or for
+ * <code>jitter</code> not to be less than <code>seconds</code>.
+ * @param P A ConnectionPool object
+ * @param seconds The maximum lifetime of a Connection, or 0 for no limit
+ * @param jitter Seconds by which lifetimes are randomly shortened
+ * @see ConnectionPool_setReaper()
+ */
+void ConnectionPool_setMaxLifetime(T P, int seconds, int jitter);
+
+
+/**
+ * Returns the maximum lifetime of Connections
+ * @param P A ConnectionPool object
+ * @return The maximum lifetime in seconds, 0 if there is no limit
+ */
+int ConnectionPool_getMaxLifetime(T P);
+
+
+/**
+ * Turn on background health checks. The reaper thread wakes up every
+ * <code>ms</code> milliseconds and pings the Connections which have been
+ * idle for more than half that time. A Connection is detached from the
+ * pool while it is pinged, and a Connection failing the ping is closed
+ * and replaced with a new Connection. Idle Connections are thereby used
+ * about once per interval, so the interval should be well below the idle
+ * timeout of firewalls between the application and the database. With
+ * health checks ConnectionPool_getConnection() no longer pings Connections,
+ * see ConnectionPool_setValidationInterval(), and a broken Connection is
+ * detected within one interval. Health checks start the reaper thread
+ * also if ConnectionPool_setReaper() was not called. Health checks are
+ * off by default and must be set <i>before</i> ConnectionPool_start(). It
+ * is a checked runtime error for <code>ms</code> to be less than 0.
+ * @param P A ConnectionPool object
+ * @param ms Milliseconds between health checks, or 0 to validate
+ * Connections on checkout
+ */
+void ConnectionPool_setHealthCheck(T P, int ms);
+
+
+/**
+ * Returns the health check interval
+ * @param P A ConnectionPool object
+ * @return The interval in milliseconds, 0 if health checks are off
+ * @see ConnectionPool_setHealthCheck()
+ */
+int ConnectionPool_getHealthCheck(T P);
+
+
+/**
+ * Limit the memory held by the result sets of the pool's Connections.
+ * The pool accounts for the rows a backend has read into memory, such
+ * as a MySQL or PostgreSQL result stored client side, and for the
+ * column and LOB buffers of a result set. The rows of a MySQL result
+ * read with a prepared statement, the binary protocol, are not
+ * accounted as the client library does not report their size, only
+ * their column buffers are. SQLite result sets are not accounted,
+ * SQLite limits its memory with the heap_limit property.
+ * A query whose result set takes the pool above the limit fails with
+ * an SQLException and its result set is freed, and so does
+ * ResultSet_next() if a column buffer grows above the limit. Memory
+ * is released when the ResultSet is closed. To read results larger
+ * than the limit, stream them with <code>result-mode=stream</code>
+ * (MySQL and PostgreSQL) so only the current rows are held. Each read
+ * replica has the same limit for its own result sets. The limit is off
+ * by default. It is a checked runtime error for <code>bytes</code> to
+ * be less than 0.
+ * @param P A ConnectionPool object
+ * @param bytes The maximum number of bytes held by result sets, or 0
+ * for no limit
+ * @see ConnectionPool_getResultMemory(), Connection_getResultMemory()
+ */
+void ConnectionPool_setResultMemoryLimit(T P, long long bytes);
+
+
+/**
+ * Returns the result memory limit
+ * @param P A ConnectionPool object
+ * @return The limit in bytes, 0 if there is no limit
+ * @see ConnectionPool_setResultMemoryLimit()
+ */
+long long ConnectionPool_getResultMemoryLimit(T P);
+
+
+/**
+ * Returns the memory held by the live result sets of the pool's
+ * Connections. The memory is accounted also if there is no limit.
+ * @param P A ConnectionPool object
+ * @return The number of bytes held by result sets
+ * @see ConnectionPool_setResultMemoryLimit()
+ */
+long long ConnectionPool_getResultMemory(T P);
+
+
+/**
+ * Add a read replica to the pool. Must be called <i>before</i>
+ * ConnectionPool_start(). The replica is served by a pool of its own
+ * which is started, stopped and freed together with this pool. The
+ * caller keeps ownership of the URL and must not free it before the
+ * pool is freed. See the read replicas section above.
+ * @param P A ConnectionPool object
+ * @param url The connection url of the replica
+ * @param weight Relative share of the read load this replica should
+ * get compared to the other replicas. Must be greater than 0
+ */
+void ConnectionPool_addReplica(T P, URL_T url, int weight);
+
+
+/**
+ * Returns the number of read replicas added to this pool
+ * @param P A ConnectionPool object
+ * @return The number of replicas
+ */
+int ConnectionPool_getReplicaCount(T P);
+
+
+/**
+ * Set the maximum number of Connections of each read replica. By default
+ * replicas have the same max connections as this pool. A replica starts
+ * with no more initial Connections than its max connections. Must be
+ * called <i>before</i> ConnectionPool_start(). It is a checked runtime
+ * error for <code>maxConnections</code> to be less than 0.
+ * @param P A ConnectionPool object
+ * @param maxConnections The maximum number of Connections of a replica,
+ * or 0 to use the max connections of this pool
+ * @see ConnectionPool_addReplica()
+ */
+void ConnectionPool_setReadConnections(T P, int maxConnections);
+
+
+/**
+ * Returns the maximum number of Connections of each read replica
+ * @param P A ConnectionPool object
+ * @return The max connections of a replica
+ */
+int ConnectionPool_getReadConnections(T P);
+
+
 /**
  * Returns the current number of connections in the pool. The number of 
  * both active and inactive connections are returned.
@@ -405,6 +1037,17 @@ int ConnectionPool_size(T P);
  */
 int ConnectionPool_active(T P);
 
+
+/**
+ * Returns a snapshot of the pool counters. This method does not lock the
+ * pool and is cheap enough to be polled frequently by a metrics exporter.
+ * The counters are read one by one and may not be mutually consistent 
+ * if the pool is changed while the snapshot is taken.
+ * @param P A ConnectionPool object
+ * @return A snapshot of the pool counters
+ */
+ConnectionPool_Snapshot_T ConnectionPool_snapshot(T P);
+
 //@}
 
 /**
@@ -419,6 +1062,19 @@ int ConnectionPool_active(T P);
 void ConnectionPool_start(T P);
 
 
+/**
+ * Start the pool without waiting for the initial connections. This
+ * method is the same as ConnectionPool_start(), except that it returns as
+ * soon as the first connection is established. The remaining initial
+ * connections are established in the background by the number of threads
+ * set with ConnectionPool_setFillThreads(). 
+ * @param P A ConnectionPool object
+ * @exception SQLException If the first connection could not be established
+ * @see SQLException.h
+ */
+void ConnectionPool_startAsync(T P);
+
+
 /**
  * Gracefully terminate the active use of the public methods of this
  * component. This method should be the last one called on a given instance
@@ -431,14 +1087,54 @@ void ConnectionPool_stop(T P);
 
 
 /**
- * Get a connection from the pool
+ * Get a connection from the pool. The most recently returned idle
+ * connection is handed out first. An idle connection which fails the
+ * ping test is removed from the pool and closed. If no connection is
+ * idle, a new connection is established without holding the pool lock.
  * @param P A ConnectionPool object
- * @return A connection from the pool or NULL if maxConnection is reached
+ * @return A connection from the pool or NULL if maxConnection is reached,
+ * if the limit of connections being established concurrently is reached
+ * or if a new connection could not be created
  * @see Connection.h
  */
 Connection_T ConnectionPool_getConnection(T P);
 
 
+/**
+ * Get a connection from the pool and wait up to <code>ms</code>
+ * milliseconds for a connection to become available if the pool has
+ * already handed out <i>maxConnections</i> Connections. Threads waiting 
+ * for a connection are served in FIFO order and a Connection returned to
+ * the pool is handed directly to the thread that has waited longest. 
+ * Waiting threads sleep and do not consume CPU. It is a checked runtime
+ * error for <code>ms</code> to be less than zero.
+ * @param P A ConnectionPool object
+ * @param ms The maximum number of milliseconds to wait for a connection
+ * @return A connection from the pool or NULL if no connection became 
+ * available within <code>ms</code> milliseconds, if a new connection could
+ * not be created or if the pool was stopped
+ * @see ConnectionPool_getConnection()
+ */
+Connection_T ConnectionPool_getConnectionWithTimeout(T P, int ms);
+
+
+/**
+ * Get a connection for reading from one of the read replicas added with
+ * ConnectionPool_addReplica(). The replica with the fewest active
+ * connections relative to its weight is used. A replica which cannot be
+ * connected to is skipped for a while and the next replica tried. If no
+ * replica is available, or the selected replica has reached its
+ * maxConnections, a connection to the primary database is returned as
+ * by ConnectionPool_getConnection(). Return the connection with
+ * Connection_close() as usual.
+ * @param P A ConnectionPool object
+ * @return A connection to a replica or the primary database, or NULL
+ * if no connection could be obtained
+ * @see ConnectionPool_getConnection()
+ */
+Connection_T ConnectionPool_getReadConnection(T P);
+
+
 /**
  * Returns a connection to the pool. The same as calling Connection_close()
  * @param P A ConnectionPool object
@@ -453,13 +1149,103 @@ void ConnectionPool_returnConnection(T P, Connection_T connection);
  * Inactive Connection are closed if and only if its 
  * <code>connectionTimeout</code> has expired <i>or</i> if the Connection 
  * failed the ping test against the database. Active Connections are 
- * <i>not</i> closed by this method. 
+ * <i>not</i> closed by this method. Idle Connections are detached from
+ * the pool in small batches and tested and closed without holding the 
+ * pool lock, so other threads can get connections while the pool is
+ * reaped. Idle Connections which reached their maximum lifetime are
+ * replaced, see ConnectionPool_setMaxLifetime().
  * @param P A ConnectionPool object
  * @return The number of Connections that was closed
  */
 int ConnectionPool_reapConnections(T P);
 
 
+/**
+ * Execute a SQL statement on a Connection borrowed from the pool for
+ * the duration of the statement. The statement is executed with
+ * Connection_execute() in autocommit mode.
+ * @param P A ConnectionPool object
+ * @param sql A SQL statement
+ * @return The number of rows changed by the statement
+ * @exception SQLException If a database error occurs or if no connection
+ * became available within the checkout timeout
+ * @see ConnectionPool_setCheckoutTimeout()
+ */
+long long ConnectionPool_execute(T P, const char *sql, ...) __attribute__((format (printf, 2, 3)));
+
+
+/**
+ * Execute a SQL query on a Connection borrowed from the pool and call
+ * <code>callback</code> with the ResultSet. The Connection is returned
+ * to the pool when the callback returns, so the ResultSet must not be
+ * used after that.
+ * @param P A ConnectionPool object
+ * @param callback Called with the ResultSet of the query
+ * @param ctx A pointer passed to the callback
+ * @param sql A SQL select statement
+ * @exception SQLException If a database error occurs or if no connection
+ * became available within the checkout timeout. An exception thrown by
+ * the callback is propagated after the Connection is returned
+ * @see ConnectionPool_setCheckoutTimeout()
+ */
+void ConnectionPool_executeQuery(T P, void (*callback)(ResultSet_T r, void *ctx), void *ctx, const char *sql, ...) __attribute__((format (printf, 4, 5)));
+
+
+/**
+ * Run <code>callback</code> in a transaction on a Connection borrowed
+ * from the pool. The transaction is committed when the callback returns
+ * and rolled back if it throws an exception, which is then propagated.
+ * The Connection is returned to the pool in both cases and must not be
+ * used by the callback after it returns. The transaction is not retried,
+ * use Connection_runTransaction() to retry on deadlocks.
+ * @param P A ConnectionPool object
+ * @param callback Called with the Connection inside the transaction
+ * @param ctx A pointer passed to the callback
+ * @exception SQLException If a database error occurs or if no connection
+ * became available within the checkout timeout
+ * @see ConnectionPool_setCheckoutTimeout()
+ */
+void ConnectionPool_executeTransaction(T P, void (*callback)(Connection_T con, void *ctx), void *ctx);
+
+
+/**
+ * Execute a SQL query through the result cache. If the statement, with
+ * its arguments formatted in, has a cached result which has not expired,
+ * <code>callback</code> is called with the cached result and no
+ * Connection is used. Otherwise the query is executed on a Connection
+ * borrowed from the pool, the result is read into memory and cached for
+ * <code>ttl</code> milliseconds, and the Connection returned to the pool
+ * before <code>callback</code> is called. The ResultSet is only valid in
+ * the callback. Values in the ResultSet are the text, or bytes, returned
+ * by ResultSet_getBytes() and numbers and dates are parsed from it. If
+ * the result cache is not enabled or <code>ttl</code> is 0, the query is
+ * executed each time but otherwise works the same.
+ * @param P A ConnectionPool object
+ * @param ttl Milliseconds a result is cached
+ * @param callback Called with the ResultSet of the query
+ * @param ctx A pointer passed to the callback
+ * @param sql A SQL select statement
+ * @exception SQLException If a database error occurs or if no connection
+ * became available within the checkout timeout. An exception thrown by
+ * the callback is propagated
+ * @see ConnectionPool_setResultCacheSize()
+ */
+void ConnectionPool_executeCachedQuery(T P, int ttl, void (*callback)(ResultSet_T r, void *ctx), void *ctx, const char *sql, ...) __attribute__((format (printf, 5, 6)));
+
+
+/**
+ * Remove cached results of statements which start with
+ * <code>prefix</code>, e.g. "select value from config" removes the
+ * results of all such queries regardless of their where clause. Whitespace
+ * in the prefix is collapsed as in the cache keys.
+ * @param P A ConnectionPool object
+ * @param prefix The start of the SQL statements to invalidate. NULL
+ * removes all cached results
+ * @return The number of cached results removed
+ */
+int ConnectionPool_invalidateCache(T P, const char *prefix);
+
+
 /** @name Class methods */
 //@{
 
@@ -469,6 +1255,23 @@ int ConnectionPool_reapConnections(T P);
  */
 const char *ConnectionPool_version(void);
 
+
+/**
+ * <b>Class method</b>, replace the functions libzdb use to allocate
+ * and free its own memory, for instance to use jemalloc or tcmalloc
+ * arenas instead of the system malloc. Memory allocated internally
+ * by the database client libraries is not affected. This method must
+ * be called before any other libzdb method, including
+ * ConnectionPool_new() and URL_new(), since memory is released with
+ * the free function in use at the time. The functions must be thread
+ * safe and have the same semantics as their standard C counterparts.
+ * @param mallocFunc Replaces malloc(3)
+ * @param callocFunc Replaces calloc(3)
+ * @param reallocFunc Replaces realloc(3)
+ * @param freeFunc Replaces free(3)
+ */
+void ConnectionPool_setAllocator(void *(*mallocFunc)(size_t size), void *(*callocFunc)(size_t count, size_t size), void *(*reallocFunc)(void *p, size_t size), void (*freeFunc)(void *p));
+
 // @}
 
 #undef T
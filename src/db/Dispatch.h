@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef DISPATCH_INCLUDED
+#define DISPATCH_INCLUDED
+
+
+/**
+ * Delegate dispatch for Connection, PreparedStatement and ResultSet.
+ * Public methods call their delegate through the op tables with:
+ * <pre>
+ * COP(C)->commit(C->D);
+ * POP(P)->execute(P->D);
+ * ROP_CALL(R, next, R->D);
+ * </pre>
+ * By default these go through the object's op pointer. When libzdb is
+ * configured with --enable-single-backend, ZDB_BACKEND_&lt;NAME&gt; is
+ * defined and the macros name that backend's op tables directly, so the
+ * compiler, or the linker with LTO, can inline the backend methods.
+ * Result sets are also created by the snapshot and result cache, and by
+ * the MySQL text protocol, so ROP_CALL tests the op table before calling
+ * the backend directly. Requires the delegate headers.
+ *
+ * @file
+ */
+
+
+#if defined ZDB_BACKEND_MYSQL
+#define ZDB_COPS mysqlcops
+#define ZDB_POPS mysqlpops
+#define ZDB_ROPS mysqlrops
+#elif defined ZDB_BACKEND_POSTGRESQL
+#define ZDB_COPS postgresqlcops
+#define ZDB_POPS postgresqlpops
+#define ZDB_ROPS postgresqlrops
+#elif defined ZDB_BACKEND_SQLITE
+#define ZDB_COPS sqlite3cops
+#define ZDB_POPS sqlite3pops
+#define ZDB_ROPS sqlite3rops
+#elif defined ZDB_BACKEND_ORACLE
+#define ZDB_COPS oraclesqlcops
+#define ZDB_POPS oraclepops
+#define ZDB_ROPS oraclerops
+#endif
+
+
+#ifdef ZDB_COPS
+
+extern const struct Cop_T ZDB_COPS;
+extern const struct Pop_T ZDB_POPS;
+extern const struct Rop_T ZDB_ROPS;
+
+#define COP(C) (&ZDB_COPS)
+#define POP(P) (&ZDB_POPS)
+#define ROP_CALL(R, method, ...) \
+        ((R)->op == &ZDB_ROPS ? ZDB_ROPS.method(__VA_ARGS__) : (R)->op->method(__VA_ARGS__))
+
+#else
+
+#define COP(C) ((C)->op)
+#define POP(P) ((P)->op)
+#define ROP_CALL(R, method, ...) ((R)->op->method(__VA_ARGS__))
+
+#endif
+
+
+#endif
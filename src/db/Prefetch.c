@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Thread.h"
+#include "ResultSet.h"
+#include "ResultSetDelegate.h"
+#include "Snapshot.h"
+#include "Prefetch.h"
+
+
+/**
+ * Implementation of the prefetching ResultSet delegate. The worker thread
+ * and the caller hand blocks over in the next field under the mutex. The
+ * worker fills next when it is empty and the caller takes it when its
+ * current block is read, so at most two blocks are held at a time. A
+ * block is a Snapshot and is read through a ResultSet of the Snapshot.
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+struct ResultSetDelegate_T {
+        int rows;               // Rows per block
+        int columnCount;
+        char **columnNames;
+        Rop_T op;
+        ResultSetDelegate_T D;  // The wrapped delegate, read by the worker thread through source
+        ResultSet_T source;
+        ResultSet_T current;    // The block read by the caller
+        long long currentSize;
+        Snapshot_T next;        // The block read ahead, NULL if not fetched yet
+        int done;               // The worker read the last row or failed
+        int stop;               // Set when the delegate is freed
+        char *error;            // Why the worker failed
+        long long sourceMemory; // Bytes held by the wrapped delegate when last read
+        long long memory;       // Bytes held by the blocks and by the wrapped delegate
+        Mutex_T mutex;
+        Sem_T cond;
+        Thread_T worker;
+};
+
+static void _free(ResultSetDelegate_T *R);
+static int _getColumnCount(ResultSetDelegate_T R);
+static const char *_getColumnName(ResultSetDelegate_T R, int columnIndex);
+static long _getColumnSize(ResultSetDelegate_T R, int columnIndex);
+static int _next(ResultSetDelegate_T R);
+static int _isnull(ResultSetDelegate_T R, int columnIndex);
+static const char *_getString(ResultSetDelegate_T R, int columnIndex);
+static const void *_getBlob(ResultSetDelegate_T R, int columnIndex, int *size);
+static long long _getMemory(ResultSetDelegate_T R);
+
+const struct Rop_T prefetchrops = {
+        .name           = "prefetch",
+        .free           = _free,
+        .getColumnCount = _getColumnCount,
+        .getColumnName  = _getColumnName,
+        .getColumnSize  = _getColumnSize,
+        .next           = _next,
+        .isnull         = _isnull,
+        .getString      = _getString,
+        .getBlob        = _getBlob,
+        .getBytes       = _getBlob,
+        .getMemory      = _getMemory
+};
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+/* Account for a new block and for the change in memory held by the wrapped delegate */
+static void _addMemory(ResultSetDelegate_T R, long long blockSize) {
+        long long sourceMemory = R->op->getMemory ? R->op->getMemory(R->D) : 0;
+        Atomic_add(R->memory, blockSize + sourceMemory - R->sourceMemory);
+        R->sourceMemory = sourceMemory;
+}
+
+
+static void *_fetch(void *arg) {
+        ResultSetDelegate_T R = arg;
+        for (int done = false; ! done;) {
+                int stop;
+                LOCK(R->mutex)
+                {
+                        while (R->next && ! R->stop)
+                                Sem_wait(R->cond, R->mutex);
+                        stop = R->stop;
+                }
+                END_LOCK;
+                if (stop)
+                        break;
+                Snapshot_T volatile S = NULL;
+                char * volatile error = NULL;
+                TRY
+                {
+                        S = Snapshot_newRows(R->source, R->rows);
+                }
+                ELSE
+                {
+                        error = Str_dup(Exception_frame.message);
+                }
+                END_TRY;
+                done = ! S || Snapshot_getRowCount(S) < R->rows;
+                _addMemory(R, S ? Snapshot_getSize(S) : 0);
+                LOCK(R->mutex)
+                {
+                        R->next = S;
+                        R->error = error;
+                        R->done = done;
+                        Sem_signal(R->cond);
+                }
+                END_LOCK;
+        }
+        return NULL;
+}
+
+
+static inline ResultSet_T _block(ResultSetDelegate_T R) {
+        if (! R->current)
+                THROW(SQLException, "No current row");
+        return R->current;
+}
+
+
+/* ------------------------------------------------------ ResultSet delegate */
+
+
+static void _free(ResultSetDelegate_T *R) {
+        LOCK((*R)->mutex)
+        {
+                (*R)->stop = true;
+                Sem_signal((*R)->cond);
+        }
+        END_LOCK;
+        // Waits for a block being read
+        Thread_join((*R)->worker);
+        if ((*R)->next)
+                Snapshot_free(&(*R)->next);
+        if ((*R)->current)
+                ResultSet_free(&(*R)->current);
+        ResultSet_free(&(*R)->source);
+        for (int i = 0; i < (*R)->columnCount; i++)
+                FREE((*R)->columnNames[i]);
+        FREE((*R)->columnNames);
+        FREE((*R)->error);
+        Sem_destroy((*R)->cond);
+        Mutex_destroy((*R)->mutex);
+        FREE(*R);
+}
+
+
+static int _getColumnCount(ResultSetDelegate_T R) {
+        return R->columnCount;
+}
+
+
+static const char *_getColumnName(ResultSetDelegate_T R, int columnIndex) {
+        if (columnIndex < 1 || columnIndex > R->columnCount)
+                return NULL;
+        return R->columnNames[columnIndex - 1];
+}
+
+
+static long _getColumnSize(ResultSetDelegate_T R, int columnIndex) {
+        return ResultSet_getColumnSize(_block(R), columnIndex);
+}
+
+
+static int _next(ResultSetDelegate_T R) {
+        if (R->current) {
+                if (ResultSet_next(R->current))
+                        return true;
+                ResultSet_free(&R->current);
+                Atomic_add(R->memory, -R->currentSize);
+        }
+        Snapshot_T S;
+        LOCK(R->mutex)
+        {
+                while (! R->next && ! R->done)
+                        Sem_wait(R->cond, R->mutex);
+                S = R->next;
+                R->next = NULL;
+                Sem_signal(R->cond);
+        }
+        END_LOCK;
+        if (! S) {
+                if (R->error)
+                        THROW(SQLException, "%s", R->error);
+                return false;
+        }
+        R->currentSize = Snapshot_getSize(S);
+        R->current = Snapshot_toResultSet(S);
+        Snapshot_free(&S);
+        return ResultSet_next(R->current);
+}
+
+
+static int _isnull(ResultSetDelegate_T R, int columnIndex) {
+        return ResultSet_isnull(_block(R), columnIndex);
+}
+
+
+static const char *_getString(ResultSetDelegate_T R, int columnIndex) {
+        return ResultSet_getString(_block(R), columnIndex);
+}
+
+
+static const void *_getBlob(ResultSetDelegate_T R, int columnIndex, int *size) {
+        return ResultSet_getBytes(_block(R), columnIndex, size);
+}
+
+
+static long long _getMemory(ResultSetDelegate_T R) {
+        return Atomic_get(R->memory);
+}
+
+
+/* ------------------------------------------------------------ Public API */
+
+
+ResultSetDelegate_T Prefetch_new(ResultSetDelegate_T D, Rop_T op, int rows) {
+        assert(D);
+        assert(op);
+        assert(rows > 0);
+        ResultSetDelegate_T R;
+        NEW(R);
+        R->rows = rows;
+        R->op = op;
+        R->D = D;
+        R->source = ResultSet_new(D, op);
+        R->columnCount = ResultSet_getColumnCount(R->source);
+        if (R->columnCount > 0) {
+                R->columnNames = CALLOC(R->columnCount, sizeof *R->columnNames);
+                for (int i = 0; i < R->columnCount; i++)
+                        R->columnNames[i] = Str_dup(ResultSet_getColumnName(R->source, i + 1));
+        }
+        _addMemory(R, 0);
+        Mutex_init(R->mutex);
+        Sem_init(R->cond);
+        Thread_create(R->worker, _fetch, R);
+        return R;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef PREFETCH_INCLUDED
+#define PREFETCH_INCLUDED
+
+
+/**
+ * A ResultSet delegate which reads the rows of another delegate ahead of
+ * the caller. A worker thread copies the next block of rows into a
+ * Snapshot while the caller reads the current block, so waiting for the
+ * database overlaps with processing the rows. See ResultSet_setPrefetch().
+ *
+ * @file
+ */
+
+
+extern const struct Rop_T prefetchrops;
+
+
+/**
+ * Create a delegate reading the rows of D in blocks and start its worker
+ * thread. Once started, only the worker thread uses D.
+ * @param D The delegate to read, freed with the new delegate
+ * @param op Delegate operations of D
+ * @param rows The number of rows in a block
+ * @return A delegate with the operations prefetchrops
+ */
+ResultSetDelegate_T Prefetch_new(ResultSetDelegate_T D, Rop_T op, int rows);
+
+
+#endif
@@ -26,9 +26,17 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <string.h>
 
+#include "URL.h"
+#include "Vector.h"
 #include "ResultSet.h"
 #include "PreparedStatement.h"
+#include "Connection.h"
+#include "ConnectionPool.h"
+#include "Statistics.h"
+#include "Trace.h"
+#include "Dispatch.h"
 
 
 /**
@@ -41,11 +49,46 @@
 /* ----------------------------------------------------------- Definitions */
 
 
+typedef enum {
+        Param_None = 0,
+        Param_String,
+        Param_Int,
+        Param_LLong,
+        Param_Double,
+        Param_Timestamp,
+        Param_Blob,
+        Param_Stream
+} Param_Type;
+
+typedef struct param_t {
+        Param_Type type;
+        int size;
+        union {
+                const char *string;
+                int integer;
+                long long llong;
+                double real;
+                time_t timestamp;
+                const void *blob;
+        } value;
+} *param_t;
+
+typedef struct stream_t {
+        char *buffer;
+        int capacity;
+} *stream_t;
+
 #define T PreparedStatement_T
 struct PreparedStatement_S {
         Pop_T op;
         int parameterCount;
+        param_t params;
+        stream_t streams;       // Blob streams read into memory for backends without setBlobStream
+        Vector_T batch;
         ResultSet_T resultSet;
+        char *sql;
+        Trace_T trace;
+        Connection_T connection;
         PreparedStatementDelegate_T D;
 };
 
@@ -59,6 +102,123 @@ static void _clearResultSet(T P) {
 }
 
 
+static void _clearBatch(T P) {
+        if (P->batch) {
+                while (! Vector_isEmpty(P->batch)) {
+                        param_t row = Vector_pop(P->batch);
+                        for (int i = 0; i < P->parameterCount; i++)
+                                if (row[i].type == Param_String || row[i].type == Param_Blob) {
+                                        void *copy = (void *)row[i].value.blob;
+                                        FREE(copy);
+                                }
+                        FREE(row);
+                }
+        }
+}
+
+
+/* Read a blob stream into the parameter's buffer for backends which cannot send a value in pieces */
+static const void *_readStream(T P, int i, int (*read)(void *buffer, int size, void *context), void *context, int *size) {
+        if (! P->streams)
+                P->streams = CALLOC(P->parameterCount, sizeof(struct stream_t));
+        stream_t s = &P->streams[i];
+        int length = 0;
+        for (int n; ; length += n) {
+                if (s->capacity - length < SQL_DEFAULT_LOB_CHUNK_SIZE) {
+                        s->capacity = s->capacity ? s->capacity * 2 : SQL_DEFAULT_LOB_CHUNK_SIZE;
+                        if (s->buffer)
+                                RESIZE(s->buffer, s->capacity);
+                        else
+                                s->buffer = ALLOC(s->capacity);
+                }
+                if ((n = read(s->buffer + length, SQL_DEFAULT_LOB_CHUNK_SIZE, context)) < 0)
+                        THROW(SQLException, "Failed to read blob stream for parameter %d", i + 1);
+                if (n == 0)
+                        break;
+        }
+        *size = length;
+        return s->buffer;
+}
+
+
+/* Call the tracer and the slow query log around the delegate's execute */
+static void _traceExecute(T P) {
+        span_t span;
+        Trace_begin(&span, P->trace, "execute", P->sql);
+        TRY
+        {
+                POP(P)->execute(P->D);
+        }
+        ELSE
+        {
+                Trace_end(&span, -1, Exception_frame.message);
+                if (Trace_isSlow(&span))
+                        Trace_logSlowQuery(&span, POP(P)->name, P->sql, -1);
+                RETHROW;
+        }
+        END_TRY;
+        long long rows = POP(P)->rowsChanged(P->D);
+        Trace_end(&span, rows, NULL);
+        if (Trace_isSlow(&span))
+                Trace_logSlowQuery(&span, POP(P)->name, P->sql, rows);
+}
+
+
+static void _traceExecuteQuery(T P) {
+        span_t span;
+        Trace_begin(&span, P->trace, "executeQuery", P->sql);
+        TRY
+        {
+                P->resultSet = POP(P)->executeQuery(P->D);
+        }
+        ELSE
+        {
+                Trace_end(&span, -1, Exception_frame.message);
+                if (Trace_isSlow(&span))
+                        Trace_logSlowQuery(&span, POP(P)->name, P->sql, -1);
+                RETHROW;
+        }
+        END_TRY;
+        Trace_end(&span, -1, P->resultSet ? NULL : "PreparedStatement_executeQuery");
+        if (Trace_isSlow(&span))
+                Trace_logSlowQuery(&span, POP(P)->name, P->sql, -1);
+        if (P->resultSet)
+                ResultSet_setTrace(P->resultSet, P->trace);
+}
+
+
+/* Set the parameters of the delegate to those of the given batch row */
+static void _bindRow(void *batch, int row) {
+        T P = batch;
+        param_t params = Vector_get(P->batch, row);
+        for (int i = 0; i < P->parameterCount; i++) {
+                param_t p = &params[i];
+                switch (p->type) {
+                        case Param_String:
+                                POP(P)->setString(P->D, i + 1, p->value.string);
+                                break;
+                        case Param_Int:
+                                POP(P)->setInt(P->D, i + 1, p->value.integer);
+                                break;
+                        case Param_LLong:
+                                POP(P)->setLLong(P->D, i + 1, p->value.llong);
+                                break;
+                        case Param_Double:
+                                POP(P)->setDouble(P->D, i + 1, p->value.real);
+                                break;
+                        case Param_Timestamp:
+                                POP(P)->setTimestamp(P->D, i + 1, p->value.timestamp);
+                                break;
+                        case Param_Blob:
+                                POP(P)->setBlob(P->D, i + 1, p->value.blob, p->size);
+                                break;
+                        default:
+                                break;
+                }
+        }
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -74,6 +234,8 @@ T PreparedStatement_new(PreparedStatementDelegate_T D, Pop_T op, int parameterCo
 	P->D = D;
 	P->op = op;
         P->parameterCount = parameterCount;
+        if (P->parameterCount > 0)
+                P->params = CALLOC(P->parameterCount, sizeof(struct param_t));
 	return P;
 }
 
@@ -81,10 +243,41 @@ T PreparedStatement_new(PreparedStatementDelegate_T D, Pop_T op, int parameterCo
 void PreparedStatement_free(T *P) {
 	assert(P && *P);
         _clearResultSet((*P));
-        (*P)->op->free(&(*P)->D);
+        _clearBatch((*P));
+        if ((*P)->batch)
+                Vector_free(&(*P)->batch);
+        if ((*P)->streams) {
+                for (int i = 0; i < (*P)->parameterCount; i++)
+                        FREE((*P)->streams[i].buffer);
+                FREE((*P)->streams);
+        }
+        FREE((*P)->params);
+        FREE((*P)->sql);
+        POP(*P)->free(&(*P)->D);
 	FREE(*P);
 }
 
+
+void PreparedStatement_clear(T P) {
+        assert(P);
+        _clearResultSet(P);
+        _clearBatch(P);
+}
+
+
+void PreparedStatement_setTrace(T P, Trace_T trace, const char *sql) {
+        assert(P);
+        P->trace = trace;
+        FREE(P->sql);
+        P->sql = Str_dup(sql);
+}
+
+
+void PreparedStatement_setConnection(T P, Connection_T connection) {
+        assert(P);
+        P->connection = connection;
+}
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -95,37 +288,59 @@ void PreparedStatement_free(T *P) {
 
 void PreparedStatement_setString(T P, int parameterIndex, const char *x) {
 	assert(P);
-        P->op->setString(P->D, parameterIndex, x);
+        POP(P)->setString(P->D, parameterIndex, x);
+        P->params[parameterIndex - 1] = (struct param_t){.type = Param_String, .value.string = x};
 }
 
 
 void PreparedStatement_setInt(T P, int parameterIndex, int x) {
 	assert(P);
-        P->op->setInt(P->D, parameterIndex, x);
+        POP(P)->setInt(P->D, parameterIndex, x);
+        P->params[parameterIndex - 1] = (struct param_t){.type = Param_Int, .value.integer = x};
 }
 
 
 void PreparedStatement_setLLong(T P, int parameterIndex, long long x) {
 	assert(P);
-        P->op->setLLong(P->D, parameterIndex, x);
+        POP(P)->setLLong(P->D, parameterIndex, x);
+        P->params[parameterIndex - 1] = (struct param_t){.type = Param_LLong, .value.llong = x};
 }
 
 
 void PreparedStatement_setDouble(T P, int parameterIndex, double x) {
 	assert(P);
-        P->op->setDouble(P->D, parameterIndex, x);
+        POP(P)->setDouble(P->D, parameterIndex, x);
+        P->params[parameterIndex - 1] = (struct param_t){.type = Param_Double, .value.real = x};
 }
 
 
 void PreparedStatement_setBlob(T P, int parameterIndex, const void *x, int size) {
 	assert(P);
-        P->op->setBlob(P->D, parameterIndex, x, size);
+        POP(P)->setBlob(P->D, parameterIndex, x, size);
+        P->params[parameterIndex - 1] = (struct param_t){.type = Param_Blob, .size = size, .value.blob = x};
+}
+
+
+void PreparedStatement_setBlobStream(T P, int parameterIndex, int (*read)(void *buffer, int size, void *context), void *context) {
+        assert(P);
+        assert(read);
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        if (POP(P)->setBlobStream) {
+                POP(P)->setBlobStream(P->D, parameterIndex, read, context);
+                P->params[i] = (struct param_t){.type = Param_Stream};
+        } else {
+                int size;
+                const void *x = _readStream(P, i, read, context, &size);
+                POP(P)->setBlob(P->D, parameterIndex, x, size);
+                P->params[i] = (struct param_t){.type = Param_Blob, .size = size, .value.blob = x};
+        }
 }
 
 
 void PreparedStatement_setTimestamp(T P, int parameterIndex, time_t x) {
         assert(P);
-        P->op->setTimestamp(P->D, parameterIndex, x);
+        POP(P)->setTimestamp(P->D, parameterIndex, x);
+        P->params[parameterIndex - 1] = (struct param_t){.type = Param_Timestamp, .value.timestamp = x};
 }
 
 
@@ -135,23 +350,83 @@ void PreparedStatement_setTimestamp(T P, int parameterIndex, time_t x) {
 void PreparedStatement_execute(T P) {
 	assert(P);
         _clearResultSet(P);
-        P->op->execute(P->D);
+        long long start = Statistics_start();
+        if (Trace_isEnabled(P->trace))
+                _traceExecute(P);
+        else
+                POP(P)->execute(P->D);
+        Statistics_record(POP(P)->name, Statistics_PreparedExecute, start);
 }
 
 
 ResultSet_T PreparedStatement_executeQuery(T P) {
 	assert(P);
         _clearResultSet(P);
-	P->resultSet = P->op->executeQuery(P->D);
+        long long start = Statistics_start();
+        if (Trace_isEnabled(P->trace))
+                _traceExecuteQuery(P);
+        else
+                P->resultSet = POP(P)->executeQuery(P->D);
         if (! P->resultSet)
                 THROW(SQLException, "PreparedStatement_executeQuery");
+        Statistics_record(POP(P)->name, Statistics_PreparedExecute, start);
+        if (P->connection)
+                ResultSet_charge(&P->resultSet, P->connection);
         return P->resultSet;
 }
 
 
+void PreparedStatement_addBatch(T P) {
+        assert(P);
+        if (! P->batch)
+                P->batch = Vector_new(64);
+        for (int i = 0; i < P->parameterCount; i++)
+                if (P->params[i].type == Param_Stream)
+                        THROW(SQLException, "Parameter %d is a blob stream and cannot be added to a batch", i + 1);
+        param_t row = CALLOC(P->parameterCount + 1, sizeof(struct param_t));
+        for (int i = 0; i < P->parameterCount; i++) {
+                row[i] = P->params[i];
+                if (row[i].type == Param_String) {
+                        row[i].value.string = Str_dup(P->params[i].value.string);
+                } else if (row[i].type == Param_Blob && P->params[i].value.blob) {
+                        void *blob = ALLOC(row[i].size + 1);
+                        memcpy(blob, P->params[i].value.blob, row[i].size);
+                        row[i].value.blob = blob;
+                }
+        }
+        Vector_push(P->batch, row);
+}
+
+
+long long PreparedStatement_executeBatch(T P) {
+        assert(P);
+        long long changes = 0;
+        _clearResultSet(P);
+        if (! P->batch || Vector_isEmpty(P->batch))
+                return 0;
+        TRY
+                int rows = Vector_size(P->batch);
+                if (POP(P)->executeBatch) {
+                        changes = POP(P)->executeBatch(P->D, rows, _bindRow, P);
+                } else {
+                        for (int i = 0; i < rows; i++) {
+                                _bindRow(P, i);
+                                POP(P)->execute(P->D);
+                                changes += POP(P)->rowsChanged(P->D);
+                        }
+                }
+        ELSE
+                _clearBatch(P);
+                RETHROW;
+        END_TRY;
+        _clearBatch(P);
+        return changes;
+}
+
+
 long long PreparedStatement_rowsChanged(T P) {
         assert(P);
-        return P->op->rowsChanged(P->D);
+        return POP(P)->rowsChanged(P->D);
 }
 
 
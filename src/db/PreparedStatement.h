@@ -94,6 +94,24 @@
  * the Prepared Statement is executed again or until the Connection is
  * returned to the Connection Pool. 
  *
+ * <h3>Batch:</h3>
+ * To execute the same statement with many sets of parameters, add each set
+ * to a batch with PreparedStatement_addBatch() and execute them together with 
+ * PreparedStatement_executeBatch(). Parameter values are copied when added 
+ * to the batch so they need not "live" until the batch is executed. Backends 
+ * execute a batch as efficient as they can, for instance PostgreSQL send all 
+ * rows in one pipeline and SQLite execute the batch in one transaction.
+ * <pre>
+ * PreparedStatement_T p = Connection_prepareStatement(con, "INSERT INTO employee(name, picture) VALUES(?, ?)");
+ * for (int i = 0; employees[i].name; i++) 
+ * {
+ *        PreparedStatement_setString(p, 1, employees[i].name);
+ *        PreparedStatement_setBlob(p, 2, employees[i].picture, employees[i].picture_size);
+ *        PreparedStatement_addBatch(p);
+ * }
+ * PreparedStatement_executeBatch(p);
+ * </pre>
+ *
  * <h3>Date and Time</h3>
  * PreparedStatement provides PreparedStatement_setTimestamp() for setting a
  * Unix timestamp value. To set SQL Date, Time or DateTime values, simply use
@@ -131,6 +149,38 @@ T PreparedStatement_new(PreparedStatementDelegate_T D, Pop_T op, int parameterCo
  */
 void PreparedStatement_free(T *P);
 
+
+/**
+ * Close any ResultSet produced by this PreparedStatement so the statement
+ * can be reused
+ * @param P A PreparedStatement object
+ */
+void PreparedStatement_clear(T P);
+
+
+struct Trace_S;
+
+/**
+ * Trace execution of this PreparedStatement and its ResultSets and
+ * report it if slow
+ * @param P A PreparedStatement object
+ * @param trace The trace settings of the Connection's pool
+ * @param sql The SQL statement, which is copied
+ */
+void PreparedStatement_setTrace(T P, struct Trace_S *trace, const char *sql);
+
+
+struct Connection_S;
+
+/**
+ * Set the Connection which prepared this PreparedStatement. The memory
+ * held by its result sets is charged to the Connection
+ * @param P A PreparedStatement object
+ * @param connection The Connection of the PreparedStatement
+ * @see ResultSet_charge()
+ */
+void PreparedStatement_setConnection(T P, struct Connection_S *connection);
+
 //>> End Protected methods
 
 /** @name Parameters */
@@ -215,6 +265,39 @@ void PreparedStatement_setDouble(T P, int parameterIndex, double x);
 void PreparedStatement_setBlob(T P, int parameterIndex, const void *x, int size);
 
 
+/**
+ * Sets the <i>in</i> parameter at index <code>parameterIndex</code> to a
+ * blob value read in pieces with <code>read(buffer, size, context)</code>.
+ * The read function copies at most size bytes of the value into buffer
+ * and returns the number of bytes copied, 0 at the end of the value or
+ * -1 on error. A large object can be inserted from a file this way:
+ * <pre>
+ * static int readFile(void *buffer, int size, void *file) {
+ *         size_t n = fread(buffer, 1, size, file);
+ *         return (n > 0 || feof(file)) ? (int)n : -1;
+ * }
+ * [..]
+ * PreparedStatement_setBlobStream(p, 1, readFile, file);
+ * PreparedStatement_execute(p);
+ * </pre>
+ * MySQL sends each piece with mysql_stmt_send_long_data() when the 
+ * statement is executed and Oracle appends the pieces to a temporary
+ * LOB, so the value is never held in client memory. Other backends
+ * read the whole value into a buffer kept with the statement. The
+ * value is read once, set the stream again before the statement is 
+ * executed again. Pieces are SQL_DEFAULT_LOB_CHUNK_SIZE bytes. 
+ * @param P A PreparedStatement object
+ * @param parameterIndex The first parameter is 1, the second is 2,..
+ * @param read The function reading the next piece of the value
+ * @param context Argument given to read. Must stay valid until the
+ * statement is executed
+ * @exception SQLException If a database access error occurs, if parameter 
+ * index is out of range or if read returns -1
+ * @see SQLException.h
+ */
+void PreparedStatement_setBlobStream(T P, int parameterIndex, int (*read)(void *buffer, int size, void *context), void *context);
+
+
 /**
  * Sets the <i>in</i> parameter at index <code>parameterIndex</code> to the
  * given Unix timestamp value. The timestamp value given in <code>x</code>
@@ -261,6 +344,29 @@ void PreparedStatement_execute(T P);
 ResultSet_T PreparedStatement_executeQuery(T P);
 
 
+/**
+ * Adds a copy of the current parameter values to this statement's batch
+ * of parameter sets. 
+ * @param P A PreparedStatement object
+ * @see PreparedStatement_executeBatch
+ */
+void PreparedStatement_addBatch(T P);
+
+
+/**
+ * Executes the prepared SQL statement, which may be an INSERT, UPDATE,
+ * or DELETE statement, once for each parameter set added with 
+ * PreparedStatement_addBatch(). The batch is empty when this method 
+ * returns, also if an error occurs. Parameters must be set again before
+ * the statement is executed with PreparedStatement_execute().
+ * @param P A PreparedStatement object
+ * @return The total number of rows changed by the statements in the batch
+ * @exception SQLException If a database error occurs
+ * @see SQLException.h
+ */
+long long PreparedStatement_executeBatch(T P);
+
+
 /**
  * Returns the number of rows that was inserted, deleted or modified by the
  * most recently completed SQL statement on the database connection. If used
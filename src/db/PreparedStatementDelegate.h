@@ -48,6 +48,14 @@ typedef struct Pop_T {
         void (*execute)(T P);
         ResultSet_T (*executeQuery)(T P);
         long long (*rowsChanged)(T P);
+        /* Optional. Execute the statement once for each of rows parameter sets, 
+         calling bind(batch, row) to set the parameters of a row before it is 
+         executed. Returns the total number of rows changed */
+        long long (*executeBatch)(T P, int rows, void (*bind)(void *batch, int row), void *batch);
+        /* Optional. Send a blob parameter in pieces read with read(buffer, size, context), which
+         returns the number of bytes read, 0 at the end of the value or -1 on error. The value 
+         may be read when the statement is executed */
+        void (*setBlobStream)(T P, int parameterIndex, int (*read)(void *buffer, int size, void *context), void *context);
 } *Pop_T;
 
 /**
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "Thread.h"
+#include "system/Time.h"
+#include "ResultSet.h"
+#include "Snapshot.h"
+#include "ResultCache.h"
+
+
+/**
+ * Implementation of the ResultCache. Entries are in a hash table for
+ * lookup and in a list ordered by use, most recently used first, for
+ * eviction. Both are protected by the cache mutex.
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define T ResultCache_T
+
+typedef struct entry_t {
+        char *key;
+        unsigned hash;
+        long long size;
+        long long expires;
+        Snapshot_T snapshot;
+        struct entry_t *chain;  // Next entry in the hash bucket
+        struct entry_t *prev;
+        struct entry_t *next;
+} *entry_t;
+
+struct ResultCache_S {
+        Mutex_T mutex;
+        long long maxBytes;
+        long long bytes;
+        int count;
+        int mask;
+        entry_t *table;
+        entry_t head;           // Most recently used
+        entry_t tail;           // Least recently used, evicted first
+};
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+static inline unsigned _hash(const char *key) {
+        unsigned h = 2166136261u; // FNV-1a
+        while (*key)
+                h = (h ^ (unsigned char)*key++) * 16777619u;
+        return h;
+}
+
+
+static void _unlink(T C, entry_t e) {
+        if (e->prev)
+                e->prev->next = e->next;
+        else
+                C->head = e->next;
+        if (e->next)
+                e->next->prev = e->prev;
+        else
+                C->tail = e->prev;
+        e->prev = e->next = NULL;
+}
+
+
+static void _pushFront(T C, entry_t e) {
+        e->next = C->head;
+        if (C->head)
+                C->head->prev = e;
+        C->head = e;
+        if (! C->tail)
+                C->tail = e;
+}
+
+
+static void _grow(T C) {
+        int size = 2 * (C->mask + 1);
+        entry_t *table = CALLOC(size, sizeof *table);
+        for (int i = 0; i <= C->mask; i++) {
+                for (entry_t e = C->table[i], chain; e; e = chain) {
+                        chain = e->chain;
+                        e->chain = table[e->hash & (size - 1)];
+                        table[e->hash & (size - 1)] = e;
+                }
+        }
+        FREE(C->table);
+        C->table = table;
+        C->mask = size - 1;
+}
+
+
+static entry_t _find(T C, const char *key, unsigned hash) {
+        for (entry_t e = C->table[hash & C->mask]; e; e = e->chain)
+                if (e->hash == hash && Str_isByteEqual(e->key, key))
+                        return e;
+        return NULL;
+}
+
+
+static void _remove(T C, entry_t e) {
+        entry_t *p = &C->table[e->hash & C->mask];
+        while (*p != e)
+                p = &(*p)->chain;
+        *p = e->chain;
+        _unlink(C, e);
+        C->bytes -= e->size;
+        C->count--;
+        Snapshot_free(&e->snapshot);
+        FREE(e->key);
+        FREE(e);
+}
+
+
+/* ------------------------------------------------------------ Public API */
+
+
+T ResultCache_new(long long maxBytes) {
+        assert(maxBytes > 0);
+        T C;
+        NEW(C);
+        Mutex_init(C->mutex);
+        C->maxBytes = maxBytes;
+        C->mask = 63;
+        C->table = CALLOC(C->mask + 1, sizeof *C->table);
+        return C;
+}
+
+
+void ResultCache_free(T *C) {
+        assert(C && *C);
+        while ((*C)->head)
+                _remove(*C, (*C)->head);
+        FREE((*C)->table);
+        Mutex_destroy((*C)->mutex);
+        FREE(*C);
+}
+
+
+char *ResultCache_newKey(const char *sql) {
+        assert(sql);
+        char *key = Str_dup(sql);
+        char *d = key;
+        char quote = 0;
+        for (const char *s = sql; *s; s++) {
+                if (quote) {
+                        if (*s == quote)
+                                quote = 0;
+                } else if (*s == '\'' || *s == '"') {
+                        quote = *s;
+                } else if (isspace((unsigned char)*s)) {
+                        while (isspace((unsigned char)s[1]))
+                                s++;
+                        if (d == key || ! s[1])
+                                continue;
+                        *d++ = ' ';
+                        continue;
+                }
+                *d++ = *s;
+        }
+        *d = 0;
+        return key;
+}
+
+
+Snapshot_T ResultCache_get(T C, const char *key) {
+        assert(C);
+        assert(key);
+        Snapshot_T S = NULL;
+        unsigned hash = _hash(key);
+        LOCK(C->mutex)
+        {
+                entry_t e = _find(C, key, hash);
+                if (e) {
+                        if (e->expires <= Time_monotonic()) {
+                                _remove(C, e);
+                        } else {
+                                _unlink(C, e);
+                                _pushFront(C, e);
+                                S = Snapshot_retain(e->snapshot);
+                        }
+                }
+        }
+        END_LOCK;
+        return S;
+}
+
+
+void ResultCache_put(T C, const char *key, Snapshot_T S, int ttl) {
+        assert(C);
+        assert(key);
+        assert(S);
+        assert(ttl > 0);
+        long long size = sizeof(struct entry_t) + strlen(key) + 1 + Snapshot_getSize(S);
+        if (size > C->maxBytes)
+                return;
+        entry_t e;
+        NEW(e);
+        e->key = Str_dup(key);
+        e->hash = _hash(key);
+        e->size = size;
+        e->expires = Time_monotonic() + ttl;
+        e->snapshot = Snapshot_retain(S);
+        LOCK(C->mutex)
+        {
+                entry_t old = _find(C, key, e->hash);
+                if (old)
+                        _remove(C, old);
+                while (C->tail && C->bytes + size > C->maxBytes)
+                        _remove(C, C->tail);
+                if (C->count > C->mask)
+                        _grow(C);
+                e->chain = C->table[e->hash & C->mask];
+                C->table[e->hash & C->mask] = e;
+                _pushFront(C, e);
+                C->bytes += size;
+                C->count++;
+        }
+        END_LOCK;
+}
+
+
+int ResultCache_invalidate(T C, const char *prefix) {
+        assert(C);
+        int removed = 0;
+        LOCK(C->mutex)
+        {
+                for (entry_t e = C->head, next; e; e = next) {
+                        next = e->next;
+                        if (! STR_DEF(prefix) || Str_startsWith(e->key, prefix)) {
+                                _remove(C, e);
+                                removed++;
+                        }
+                }
+        }
+        END_LOCK;
+        return removed;
+}
+
+
+long long ResultCache_getSize(T C) {
+        assert(C);
+        return C->bytes;
+}
+
+
+#undef T
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef RESULTCACHE_INCLUDED
+#define RESULTCACHE_INCLUDED
+
+
+/**
+ * A ResultCache keeps Snapshots of query results by key, for
+ * ConnectionPool_executeCachedQuery(). The cache is bounded by the bytes
+ * of its entries and evicts the least recently used entry first. Entries
+ * expire after their time to live and are removed when next looked up
+ * or evicted. Keys are the SQL statement with its arguments formatted
+ * in and with whitespace outside string literals collapsed. The cache
+ * is thread-safe.
+ *
+ * @file
+ */
+
+
+#define T ResultCache_T
+typedef struct ResultCache_S *T;
+
+
+/**
+ * Create a new ResultCache
+ * @param maxBytes The maximum number of bytes used by cached entries
+ * @return A new ResultCache
+ */
+T ResultCache_new(long long maxBytes);
+
+
+/**
+ * Free the cache and release its Snapshots
+ * @param C A ResultCache reference
+ */
+void ResultCache_free(T *C);
+
+
+/**
+ * Normalize a SQL statement to a cache key
+ * @param sql A SQL statement with its arguments formatted in
+ * @return The key. The caller must free it
+ */
+char *ResultCache_newKey(const char *sql);
+
+
+/**
+ * Returns the Snapshot cached for key
+ * @param C A ResultCache
+ * @param key A key from ResultCache_newKey()
+ * @return A Snapshot with a reference the caller must release with
+ * Snapshot_free(), or NULL if key is not cached or has expired
+ */
+Snapshot_T ResultCache_get(T C, const char *key);
+
+
+/**
+ * Cache a Snapshot for key, replacing a previous entry. A Snapshot
+ * larger than the cache is not cached.
+ * @param C A ResultCache
+ * @param key A key from ResultCache_newKey()
+ * @param S The Snapshot, the cache adds a reference
+ * @param ttl Milliseconds the entry is valid
+ */
+void ResultCache_put(T C, const char *key, Snapshot_T S, int ttl);
+
+
+/**
+ * Remove the entries with keys starting with prefix
+ * @param C A ResultCache
+ * @param prefix A key prefix, NULL or the empty string removes all entries
+ * @return The number of entries removed
+ */
+int ResultCache_invalidate(T C, const char *prefix);
+
+
+/**
+ * Returns the number of bytes used by cached entries
+ * @param C A ResultCache
+ * @return Bytes used
+ */
+long long ResultCache_getSize(T C);
+
+
+#undef T
+#endif
@@ -26,9 +26,19 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <string.h>
 
+#include "URL.h"
 #include "ResultSet.h"
+#include "PreparedStatement.h"
+#include "Connection.h"
+#include "ConnectionPool.h"
 #include "system/Time.h"
+#include "Statistics.h"
+#include "Trace.h"
+#include "Dispatch.h"
+#include "Snapshot.h"
+#include "Prefetch.h"
 
 
 /**
@@ -41,9 +51,18 @@
 /* ----------------------------------------------------------- Definitions */
 
 
+#define MEMORY_EXCEEDED "Result set of %lld bytes exceeds the result memory limit of the connection pool"
+
 #define T ResultSet_T
 struct ResultSet_S {
         Rop_T op;
+        int *columnNames;       // Open addressing table of column index + 1, built on first access by name
+        int columnNamesMask;
+        int pending;            // The current row did not fit in the last batch and is returned first by the next
+        int fetched;            // All rows were returned by ResultSet_fetchBatch
+        long long memory;       // Bytes charged to the connection
+        Connection_T connection;
+        Trace_T trace;
         ResultSetDelegate_T D;
 };
 
@@ -51,16 +70,91 @@ struct ResultSet_S {
 /* ------------------------------------------------------- Private methods */
 
 
-static inline int _getIndex(T R, const char *name) {
+static inline unsigned _hash(const char *name) {
+        unsigned h = 2166136261u; // FNV-1a
+        while (*name)
+                h = (h ^ (unsigned char)*name++) * 16777619u;
+        return h;
+}
+
+
+/* Build a hash table of the column names with at least twice as many slots as columns. The
+   first column is kept if names are duplicated, as for a linear search */
+static void _hashColumnNames(T R) {
         int columns = ResultSet_getColumnCount(R);
-        for (int i = 1; i <= columns; i++)
-                if (Str_isByteEqual(name, ResultSet_getColumnName(R, i)))
-                        return i;
+        int size = 8;
+        while (size < columns * 2)
+                size *= 2;
+        R->columnNames = CALLOC(size, sizeof *R->columnNames);
+        R->columnNamesMask = size - 1;
+        for (int i = 1; i <= columns; i++) {
+                const char *name = ResultSet_getColumnName(R, i);
+                if (! name)
+                        continue;
+                unsigned slot = _hash(name) & R->columnNamesMask;
+                for (; R->columnNames[slot]; slot = (slot + 1) & R->columnNamesMask)
+                        if (Str_isByteEqual(name, ResultSet_getColumnName(R, R->columnNames[slot])))
+                                break;
+                if (! R->columnNames[slot])
+                        R->columnNames[slot] = i;
+        }
+}
+
+
+static inline int _getIndex(T R, const char *name) {
+        if (name) {
+                if (! R->columnNames)
+                        _hashColumnNames(R);
+                for (unsigned slot = _hash(name) & R->columnNamesMask; R->columnNames[slot]; slot = (slot + 1) & R->columnNamesMask)
+                        if (Str_isByteEqual(name, ResultSet_getColumnName(R, R->columnNames[slot])))
+                                return R->columnNames[slot];
+        }
         THROW(SQLException, "Invalid column name '%s'", name ? name : "null");
         return -1;
 }
 
 
+/* Returns true if columnIndex is valid and the column value is not SQL NULL, without throwing */
+static inline int _hasValue(T R, int columnIndex) {
+        if (columnIndex < 1 || columnIndex > ROP_CALL(R, getColumnCount, R->D))
+                return false;
+        return ! ROP_CALL(R, isnull, R->D, columnIndex);
+}
+
+
+/* Charge the change in memory held by the delegate to the connection. Returns false if the
+   memory grew and the pool's result memory limit is exceeded */
+static inline int _charge(T R) {
+        if (R->connection && R->op->getMemory) {
+                long long memory = ROP_CALL(R, getMemory, R->D);
+                if (memory != R->memory) {
+                        long long bytes = memory - R->memory;
+                        R->memory = memory;
+                        return Connection_chargeMemory(R->connection, bytes);
+                }
+        }
+        return true;
+}
+
+
+static int _traceNext(T R) {
+        volatile int next = false;
+        TRACE_BEGIN(R->trace, "next", NULL);
+        TRY
+        {
+                next = ROP_CALL(R, next, R->D);
+        }
+        ELSE
+        {
+                TRACE_END(-1, Exception_frame.message);
+                RETHROW;
+        }
+        END_TRY;
+        TRACE_END(next, NULL);
+        return next;
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -81,10 +175,31 @@ T ResultSet_new(ResultSetDelegate_T D, Rop_T op) {
 
 void ResultSet_free(T *R) {
 	assert(R && *R);
+        if ((*R)->memory)
+                Connection_chargeMemory((*R)->connection, -(*R)->memory);
         (*R)->op->free(&(*R)->D);
+        FREE((*R)->columnNames);
 	FREE(*R);
 }
 
+
+void ResultSet_setTrace(T R, Trace_T trace) {
+        assert(R);
+        R->trace = trace;
+}
+
+
+void ResultSet_charge(T *R, Connection_T connection) {
+        assert(R && *R);
+        assert(connection);
+        (*R)->connection = connection;
+        if (! _charge(*R)) {
+                long long memory = (*R)->memory;
+                ResultSet_free(R);
+                THROW(SQLException, MEMORY_EXCEEDED, memory);
+        }
+}
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -115,13 +230,39 @@ long ResultSet_getColumnSize(T R, int columnIndex) {
 
 
 int ResultSet_next(T R) {
-        return R ? R->op->next(R->D) : false;
+        if (R && R->pending) {
+                R->pending = false;
+                return true;
+        }
+        if (! R)
+                return false;
+        long long start = Statistics_start();
+        int next = Trace_isTracing(R->trace) ? _traceNext(R) : ROP_CALL(R, next, R->D);
+        Statistics_record(R->op->name, Statistics_Next, start);
+        if (! _charge(R))
+                THROW(SQLException, MEMORY_EXCEEDED, R->memory);
+        return next;
+}
+
+
+int ResultSet_nextResult(T R) {
+        assert(R);
+        if (! R->op->nextResult)
+                return false;
+        int next = R->op->nextResult(R->D);
+        // The next result has its own columns and rows
+        FREE(R->columnNames);
+        R->pending = false;
+        R->fetched = ! next;
+        if (! _charge(R))
+                THROW(SQLException, MEMORY_EXCEEDED, R->memory);
+        return next;
 }
 
 
 int ResultSet_isnull(T R, int columnIndex) {
         assert(R);
-        return R->op->isnull(R->D, columnIndex);
+        return ROP_CALL(R, isnull, R->D, columnIndex);
 }
 
 
@@ -130,7 +271,7 @@ int ResultSet_isnull(T R, int columnIndex) {
 
 const char *ResultSet_getString(T R, int columnIndex) {
 	assert(R);
-	return R->op->getString(R->D, columnIndex);
+	return ROP_CALL(R, getString, R->D, columnIndex);
 }
 
 
@@ -142,7 +283,9 @@ const char *ResultSet_getStringByName(T R, const char *columnName) {
 
 int ResultSet_getInt(T R, int columnIndex) {
 	assert(R);
-        const char *s = R->op->getString(R->D, columnIndex);
+        if (R->op->getInt)
+                return ROP_CALL(R, getInt, R->D, columnIndex);
+        const char *s = ROP_CALL(R, getString, R->D, columnIndex);
 	return s ? Str_parseInt(s) : 0;
 }
 
@@ -155,7 +298,9 @@ int ResultSet_getIntByName(T R, const char *columnName) {
 
 long long ResultSet_getLLong(T R, int columnIndex) {
 	assert(R);
-        const char *s = R->op->getString(R->D, columnIndex);
+        if (R->op->getLLong)
+                return ROP_CALL(R, getLLong, R->D, columnIndex);
+        const char *s = ROP_CALL(R, getString, R->D, columnIndex);
 	return s ? Str_parseLLong(s) : 0;
 }
 
@@ -168,7 +313,9 @@ long long ResultSet_getLLongByName(T R, const char *columnName) {
 
 double ResultSet_getDouble(T R, int columnIndex) {
 	assert(R);
-        const char *s = R->op->getString(R->D, columnIndex);
+        if (R->op->getDouble)
+                return ROP_CALL(R, getDouble, R->D, columnIndex);
+        const char *s = ROP_CALL(R, getString, R->D, columnIndex);
 	return s ? Str_parseDouble(s) : 0.0;
 }
 
@@ -179,9 +326,147 @@ double ResultSet_getDoubleByName(T R, const char *columnName) {
 }
 
 
+/* Store column c of the current row at row in the batch. Returns false if a string does not fit */
+static inline int _fetchColumn(T R, int c, int row, ResultSet_Column_T *column) {
+        int isnull = ROP_CALL(R, isnull, R->D, c + 1);
+        if (isnull && column->nulls)
+                column->nulls[row / 8] |= (unsigned char)(1 << (row % 8));
+        switch (column->type) {
+                case ResultSet_LLong:
+                        column->llongs[row] = isnull ? 0 : ResultSet_getLLong(R, c + 1);
+                        break;
+                case ResultSet_Double:
+                        column->doubles[row] = isnull ? 0.0 : ResultSet_getDouble(R, c + 1);
+                        break;
+                case ResultSet_String:
+                {
+                        int size = 0;
+                        const void *bytes = isnull ? NULL : ResultSet_getBytes(R, c + 1, &size);
+                        if (column->offsets[row] + size > column->dataSize)
+                                return false;
+                        if (size)
+                                memcpy(column->data + column->offsets[row], bytes, size);
+                        column->offsets[row + 1] = column->offsets[row] + size;
+                        break;
+                }
+                default:
+                        break;
+        }
+        return true;
+}
+
+
+int ResultSet_fetchBatch(T R, int maxRows, ResultSet_Column_T *columns) {
+        assert(R);
+        assert(maxRows > 0);
+        assert(columns);
+        int count = R->op->getColumnCount(R->D);
+        for (int c = 0; c < count; c++) {
+                if (columns[c].type == ResultSet_String) {
+                        assert(columns[c].offsets && columns[c].data);
+                        columns[c].offsets[0] = 0;
+                }
+                if (columns[c].nulls)
+                        memset(columns[c].nulls, 0, (maxRows + 7) / 8);
+        }
+        int rows = 0;
+        // Some drivers, e.g. SQLite, start over if stepped past the last row
+        if (R->fetched)
+                return 0;
+        while (rows < maxRows) {
+                if (! ResultSet_next(R)) {
+                        R->fetched = true;
+                        break;
+                }
+                for (int c = 0; c < count; c++) {
+                        if (columns[c].type == ResultSet_Skip)
+                                continue;
+                        if (! _fetchColumn(R, c, rows, &columns[c])) {
+                                // Return the row first in the next batch, what was stored of it here is past the rows returned
+                                R->pending = true;
+                                if (rows == 0)
+                                        THROW(SQLException, "Value in column %d is larger than the batch data buffer", c + 1);
+                                return rows;
+                        }
+                }
+                rows++;
+        }
+        return rows;
+}
+
+
+T ResultSet_materialize(T R) {
+        assert(R);
+        Snapshot_T S = Snapshot_new(R);
+        T M = Snapshot_toResultSet(S);
+        Snapshot_free(&S);
+        return M;
+}
+
+
+void ResultSet_freeMaterialized(T *R) {
+        assert(R && *R);
+        assert(Str_isEqual((*R)->op->name, "snapshot"));
+        ResultSet_free(R);
+}
+
+
+void ResultSet_setPrefetch(T R, int rows) {
+        assert(R);
+        assert(rows > 0);
+        if (R->op == (Rop_T)&prefetchrops)
+                return;
+        R->D = Prefetch_new(R->D, R->op, rows);
+        R->op = (Rop_T)&prefetchrops;
+}
+
+
+int ResultSet_tryGetString(T R, int columnIndex, const char **value) {
+        assert(R);
+        assert(value);
+        if (! _hasValue(R, columnIndex))
+                return false;
+        *value = R->op->getString(R->D, columnIndex);
+        return true;
+}
+
+
+int ResultSet_tryGetInt(T R, int columnIndex, int *value) {
+        assert(R);
+        assert(value);
+        if (! _hasValue(R, columnIndex))
+                return false;
+        *value = ResultSet_getInt(R, columnIndex);
+        return true;
+}
+
+
+int ResultSet_tryGetLLong(T R, int columnIndex, long long *value) {
+        assert(R);
+        assert(value);
+        if (! _hasValue(R, columnIndex))
+                return false;
+        *value = ResultSet_getLLong(R, columnIndex);
+        return true;
+}
+
+
+int ResultSet_tryGetDouble(T R, int columnIndex, double *value) {
+        assert(R);
+        assert(value);
+        if (! _hasValue(R, columnIndex))
+                return false;
+        *value = ResultSet_getDouble(R, columnIndex);
+        return true;
+}
+
+
 const void *ResultSet_getBlob(T R, int columnIndex, int *size) {
 	assert(R);
         const void *b = R->op->getBlob(R->D, columnIndex, size);
+        // A blob may be read into a buffer of the delegate, such as an Oracle LOB
+        if (! _charge(R))
+                THROW(SQLException, MEMORY_EXCEEDED, R->memory);
         if (! b)
                 *size = 0;
 	return b;
@@ -194,6 +479,39 @@ const void *ResultSet_getBlobByName(T R, const char *columnName, int *size) {
 }
 
 
+int ResultSet_readBlob(T R, int columnIndex, long long offset, void *buffer, int length) {
+        assert(R);
+        assert(offset >= 0);
+        assert(buffer);
+        assert(length >= 0);
+        if (R->op->readBlob)
+                return R->op->readBlob(R->D, columnIndex, offset, buffer, length);
+        int size = 0;
+        const void *blob = R->op->getBlob(R->D, columnIndex, &size);
+        return copyBlob(blob, size, offset, buffer, length);
+}
+
+
+const void *ResultSet_getBytes(T R, int columnIndex, int *size) {
+	assert(R);
+        assert(size);
+        const void *b;
+        if (R->op->getBytes)
+                b = R->op->getBytes(R->D, columnIndex, size);
+        else if ((b = R->op->getString(R->D, columnIndex)))
+                *size = (int)strlen(b);
+        if (! b)
+                *size = 0;
+	return b;
+}
+
+
+const void *ResultSet_getBytesByName(T R, const char *columnName, int *size) {
+	assert(R);
+	return ResultSet_getBytes(R, _getIndex(R, columnName), size);
+}
+
+
 /* --------------------------------------------------------- Date and Time */
 
 
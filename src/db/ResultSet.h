@@ -105,6 +105,29 @@
 #define T ResultSet_T
 typedef struct ResultSet_S *T;
 
+/**
+ * How a column is stored by ResultSet_fetchBatch()
+ */
+typedef enum {
+        ResultSet_Skip = 0,     ///< The column is not fetched
+        ResultSet_LLong,        ///< Fetched as long long into llongs
+        ResultSet_Double,       ///< Fetched as double into doubles
+        ResultSet_String        ///< Fetched as bytes into data, delimited by offsets
+} ResultSet_Type;
+
+/**
+ * Caller provided storage for one column in ResultSet_fetchBatch()
+ */
+typedef struct ResultSet_Column_T {
+        ResultSet_Type type;    ///< How the column is fetched
+        long long *llongs;      ///< maxRows values for ResultSet_LLong
+        double *doubles;        ///< maxRows values for ResultSet_Double
+        int *offsets;           ///< maxRows + 1 offsets for ResultSet_String, row i is data[offsets[i]..offsets[i + 1]]
+        char *data;             ///< String bytes for ResultSet_String, not NUL terminated
+        int dataSize;           ///< Size of data in bytes
+        unsigned char *nulls;   ///< Optional bitmap of (maxRows + 7) / 8 bytes, bit i is set if row i is SQL NULL
+} ResultSet_Column_T;
+
 
 //<< Protected methods
 
@@ -123,6 +146,30 @@ T ResultSet_new(ResultSetDelegate_T D, Rop_T op);
  */
 void ResultSet_free(T *R);
 
+
+struct Trace_S;
+
+/**
+ * Trace ResultSet_next() calls on this ResultSet
+ * @param R A ResultSet object
+ * @param trace The trace settings of the Connection's pool
+ */
+void ResultSet_setTrace(T R, struct Trace_S *trace);
+
+
+struct Connection_S;
+
+/**
+ * Charge the memory held by a new ResultSet to the Connection which
+ * executed the query and to its pool. The charge is updated as rows are
+ * read and released when the ResultSet is freed.
+ * @param R A ResultSet object reference
+ * @param connection The Connection of the ResultSet
+ * @exception SQLException If the pool's result memory limit is exceeded,
+ * the ResultSet is then freed and R set to NULL
+ */
+void ResultSet_charge(T *R, struct Connection_S *connection);
+
 //>> End Protected methods
 
 /** @name Properties */
@@ -177,6 +224,37 @@ long ResultSet_getColumnSize(T R, int columnIndex);
  */
 int ResultSet_next(T R);
 
+
+/**
+ * Moves to the result of the next statement in a query with several
+ * statements separated by semicolon. All statements are sent to the
+ * server together, so several lookups cost one round-trip. The
+ * ResultSet is positioned before the first row of the next statement
+ * returning rows, remaining rows of the current statement are
+ * discarded and statements which do not return rows are executed and
+ * skipped. All statements are executed even if this method is not
+ * called; with SQLite, statements not reached are executed when the
+ * ResultSet is closed. The ResultSet returned by Connection_executeQuery() is the
+ * result of the first statement returning rows. Example:
+ * <pre>
+ * ResultSet_T r = Connection_executeQuery(con, "select name from users where id = 1; select count(*) from orders");
+ * while (ResultSet_next(r))
+ *         [..]
+ * if (ResultSet_nextResult(r) && ResultSet_next(r))
+ *         orders = ResultSet_getInt(r, 1);
+ * </pre>
+ * Supported by SQLite, by PostgreSQL unless <code>result-mode=stream</code>
+ * and by MySQL with <code>query-protocol=text</code>, as MySQL cannot 
+ * prepare several statements at once. For other result sets false is
+ * returned.
+ * @param R A ResultSet object
+ * @return true if the ResultSet moved to the result of the next
+ * statement, false if there are no more results
+ * @exception SQLException If a database access error occurs or a
+ * statement failed
+ */
+int ResultSet_nextResult(T R);
+
 /** @name Columns */
 //@{
 
@@ -383,6 +461,249 @@ const void *ResultSet_getBlob(T R, int columnIndex, int *size);
  */
 const void *ResultSet_getBlobByName(T R, const char *columnName, int *size);
 
+
+/**
+ * Reads up to <code>length</code> bytes of the designated column in
+ * the current row, starting at byte <code>offset</code>, into buffer.
+ * A large object can be read in pieces into a fixed size buffer:
+ * <pre>
+ * char chunk[65536];
+ * long long offset = 0;
+ * for (int n; (n = ResultSet_readBlob(r, 1, offset, chunk, sizeof(chunk))) > 0; offset += n)
+ *         fwrite(chunk, 1, n, file);
+ * </pre>
+ * With Oracle LOB columns only the requested piece is read from the 
+ * server, with MySQL it is read from the row received by the client
+ * without growing the column buffer. With other result sets the value 
+ * is already in client memory and the piece is copied from it. For an
+ * Oracle CLOB offset is in characters.
+ * @param R A ResultSet object
+ * @param columnIndex The first column is 1, the second is 2, ...
+ * @param offset Where to start reading, the first byte is 0
+ * @param buffer The buffer to read into
+ * @param length The maximum number of bytes to read
+ * @return The number of bytes read, 0 if offset is at or past the end
+ * of the value or if the value is SQL NULL
+ * @exception SQLException If a database access error occurs or 
+ * columnIndex is outside the valid range
+ * @see SQLException.h
+ */
+int ResultSet_readBlob(T R, int columnIndex, long long offset, void *buffer, int length);
+
+
+/**
+ * Retrieves the value of the designated column in the current row of
+ * this ResultSet object as a borrowed view into the database client
+ * library's own buffer. Unlike ResultSet_getString() the value is
+ * <i>not</i> NUL terminated and is not copied, the length is stored
+ * in size instead. Use this method to forward a value, e.g. into a
+ * serializer, without an extra copy and strlen. The bytes are the
+ * value as sent by the server; a PostgreSQL bytea in text format is
+ * <i>not</i> unescaped, use ResultSet_getBlob() for that. If
+ * <code>columnIndex</code> is outside the range
+ * [1..ResultSet_getColumnCount()] this method throws an SQLException.
+ * <i>The returned view is only valid until the next call to
+ * ResultSet_next() or another getter on the same column and must
+ * not be modified.</i>
+ * @param R A ResultSet object
+ * @param columnIndex The first column is 1, the second is 2, ...
+ * @param size The number of bytes in the value is stored in size
+ * @return The column value; if the value is SQL NULL, the value
+ * returned is NULL
+ * @exception SQLException If a database access error occurs or
+ * columnIndex is outside the valid range
+ * @see SQLException.h
+ */
+const void *ResultSet_getBytes(T R, int columnIndex, int *size);
+
+
+/**
+ * Retrieves the value of the designated column in the current row of
+ * this ResultSet object as a borrowed view into the database client
+ * library's own buffer. See ResultSet_getBytes(). If
+ * <code>columnName</code> is not found this method throws an
+ * SQLException. <i>The returned view is only valid until the next
+ * call to ResultSet_next() and must not be modified.</i>
+ * @param R A ResultSet object
+ * @param columnName The SQL name of the column. <i>case-sensitive</i>
+ * @param size The number of bytes in the value is stored in size
+ * @return The column value; if the value is SQL NULL, the value
+ * returned is NULL
+ * @exception SQLException If a database access error occurs or
+ * columnName does not exist
+ * @see SQLException.h
+ */
+const void *ResultSet_getBytesByName(T R, const char *columnName, int *size);
+
+//@}
+
+/** @name Batch fetch */
+//@{
+
+/**
+ * Fetch up to <code>maxRows</code> rows into caller provided columnar
+ * arrays, one ResultSet_Column_T per column in the ResultSet, skipping
+ * columns whose type is ResultSet_Skip. Numeric columns are stored in
+ * the <code>llongs</code> or <code>doubles</code> array and string
+ * columns are copied into <code>data</code> with row <i>i</i> at
+ * <code>data[offsets[i]]</code> and <code>offsets[i + 1] - offsets[i]</code>
+ * bytes long. A SQL NULL value is stored as 0 or an empty string and
+ * its bit in <code>nulls</code>, if given, is set. Fetching stops
+ * early when a string value does not fit in <code>data</code>; the
+ * row is then returned first by the next call. If not even the first
+ * row fits, an SQLException is thrown and the row is kept as the
+ * current row, so the call can be repeated with a larger buffer. Each
+ * call starts filling the arrays from index 0, and ResultSet_next()
+ * should not be used on the same ResultSet. Example:
+ * <pre>
+ * long long ids[1000];
+ * int offsets[1001];
+ * char names[65536];
+ * ResultSet_Column_T columns[2] = {
+ *         {.type = ResultSet_LLong, .llongs = ids},
+ *         {.type = ResultSet_String, .offsets = offsets, .data = names, .dataSize = sizeof(names)}
+ * };
+ * ResultSet_T r = Connection_executeQuery(con, "select id, name from employee");
+ * for (int rows; (rows = ResultSet_fetchBatch(r, 1000, columns)) > 0;)
+ *         process(rows, ids, offsets, names);
+ * </pre>
+ * @param R A ResultSet object
+ * @param maxRows The maximum number of rows to fetch, the capacity of
+ * the arrays in columns
+ * @param columns An array of ResultSet_getColumnCount() columns
+ * @return The number of rows fetched, 0 if there are no more rows
+ * @exception SQLException If a database access error occurs, if a
+ * value cannot be converted to the column type or if a single string
+ * value is larger than the data buffer
+ * @see SQLException.h
+ */
+int ResultSet_fetchBatch(T R, int maxRows, ResultSet_Column_T *columns);
+
+
+/**
+ * Read the remaining rows of this ResultSet into memory and return them
+ * as a new ResultSet which does not depend on the Connection. The
+ * Connection can be returned to the pool right away while the rows are
+ * processed, also by another thread. The rows are kept in one allocation
+ * as returned by ResultSet_getBytes(), so ResultSet_getString() and
+ * ResultSet_getBlob() return the same bytes and numbers and dates are
+ * parsed from that text. This ResultSet is read to the end. Example:
+ * <pre>
+ * Connection_T con = ConnectionPool_getConnection(pool);
+ * ResultSet_T r = ResultSet_materialize(Connection_executeQuery(con, "select id, name from employee"));
+ * Connection_close(con);
+ * while (ResultSet_next(r))
+ *         [..]
+ * ResultSet_freeMaterialized(&r);
+ * </pre>
+ * @param R A ResultSet object
+ * @return A materialized ResultSet positioned before its first row. The
+ * caller must free it with ResultSet_freeMaterialized()
+ * @exception SQLException If a database access error occurs
+ * @see ResultSet_freeMaterialized()
+ */
+T ResultSet_materialize(T R);
+
+
+/**
+ * Free a ResultSet returned by ResultSet_materialize() and set R to
+ * NULL. It is a checked runtime error for R to be any other ResultSet.
+ * @param R A materialized ResultSet reference
+ */
+void ResultSet_freeMaterialized(T *R);
+
+
+/**
+ * Read the rows of this ResultSet ahead of the caller. A background
+ * thread reads the next block of <code>rows</code> rows from the
+ * database while the caller processes the current block, so waiting
+ * for the server overlaps with the work done per row. At most two
+ * blocks are held in memory. Values are copied as returned by
+ * ResultSet_getBytes(), so numbers and dates are parsed from that
+ * text as for ResultSet_materialize(), and ResultSet_nextResult()
+ * returns false. Call this method before the first ResultSet_next()
+ * and do not use the Connection until this ResultSet is closed, as the
+ * background thread reads from it. Example:
+ * <pre>
+ * ResultSet_T r = Connection_executeQuery(con, "select id, name from employee");
+ * ResultSet_setPrefetch(r, 1000);
+ * while (ResultSet_next(r))
+ *         process(ResultSet_getInt(r, 1), ResultSet_getString(r, 2));
+ * </pre>
+ * With PostgreSQL and MySQL, use <code>result-mode=stream</code> so
+ * rows are read from the server as they are needed rather than by
+ * Connection_executeQuery(). It is a checked runtime error for rows
+ * to be less than 1.
+ * @param R A ResultSet object
+ * @param rows The number of rows read ahead in each block
+ */
+void ResultSet_setPrefetch(T R, int rows);
+
+//@}
+
+/** @name Status returning accessors
+ * These methods return false instead of throwing an SQLException if
+ * the column index is out of range, and also if the value is SQL NULL,
+ * so a tight scan loop need not set up a TRY block per row. A value
+ * which cannot be converted to the requested type, e.g. a text value
+ * read as a number, still throws an SQLException.
+ */
+//@{
+
+/**
+ * Retrieves the value of the designated column in the current row of
+ * this ResultSet object as a C-string without throwing an exception
+ * for an invalid column index. See ResultSet_getString().
+ * @param R A ResultSet object
+ * @param columnIndex The first column is 1, the second is 2, ...
+ * @param value The column value is stored in value
+ * @return true if the value was retrieved, false if columnIndex is
+ * outside the valid range or the value is SQL NULL
+ */
+int ResultSet_tryGetString(T R, int columnIndex, const char **value);
+
+
+/**
+ * Retrieves the value of the designated column in the current row of
+ * this ResultSet object as an int without throwing an exception for
+ * an invalid column index. See ResultSet_getInt().
+ * @param R A ResultSet object
+ * @param columnIndex The first column is 1, the second is 2, ...
+ * @param value The column value is stored in value
+ * @return true if the value was retrieved, false if columnIndex is
+ * outside the valid range or the value is SQL NULL
+ * @exception SQLException If the value is not a number
+ */
+int ResultSet_tryGetInt(T R, int columnIndex, int *value);
+
+
+/**
+ * Retrieves the value of the designated column in the current row of
+ * this ResultSet object as a long long without throwing an exception
+ * for an invalid column index. See ResultSet_getLLong().
+ * @param R A ResultSet object
+ * @param columnIndex The first column is 1, the second is 2, ...
+ * @param value The column value is stored in value
+ * @return true if the value was retrieved, false if columnIndex is
+ * outside the valid range or the value is SQL NULL
+ * @exception SQLException If the value is not a number
+ */
+int ResultSet_tryGetLLong(T R, int columnIndex, long long *value);
+
+
+/**
+ * Retrieves the value of the designated column in the current row of
+ * this ResultSet object as a double without throwing an exception for
+ * an invalid column index. See ResultSet_getDouble().
+ * @param R A ResultSet object
+ * @param columnIndex The first column is 1, the second is 2, ...
+ * @param value The column value is stored in value
+ * @return true if the value was retrieved, false if columnIndex is
+ * outside the valid range or the value is SQL NULL
+ * @exception SQLException If the value is not a number
+ */
+int ResultSet_tryGetDouble(T R, int columnIndex, double *value);
+
 //@}
 
 /** @name Date and Time  */
@@ -403,6 +724,9 @@ const void *ResultSet_getBlobByName(T R, const char *columnName, int *size);
  * to be either a numerical value representing a Unix Time in UTC which is
  * returned as-is or an <a href="http://en.wikipedia.org/wiki/ISO_8601">ISO 8601</a>
  * time string which is converted to a time_t value.
+ * <i class="textinfo">MySQL</i> zero dates such as '0000-00-00' are returned
+ * as 0, as for SQL NULL, and a TIME value is returned as its signed number
+ * of seconds.
  * See also PreparedStatement_setTimestamp()
  * @param R A ResultSet object
  * @param columnIndex The first column is 1, the second is 2, ...
@@ -463,6 +787,10 @@ time_t ResultSet_getTimestampByName(T R, const char *columnName);
  * convention. All other fields in the structure are set to zero. If the 
  * column type is DateTime or Timestamp all the fields mentioned above are 
  * set, if it is a Date or Time, only the relevant fields are set.
+ * <i class="textinfo">MySQL</i> zero dates such as '0000-00-00' are returned
+ * as a zeroed tm structure, as for SQL NULL. A MySQL TIME value may be
+ * negative or longer than a day, whole days are then set in tm_mday and
+ * a negative value has all fields negative.
  *
  * @param R A ResultSet object
  * @param columnIndex The first column is 1, the second is 2, ...
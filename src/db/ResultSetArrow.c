@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ResultSet.h"
+#include "ResultSetArrow.h"
+
+
+/**
+ * Implementation of the Arrow C stream export of a ResultSet. Record
+ * batches are filled with ResultSet_fetchBatch() directly into buffers
+ * owned by the exported ArrowArray.
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define T ResultSet_T
+
+// Initial bytes per row for string columns, the buffer grows if values are larger
+#define DATA_PER_ROW 64
+
+typedef struct Stream_S {
+        T R;
+        int batchRows;
+        int columnCount;
+        ResultSet_Type *types;
+        int *dataSize;          // Bytes allocated for each string column in the next batch
+        char error[EXCEPTION_MESSAGE_LENGTH + 1];
+} *Stream_T;
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+static const char *_format(ResultSet_Type type) {
+        switch (type) {
+                case ResultSet_LLong: return "l";
+                case ResultSet_Double: return "g";
+                default: return "u";
+        }
+}
+
+
+static int _children(Stream_T S) {
+        int children = 0;
+        for (int c = 0; c < S->columnCount; c++)
+                if (S->types[c] != ResultSet_Skip)
+                        children++;
+        return children;
+}
+
+
+// The child's name is owned by private_data
+static void _releaseChildSchema(struct ArrowSchema *schema) {
+        FREE(schema->private_data);
+        schema->release = NULL;
+}
+
+
+static void _releaseSchema(struct ArrowSchema *schema) {
+        for (int i = 0; i < schema->n_children; i++) {
+                if (schema->children[i]->release)
+                        schema->children[i]->release(schema->children[i]);
+                FREE(schema->children[i]);
+        }
+        FREE(schema->children);
+        schema->release = NULL;
+}
+
+
+// The child's buffers array is private_data, i.e. the buffers are not const here
+static void _releaseChildArray(struct ArrowArray *array) {
+        void **buffers = array->private_data;
+        for (int i = 0; i < array->n_buffers; i++)
+                FREE(buffers[i]);
+        FREE(array->private_data);
+        array->release = NULL;
+}
+
+
+static void _releaseArray(struct ArrowArray *array) {
+        for (int i = 0; i < array->n_children; i++) {
+                if (array->children[i]->release)
+                        array->children[i]->release(array->children[i]);
+                FREE(array->children[i]);
+        }
+        FREE(array->children);
+        FREE(array->buffers);
+        array->release = NULL;
+}
+
+
+/* Our bitmap has a bit set for NULL, Arrow's validity bitmap has a bit set for a value.
+   Returns the number of NULL values. The bitmap is freed if there are none */
+static int64_t _validity(struct ArrowArray *child, int rows) {
+        void **buffers = child->private_data;
+        unsigned char *bitmap = buffers[0];
+        int64_t nulls = 0;
+        for (int i = 0; i < (rows + 7) / 8; i++) {
+                for (unsigned char b = bitmap[i]; b; b &= b - 1)
+                        nulls++;
+                bitmap[i] = ~bitmap[i];
+        }
+        if (nulls == 0)
+                FREE(buffers[0]);
+        return nulls;
+}
+
+
+/* Allocate the record batch and point the fetch columns into its buffers */
+static void _newBatch(Stream_T S, struct ArrowArray *out, ResultSet_Column_T *columns) {
+        int bitmapSize = (S->batchRows + 7) / 8;
+        *out = (struct ArrowArray){.n_buffers = 1, .n_children = _children(S), .release = _releaseArray};
+        out->buffers = CALLOC(1, sizeof *out->buffers);
+        out->children = CALLOC(out->n_children, sizeof *out->children);
+        for (int c = 0, i = 0; c < S->columnCount; c++) {
+                columns[c] = (ResultSet_Column_T){.type = S->types[c]};
+                if (S->types[c] == ResultSet_Skip)
+                        continue;
+                struct ArrowArray *child;
+                NEW(child);
+                out->children[i++] = child;
+                child->n_buffers = S->types[c] == ResultSet_String ? 3 : 2;
+                void **buffers = child->private_data = CALLOC(child->n_buffers, sizeof(void *));
+                child->buffers = (const void **)buffers;
+                child->release = _releaseChildArray;
+                buffers[0] = columns[c].nulls = ALLOC(bitmapSize);
+                switch (S->types[c]) {
+                        case ResultSet_LLong:
+                                buffers[1] = columns[c].llongs = ALLOC(S->batchRows * sizeof(long long));
+                                break;
+                        case ResultSet_Double:
+                                buffers[1] = columns[c].doubles = ALLOC(S->batchRows * sizeof(double));
+                                break;
+                        default:
+                                buffers[1] = columns[c].offsets = ALLOC((S->batchRows + 1) * sizeof(int));
+                                buffers[2] = columns[c].data = ALLOC(S->dataSize[c]);
+                                columns[c].dataSize = S->dataSize[c];
+                                break;
+                }
+        }
+}
+
+
+/* Grow the string columns which did not have room for the current row. Returns false if
+   none was too small, i.e. the batch failed for another reason */
+static int _growData(Stream_T S, struct ArrowArray *out, ResultSet_Column_T *columns) {
+        int grown = false;
+        for (int c = 0, i = 0; c < S->columnCount; c++) {
+                if (S->types[c] == ResultSet_Skip)
+                        continue;
+                struct ArrowArray *child = out->children[i++];
+                if (S->types[c] != ResultSet_String)
+                        continue;
+                int size = 0;
+                ResultSet_getBytes(S->R, c + 1, &size);
+                if (size > columns[c].dataSize) {
+                        S->dataSize[c] = columns[c].dataSize = size > 2 * columns[c].dataSize ? size : 2 * columns[c].dataSize;
+                        RESIZE(columns[c].data, columns[c].dataSize);
+                        ((void **)child->private_data)[2] = columns[c].data;
+                        grown = true;
+                }
+        }
+        return grown;
+}
+
+
+static int _fetch(Stream_T S, ResultSet_Column_T *columns, struct ArrowArray *out) {
+        volatile int rows = -1;
+        while (rows < 0) {
+                TRY
+                {
+                        rows = ResultSet_fetchBatch(S->R, S->batchRows, columns);
+                }
+                CATCH(SQLException)
+                {
+                        if (! _growData(S, out, columns))
+                                RETHROW;
+                }
+                END_TRY;
+        }
+        return rows;
+}
+
+
+static int _getSchema(struct ArrowArrayStream *stream, struct ArrowSchema *out) {
+        Stream_T S = stream->private_data;
+        *out = (struct ArrowSchema){.format = "+s", .name = "", .n_children = _children(S), .release = _releaseSchema};
+        out->children = CALLOC(out->n_children, sizeof *out->children);
+        for (int c = 0, i = 0; c < S->columnCount; c++) {
+                if (S->types[c] == ResultSet_Skip)
+                        continue;
+                const char *name = ResultSet_getColumnName(S->R, c + 1);
+                struct ArrowSchema *child;
+                NEW(child);
+                out->children[i++] = child;
+                child->format = _format(S->types[c]);
+                child->name = child->private_data = Str_dup(name ? name : "");
+                child->flags = ARROW_FLAG_NULLABLE;
+                child->release = _releaseChildSchema;
+        }
+        return 0;
+}
+
+
+static int _getNext(struct ArrowArrayStream *stream, struct ArrowArray *out) {
+        Stream_T S = stream->private_data;
+        ResultSet_Column_T columns[S->columnCount + 1];
+        volatile int status = 0;
+        _newBatch(S, out, columns);
+        TRY
+        {
+                int rows = _fetch(S, columns, out);
+                if (rows == 0) {
+                        out->release(out);
+                } else {
+                        out->length = rows;
+                        for (int c = 0, i = 0; c < S->columnCount; c++) {
+                                if (S->types[c] == ResultSet_Skip)
+                                        continue;
+                                struct ArrowArray *child = out->children[i++];
+                                child->length = rows;
+                                child->null_count = _validity(child, rows);
+                                // A short batch which filled the string buffer, start the next with more room
+                                if (S->types[c] == ResultSet_String && rows < S->batchRows && columns[c].offsets[rows] > columns[c].dataSize / 2)
+                                        S->dataSize[c] = 2 * columns[c].dataSize;
+                        }
+                }
+        }
+        CATCH(SQLException)
+        {
+                snprintf(S->error, sizeof S->error, "%s", Exception_frame.message);
+                out->release(out);
+                status = EIO;
+        }
+        END_TRY;
+        return status;
+}
+
+
+static const char *_getLastError(struct ArrowArrayStream *stream) {
+        Stream_T S = stream->private_data;
+        return *S->error ? S->error : NULL;
+}
+
+
+static void _release(struct ArrowArrayStream *stream) {
+        Stream_T S = stream->private_data;
+        FREE(S->types);
+        FREE(S->dataSize);
+        FREE(S);
+        stream->release = NULL;
+}
+
+
+/* ------------------------------------------------------------ Public API */
+
+
+void ResultSet_exportArrowStream(T R, int batchRows, const ResultSet_Type *types, struct ArrowArrayStream *stream) {
+        assert(R);
+        assert(batchRows > 0);
+        assert(stream);
+        Stream_T S;
+        NEW(S);
+        S->R = R;
+        S->batchRows = batchRows;
+        S->columnCount = ResultSet_getColumnCount(R);
+        S->types = CALLOC(S->columnCount + 1, sizeof *S->types);
+        S->dataSize = CALLOC(S->columnCount + 1, sizeof *S->dataSize);
+        for (int c = 0; c < S->columnCount; c++) {
+                S->types[c] = types ? types[c] : ResultSet_String;
+                S->dataSize[c] = batchRows * DATA_PER_ROW;
+        }
+        *stream = (struct ArrowArrayStream){
+                .get_schema = _getSchema,
+                .get_next = _getNext,
+                .get_last_error = _getLastError,
+                .release = _release,
+                .private_data = S
+        };
+}
+
+
+#undef T
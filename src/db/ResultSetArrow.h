@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef RESULTSETARROW_INCLUDED
+#define RESULTSETARROW_INCLUDED
+#include <stdint.h>
+
+
+/**
+ * Export a ResultSet as an <a href="https://arrow.apache.org/docs/format/CStreamInterface.html">
+ * Arrow C stream</a> of record batches. The stream is filled with
+ * ResultSet_fetchBatch() and each batch owns its buffers, so an Arrow
+ * consumer can use the column data without copying it again. The Arrow
+ * C Data Interface is an ABI, and a program does not have to link with
+ * an Arrow library to use this interface.
+ *
+ * This interface is only available if libzdb was configured with
+ * <code>--enable-arrow</code> and must be included after zdb.h. Example:
+ * <pre>
+ * ResultSet_Type types[] = {ResultSet_LLong, ResultSet_String, ResultSet_Double};
+ * struct ArrowArrayStream stream;
+ * ResultSet_T r = Connection_executeQuery(con, "select id, name, percent from employee");
+ * ResultSet_exportArrowStream(r, 1024, types, &stream);
+ * consume(&stream); // e.g. hand the stream to an analytics engine
+ * stream.release(&stream);
+ * </pre>
+ * The stream reads from the ResultSet and must be consumed and released
+ * before the ResultSet's Connection is used again or closed.
+ *
+ * @see ResultSet.h
+ * @file
+ */
+
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+        const char *format;
+        const char *name;
+        const char *metadata;
+        int64_t flags;
+        int64_t n_children;
+        struct ArrowSchema **children;
+        struct ArrowSchema *dictionary;
+        void (*release)(struct ArrowSchema *);
+        void *private_data;
+};
+
+struct ArrowArray {
+        int64_t length;
+        int64_t null_count;
+        int64_t offset;
+        int64_t n_buffers;
+        int64_t n_children;
+        const void **buffers;
+        struct ArrowArray **children;
+        struct ArrowArray *dictionary;
+        void (*release)(struct ArrowArray *);
+        void *private_data;
+};
+
+#endif
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+        int (*get_schema)(struct ArrowArrayStream *, struct ArrowSchema *out);
+        int (*get_next)(struct ArrowArrayStream *, struct ArrowArray *out);
+        const char *(*get_last_error)(struct ArrowArrayStream *);
+        void (*release)(struct ArrowArrayStream *);
+        void *private_data;
+};
+
+#endif
+
+
+#define T ResultSet_T
+
+/**
+ * Initialize <code>stream</code> to export the remaining rows of the
+ * ResultSet as Arrow record batches of at most <code>batchRows</code>
+ * rows. The schema has one nullable child per column whose type in
+ * <code>types</code> is not ResultSet_Skip, named after the column:
+ * ResultSet_LLong columns are exported as int64, ResultSet_Double
+ * columns as float64 and ResultSet_String columns as utf8. If
+ * <code>types</code> is NULL, all columns are exported as utf8.
+ * Errors while reading are reported by the stream's get_next callback
+ * with <code>EIO</code> and the SQLException message is available from
+ * get_last_error.
+ * @param R A ResultSet object
+ * @param batchRows The maximum number of rows in a record batch
+ * @param types An array of ResultSet_getColumnCount() column types or NULL
+ * @param stream The stream to initialize. The caller must release it
+ * with stream->release(stream)
+ * @see ResultSet_fetchBatch
+ */
+void ResultSet_exportArrowStream(T R, int batchRows, const ResultSet_Type *types, struct ArrowArrayStream *stream);
+
+#undef T
+#endif
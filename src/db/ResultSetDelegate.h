@@ -25,6 +25,7 @@
 
 #ifndef RESULTSETDELEGATE_INCLUDED
 #define RESULTSETDELEGATE_INCLUDED
+#include <string.h>
 #include "system/Time.h"
 
 /**
@@ -47,8 +48,16 @@ typedef struct Rop_T {
         int (*isnull)(T R, int columnIndex);
         const char *(*getString)(T R, int columnIndex);
         const void *(*getBlob)(T R, int columnIndex, int *size);
+        int (*getInt)(T R, int columnIndex);
+        long long (*getLLong)(T R, int columnIndex);
+        double (*getDouble)(T R, int columnIndex);
         time_t (*getTimestamp)(T R, int columnIndex);
         struct tm *(*getDateTime)(T R, int columnIndex, struct tm *tm);
+        // Optional methods
+        const void *(*getBytes)(T R, int columnIndex, int *size);
+        int (*nextResult)(T R);
+        int (*readBlob)(T R, int columnIndex, long long offset, void *buffer, int length);
+        long long (*getMemory)(T R);    // Bytes of rows and column buffers held by the delegate
 } *Rop_T;
 
 /**
@@ -63,5 +72,19 @@ static inline int checkAndSetColumnIndex(int columnIndex, int columnCount) {
         return i;
 }
 
+
+/**
+ * Copy up to length bytes from offset of a value of size bytes to buffer.
+ * @return The number of bytes copied, 0 if offset is at or past the end
+ */
+static inline int copyBlob(const void *value, long long size, long long offset, void *buffer, int length) {
+        if (! value || offset >= size)
+                return 0;
+        if (length > size - offset)
+                length = (int)(size - offset);
+        memcpy(buffer, (const char *)value + offset, length);
+        return length;
+}
+
 #undef T
 #endif
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Thread.h"
+#include "ResultSet.h"
+#include "ResultSetDelegate.h"
+#include "Snapshot.h"
+
+
+/**
+ * Implementation of the Snapshot interface and of the ResultSet delegate
+ * over a Snapshot. The column names and values are cells in one array,
+ * names first and then the values row by row, pointing into a data area
+ * which directly follows the cells in the same allocation.
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define T Snapshot_T
+
+typedef struct cell_t {
+        long long offset;
+        int size;               // -1 if the value is SQL NULL
+} cell_t;
+
+struct Snapshot_S {
+        int refs;
+        int columnCount;
+        int rowCount;
+        long long size;
+        cell_t *cells;
+        char *data;
+};
+
+/* Cells and data while the ResultSet is read */
+typedef struct builder_t {
+        cell_t *cells;
+        int cellCount;
+        int cellSize;
+        char *data;
+        long long dataLength;
+        long long dataSize;
+} *builder_t;
+
+struct ResultSetDelegate_T {
+        T S;
+        int row;
+};
+
+static void _free(ResultSetDelegate_T *R);
+static int _getColumnCount(ResultSetDelegate_T R);
+static const char *_getColumnName(ResultSetDelegate_T R, int columnIndex);
+static long _getColumnSize(ResultSetDelegate_T R, int columnIndex);
+static int _next(ResultSetDelegate_T R);
+static int _isnull(ResultSetDelegate_T R, int columnIndex);
+static const char *_getString(ResultSetDelegate_T R, int columnIndex);
+static const void *_getBlob(ResultSetDelegate_T R, int columnIndex, int *size);
+
+static const struct Rop_T snapshotrops = {
+        .name           = "snapshot",
+        .free           = _free,
+        .getColumnCount = _getColumnCount,
+        .getColumnName  = _getColumnName,
+        .getColumnSize  = _getColumnSize,
+        .next           = _next,
+        .isnull         = _isnull,
+        .getString      = _getString,
+        .getBlob        = _getBlob,
+        .getBytes       = _getBlob
+};
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+static void _add(builder_t b, const void *value, int size) {
+        if (b->cellCount == b->cellSize) {
+                b->cellSize *= 2;
+                RESIZE(b->cells, b->cellSize * sizeof *b->cells);
+        }
+        if (! value) {
+                b->cells[b->cellCount++] = (cell_t){.size = -1};
+                return;
+        }
+        if (b->dataLength + size + 1 > b->dataSize) {
+                while (b->dataLength + size + 1 > b->dataSize)
+                        b->dataSize *= 2;
+                RESIZE(b->data, b->dataSize);
+        }
+        memcpy(b->data + b->dataLength, value, size);
+        b->data[b->dataLength + size] = 0;
+        b->cells[b->cellCount++] = (cell_t){.offset = b->dataLength, .size = size};
+        b->dataLength += size + 1;
+}
+
+
+/* Read up to maxRows rows, or all rows if maxRows is 0. The row count is tested first so
+   no row is read past maxRows */
+static void _read(builder_t b, ResultSet_T R, int columnCount, int maxRows) {
+        for (int i = 1; i <= columnCount; i++) {
+                const char *name = ResultSet_getColumnName(R, i);
+                _add(b, name, name ? (int)strlen(name) : 0);
+        }
+        for (int rows = 0; (! maxRows || rows < maxRows) && ResultSet_next(R); rows++) {
+                for (int i = 1; i <= columnCount; i++) {
+                        int size = 0;
+                        const void *value = ResultSet_getBytes(R, i, &size);
+                        // An empty value is not NULL
+                        if (! value && ! ResultSet_isnull(R, i))
+                                value = "";
+                        _add(b, value, size);
+                }
+        }
+}
+
+
+/* Copy the cells and the data into one allocation */
+static T _pack(builder_t b, int columnCount) {
+        long long size = sizeof(struct Snapshot_S) + b->cellCount * sizeof(cell_t) + b->dataLength;
+        T S = ALLOC(size);
+        S->refs = 1;
+        S->columnCount = columnCount;
+        S->rowCount = columnCount ? b->cellCount / columnCount - 1 : 0;
+        S->size = size;
+        S->cells = (cell_t *)(S + 1);
+        S->data = (char *)(S->cells + b->cellCount);
+        memcpy(S->cells, b->cells, b->cellCount * sizeof(cell_t));
+        memcpy(S->data, b->data, b->dataLength);
+        return S;
+}
+
+
+static inline cell_t *_cell(ResultSetDelegate_T R, int columnIndex) {
+        int i = checkAndSetColumnIndex(columnIndex, R->S->columnCount);
+        if (R->row < 0 || R->row >= R->S->rowCount)
+                THROW(SQLException, "No current row");
+        return &R->S->cells[(R->row + 1) * R->S->columnCount + i];
+}
+
+
+/* ------------------------------------------------------ ResultSet delegate */
+
+
+static void _free(ResultSetDelegate_T *R) {
+        Snapshot_free(&(*R)->S);
+        FREE(*R);
+}
+
+
+static int _getColumnCount(ResultSetDelegate_T R) {
+        return R->S->columnCount;
+}
+
+
+static const char *_getColumnName(ResultSetDelegate_T R, int columnIndex) {
+        if (columnIndex < 1 || columnIndex > R->S->columnCount)
+                return NULL;
+        cell_t *cell = &R->S->cells[columnIndex - 1];
+        return cell->size < 0 ? NULL : R->S->data + cell->offset;
+}
+
+
+static long _getColumnSize(ResultSetDelegate_T R, int columnIndex) {
+        cell_t *cell = _cell(R, columnIndex);
+        return cell->size < 0 ? 0 : cell->size;
+}
+
+
+static int _next(ResultSetDelegate_T R) {
+        if (R->row < R->S->rowCount)
+                R->row++;
+        return R->row < R->S->rowCount;
+}
+
+
+static int _isnull(ResultSetDelegate_T R, int columnIndex) {
+        return _cell(R, columnIndex)->size < 0;
+}
+
+
+static const char *_getString(ResultSetDelegate_T R, int columnIndex) {
+        cell_t *cell = _cell(R, columnIndex);
+        return cell->size < 0 ? NULL : R->S->data + cell->offset;
+}
+
+
+static const void *_getBlob(ResultSetDelegate_T R, int columnIndex, int *size) {
+        cell_t *cell = _cell(R, columnIndex);
+        if (cell->size < 0)
+                return NULL;
+        *size = cell->size;
+        return R->S->data + cell->offset;
+}
+
+
+/* ------------------------------------------------------------ Public API */
+
+
+T Snapshot_new(ResultSet_T R) {
+        return Snapshot_newRows(R, 0);
+}
+
+
+T Snapshot_newRows(ResultSet_T R, int maxRows) {
+        assert(R);
+        assert(maxRows >= 0);
+        int columnCount = ResultSet_getColumnCount(R);
+        builder_t b;
+        NEW(b);
+        b->cellSize = 64 + columnCount;
+        b->cells = ALLOC(b->cellSize * sizeof *b->cells);
+        b->dataSize = 1024;
+        b->data = ALLOC(b->dataSize);
+        T volatile S = NULL;
+        TRY
+        {
+                _read(b, R, columnCount, maxRows);
+                S = _pack(b, columnCount);
+        }
+        FINALLY
+        {
+                FREE(b->cells);
+                FREE(b->data);
+                FREE(b);
+        }
+        END_TRY;
+        return S;
+}
+
+
+T Snapshot_retain(T S) {
+        assert(S);
+        Atomic_add(S->refs, 1);
+        return S;
+}
+
+
+void Snapshot_free(T *S) {
+        assert(S && *S);
+        if (Atomic_add((*S)->refs, -1) == 0)
+                FREE(*S);
+        *S = NULL;
+}
+
+
+int Snapshot_getRowCount(T S) {
+        assert(S);
+        return S->rowCount;
+}
+
+
+long long Snapshot_getSize(T S) {
+        assert(S);
+        return S->size;
+}
+
+
+ResultSet_T Snapshot_toResultSet(T S) {
+        assert(S);
+        ResultSetDelegate_T D;
+        NEW(D);
+        D->S = Snapshot_retain(S);
+        D->row = -1;
+        return ResultSet_new(D, (Rop_T)&snapshotrops);
+}
+
+
+#undef T
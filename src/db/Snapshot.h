@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef SNAPSHOT_INCLUDED
+#define SNAPSHOT_INCLUDED
+
+
+/**
+ * A Snapshot is a read-only copy of the rows of a ResultSet, kept in a
+ * single allocation and independent of the Connection the rows came
+ * from. A Snapshot is reference counted and immutable, so any number of
+ * threads can read it at the same time, each through a ResultSet of its
+ * own from Snapshot_toResultSet(). Values are kept as returned by
+ * ResultSet_getBytes() and are NUL terminated, so ResultSet_getString()
+ * and ResultSet_getBlob() return the same bytes and numbers and dates
+ * are parsed from their text.
+ *
+ * @file
+ */
+
+
+#define T Snapshot_T
+typedef struct Snapshot_S *T;
+
+
+/**
+ * Create a Snapshot of the remaining rows of a ResultSet. The ResultSet
+ * is read to the end.
+ * @param R A ResultSet
+ * @return A Snapshot with a reference count of 1
+ * @exception SQLException If a database error occurs
+ */
+T Snapshot_new(ResultSet_T R);
+
+
+/**
+ * Create a Snapshot of at most maxRows of the remaining rows of a
+ * ResultSet. The ResultSet is positioned on the last row copied, so
+ * the next Snapshot continues with the row after it.
+ * @param R A ResultSet
+ * @param maxRows The maximum number of rows to copy, 0 for all rows
+ * @return A Snapshot with a reference count of 1
+ * @exception SQLException If a database error occurs
+ */
+T Snapshot_newRows(ResultSet_T R, int maxRows);
+
+
+/**
+ * Add a reference to the Snapshot
+ * @param S A Snapshot
+ * @return S
+ */
+T Snapshot_retain(T S);
+
+
+/**
+ * Release a reference to the Snapshot and set S to NULL. The Snapshot is
+ * freed with the last reference.
+ * @param S A Snapshot reference
+ */
+void Snapshot_free(T *S);
+
+
+/**
+ * Returns the number of rows in the Snapshot
+ * @param S A Snapshot
+ * @return The number of rows
+ */
+int Snapshot_getRowCount(T S);
+
+
+/**
+ * Returns the number of bytes allocated for the Snapshot
+ * @param S A Snapshot
+ * @return The size of the Snapshot in bytes
+ */
+long long Snapshot_getSize(T S);
+
+
+/**
+ * Create a ResultSet positioned before the first row of the Snapshot.
+ * The ResultSet holds a reference to the Snapshot until it is freed
+ * with ResultSet_free().
+ * @param S A Snapshot
+ * @return A new ResultSet
+ */
+ResultSet_T Snapshot_toResultSet(T S);
+
+
+#undef T
+#endif
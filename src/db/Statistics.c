@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "Config.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "Thread.h"
+#include "Statistics.h"
+
+
+/**
+ * Implementation of the Statistics interface. Counters are kept in a
+ * fixed table with a slot per backend and updated with atomic adds,
+ * so recording never takes a lock.
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+// Room for all backends libzdb supports, with some to spare
+#define BACKENDS 8
+
+typedef struct histogram_t {
+        long long count;
+        long long total;
+        long long max;
+        long long buckets[STATISTICS_BUCKETS];
+} histogram_t;
+
+static struct backend_t {
+        const char *name;
+        histogram_t operations[Statistics_Operations];
+} backends[BACKENDS];
+
+volatile int Statistics_enabled = false;
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+/* Four buckets per power of two. Values below 4 have a bucket each, otherwise the bucket
+   is given by the most significant bit and the two bits following it */
+static inline int _bucket(long long micros) {
+        if (micros < 4)
+                return micros < 0 ? 0 : (int)micros;
+        int msb = 63 - __builtin_clzll(micros);
+        int bucket = (msb - 1) * 4 + (int)((micros >> (msb - 2)) & 3);
+        return bucket < STATISTICS_BUCKETS ? bucket : STATISTICS_BUCKETS - 1;
+}
+
+
+/* The largest value in the bucket */
+static inline long long _upperBound(int bucket) {
+        if (bucket < 4)
+                return bucket;
+        bucket++;
+        return ((4LL + bucket % 4) << (bucket / 4 - 1)) - 1;
+}
+
+
+static struct backend_t *_getBackend(const char *name, int create) {
+        for (int i = 0; i < BACKENDS; i++) {
+                const char *n = backends[i].name;
+                if (! n) {
+                        if (! create)
+                                return NULL;
+                        if (Atomic_cas(backends[i].name, NULL, name))
+                                return &backends[i];
+                        n = backends[i].name;
+                }
+                if (n == name || Str_isEqual(n, name))
+                        return &backends[i];
+        }
+        return NULL;
+}
+
+
+/* ----------------------------------------------------- Protected methods */
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility push(hidden)
+#endif
+
+long long Statistics_now(void) {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (long long)t.tv_sec * 1000000LL + t.tv_nsec / 1000 + 1;
+}
+
+
+void Statistics_add(const char *backend, Statistics_Operation operation, long long micros) {
+        assert(operation >= 0 && operation < Statistics_Operations);
+        struct backend_t *b = _getBackend(backend, true);
+        if (b) {
+                histogram_t *h = &b->operations[operation];
+                Atomic_add(h->count, 1);
+                Atomic_add(h->total, micros);
+                Atomic_add(h->buckets[_bucket(micros)], 1);
+                for (long long max = h->max; micros > max; max = h->max)
+                        if (Atomic_cas(h->max, max, micros))
+                                break;
+        }
+}
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility pop
+#endif
+
+
+/* ------------------------------------------------------------ Public API */
+
+
+void Statistics_setEnabled(int enabled) {
+#ifndef ZDB_NO_STATISTICS
+        Statistics_enabled = enabled;
+#endif
+}
+
+
+int Statistics_isEnabled(void) {
+        return Statistics_enabled;
+}
+
+
+int Statistics_get(const char *backend, Statistics_Operation operation, Statistics_Histogram_T *histogram) {
+        assert(backend);
+        assert(operation >= 0 && operation < Statistics_Operations);
+        assert(histogram);
+        memset(histogram, 0, sizeof *histogram);
+        struct backend_t *b = _getBackend(backend, false);
+        if (! b)
+                return false;
+        histogram_t *h = &b->operations[operation];
+        histogram->count = Atomic_get(h->count);
+        histogram->total = Atomic_get(h->total);
+        histogram->max = Atomic_get(h->max);
+        for (int i = 0; i < STATISTICS_BUCKETS; i++)
+                histogram->buckets[i] = Atomic_get(h->buckets[i]);
+        return true;
+}
+
+
+long long Statistics_percentile(const Statistics_Histogram_T *histogram, double percent) {
+        assert(histogram);
+        long long count = 0;
+        for (int i = 0; i < STATISTICS_BUCKETS; i++)
+                count += histogram->buckets[i];
+        if (count == 0)
+                return 0;
+        long long rank = (long long)(count * percent / 100.0 + 0.5);
+        if (rank < 1)
+                rank = 1;
+        long long seen = 0;
+        for (int i = 0; i < STATISTICS_BUCKETS; i++) {
+                seen += histogram->buckets[i];
+                if (seen >= rank)
+                        return _upperBound(i) < histogram->max ? _upperBound(i) : histogram->max;
+        }
+        return histogram->max;
+}
+
+
+void Statistics_reset(void) {
+        // Backend names are kept, a thread may be recording into its slot
+        for (int i = 0; i < BACKENDS; i++)
+                memset(backends[i].operations, 0, sizeof backends[i].operations);
+}
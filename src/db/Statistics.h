@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef STATISTICS_INCLUDED
+#define STATISTICS_INCLUDED
+
+
+/**
+ * <b>Statistics</b> collects call counts and latency histograms for
+ * operations in libzdb, per database backend. Statistics are disabled
+ * by default and cost a single test of a flag per operation until
+ * enabled with Statistics_setEnabled(). Configure libzdb with
+ * <code>--disable-statistics</code> to compile the instrumentation out.
+ *
+ * Latencies are measured in microseconds with a monotonic clock and
+ * kept in a histogram with four buckets per power of two, so a
+ * percentile is accurate to within 25%. Only calls which succeed are
+ * recorded. Statistics_Checkout measures the time spent in
+ * ConnectionPool_getConnection() and
+ * ConnectionPool_getConnectionWithTimeout(), including waiting for a
+ * connection, and can be compared with the time spent executing
+ * statements to tell pool wait time apart from server time. Example:
+ * <pre>
+ * Statistics_setEnabled(true);
+ * ...
+ * Statistics_Histogram_T h;
+ * if (Statistics_get("postgresql", Statistics_ExecuteQuery, &h))
+ *         printf("%lld queries, p99 %lld us\n", h.count, Statistics_percentile(&h, 99));
+ * </pre>
+ * Backends are named as in the connection URL protocol, e.g.
+ * "mysql", "postgresql", "sqlite" or "oracle".
+ *
+ * @file
+ */
+
+
+/**
+ * The number of buckets in a Statistics histogram
+ */
+#define STATISTICS_BUCKETS 160
+
+/**
+ * Instrumented operations
+ */
+typedef enum {
+        Statistics_Checkout = 0,        ///< Getting a Connection from a ConnectionPool
+        Statistics_Execute,             ///< Connection_execute()
+        Statistics_ExecuteQuery,        ///< Connection_executeQuery()
+        Statistics_PreparedExecute,     ///< PreparedStatement_execute() and PreparedStatement_executeQuery()
+        Statistics_Next,                ///< ResultSet_next()
+        Statistics_Operations
+} Statistics_Operation;
+
+/**
+ * A snapshot of the latency histogram of an operation
+ */
+typedef struct Statistics_Histogram_T {
+        long long count;                        ///< Number of calls recorded
+        long long total;                        ///< Sum of latencies in microseconds
+        long long max;                          ///< Largest latency in microseconds
+        long long buckets[STATISTICS_BUCKETS];  ///< Calls per latency bucket
+} Statistics_Histogram_T;
+
+
+//<< Protected methods
+
+extern volatile int Statistics_enabled;
+
+#ifdef ZDB_NO_STATISTICS
+#define Statistics_start() 0LL
+#define Statistics_record(backend, operation, start) ((void)(start))
+#else
+/* Returns a start time for Statistics_record() or 0 if statistics are disabled */
+#define Statistics_start() (Statistics_enabled ? Statistics_now() : 0LL)
+#define Statistics_record(backend, operation, start) \
+        do { if (start) Statistics_add((backend), (operation), Statistics_now() - (start)); } while (0)
+#endif
+
+/**
+ * Returns a monotonic time in microseconds, never 0
+ * @return Microseconds since an arbitrary point in time
+ */
+long long Statistics_now(void);
+
+/**
+ * Record a call to an operation
+ * @param backend The backend name
+ * @param operation The operation
+ * @param micros The latency in microseconds
+ */
+void Statistics_add(const char *backend, Statistics_Operation operation, long long micros);
+
+//>> End Protected methods
+
+
+/** @name Class methods */
+//@{
+
+/**
+ * Enable or disable collection of statistics. Collected statistics
+ * are kept when disabled. In a library configured with
+ * <code>--disable-statistics</code> this method has no effect.
+ * @param enabled true to collect statistics, false to stop
+ */
+void Statistics_setEnabled(int enabled);
+
+
+/**
+ * Returns true if statistics are collected
+ * @return true if enabled, otherwise false
+ */
+int Statistics_isEnabled(void);
+
+
+/**
+ * Get a snapshot of the histogram of an operation for a backend.
+ * Calls may be recorded concurrently, so the fields of the snapshot
+ * can be off by the calls in progress.
+ * @param backend The backend name, e.g. "postgresql"
+ * @param operation The operation
+ * @param histogram The snapshot is stored here
+ * @return true if statistics were recorded for the backend, otherwise
+ * false and histogram is zeroed
+ */
+int Statistics_get(const char *backend, Statistics_Operation operation, Statistics_Histogram_T *histogram);
+
+
+/**
+ * Returns the latency below which <code>percent</code> of the calls in
+ * the histogram completed, rounded up to the upper bound of its bucket
+ * @param histogram A histogram snapshot from Statistics_get()
+ * @param percent The percentile, e.g. 50 for the median or 99.9
+ * @return The latency in microseconds or 0 if the histogram is empty
+ */
+long long Statistics_percentile(const Statistics_Histogram_T *histogram, double percent);
+
+
+/**
+ * Remove all collected statistics
+ */
+void Statistics_reset(void);
+
+//@}
+
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "URL.h"
+#include "ResultSet.h"
+#include "PreparedStatement.h"
+#include "Connection.h"
+#include "ConnectionPool.h"
+#include "Trace.h"
+
+
+/**
+ * Implementation of the slow query log
+ *
+ * @file
+ */
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+static inline int _isWord(char c) {
+        return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+
+/* Replace string and numeric literals with '?' so statements differing only in their
+   values are reported with the same text. The caller must free the result */
+static char *_normalize(const char *sql) {
+        char *normalized = ALLOC(strlen(sql) + 1);
+        char *d = normalized;
+        for (const char *s = sql; *s;) {
+                if (*s == '\'') {
+                        // A quote inside a literal is doubled
+                        for (s++; *s && ! (*s == '\'' && s[1] != '\''); s++)
+                                if (*s == '\'')
+                                        s++;
+                        if (*s)
+                                s++;
+                        *d++ = '?';
+                } else if (isdigit((unsigned char)*s) && (s == sql || ! _isWord(s[-1]))) {
+                        while (_isWord(*s) || *s == '.')
+                                s++;
+                        *d++ = '?';
+                } else {
+                        *d++ = *s++;
+                }
+        }
+        *d = 0;
+        return normalized;
+}
+
+
+/* ----------------------------------------------------- Protected methods */
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility push(hidden)
+#endif
+
+void Trace_logSlowQuery(span_t *span, const char *backend, const char *sql, long long rows) {
+        assert(span);
+        Trace_T t = span->trace;
+        char *normalized = t->normalize && sql ? _normalize(sql) : NULL;
+        ConnectionPool_SlowQuery_T query = {
+                .sql = normalized ? normalized : sql,
+                .backend = backend,
+                .micros = span->micros,
+                .rows = rows
+        };
+        t->slowQueryHandler(&query, t->slowQueryContext);
+        FREE(normalized);
+}
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility pop
+#endif
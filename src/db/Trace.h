@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef TRACE_INCLUDED
+#define TRACE_INCLUDED
+#include "Thread.h"
+#include "Statistics.h"
+
+
+/**
+ * Trace holds the ConnectionPool_Tracer_T callbacks and the slow query
+ * log settings of a pool. Connections, prepared statements and result
+ * sets keep a pointer to their pool's Trace and call the tracer around
+ * delegate operations with:
+ * <pre>
+ * TRACE_BEGIN(C->trace, "commit", NULL);
+ * int success = COP(C)->commit(C->D);
+ * TRACE_END(-1, success ? NULL : Connection_getLastError(C));
+ * </pre>
+ * If no tracer is registered only the tracer's begin callback is
+ * tested, and the arguments to TRACE_END are not evaluated. Statement
+ * execution also reports slow statements with Trace_begin(),
+ * Trace_end(), Trace_isSlow() and Trace_logSlowQuery(). Requires ConnectionPool.h.
+ *
+ * @file
+ */
+
+
+typedef struct Trace_S {
+        ConnectionPool_Tracer_T tracer;
+        long long slowMicros;           // Slow query threshold, 0 if the slow query log is off
+        int sampling;                   // Report one of this many slow queries
+        int normalize;                  // Replace literals with '?' in reported SQL
+        int slowQueries;                // Number of slow queries, for sampling
+        void (*slowQueryHandler)(const ConnectionPool_SlowQuery_T *query, void *context);
+        void *slowQueryContext;
+} *Trace_T;
+
+
+/* A traced call */
+typedef struct span_t {
+        Trace_T trace;
+        const char *operation;
+        void *span;
+        long long start;
+        long long micros;
+} span_t;
+
+
+#define Trace_isTracing(t) ((t) && (t)->tracer.begin)
+#define Trace_isEnabled(t) ((t) && ((t)->tracer.begin || (t)->slowMicros))
+
+
+static inline void Trace_begin(span_t *span, Trace_T t, const char *operation, const char *sql) {
+        span->trace = t;
+        span->operation = operation;
+        span->span = t->tracer.begin ? t->tracer.begin(t->tracer.context, operation, sql) : NULL;
+        span->start = Statistics_now();
+}
+
+
+static inline void Trace_end(span_t *span, long long rows, const char *error) {
+        Trace_T t = span->trace;
+        span->micros = Statistics_now() - span->start;
+        if (t->tracer.begin && t->tracer.end)
+                t->tracer.end(t->tracer.context, span->span, span->operation, rows, span->micros, error);
+}
+
+
+/* Returns true if the ended call was slow and is sampled for the slow query log */
+static inline int Trace_isSlow(span_t *span) {
+        Trace_T t = span->trace;
+        if (t->slowMicros && span->micros >= t->slowMicros)
+                return (Atomic_add(t->slowQueries, 1) - 1) % t->sampling == 0;
+        return false;
+}
+
+
+/**
+ * Report a slow query, after Trace_isSlow() returned true
+ * @param span The traced call
+ * @param backend The backend name
+ * @param sql The SQL statement
+ * @param rows Number of rows affected or -1
+ */
+void Trace_logSlowQuery(span_t *span, const char *backend, const char *sql, long long rows);
+
+
+#define TRACE_BEGIN(t, operation, sql) \
+        span_t span = {.trace = NULL}; \
+        if (Trace_isTracing(t)) Trace_begin(&span, (t), (operation), (sql))
+
+
+#define TRACE_END(rows, error) \
+        do { if (span.trace) Trace_end(&span, (rows), (error)); } while (0)
+
+
+#endif
@@ -29,13 +29,18 @@
 #include <string.h>
 #include <mysql.h>
 #include <errmsg.h>
+#include <mysqld_error.h>
 
 #include "URL.h"
+#include "Thread.h"
+#include "system/Watchdog.h"
 #include "ResultSet.h"
 #include "StringBuffer.h"
 #include "PreparedStatement.h"
 #include "MysqlResultSet.h"
+#include "MysqlTextResultSet.h"
 #include "MysqlPreparedStatement.h"
+#include "Connection.h"
 #include "ConnectionDelegate.h"
 #include "MysqlConnection.h"
 
@@ -43,9 +48,6 @@
 /**
  * Implementation of the Connection/Delegate interface for mysql. 
  *
- * TODO: Query Timeout has no effect as this is not implemented, 
- * see MysqlConnection_setQueryTimeout() below.
- *
  * @file
  */
 
@@ -68,80 +70,137 @@ const struct Cop_T mysqlcops = {
         .execute		= MysqlConnection_execute,
         .executeQuery		= MysqlConnection_executeQuery,
         .prepareStatement	= MysqlConnection_prepareStatement,
-        .getLastError		= MysqlConnection_getLastError
+        .getLastError		= MysqlConnection_getLastError,
+        .isRetryable		= MysqlConnection_isRetryable,
+        .newContext		= MysqlConnection_newContext,
+        .freeContext		= MysqlConnection_freeContext,
+        .setFetchSize		= MysqlConnection_setFetchSize
 };
 
+/* Connector/C 8.0.29 can export the TLS session of a connection so the next connect
+   resumes it instead of doing a full handshake. MariaDB Connector/C has no such API */
+#if MYSQL_VERSION_ID >= 80029 && ! defined(MARIADB_BASE_VERSION) && ! defined(LIBMARIADB)
+#define MYSQL_TLS_SESSION 1
+#endif
+
+/* Connect settings of a pool, derived from the URL once. Strings point into the URL,
+   which outlives the pool */
+typedef struct context_t {
+        char *error;                    // Set if the URL is invalid, reported by each connect
+        const char *user;
+        const char *password;
+        const char *host;
+        const char *database;
+        const char *unixSocket;
+        const char *charset;
+        int port;
+        int connectTimeout;
+        int ssl;
+        my_bool secureAuth;
+        unsigned long clientFlags;
+        MysqlResult_Mode resultMode;
+        int prefetchRows;
+        int textProtocol;
+#ifdef MYSQL_TLS_SESSION
+        Mutex_T mutex;
+        char *session;                  // TLS session of the last connect, resumed by the next
+#endif
+} *context_t;
+
 #define T ConnectionDelegate_T
 struct T {
         URL_T url;
+        context_t context;
 	MYSQL *db;
 	int maxRows;
 	int timeout;
 	int lastError;
+        MysqlResult_Mode resultMode;
+        int prefetchRows;
+        int fetchSize;
+        int textProtocol;
         StringBuffer_T sb;
+        StringBuffer_T pending;         // Deferred START TRANSACTION sent with the next statement
+        Watchdog_T watchdog;
 };
 #define MYSQL_OK 0
+#define MYSQL_PREFETCH_ROWS 100
 
 extern const struct Rop_T mysqlrops;
+extern const struct Rop_T mysqltextrops;
 extern const struct Pop_T mysqlpops;
 
 
 /* ------------------------------------------------------- Private methods */
 
 
-static MYSQL *_doConnect(URL_T url, char **error) {
-#define ERROR(e) do {*error = Str_dup(e); goto error;} while (0)
-        int port;
+#ifdef MYSQL_TLS_SESSION
+/* Resume the TLS session of the last connect, if any. The caller frees the returned copy
+   after the connect, in case the option is not copied by the client library */
+static char *_resumeSession(context_t X, MYSQL *db) {
+        char *session = NULL;
+        LOCK(X->mutex)
+        {
+                session = X->session ? Str_dup(X->session) : NULL;
+        }
+        END_LOCK;
+        if (session)
+                mysql_options(db, MYSQL_OPT_SSL_SESSION_DATA, session);
+        return session;
+}
+
+
+/* Keep the TLS session of a new connection for the next connect */
+static void _saveSession(context_t X, MYSQL *db) {
+        unsigned int length = 0;
+        void *data = mysql_get_ssl_session_data(db, 0, &length);
+        if (data) {
+                LOCK(X->mutex)
+                {
+                        FREE(X->session);
+                        X->session = Str_dup(data);
+                }
+                END_LOCK;
+                mysql_free_ssl_session_data(db, data);
+        }
+}
+#endif
+
+
+static MYSQL *_doConnect(context_t X, char **error) {
         my_bool yes = 1;
-        my_bool no = 0;
-        int connectTimeout = SQL_DEFAULT_TCP_TIMEOUT;
-        unsigned long clientFlags = CLIENT_MULTI_STATEMENTS;
-        const char *user, *password, *host, *database, *charset, *timeout;
-        const char *unix_socket = URL_getParameter(url, "unix-socket");
+        if (X->error) {
+                *error = Str_dup(X->error);
+                return NULL;
+        }
         MYSQL *db = mysql_init(NULL);
         if (! db) {
                 *error = Str_dup("unable to allocate mysql handler");
                 return NULL;
         } 
-        if (! (user = URL_getUser(url)))
-                if (! (user = URL_getParameter(url, "user")))
-                        ERROR("no username specified in URL");
-        if (! (password = URL_getPassword(url)))
-                if (! (password = URL_getParameter(url, "password")))
-                        ERROR("no password specified in URL");
-        if (unix_socket) {
-		host = "localhost"; // Make sure host is localhost if unix socket is to be used
-        } else if (! (host = URL_getHost(url)))
-                ERROR("no host specified in URL");
-        if ((port = URL_getPort(url)) <= 0)
-                ERROR("no port specified in URL");
-        if (! (database = URL_getPath(url)))
-                ERROR("no database specified in URL");
-        else
-                database++;
         /* Options */
-        if (IS(URL_getParameter(url, "compress"), "true"))
-                clientFlags |= CLIENT_COMPRESS;
-        if (IS(URL_getParameter(url, "use-ssl"), "true"))
+        if (X->ssl)
                 mysql_ssl_set(db, 0,0,0,0,0);
-        if (IS(URL_getParameter(url, "secure-auth"), "true"))
-                mysql_options(db, MYSQL_SECURE_AUTH, (const char*)&yes);
-        else
-                mysql_options(db, MYSQL_SECURE_AUTH, (const char*)&no);
-        if ((timeout = URL_getParameter(url, "connect-timeout"))) {
-                TRY connectTimeout = Str_parseInt(timeout); ELSE ERROR("invalid connect timeout value"); END_TRY;
-        }
-        mysql_options(db, MYSQL_OPT_CONNECT_TIMEOUT, (const char*)&connectTimeout);
-        if ((charset = URL_getParameter(url, "charset")))
-                mysql_options(db, MYSQL_SET_CHARSET_NAME, charset);
+        mysql_options(db, MYSQL_SECURE_AUTH, (const char*)&X->secureAuth);
+        mysql_options(db, MYSQL_OPT_CONNECT_TIMEOUT, (const char*)&X->connectTimeout);
+        if (X->charset)
+                mysql_options(db, MYSQL_SET_CHARSET_NAME, X->charset);
 #if MYSQL_VERSION_ID >= 50013
         mysql_options(db, MYSQL_OPT_RECONNECT, (const char*)&yes);
+#endif
+#ifdef MYSQL_TLS_SESSION
+        char *session = X->ssl ? _resumeSession(X, db) : NULL;
 #endif
         /* Connect */
-        if (mysql_real_connect(db, host, user, password, database, port, unix_socket, clientFlags))
+        MYSQL *connected = mysql_real_connect(db, X->host, X->user, X->password, X->database, X->port, X->unixSocket, X->clientFlags);
+#ifdef MYSQL_TLS_SESSION
+        FREE(session);
+        if (connected && X->ssl)
+                _saveSession(X, db);
+#endif
+        if (connected)
                 return db;
         *error = Str_dup(mysql_error(db));
-error:
         mysql_close(db);
         return NULL;
 }
@@ -163,6 +222,79 @@ static int _prepare(T C, const char *sql, int len, MYSQL_STMT **stmt) {
 }
 
 
+/* Watchdog alarm. MySQL has no client side way to interrupt a statement, so
+ kill it from a control connection. Only the statement is killed, not the connection.
+ The alarm runs on a thread of its own, so the connect does not hold up other timeouts */
+static void _kill(void *args) {
+        T C = args;
+        char *error = NULL;
+        unsigned long id = mysql_thread_id(C->db);
+        MYSQL *control = _doConnect(C->context, &error);
+        if (control) {
+                char kill[64];
+                snprintf(kill, sizeof(kill), "KILL QUERY %lu", id);
+                if (mysql_query(control, kill))
+                        DEBUG("Query timeout -- %s failed: %s\n", kill, mysql_error(control));
+                mysql_close(control);
+        } else {
+                DEBUG("Query timeout -- cannot connect to kill query %lu: %s\n", id, error);
+                FREE(error);
+        }
+}
+
+
+/* Rows to prefetch from a server side cursor in cursor result mode, 0 in other modes */
+static inline int _prefetchRows(T C) {
+        if (C->resultMode != MysqlResult_Cursor)
+                return 0;
+        return (C->fetchSize > 0) ? C->fetchSize : C->prefetchRows;
+}
+
+
+/* Set the statement in sb, after a deferred START TRANSACTION if one is pending. Returns
+   the number of statements put before the statement, whose results the caller must skip */
+static int _setStatement(T C, const char *sql, va_list ap) {
+        va_list ap_copy;
+        int statements = 0;
+        if (StringBuffer_length(C->pending) > 0) {
+                for (const char *s = StringBuffer_toString(C->pending); *s; s++)
+                        if (*s == ';')
+                                statements++;
+                StringBuffer_set(C->sb, "%s", StringBuffer_toString(C->pending));
+                StringBuffer_clear(C->pending);
+        } else {
+                StringBuffer_clear(C->sb);
+        }
+        va_copy(ap_copy, ap);
+        StringBuffer_vappend(C->sb, sql, ap_copy);
+        va_end(ap_copy);
+        return statements;
+}
+
+
+/* Run the query with the text protocol, without a server side prepared statement. A stored
+   result is read with mysql_store_result, otherwise rows are read with mysql_use_result as
+   the text protocol has no cursors */
+static ResultSet_T _executeTextQuery(T C) {
+        MYSQL_RES *res = NULL;
+        int stream = C->resultMode != MysqlResult_Store;
+        if (C->timeout > 0)
+                Watchdog_start(C->watchdog, C->timeout);
+        if (! (C->lastError = mysql_real_query(C->db, StringBuffer_toString(C->sb), StringBuffer_length(C->sb)))) {
+                // Start with the first statement returning rows, see ResultSet_nextResult(). A NULL result without an error is a statement which does not return rows
+                while (! (res = stream ? mysql_use_result(C->db) : mysql_store_result(C->db)) && ! mysql_errno(C->db))
+                        if ((C->lastError = mysql_next_result(C->db)) != MYSQL_OK)
+                                break;
+                if (C->lastError < 0) // No more results
+                        C->lastError = MYSQL_OK;
+        }
+        Watchdog_stop(C->watchdog);
+        if (C->lastError || (! res && mysql_errno(C->db)))
+                return NULL;
+        return ResultSet_new(MysqlTextResultSet_new(C->db, res, C->maxRows, stream), (Rop_T)&mysqltextrops);
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -170,41 +302,137 @@ static int _prepare(T C, const char *sql, int len, MYSQL_STMT **stmt) {
 #pragma GCC visibility push(hidden)
 #endif
 
-T MysqlConnection_new(URL_T url, char **error) {
+/* Send a deferred START TRANSACTION before a prepared statement is executed and read
+   its results. Returns MYSQL_OK or the error, the pending statements are cleared */
+int MysqlConnection_sendPending(MYSQL *db, StringBuffer_T pending) {
+        int status = MYSQL_OK;
+        if (StringBuffer_length(pending) > 0) {
+                if (! (status = mysql_real_query(db, StringBuffer_toString(pending), StringBuffer_length(pending))))
+                        while ((status = mysql_next_result(db)) == MYSQL_OK);
+                if (status < 0) // No more results
+                        status = MYSQL_OK;
+                StringBuffer_clear(pending);
+        }
+        return status;
+}
+
+
+void *MysqlConnection_newContext(URL_T url) {
+#define ERROR(e) do {X->error = Str_dup(e); return X;} while (0)
+        context_t X;
+        assert(url);
+        NEW(X);
+#ifdef MYSQL_TLS_SESSION
+        Mutex_init(X->mutex);
+#endif
+        X->clientFlags = CLIENT_MULTI_STATEMENTS;
+        X->connectTimeout = SQL_DEFAULT_TCP_TIMEOUT;
+        X->unixSocket = URL_getParameter(url, "unix-socket");
+        if (! (X->user = URL_getUser(url)))
+                if (! (X->user = URL_getParameter(url, "user")))
+                        ERROR("no username specified in URL");
+        if (! (X->password = URL_getPassword(url)))
+                if (! (X->password = URL_getParameter(url, "password")))
+                        ERROR("no password specified in URL");
+        if (X->unixSocket) {
+		X->host = "localhost"; // Make sure host is localhost if unix socket is to be used
+        } else if (! (X->host = URL_getHost(url)))
+                ERROR("no host specified in URL");
+        if ((X->port = URL_getPort(url)) <= 0)
+                ERROR("no port specified in URL");
+        if (! (X->database = URL_getPath(url)))
+                ERROR("no database specified in URL");
+        else
+                X->database++;
+        /* Options */
+        if (IS(URL_getParameter(url, "compress"), "true"))
+                X->clientFlags |= CLIENT_COMPRESS;
+        X->ssl = IS(URL_getParameter(url, "use-ssl"), "true");
+        X->secureAuth = IS(URL_getParameter(url, "secure-auth"), "true");
+        const char *timeout = URL_getParameter(url, "connect-timeout");
+        if (timeout) {
+                TRY X->connectTimeout = Str_parseInt(timeout); ELSE X->connectTimeout = -1; END_TRY;
+                if (X->connectTimeout < 0)
+                        ERROR("invalid connect timeout value");
+        }
+        X->charset = URL_getParameter(url, "charset");
+        X->resultMode = MysqlResult_Store;
+        const char *mode = URL_getParameter(url, "result-mode");
+        if (IS(mode, "stream")) {
+                X->resultMode = MysqlResult_Stream;
+        } else if (IS(mode, "cursor")) {
+                X->resultMode = MysqlResult_Cursor;
+        } else if (mode && ! IS(mode, "store")) {
+                ERROR("invalid result mode, expected store, stream or cursor");
+        }
+        X->prefetchRows = MYSQL_PREFETCH_ROWS;
+        const char *rows = URL_getParameter(url, "prefetch-rows");
+        if (rows) {
+                TRY X->prefetchRows = Str_parseInt(rows); ELSE X->prefetchRows = 0; END_TRY;
+                if (X->prefetchRows <= 0)
+                        ERROR("invalid prefetch rows value");
+        }
+        const char *protocol = URL_getParameter(url, "query-protocol");
+        if (protocol && ! IS(protocol, "text") && ! IS(protocol, "binary"))
+                ERROR("invalid query protocol, expected text or binary");
+        X->textProtocol = IS(protocol, "text");
+        return X;
+}
+
+
+void MysqlConnection_freeContext(void **context) {
+        assert(context && *context);
+        context_t X = *context;
+#ifdef MYSQL_TLS_SESSION
+        Mutex_destroy(X->mutex);
+        FREE(X->session);
+#endif
+        FREE(X->error);
+        FREE(X);
+        *context = NULL;
+}
+
+
+T MysqlConnection_new(URL_T url, void *context, char **error) {
 	T C;
         MYSQL *db;
 	assert(url);
+        assert(context);
         assert(error);
-        if (! (db = _doConnect(url, error)))
+        context_t X = context;
+        if (! (db = _doConnect(X, error)))
                 return NULL;
 	NEW(C);
         C->db = db;
+        C->context = X;
+        C->textProtocol = X->textProtocol;
         C->url = url;
+        C->resultMode = X->resultMode;
+        C->prefetchRows = X->prefetchRows;
         C->sb = StringBuffer_create(STRLEN);
+        C->pending = StringBuffer_create(STRLEN);
         C->timeout = SQL_DEFAULT_TIMEOUT;
+        C->watchdog = Watchdog_new(_kill, C);
 	return C;
 }
 
 
 void MysqlConnection_free(T *C) {
 	assert(C && *C);
+        Watchdog_free(&(*C)->watchdog);
         mysql_close((*C)->db);
         StringBuffer_free(&(*C)->sb);
+        StringBuffer_free(&(*C)->pending);
 	FREE(*C);
 }
 
 
 /* 
- TODO: Query Timeout has no effect as this is not implemented in MySQL. 
- MySQL does not provide a general way to do this. The MySQL
- JDBC driver implements query timeout by running a separate timer
- thread and then KILL the process in the server if query execution 
- time exceed timeout. This is a brute force approach with potential
- resource side-effects which we'd rather not use. 
- 
- If you use innodb, setting innodb_lock_wait_timeout in the server
- can be a possible alternative. Default innodb_lock_wait_timeout is 50 sec.
- 
+ MySQL does not provide a general way to time out a query. Like the MySQL
+ JDBC driver, a statement running longer than the timeout is killed with
+ KILL QUERY from a separate connection, see _kill() above. The statement
+ fails with "Query execution was interrupted" and the connection remains
+ usable.
  */
 void MysqlConnection_setQueryTimeout(T C, int ms) {
 	assert(C);
@@ -218,21 +446,45 @@ void MysqlConnection_setMaxRows(T C, int max) {
 }
 
 
+void MysqlConnection_setFetchSize(T C, int rows) {
+        assert(C);
+        C->fetchSize = rows;
+}
+
+
 int MysqlConnection_ping(T C) {
         assert(C);
         return (mysql_ping(C->db) == 0);
 }
 
 
-int MysqlConnection_beginTransaction(T C) {
+int MysqlConnection_beginTransaction(T C, int type) {
 	assert(C);
-        C->lastError = mysql_query(C->db, "START TRANSACTION;");
+        static const char *isolation[] = {NULL, "READ COMMITTED", "REPEATABLE READ", "SERIALIZABLE"};
+        int level = type & ~(Transaction_ReadOnly | Transaction_Deferred);
+        // As with START TRANSACTION, a transaction which was not started yet is ended
+        StringBuffer_clear(C->pending);
+        if (isolation[level])
+                StringBuffer_append(C->pending, "SET TRANSACTION ISOLATION LEVEL %s;", isolation[level]);
+        StringBuffer_append(C->pending, "START TRANSACTION%s;", (type & Transaction_ReadOnly) ? " READ ONLY" : "");
+        if (type & Transaction_Deferred) {
+                // Sent with the next statement, see _setStatement and MysqlConnection_sendPending
+                C->lastError = MYSQL_OK;
+                return true;
+        }
+        C->lastError = MysqlConnection_sendPending(C->db, C->pending);
         return (C->lastError == MYSQL_OK);
 }
 
 
 int MysqlConnection_commit(T C) {
 	assert(C);
+        if (StringBuffer_length(C->pending) > 0) {
+                // Nothing was sent in the transaction
+                StringBuffer_clear(C->pending);
+                C->lastError = MYSQL_OK;
+                return true;
+        }
         C->lastError = mysql_query(C->db, "COMMIT;");
         return (C->lastError == MYSQL_OK);
 }
@@ -240,6 +492,11 @@ int MysqlConnection_commit(T C) {
 
 int MysqlConnection_rollback(T C) {
 	assert(C);
+        if (StringBuffer_length(C->pending) > 0) {
+                StringBuffer_clear(C->pending);
+                C->lastError = MYSQL_OK;
+                return true;
+        }
         C->lastError = mysql_query(C->db, "ROLLBACK;");
         return (C->lastError == MYSQL_OK);
 }
@@ -258,12 +515,15 @@ long long MysqlConnection_rowsChanged(T C) {
 
 
 int MysqlConnection_execute(T C, const char *sql, va_list ap) {
-        va_list ap_copy;
 	assert(C);
-        va_copy(ap_copy, ap);
-        StringBuffer_vset(C->sb, sql, ap_copy);
-        va_end(ap_copy);
+        int skip = _setStatement(C, sql, ap);
+        if (C->timeout > 0)
+                Watchdog_start(C->watchdog, C->timeout);
         C->lastError = mysql_real_query(C->db, StringBuffer_toString(C->sb), StringBuffer_length(C->sb));
+        // Move on to the result of the statement, past a deferred START TRANSACTION
+        for (; skip > 0 && C->lastError == MYSQL_OK; skip--)
+                C->lastError = mysql_next_result(C->db);
+        Watchdog_stop(C->watchdog);
 	return (C->lastError == MYSQL_OK);
 }
 
@@ -272,20 +532,36 @@ ResultSet_T MysqlConnection_executeQuery(T C, const char *sql, va_list ap) {
         va_list ap_copy;
         MYSQL_STMT *stmt = NULL;
 	assert(C);
+        // A deferred START TRANSACTION does not return rows and is skipped as such
+        if (C->textProtocol) {
+                _setStatement(C, sql, ap);
+                return _executeTextQuery(C);
+        }
+        if ((C->lastError = MysqlConnection_sendPending(C->db, C->pending)))
+                return NULL;
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
         if (_prepare(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), &stmt)) {
 #if MYSQL_VERSION_ID >= 50002
-                unsigned long cursor = CURSOR_TYPE_READ_ONLY;
+                // Without a cursor the server sends the result as it is produced, a cursor materializes it in a temporary table first
+                unsigned long cursor = (C->resultMode == MysqlResult_Cursor) ? CURSOR_TYPE_READ_ONLY : CURSOR_TYPE_NO_CURSOR;
                 mysql_stmt_attr_set(stmt, STMT_ATTR_CURSOR_TYPE, &cursor);
-#endif
-                if ((C->lastError = mysql_stmt_execute(stmt))) {
-                        StringBuffer_set(C->sb, "%s", mysql_stmt_error(stmt));
-                        mysql_stmt_close(stmt);
+                if (_prefetchRows(C) > 0) {
+                        unsigned long rows = _prefetchRows(C);
+                        mysql_stmt_attr_set(stmt, STMT_ATTR_PREFETCH_ROWS, &rows);
                 }
-                else
-                        return ResultSet_new(MysqlResultSet_new(stmt, C->maxRows, false), (Rop_T)&mysqlrops);
+#endif
+                if (C->timeout > 0)
+                        Watchdog_start(C->watchdog, C->timeout);
+                ResultSetDelegate_T R = NULL;
+                if (! (C->lastError = mysql_stmt_execute(stmt)))
+                        R = MysqlResultSet_new(stmt, C->maxRows, false, C->resultMode != MysqlResult_Store);
+                Watchdog_stop(C->watchdog);
+                if (R)
+                        return ResultSet_new(R, (Rop_T)&mysqlrops);
+                StringBuffer_set(C->sb, "%s", mysql_stmt_error(stmt));
+                mysql_stmt_close(stmt);
         }
         return NULL;
 }
@@ -300,7 +576,7 @@ PreparedStatement_T MysqlConnection_prepareStatement(T C, const char *sql, va_li
         va_end(ap_copy);
         if (_prepare(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), &stmt)) {
                 int parameterCount = (int)mysql_stmt_param_count(stmt);
-		return PreparedStatement_new(MysqlPreparedStatement_new(stmt, C->maxRows, parameterCount), (Pop_T)&mysqlpops, parameterCount);
+		return PreparedStatement_new(MysqlPreparedStatement_new(C->db, C->pending, stmt, C->maxRows, parameterCount, C->resultMode, _prefetchRows(C), &C->timeout, C->watchdog), (Pop_T)&mysqlpops, parameterCount);
         }
         return NULL;
 }
@@ -314,6 +590,14 @@ const char *MysqlConnection_getLastError(T C) {
 }
 
 
+int MysqlConnection_isRetryable(T C) {
+        assert(C);
+        // Errors of prepared statements are also set on the connection
+        unsigned int error = mysql_errno(C->db);
+        return error == ER_LOCK_DEADLOCK || error == ER_LOCK_WAIT_TIMEOUT;
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
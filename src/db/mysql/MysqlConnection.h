@@ -24,12 +24,16 @@
 #ifndef MYSQLCONNECTION_INCLUDED
 #define MYSQLCONNECTION_INCLUDED
 #define T ConnectionDelegate_T
-T MysqlConnection_new(URL_T url, char **error);
+int MysqlConnection_sendPending(MYSQL *db, StringBuffer_T pending);
+void *MysqlConnection_newContext(URL_T url);
+void MysqlConnection_freeContext(void **context);
+T MysqlConnection_new(URL_T url, void *context, char **error);
 void MysqlConnection_free(T *C);
 void MysqlConnection_setQueryTimeout(T C, int ms);
 void MysqlConnection_setMaxRows(T C, int max);
+void MysqlConnection_setFetchSize(T C, int rows);
 int MysqlConnection_ping(T C);
-int MysqlConnection_beginTransaction(T C);
+int MysqlConnection_beginTransaction(T C, int type);
 int MysqlConnection_commit(T C);
 int MysqlConnection_rollback(T C);
 long long MysqlConnection_lastRowId(T C);
@@ -38,6 +42,7 @@ int MysqlConnection_execute(T C, const char *sql, va_list ap);
 ResultSet_T MysqlConnection_executeQuery(T C, const char *sql, va_list ap);
 PreparedStatement_T MysqlConnection_prepareStatement(T C, const char *sql, va_list ap);
 const char *MysqlConnection_getLastError(T C);
+int MysqlConnection_isRetryable(T C);
 #undef T
 #endif
 
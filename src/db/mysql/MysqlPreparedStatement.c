@@ -29,10 +29,16 @@
 #include <string.h>
 #include <mysql.h>
 
+#include "URL.h"
 #include "ResultSet.h"
+#include "StringBuffer.h"
+#include "PreparedStatement.h"
+#include "system/Watchdog.h"
 #include "MysqlResultSet.h"
 #include "PreparedStatementDelegate.h"
 #include "MysqlPreparedStatement.h"
+#include "ConnectionDelegate.h"
+#include "MysqlConnection.h"
 
 
 /**
@@ -58,7 +64,8 @@ const struct Pop_T mysqlpops = {
         .setBlob        = MysqlPreparedStatement_setBlob,
         .execute        = MysqlPreparedStatement_execute,
         .executeQuery   = MysqlPreparedStatement_executeQuery,
-        .rowsChanged    = MysqlPreparedStatement_rowsChanged
+        .rowsChanged    = MysqlPreparedStatement_rowsChanged,
+        .setBlobStream  = MysqlPreparedStatement_setBlobStream
 };
 
 typedef struct param_t {
@@ -68,17 +75,28 @@ typedef struct param_t {
                 double real;
                 MYSQL_TIME timestamp;
         } type;
-        long length;
+        unsigned long length;
+        int (*read)(void *buffer, int size, void *context); // Blob stream sent when executed
+        void *context;
 } *param_t;
 
 #define T PreparedStatementDelegate_T
 struct T {
         int maxRows;
         int lastError;
+        MysqlResult_Mode mode;
+        int prefetchRows;
+        const int *timeout;     // The connection's query timeout, read when the statement is executed
+        Watchdog_T watchdog;
         param_t params;
+        MYSQL *db;
+        StringBuffer_T pending; // The connection's deferred START TRANSACTION
         MYSQL_STMT *stmt;
         MYSQL_BIND *bind;
         int parameterCount;
+        int rebind;             // Parameter binds changed since mysql_stmt_bind_param()
+        int longData;           // Blob streams were sent with the last execute
+        long cursor;            // Cursor type set on the statement, -1 if none is set
 };
 
 static my_bool yes = true;
@@ -86,6 +104,76 @@ static my_bool yes = true;
 extern const struct Rop_T mysqlrops;
 
 
+/* ------------------------------------------------------- Private methods */
+
+
+/* Set the bind of a parameter. mysql_stmt_bind_param() copies the binds and the
+   bound buffers are read on execute, so the statement is only bound again if the
+   type, buffer or null indicator of a parameter changed */
+static inline void _setBind(T P, int i, enum enum_field_types type, void *buffer, my_bool *is_null, unsigned long *length) {
+        MYSQL_BIND *b = &P->bind[i];
+        if (b->buffer_type != type || b->buffer != buffer || b->is_null != is_null || b->length != length) {
+                b->buffer_type = type;
+                b->buffer = buffer;
+                b->is_null = is_null;
+                b->length = length;
+                P->rebind = true;
+        }
+}
+
+
+#if MYSQL_VERSION_ID >= 50002
+/* Set the cursor type if it differs from the cursor type set on the statement */
+static inline void _setCursor(T P, unsigned long cursor) {
+        if (P->cursor != (long)cursor) {
+                mysql_stmt_attr_set(P->stmt, STMT_ATTR_CURSOR_TYPE, &cursor);
+                if (cursor == CURSOR_TYPE_READ_ONLY && P->prefetchRows > 0) {
+                        unsigned long rows = P->prefetchRows;
+                        mysql_stmt_attr_set(P->stmt, STMT_ATTR_PREFETCH_ROWS, &rows);
+                }
+                P->cursor = cursor;
+        }
+}
+#endif
+
+
+/* Bind the parameters if the binds changed and send blob streams in pieces. A stream is read once */
+static void _bindParameters(T P) {
+        P->longData = false;
+        if (P->parameterCount > 0) {
+                if (P->rebind) {
+                        if ((P->lastError = mysql_stmt_bind_param(P->stmt, P->bind)))
+                                THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
+                        P->rebind = false;
+                }
+                char * volatile chunk = NULL;
+                TRY
+                {
+                        for (int i = 0; i < P->parameterCount; i++) {
+                                if (! P->params[i].read)
+                                        continue;
+                                if (! chunk)
+                                        chunk = ALLOC(SQL_DEFAULT_LOB_CHUNK_SIZE);
+                                int (*read)(void *, int, void *) = P->params[i].read;
+                                P->params[i].read = NULL;
+                                P->longData = true;
+                                for (int n; (n = read(chunk, SQL_DEFAULT_LOB_CHUNK_SIZE, P->params[i].context)); ) {
+                                        if (n < 0)
+                                                THROW(SQLException, "Failed to read blob stream for parameter %d", i + 1);
+                                        if ((P->lastError = mysql_stmt_send_long_data(P->stmt, i, chunk, n)))
+                                                THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
+                                }
+                        }
+                }
+                FINALLY
+                {
+                        FREE(chunk);
+                }
+                END_TRY;
+        }
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -93,17 +181,27 @@ extern const struct Rop_T mysqlrops;
 #pragma GCC visibility push(hidden)
 #endif
 
-T MysqlPreparedStatement_new(void *stmt, int maxRows, int parameterCount) {
+T MysqlPreparedStatement_new(MYSQL *db, StringBuffer_T pending, void *stmt, int maxRows, int parameterCount, MysqlResult_Mode mode, int prefetchRows, const int *timeout, Watchdog_T watchdog) {
         T P;
         assert(stmt);
+        assert(timeout);
+        assert(watchdog);
         NEW(P);
+        P->db = db;
+        P->pending = pending;
         P->stmt = stmt;
         P->maxRows = maxRows;
+        P->mode = mode;
+        P->prefetchRows = prefetchRows;
+        P->timeout = timeout;
+        P->watchdog = watchdog; // Owned by the connection
         P->parameterCount = parameterCount;
         if (P->parameterCount > 0) {
                 P->params = CALLOC(P->parameterCount, sizeof(struct param_t));
                 P->bind = CALLOC(P->parameterCount, sizeof(MYSQL_BIND));
         }
+        P->rebind = true;
+        P->cursor = -1;
         P->lastError = MYSQL_OK;
         return P;
 }
@@ -127,52 +225,43 @@ void MysqlPreparedStatement_free(T *P) {
 void MysqlPreparedStatement_setString(T P, int parameterIndex, const char *x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
-        P->bind[i].buffer_type = MYSQL_TYPE_STRING;
-        P->bind[i].buffer = (char*)x;
-        if (! x) {
-                P->params[i].length = 0;
-                P->bind[i].is_null = &yes;
-        } else {
-                P->params[i].length = strlen(x);
-                P->bind[i].is_null = 0;
-        }
-        P->bind[i].length = &P->params[i].length;
+        P->params[i].read = NULL;
+        P->params[i].length = x ? strlen(x) : 0;
+        _setBind(P, i, MYSQL_TYPE_STRING, (char*)x, x ? NULL : &yes, &P->params[i].length);
 }
 
 
 void MysqlPreparedStatement_setInt(T P, int parameterIndex, int x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i].read = NULL;
         P->params[i].type.integer = x;
-        P->bind[i].buffer_type = MYSQL_TYPE_LONG;
-        P->bind[i].buffer = &P->params[i].type.integer;
-        P->bind[i].is_null = 0;
+        _setBind(P, i, MYSQL_TYPE_LONG, &P->params[i].type.integer, NULL, NULL);
 }
 
 
 void MysqlPreparedStatement_setLLong(T P, int parameterIndex, long long x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i].read = NULL;
         P->params[i].type.llong = x;
-        P->bind[i].buffer_type = MYSQL_TYPE_LONGLONG;
-        P->bind[i].buffer = &P->params[i].type.llong;
-        P->bind[i].is_null = 0;
+        _setBind(P, i, MYSQL_TYPE_LONGLONG, &P->params[i].type.llong, NULL, NULL);
 }
 
 
 void MysqlPreparedStatement_setDouble(T P, int parameterIndex, double x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i].read = NULL;
         P->params[i].type.real = x;
-        P->bind[i].buffer_type = MYSQL_TYPE_DOUBLE;
-        P->bind[i].buffer = &P->params[i].type.real;
-        P->bind[i].is_null = 0;
+        _setBind(P, i, MYSQL_TYPE_DOUBLE, &P->params[i].type.real, NULL, NULL);
 }
 
 
 void MysqlPreparedStatement_setTimestamp(T P, int parameterIndex, time_t x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i].read = NULL;
         struct tm ts = {.tm_isdst = -1};
         gmtime_r(&x, &ts);
         P->params[i].type.timestamp.year = ts.tm_year + 1900;
@@ -181,59 +270,70 @@ void MysqlPreparedStatement_setTimestamp(T P, int parameterIndex, time_t x) {
         P->params[i].type.timestamp.hour = ts.tm_hour;
         P->params[i].type.timestamp.minute = ts.tm_min;
         P->params[i].type.timestamp.second = ts.tm_sec;
-        P->bind[i].buffer_type = MYSQL_TYPE_TIMESTAMP;
-        P->bind[i].buffer = &P->params[i].type.timestamp;
-        P->bind[i].is_null = 0;
+        _setBind(P, i, MYSQL_TYPE_TIMESTAMP, &P->params[i].type.timestamp, NULL, NULL);
 }
 
 
 void MysqlPreparedStatement_setBlob(T P, int parameterIndex, const void *x, int size) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
-        P->bind[i].buffer_type = MYSQL_TYPE_BLOB;
-        P->bind[i].buffer = (void*)x;
-        if (! x) {
-                P->params[i].length = 0;
-                P->bind[i].is_null = &yes;
-        } else {
-                P->params[i].length = size;
-                P->bind[i].is_null = 0;
-        }
-        P->bind[i].length = &P->params[i].length;
+        P->params[i].read = NULL;
+        P->params[i].length = x ? size : 0;
+        _setBind(P, i, MYSQL_TYPE_BLOB, (void*)x, x ? NULL : &yes, &P->params[i].length);
+}
+
+
+void MysqlPreparedStatement_setBlobStream(T P, int parameterIndex, int (*read)(void *buffer, int size, void *context), void *context) {
+        assert(P);
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i].read = read;
+        P->params[i].context = context;
+        P->params[i].length = 0;
+        _setBind(P, i, MYSQL_TYPE_BLOB, NULL, NULL, &P->params[i].length);
 }
 
 
 void MysqlPreparedStatement_execute(T P) {
         assert(P);
-        if (P->parameterCount > 0)
-                if ((P->lastError = mysql_stmt_bind_param(P->stmt, P->bind)))
-                        THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
+        _bindParameters(P);
 #if MYSQL_VERSION_ID >= 50002
-        unsigned long cursor = CURSOR_TYPE_NO_CURSOR;
-        mysql_stmt_attr_set(P->stmt, STMT_ATTR_CURSOR_TYPE, &cursor);
+        _setCursor(P, CURSOR_TYPE_NO_CURSOR);
 #endif
-        if ((P->lastError = mysql_stmt_execute(P->stmt)))
+        if ((P->lastError = MysqlConnection_sendPending(P->db, P->pending)))
+                THROW(SQLException, "%s", mysql_error(P->db));
+        if (*P->timeout > 0)
+                Watchdog_start(P->watchdog, *P->timeout);
+        P->lastError = mysql_stmt_execute(P->stmt);
+        Watchdog_stop(P->watchdog);
+        if (P->lastError)
                 THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
-        if (P->lastError == MYSQL_OK) {
-                /* Discard prepared param data in client/server */
+        if (P->longData) {
+                /* Discard long data sent for blob streams in client/server. Without long
+                   data there is nothing to discard, so a re-execute costs one round trip */
                 P->lastError = mysql_stmt_reset(P->stmt);
+        } else if (mysql_stmt_field_count(P->stmt) > 0) {
+                /* Read off rows of a statement returning a result, as the reset did */
+                mysql_stmt_free_result(P->stmt);
         }
 }
 
 
 ResultSet_T MysqlPreparedStatement_executeQuery(T P) {
         assert(P);
-        if (P->parameterCount > 0)
-                if ((P->lastError = mysql_stmt_bind_param(P->stmt, P->bind)))
-                        THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
+        _bindParameters(P);
 #if MYSQL_VERSION_ID >= 50002
-        unsigned long cursor = CURSOR_TYPE_READ_ONLY;
-        mysql_stmt_attr_set(P->stmt, STMT_ATTR_CURSOR_TYPE, &cursor);
+        _setCursor(P, P->mode == MysqlResult_Cursor ? CURSOR_TYPE_READ_ONLY : CURSOR_TYPE_NO_CURSOR);
 #endif
-        if ((P->lastError = mysql_stmt_execute(P->stmt)))
-                THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
-        if (P->lastError == MYSQL_OK)
-                return ResultSet_new(MysqlResultSet_new(P->stmt, P->maxRows, true), (Rop_T)&mysqlrops);
+        if ((P->lastError = MysqlConnection_sendPending(P->db, P->pending)))
+                THROW(SQLException, "%s", mysql_error(P->db));
+        if (*P->timeout > 0)
+                Watchdog_start(P->watchdog, *P->timeout);
+        ResultSetDelegate_T R = NULL;
+        if (! (P->lastError = mysql_stmt_execute(P->stmt)))
+                R = MysqlResultSet_new(P->stmt, P->maxRows, true, P->mode != MysqlResult_Store);
+        Watchdog_stop(P->watchdog);
+        if (R)
+                return ResultSet_new(R, (Rop_T)&mysqlrops);
         THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
         return NULL;
 }
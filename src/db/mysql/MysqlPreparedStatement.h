@@ -24,7 +24,7 @@
 #ifndef MYSQLPREPAREDSTATEMENT_INCLUDED
 #define MYSQLPREPAREDSTATEMENT_INCLUDED
 #define T PreparedStatementDelegate_T
-T MysqlPreparedStatement_new(void *stmt, int maxRows, int parameterCount);
+T MysqlPreparedStatement_new(MYSQL *db, StringBuffer_T pending, void *stmt, int maxRows, int parameterCount, MysqlResult_Mode mode, int prefetchRows, const int *timeout, Watchdog_T watchdog);
 void MysqlPreparedStatement_free(T *P);
 void MysqlPreparedStatement_setString(T P, int parameterIndex, const char *x);
 void MysqlPreparedStatement_setInt(T P, int parameterIndex, int x);
@@ -32,6 +32,7 @@ void MysqlPreparedStatement_setLLong(T P, int parameterIndex, long long x);
 void MysqlPreparedStatement_setDouble(T P, int parameterIndex, double x);
 void MysqlPreparedStatement_setTimestamp(T P, int parameterIndex, time_t x);
 void MysqlPreparedStatement_setBlob(T P, int parameterIndex, const void *x, int size);
+void MysqlPreparedStatement_setBlobStream(T P, int parameterIndex, int (*read)(void *buffer, int size, void *context), void *context);
 void MysqlPreparedStatement_execute(T P);
 ResultSet_T MysqlPreparedStatement_executeQuery(T P);
 long long MysqlPreparedStatement_rowsChanged(T P);
@@ -26,7 +26,10 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <float.h>
+#include <time.h>
 #include <mysql.h>
 #include <errmsg.h>
 
@@ -56,8 +59,15 @@ const struct Rop_T mysqlrops = {
         .next           = MysqlResultSet_next,
         .isnull         = MysqlResultSet_isnull,
         .getString      = MysqlResultSet_getString,
-        .getBlob        = MysqlResultSet_getBlob
-        // getTimestamp and getDateTime is handled in ResultSet
+        .getBlob        = MysqlResultSet_getBlob,
+        .getInt         = MysqlResultSet_getInt,
+        .getLLong       = MysqlResultSet_getLLong,
+        .getDouble      = MysqlResultSet_getDouble,
+        .getTimestamp   = MysqlResultSet_getTimestamp,
+        .getDateTime    = MysqlResultSet_getDateTime,
+        .getBytes       = MysqlResultSet_getBlob, // Already a view into the bind buffer
+        .readBlob       = MysqlResultSet_readBlob,
+        .getMemory      = MysqlResultSet_getMemory
 };
 
 typedef struct column_t {
@@ -65,6 +75,12 @@ typedef struct column_t {
         MYSQL_FIELD *field;
         unsigned long real_length;
         char *buffer;
+        union {
+                long long ll;
+                float f;
+                double d;
+                MYSQL_TIME t;
+        } value;
 } *column_t;
 
 #define T ResultSetDelegate_T
@@ -76,6 +92,7 @@ struct T {
         int needRebind;
 	int currentRow;
 	int columnCount;
+        long long memory;       // Column buffers, see MysqlResultSet_getMemory()
         MYSQL_RES *meta;
         MYSQL_BIND *bind;
 	MYSQL_STMT *stmt;
@@ -86,10 +103,133 @@ struct T {
 /* ------------------------------------------------------- Private methods */
 
 
+/* Bind integer, floating point and temporal columns to their native type
+   so values are read without a string conversion. Other columns are bound
+   as strings, sized to hold the longest value in a stored result */
+static void _bindColumn(T R, int i) {
+        column_t c = &R->columns[i];
+        MYSQL_BIND *b = &R->bind[i];
+        c->field = mysql_fetch_field_direct(R->meta, i);
+        unsigned long size = c->field->max_length > STRLEN ? c->field->max_length : STRLEN;
+        c->buffer = ALLOC(size + 1);
+        R->memory += size + 1;
+        b->is_null = &c->is_null;
+        b->length = &c->real_length;
+        if (! (c->field->flags & ZEROFILL_FLAG)) {
+                switch (c->field->type) {
+                        case MYSQL_TYPE_TINY:
+                        case MYSQL_TYPE_SHORT:
+                        case MYSQL_TYPE_INT24:
+                        case MYSQL_TYPE_LONG:
+                        case MYSQL_TYPE_LONGLONG:
+                                b->buffer_type = MYSQL_TYPE_LONGLONG;
+                                b->buffer = &c->value.ll;
+                                b->is_unsigned = (c->field->flags & UNSIGNED_FLAG) ? true : false;
+                                return;
+                        case MYSQL_TYPE_FLOAT:
+                                b->buffer_type = MYSQL_TYPE_FLOAT;
+                                b->buffer = &c->value.f;
+                                return;
+                        case MYSQL_TYPE_DOUBLE:
+                                b->buffer_type = MYSQL_TYPE_DOUBLE;
+                                b->buffer = &c->value.d;
+                                return;
+                        case MYSQL_TYPE_DATE:
+                        case MYSQL_TYPE_TIME:
+                        case MYSQL_TYPE_DATETIME:
+                        case MYSQL_TYPE_TIMESTAMP:
+                                b->buffer_type = c->field->type;
+                                b->buffer = &c->value.t;
+                                return;
+                        default:
+                                break;
+                }
+        }
+        b->buffer_type = MYSQL_TYPE_STRING;
+        b->buffer = c->buffer;
+        b->buffer_length = size;
+}
+
+
+static inline int _isTemporal(enum enum_field_types type) {
+        return (type == MYSQL_TYPE_DATE || type == MYSQL_TYPE_TIME || type == MYSQL_TYPE_DATETIME || type == MYSQL_TYPE_TIMESTAMP);
+}
+
+
+/* Returns true if t is a date with a zero month or day, such as the zero date 0000-00-00 */
+static inline int _isZeroDate(MYSQL_TIME *t) {
+        return t->time_type != MYSQL_TIMESTAMP_TIME && (t->month == 0 || t->day == 0);
+}
+
+
+/* Format value with the fewest digits which read back as the same value, as the server does
+   in the text protocol. Digits from DBL_DIG or FLT_DIG are tried first, as all values of up to
+   that many digits read back the same */
+static void _formatReal(char *buffer, double value, int isFloat) {
+        for (int digits = isFloat ? FLT_DIG : DBL_DIG; ; digits++) {
+                snprintf(buffer, STRLEN, "%.*g", digits, value);
+                if (digits >= (isFloat ? 9 : 17))
+                        break;
+                if (isFloat ? strtof(buffer, NULL) == (float)value : strtod(buffer, NULL) == value)
+                        break;
+        }
+}
+
+
+/* Format a temporal value the same way as the server does in the text protocol */
+static void _formatTime(column_t c) {
+        MYSQL_TIME *t = &c->value.t;
+        int n;
+        switch (t->time_type) {
+                case MYSQL_TIMESTAMP_DATE:
+                        snprintf(c->buffer, STRLEN, "%04u-%02u-%02u", t->year, t->month, t->day);
+                        return;
+                case MYSQL_TIMESTAMP_TIME:
+                        n = snprintf(c->buffer, STRLEN, "%s%02u:%02u:%02u", t->neg ? "-" : "", t->hour, t->minute, t->second);
+                        break;
+                default:
+                        n = snprintf(c->buffer, STRLEN, "%04u-%02u-%02u %02u:%02u:%02u", t->year, t->month, t->day, t->hour, t->minute, t->second);
+                        break;
+        }
+        int decimals = c->field->decimals;
+        if (decimals > 0 && decimals <= 6) {
+                unsigned long fraction = t->second_part;
+                for (int i = decimals; i < 6; i++)
+                        fraction /= 10;
+                snprintf(c->buffer + n, STRLEN - n, ".%0*lu", decimals, fraction);
+        }
+}
+
+
+/* Return the string representation of a natively bound column */
+static const char *_toString(T R, int i) {
+        column_t c = &R->columns[i];
+        switch (R->bind[i].buffer_type) {
+                case MYSQL_TYPE_LONGLONG:
+                        if (R->bind[i].is_unsigned)
+                                snprintf(c->buffer, STRLEN, "%llu", (unsigned long long)c->value.ll);
+                        else
+                                snprintf(c->buffer, STRLEN, "%lld", c->value.ll);
+                        break;
+                case MYSQL_TYPE_FLOAT:
+                        _formatReal(c->buffer, c->value.f, true);
+                        break;
+                case MYSQL_TYPE_DOUBLE:
+                        _formatReal(c->buffer, c->value.d, false);
+                        break;
+                default:
+                        _formatTime(c);
+                        break;
+        }
+        return c->buffer;
+}
+
+
 static inline void _ensureCapacity(T R, int i) {
         if ((R->columns[i].real_length > R->bind[i].buffer_length)) {
                 /* Column was truncated, resize and fetch column directly. */
                 RESIZE(R->columns[i].buffer, R->columns[i].real_length + 1);
+                R->memory += R->columns[i].real_length - R->bind[i].buffer_length;
                 R->bind[i].buffer = R->columns[i].buffer;
                 R->bind[i].buffer_length = R->columns[i].real_length;
                 if ((R->lastError = mysql_stmt_fetch_column(R->stmt, &R->bind[i], i, 0)))
@@ -106,7 +246,7 @@ static inline void _ensureCapacity(T R, int i) {
 #pragma GCC visibility push(hidden)
 #endif
 
-T MysqlResultSet_new(void *stmt, int maxRows, int keep) {
+T MysqlResultSet_new(void *stmt, int maxRows, int keep, int stream) {
 	T R;
 	assert(stmt);
 	NEW(R);
@@ -120,23 +260,21 @@ T MysqlResultSet_new(void *stmt, int maxRows, int keep) {
         } else {
                 R->bind = CALLOC(R->columnCount, sizeof (MYSQL_BIND));
                 R->columns = CALLOC(R->columnCount, sizeof (struct column_t));
-                for (int i = 0; i < R->columnCount; i++) {
-                        R->columns[i].buffer = ALLOC(STRLEN + 1);
-                        R->bind[i].buffer_type = MYSQL_TYPE_STRING;
-                        R->bind[i].buffer = R->columns[i].buffer;
-                        R->bind[i].buffer_length = STRLEN;
-                        R->bind[i].is_null = &R->columns[i].is_null;
-                        R->bind[i].length = &R->columns[i].real_length;
-                        R->columns[i].field = mysql_fetch_field_direct(R->meta, i);
+                // Store resultset client side, speeds up processing with > 10x at the cost of increased memory usage.
+                // Otherwise rows are read from the connection or fetched from the server cursor, see MysqlResult_Mode
+                if (! stream) {
+                        // Let store result set max_length so columns are bound large enough to avoid a refetch and rebind per row
+                        my_bool updateMaxLength = true;
+                        mysql_stmt_attr_set(R->stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &updateMaxLength);
+                        if ((R->lastError = mysql_stmt_store_result(R->stmt)))
+                                DEBUG("Warning: store result - %s\n", mysql_stmt_error(stmt));
                 }
+                for (int i = 0; i < R->columnCount; i++)
+                        _bindColumn(R, i);
                 if ((R->lastError = mysql_stmt_bind_result(R->stmt, R->bind))) {
                         DEBUG("Error: bind - %s\n", mysql_stmt_error(stmt));
                         R->stop = true;
                 }
-                // Store resultset client side, speeds up processing with > 10x at the cost of increased memory usage
-                if ((R->lastError = mysql_stmt_store_result(R->stmt))) {
-                        DEBUG("Warning: store result - %s\n", mysql_stmt_error(stmt));
-                }
         }
 	return R;
 }
@@ -176,6 +314,8 @@ long MysqlResultSet_getColumnSize(T R, int columnIndex) {
         int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
         if (R->columns[i].is_null)
                 return 0;
+        if (R->bind[i].buffer_type != MYSQL_TYPE_STRING)
+                return strlen(_toString(R, i));
         return R->columns[i].real_length;
 }
 
@@ -218,6 +358,8 @@ const char *MysqlResultSet_getString(T R, int columnIndex) {
         int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
         if (R->columns[i].is_null)
                 return NULL;
+        if (R->bind[i].buffer_type != MYSQL_TYPE_STRING)
+                return _toString(R, i);
         _ensureCapacity(R, i);
         R->columns[i].buffer[R->columns[i].real_length] = 0;
         return R->columns[i].buffer;
@@ -229,12 +371,157 @@ const void *MysqlResultSet_getBlob(T R, int columnIndex, int *size) {
         int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
         if (R->columns[i].is_null)
                 return NULL;
+        if (R->bind[i].buffer_type != MYSQL_TYPE_STRING) {
+                const char *s = _toString(R, i);
+                *size = (int)strlen(s);
+                return s;
+        }
         _ensureCapacity(R, i);
         *size = (int)R->columns[i].real_length;
         return R->columns[i].buffer;
 }
 
 
+int MysqlResultSet_readBlob(T R, int columnIndex, long long offset, void *buffer, int length) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        column_t c = &R->columns[i];
+        if (c->is_null)
+                return 0;
+        if (R->bind[i].buffer_type != MYSQL_TYPE_STRING) {
+                const char *s = _toString(R, i);
+                return copyBlob(s, strlen(s), offset, buffer, length);
+        }
+        if (c->real_length <= R->bind[i].buffer_length || offset >= (long long)c->real_length)
+                return copyBlob(c->buffer, c->real_length, offset, buffer, length);
+        // The value was truncated in the bind buffer, fetch the piece directly instead of growing the buffer
+        my_bool isNull = false;
+        unsigned long size = 0;
+        MYSQL_BIND b = {
+                .buffer_type = MYSQL_TYPE_BLOB,
+                .buffer = buffer,
+                .buffer_length = length,
+                .length = &size,
+                .is_null = &isNull
+        };
+        if ((R->lastError = mysql_stmt_fetch_column(R->stmt, &b, i, (unsigned long)offset)))
+                THROW(SQLException, "mysql_stmt_fetch_column -- %s", mysql_stmt_error(R->stmt));
+        // size is the length of the value
+        size -= (unsigned long)offset;
+        return (int)(size < (unsigned long)length ? size : (unsigned long)length);
+}
+
+
+int MysqlResultSet_getInt(T R, int columnIndex) {
+        assert(R);
+        return (int)MysqlResultSet_getLLong(R, columnIndex);
+}
+
+
+long long MysqlResultSet_getLLong(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (R->columns[i].is_null)
+                return 0;
+        switch (R->bind[i].buffer_type) {
+                case MYSQL_TYPE_LONGLONG:
+                        return R->columns[i].value.ll;
+                case MYSQL_TYPE_FLOAT:
+                        return (long long)R->columns[i].value.f;
+                case MYSQL_TYPE_DOUBLE:
+                        return (long long)R->columns[i].value.d;
+                default:
+                        return Str_parseLLong(MysqlResultSet_getString(R, columnIndex));
+        }
+}
+
+
+double MysqlResultSet_getDouble(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (R->columns[i].is_null)
+                return 0.0;
+        switch (R->bind[i].buffer_type) {
+                case MYSQL_TYPE_LONGLONG:
+                        if (R->bind[i].is_unsigned)
+                                return (double)(unsigned long long)R->columns[i].value.ll;
+                        return (double)R->columns[i].value.ll;
+                case MYSQL_TYPE_FLOAT:
+                        return R->columns[i].value.f;
+                case MYSQL_TYPE_DOUBLE:
+                        return R->columns[i].value.d;
+                default:
+                        return Str_parseDouble(MysqlResultSet_getString(R, columnIndex));
+        }
+}
+
+
+time_t MysqlResultSet_getTimestamp(T R, int columnIndex) {
+        assert(R);
+        struct tm tm = {.tm_year = 0};
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (R->columns[i].is_null)
+                return 0;
+        if (! _isTemporal(R->bind[i].buffer_type))
+                return Time_toTimestamp(MysqlResultSet_getString(R, columnIndex));
+        MYSQL_TIME *t = &R->columns[i].value.t;
+        // A zero date is returned as for SQL NULL and a time value as its signed number of seconds
+        if (_isZeroDate(t))
+                return 0;
+        if (t->time_type == MYSQL_TIMESTAMP_TIME) {
+                time_t seconds = (time_t)t->hour * 3600 + t->minute * 60 + t->second;
+                return t->neg ? -seconds : seconds;
+        }
+        MysqlResultSet_getDateTime(R, columnIndex, &tm);
+        tm.tm_year -= 1900;
+        return timegm(&tm);
+}
+
+
+struct tm *MysqlResultSet_getDateTime(T R, int columnIndex, struct tm *tm) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (R->columns[i].is_null)
+                return tm;
+        if (! _isTemporal(R->bind[i].buffer_type)) {
+                const char *s = MysqlResultSet_getString(R, columnIndex);
+                if (STR_DEF(s))
+                        Time_toDateTime(s, tm);
+                return tm;
+        }
+        // Same representation as Time_toDateTime, tm_year is the year and date fields are zero for a time value
+        MYSQL_TIME *t = &R->columns[i].value.t;
+        if (_isZeroDate(t))
+                return tm;
+        if (t->time_type != MYSQL_TIMESTAMP_TIME) {
+                tm->tm_year = t->year;
+                tm->tm_mon = t->month - 1;
+                tm->tm_mday = t->day;
+                tm->tm_hour = t->hour;
+        } else {
+                // A time value may be negative and up to 838 hours, whole days are kept in tm_mday
+                int sign = t->neg ? -1 : 1;
+                tm->tm_mday = sign * (int)(t->hour / 24);
+                tm->tm_hour = sign * (int)(t->hour % 24);
+                tm->tm_min = sign * (int)t->minute;
+                tm->tm_sec = sign * (int)t->second;
+                return tm;
+        }
+        tm->tm_min = t->minute;
+        tm->tm_sec = t->second;
+        return tm;
+}
+
+
+/* The column buffers. The rows of a stored result are not included, the client library
+   does not report their size and an estimate from the longest value of each column
+   would charge every row as if it held that value */
+long long MysqlResultSet_getMemory(T R) {
+        assert(R);
+        return R->memory;
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -24,7 +24,13 @@
 #ifndef MYSQLRESULTSET_INCLUDED
 #define MYSQLRESULTSET_INCLUDED
 #define T ResultSetDelegate_T
-T MysqlResultSet_new(void *stmt, int maxRows, int keep);
+/* How rows of a binary protocol result are fetched, see the result-mode URL option */
+typedef enum {
+        MysqlResult_Store = 0,  // No cursor, the result is stored client side when executed
+        MysqlResult_Stream,     // No cursor, rows are read from the connection as fetched
+        MysqlResult_Cursor      // Read-only server side cursor, prefetch rows at a time
+} MysqlResult_Mode;
+T MysqlResultSet_new(void *stmt, int maxRows, int keep, int stream);
 void MysqlResultSet_free(T *R);
 int MysqlResultSet_getColumnCount(T R);
 const char *MysqlResultSet_getColumnName(T R, int columnIndex);
@@ -33,5 +39,12 @@ int MysqlResultSet_next(T R);
 int MysqlResultSet_isnull(T R, int columnIndex);
 const char *MysqlResultSet_getString(T R, int columnIndex);
 const void *MysqlResultSet_getBlob(T R, int columnIndex, int *size);
+int MysqlResultSet_readBlob(T R, int columnIndex, long long offset, void *buffer, int length);
+int MysqlResultSet_getInt(T R, int columnIndex);
+long long MysqlResultSet_getLLong(T R, int columnIndex);
+double MysqlResultSet_getDouble(T R, int columnIndex);
+time_t MysqlResultSet_getTimestamp(T R, int columnIndex);
+struct tm *MysqlResultSet_getDateTime(T R, int columnIndex, struct tm *tm);
+long long MysqlResultSet_getMemory(T R);
 #undef T
 #endif
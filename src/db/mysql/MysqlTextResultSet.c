@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <mysql.h>
+
+#include "ResultSetDelegate.h"
+#include "MysqlTextResultSet.h"
+
+
+/**
+ * Implementation of the ResultSet/Delegate interface for query results
+ * read with the mysql text protocol, mysql_fetch_row(). Values are sent
+ * by the server as strings and converted on access. Accessing columns 
+ * with index outside range throws SQLException
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define MYSQL_OK 0
+
+const struct Rop_T mysqltextrops = {
+	.name           = "mysql",
+        .free           = MysqlTextResultSet_free,
+        .getColumnCount = MysqlTextResultSet_getColumnCount,
+        .getColumnName  = MysqlTextResultSet_getColumnName,
+        .getColumnSize  = MysqlTextResultSet_getColumnSize,
+        .next           = MysqlTextResultSet_next,
+        .isnull         = MysqlTextResultSet_isnull,
+        .getString      = MysqlTextResultSet_getString,
+        .getBlob        = MysqlTextResultSet_getBlob,
+        .getInt         = MysqlTextResultSet_getInt,
+        .getLLong       = MysqlTextResultSet_getLLong,
+        .getDouble      = MysqlTextResultSet_getDouble,
+        .getTimestamp   = MysqlTextResultSet_getTimestamp,
+        .getDateTime    = MysqlTextResultSet_getDateTime,
+        .getBytes       = MysqlTextResultSet_getBlob, // Already a view into the row buffer
+        .nextResult     = MysqlTextResultSet_nextResult,
+        .getMemory      = MysqlTextResultSet_getMemory
+};
+
+#define T ResultSetDelegate_T
+struct T {
+        int stop;
+        int stream;
+        int maxRows;
+	int currentRow;
+	int columnCount;
+        long long memory;       // Size of the stored rows, 0 for a streamed result
+        MYSQL *db;
+        MYSQL_RES *res;
+        MYSQL_ROW row;
+        MYSQL_FIELD *fields;
+        unsigned long *lengths;
+};
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+static void _setResult(T R, MYSQL_RES *res) {
+        R->res = res;
+        R->row = NULL;
+        R->currentRow = 0;
+        R->memory = 0;
+        if (! R->res) {
+                // The statement did not return a result set
+                R->stop = true;
+                R->columnCount = 0;
+                R->fields = NULL;
+        } else {
+                R->stop = false;
+                R->columnCount = mysql_num_fields(R->res);
+                R->fields = mysql_fetch_fields(R->res);
+                if (! R->stream) {
+                        // The client library does not report the size of a stored result, sum the value lengths of each row
+                        long long row = sizeof(MYSQL_ROWS) + (R->columnCount + 1) * sizeof(char *);
+                        while (mysql_fetch_row(R->res)) {
+                                unsigned long *lengths = mysql_fetch_lengths(R->res);
+                                R->memory += row;
+                                for (int i = 0; i < R->columnCount; i++)
+                                        R->memory += lengths[i] + 1;
+                        }
+                        mysql_data_seek(R->res, 0);
+                }
+        }
+}
+
+
+/* ----------------------------------------------------- Protected methods */
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility push(hidden)
+#endif
+
+T MysqlTextResultSet_new(void *db, void *res, int maxRows, int stream) {
+	T R;
+	assert(db);
+	NEW(R);
+        R->db = db;
+        R->stream = stream;
+        R->maxRows = maxRows;
+        _setResult(R, res);
+	return R;
+}
+
+
+void MysqlTextResultSet_free(T *R) {
+	assert(R && *R);
+        // Reads and discards rows not yet fetched from an unbuffered result
+        if ((*R)->res)
+                mysql_free_result((*R)->res);
+        // Discard results of any following statements so the connection can be used again
+        while (mysql_next_result((*R)->db) == 0) {
+                MYSQL_RES *res = mysql_use_result((*R)->db);
+                if (res)
+                        mysql_free_result(res);
+        }
+	FREE(*R);
+}
+
+
+int MysqlTextResultSet_getColumnCount(T R) {
+	assert(R);
+	return R->columnCount;
+}
+
+
+const char *MysqlTextResultSet_getColumnName(T R, int columnIndex) {
+	assert(R);
+	columnIndex--;
+	if (R->columnCount <= 0 || columnIndex < 0 || columnIndex >= R->columnCount)
+		return NULL;
+	return R->fields[columnIndex].name;
+}
+
+
+long MysqlTextResultSet_getColumnSize(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (! R->row || ! R->row[i])
+                return 0;
+        return R->lengths[i];
+}
+
+
+int MysqlTextResultSet_next(T R) {
+	assert(R);
+        if (R->stop)
+                return false;
+        if (R->maxRows && (R->currentRow++ >= R->maxRows)) {
+                R->stop = true;
+                return false;
+        }
+        if (! (R->row = mysql_fetch_row(R->res))) {
+                R->stop = true;
+                if (mysql_errno(R->db))
+                        THROW(SQLException, "mysql_fetch_row -- %s", mysql_error(R->db));
+                return false;
+        }
+        R->lengths = mysql_fetch_lengths(R->res);
+        return true;
+}
+
+
+int MysqlTextResultSet_isnull(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        return ! R->row || ! R->row[i];
+}
+
+
+const char *MysqlTextResultSet_getString(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        // Values in a row from the text protocol are NUL terminated
+        return R->row ? R->row[i] : NULL;
+}
+
+
+const void *MysqlTextResultSet_getBlob(T R, int columnIndex, int *size) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (! R->row || ! R->row[i])
+                return NULL;
+        *size = (int)R->lengths[i];
+        return R->row[i];
+}
+
+
+int MysqlTextResultSet_getInt(T R, int columnIndex) {
+        assert(R);
+        return (int)MysqlTextResultSet_getLLong(R, columnIndex);
+}
+
+
+long long MysqlTextResultSet_getLLong(T R, int columnIndex) {
+        assert(R);
+        const char *s = MysqlTextResultSet_getString(R, columnIndex);
+        return s ? Str_parseLLong(s) : 0;
+}
+
+
+double MysqlTextResultSet_getDouble(T R, int columnIndex) {
+        assert(R);
+        const char *s = MysqlTextResultSet_getString(R, columnIndex);
+        return s ? Str_parseDouble(s) : 0.0;
+}
+
+
+time_t MysqlTextResultSet_getTimestamp(T R, int columnIndex) {
+        assert(R);
+        const char *s = MysqlTextResultSet_getString(R, columnIndex);
+        return STR_DEF(s) ? Time_toTimestamp(s) : 0;
+}
+
+
+struct tm *MysqlTextResultSet_getDateTime(T R, int columnIndex, struct tm *tm) {
+        assert(R);
+        const char *s = MysqlTextResultSet_getString(R, columnIndex);
+        if (STR_DEF(s))
+                Time_toDateTime(s, tm);
+        return tm;
+}
+
+
+int MysqlTextResultSet_nextResult(T R) {
+        assert(R);
+        int status;
+        if (R->res)
+                mysql_free_result(R->res);
+        _setResult(R, NULL);
+        // Statements which do not return rows have no result set and are skipped
+        while ((status = mysql_next_result(R->db)) == MYSQL_OK) {
+                MYSQL_RES *res = R->stream ? mysql_use_result(R->db) : mysql_store_result(R->db);
+                if (res) {
+                        _setResult(R, res);
+                        return true;
+                }
+                if (mysql_errno(R->db))
+                        break;
+        }
+        if (mysql_errno(R->db))
+                THROW(SQLException, "%s", mysql_error(R->db));
+        return false;
+}
+
+
+long long MysqlTextResultSet_getMemory(T R) {
+        assert(R);
+        return R->memory;
+}
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility pop
+#endif
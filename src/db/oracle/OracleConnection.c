@@ -39,9 +39,10 @@
 #include "PreparedStatement.h"
 #include "OracleResultSet.h"
 #include "OraclePreparedStatement.h"
+#include "Connection.h"
 #include "ConnectionDelegate.h"
 #include "OracleConnection.h"
-#include "OracleWatchdog.h"
+#include "system/Watchdog.h"
 
 
 /**
@@ -68,11 +69,38 @@ const struct Cop_T oraclesqlcops = {
         .execute		= OracleConnection_execute,
         .executeQuery		= OracleConnection_executeQuery,
         .prepareStatement	= OracleConnection_prepareStatement,
-        .getLastError		= OracleConnection_getLastError
+        .getLastError		= OracleConnection_getLastError,
+        .isRetryable		= OracleConnection_isRetryable,
+        .setFetchSize		= OracleConnection_setFetchSize
 };
 
 #define ERB_SIZE 152
+#define ORA_DEADLOCK 60
+#define ORA_CANNOT_SERIALIZE 8177
 #define ORACLE_TRANSACTION_PERIOD 10
+#define ORACLE_PREFETCH_ROWS 100
+#define ORACLE_STATEMENT_CACHE 20
+// The connection pool bounds the number of sessions in use
+#define ORACLE_SESSION_POOL_MAX 1024
+
+/* An OCI environment and session pool shared by the connections of a
+   connection pool. Found by the pool's URL and freed with its last connection */
+typedef struct sessionpool_t {
+        URL_T          url;
+        int            refcount;
+        OCIEnv*        env;
+        OCIError*      err;
+        OCISPool*      spool;
+        OraText*       name;
+        ub4            nameLength;
+        struct sessionpool_t *next;
+} *sessionpool_t;
+
+static struct {
+        sessionpool_t  list;
+        Mutex_T        mutex;
+} sessionPools;
+static Once_T once = PTHREAD_ONCE_INIT;
 
 #define T ConnectionDelegate_T
 struct T {
@@ -83,15 +111,18 @@ struct T {
         OCISession*    usr;
         OCIServer*     srv;
         OCITrans*      txnhp;
+        sessionpool_t  sessionPool;
         char           erb[ERB_SIZE];
         int            maxRows;
         int            timeout;
-        int            countdown;
+        int            prefetchRows;
+        int            prefetchMemory;
+        int            fetchSize;
+        ub4            statementCache;
         sword          lastError;
         ub4            rowsChanged;
         StringBuffer_T sb;
-        Thread_T       watchdog;
-        char           running;
+        Watchdog_T watchdog;
 };
 
 extern const struct Rop_T oraclerops;
@@ -101,9 +132,114 @@ extern const struct Pop_T oraclepops;
 /* ------------------------------------------------------- Private methods */
 
 
-static int _doConnect(T C, URL_T url, char**  error) {
 #define ERROR(e) do {*error = Str_dup(e); return false;} while (0)
 #define ORAERROR(e) do{ *error = Str_dup(OracleConnection_getLastError(e)); return false;} while(0)
+
+
+static void _init(void) {
+        Mutex_init(sessionPools.mutex);
+}
+
+
+static void _freeSessionPool(sessionpool_t s) {
+        if (s->spool) {
+                OCISessionPoolDestroy(s->spool, s->err, OCI_DEFAULT);
+                OCIHandleFree(s->spool, OCI_HTYPE_SPOOL);
+        }
+        if (s->env)
+                OCIHandleFree(s->env, OCI_HTYPE_ENV);
+        FREE(s);
+}
+
+
+/* Return the session pool for url, created with the first connection. Must be called with sessionPools.mutex locked */
+static sessionpool_t _getSessionPool(T C, URL_T url, const char *username, const char *password, char **error) {
+        for (sessionpool_t s = sessionPools.list; s; s = s->next) {
+                if (s->url == url) {
+                        s->refcount++;
+                        return s;
+                }
+        }
+        sessionpool_t s;
+        NEW(s);
+        s->url = url;
+        if (OCIEnvCreate(&s->env, OCI_THREADED | OCI_OBJECT | OCI_NCHAR_LITERAL_REPLACE_ON, 0, 0, 0, 0, 0, 0)) {
+                *error = Str_dup("Create a OCI environment failed");
+                goto fail;
+        }
+        if (OCI_SUCCESS != OCIHandleAlloc(s->env, (dvoid**)&s->err, OCI_HTYPE_ERROR, 0, 0)) {
+                *error = Str_dup("Allocating error handler failed");
+                goto fail;
+        }
+        if (OCI_SUCCESS != OCIHandleAlloc(s->env, (dvoid**)&s->spool, OCI_HTYPE_SPOOL, 0, 0)) {
+                *error = Str_dup("Allocating session pool handle failed");
+                goto fail;
+        }
+        sword status = OCISessionPoolCreate(s->env, s->err, s->spool, &s->name, &s->nameLength,
+                                     (OraText *)StringBuffer_toString(C->sb), StringBuffer_length(C->sb),
+                                     0, ORACLE_SESSION_POOL_MAX, 1,
+                                     (OraText *)username, (ub4)strlen(username), (OraText *)password, (ub4)strlen(password),
+                                     OCI_SPC_HOMOGENEOUS | OCI_SPC_STMTCACHE);
+        if (status != OCI_SUCCESS && status != OCI_SUCCESS_WITH_INFO) {
+                sb4 errcode;
+                OCIErrorGet(s->err, 1, NULL, &errcode, C->erb, (ub4)ERB_SIZE, OCI_HTYPE_ERROR);
+                *error = Str_dup(C->erb);
+                goto fail;
+        }
+        s->refcount = 1;
+        s->next = sessionPools.list;
+        sessionPools.list = s;
+        return s;
+fail:
+        _freeSessionPool(s);
+        return NULL;
+}
+
+
+static void _releaseSessionPool(sessionpool_t s) {
+        LOCK(sessionPools.mutex)
+        {
+                if (--s->refcount == 0) {
+                        for (sessionpool_t *p = &sessionPools.list; *p; p = &(*p)->next) {
+                                if (*p == s) {
+                                        *p = s->next;
+                                        break;
+                                }
+                        }
+                        _freeSessionPool(s);
+                }
+        }
+        END_LOCK;
+}
+
+
+/* Get a session from the shared session pool instead of attaching to the server and beginning a session of our own */
+static int _doSessionPoolConnect(T C, URL_T url, const char *username, const char *password, char **error) {
+        Thread_once(once, _init);
+        LOCK(sessionPools.mutex)
+        {
+                C->sessionPool = _getSessionPool(C, url, username, password, error);
+        }
+        END_LOCK;
+        if (! C->sessionPool)
+                return false;
+        C->env = C->sessionPool->env;
+        // The pool's error handle is shared, each connection uses its own
+        if (OCI_SUCCESS != OCIHandleAlloc(C->env, (dvoid**)&C->err, OCI_HTYPE_ERROR, 0, 0))
+                ERROR("Allocating error handler failed");
+        C->lastError = OCISessionGet(C->env, C->err, &C->svc, NULL, C->sessionPool->name, C->sessionPool->nameLength,
+                                     NULL, 0, NULL, NULL, NULL, OCI_SESSGET_SPOOL | OCI_SESSGET_STMTCACHE);
+        if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO) {
+                C->svc = NULL;
+                ORAERROR(C);
+        }
+        OCIAttrGet(C->svc, OCI_HTYPE_SVCCTX, &C->usr, NULL, OCI_ATTR_SESSION, C->err);
+        OCIAttrSet(C->svc, OCI_HTYPE_SVCCTX, &C->statementCache, 0, OCI_ATTR_STMTCACHESIZE, C->err);
+        return true;
+}
+
+
+static int _doConnect(T C, URL_T url, char**  error) {
         const char *database, *username, *password;
         const char *host = URL_getHost(url);
         int port = URL_getPort(url);
@@ -116,6 +252,39 @@ static int _doConnect(T C, URL_T url, char**  error) {
         if (! (database = URL_getPath(url)))
                 ERROR("no database specified in URL");
         ++database;
+        /* Rows and memory the client prefetch in one round trip */
+        C->prefetchRows = ORACLE_PREFETCH_ROWS;
+        if (URL_getParameter(url, "prefetch-rows")) {
+                TRY C->prefetchRows = Str_parseInt(URL_getParameter(url, "prefetch-rows")); ELSE C->prefetchRows = 0; END_TRY;
+                if (C->prefetchRows <= 0)
+                        ERROR("invalid prefetch rows value");
+        }
+        if (URL_getParameter(url, "prefetch-memory")) {
+                TRY C->prefetchMemory = Str_parseInt(URL_getParameter(url, "prefetch-memory")); ELSE C->prefetchMemory = -1; END_TRY;
+                if (C->prefetchMemory < 0)
+                        ERROR("invalid prefetch memory value");
+        }
+        int sessionPool = IS(URL_getParameter(url, "session-pool"), "true");
+        /* Statements kept prepared per session by OCIStmtPrepare2 */
+        C->statementCache = sessionPool ? ORACLE_STATEMENT_CACHE : 0;
+        if (URL_getParameter(url, "statement-cache")) {
+                volatile int size = -1;
+                TRY size = Str_parseInt(URL_getParameter(url, "statement-cache")); ELSE size = -1; END_TRY;
+                if (size < 0)
+                        ERROR("invalid statement cache value");
+                C->statementCache = size;
+        }
+        StringBuffer_clear(C->sb);
+        /* Oracle connect string is on the form: //host[:port]/service name */
+        if (host) {
+                StringBuffer_append(C->sb, "//%s", host);
+                if (port > 0)
+                        StringBuffer_append(C->sb, ":%d", port);
+                StringBuffer_append(C->sb, "/%s", database);
+        } else /* Or just service name */
+                StringBuffer_append(C->sb, "%s", database);
+        if (sessionPool)
+                return _doSessionPoolConnect(C, url, username, password, error);
         /* Create a thread-safe OCI environment with N' substitution turned on. */
         if (OCIEnvCreate(&C->env, OCI_THREADED | OCI_OBJECT | OCI_NCHAR_LITERAL_REPLACE_ON, 0, 0, 0, 0, 0, 0))
                 ERROR("Create a OCI environment failed");
@@ -128,15 +297,6 @@ static int _doConnect(T C, URL_T url, char**  error) {
         /* allocate a service handle */
         if (OCI_SUCCESS != OCIHandleAlloc(C->env, (dvoid**)&C->svc, OCI_HTYPE_SVCCTX, 0, 0))
                 ERROR("Allocating service handle failed");
-        StringBuffer_clear(C->sb);
-        /* Oracle connect string is on the form: //host[:port]/service name */
-        if (host) {
-                StringBuffer_append(C->sb, "//%s", host);
-                if (port > 0)
-                        StringBuffer_append(C->sb, ":%d", port);
-                StringBuffer_append(C->sb, "/%s", database);
-        } else /* Or just service name */
-                StringBuffer_append(C->sb, "%s", database);
         /* Create a server context */
         C->lastError = OCIServerAttach(C->srv, C->err, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), 0);
         if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO)
@@ -158,11 +318,33 @@ static int _doConnect(T C, URL_T url, char**  error) {
         if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO)
                 ORAERROR(C);
         OCIAttrSet(C->svc, OCI_HTYPE_SVCCTX, C->usr, 0, OCI_ATTR_SESSION, C->err);
+        OCIAttrSet(C->svc, OCI_HTYPE_SVCCTX, &C->statementCache, 0, OCI_ATTR_STMTCACHESIZE, C->err);
         return true;
 }
 
 
-WATCHDOG(watchdog, T)
+/* Prepare sql with the session's statement cache. Release the statement with OCIStmtRelease */
+static int _prepare(T C, OCIStmt **stmtp) {
+        C->lastError = OCIStmtPrepare2(C->svc, stmtp, C->err, (OraText *)StringBuffer_toString(C->sb), StringBuffer_length(C->sb), NULL, 0, OCI_NTV_SYNTAX, OCI_DEFAULT);
+        return C->lastError == OCI_SUCCESS || C->lastError == OCI_SUCCESS_WITH_INFO;
+}
+
+
+/* Let OCIStmtExecute and OCIStmtFetch2 bring rows into the client side row cache in batches, instead of one round trip per row */
+static void _setPrefetch(T C, OCIStmt *stmtp) {
+        ub4 rows = C->fetchSize > 0 ? C->fetchSize : C->prefetchRows;
+        ub4 memory = C->prefetchMemory;
+        OCIAttrSet(stmtp, OCI_HTYPE_STMT, &rows, sizeof(rows), OCI_ATTR_PREFETCH_ROWS, C->err);
+        if (memory > 0)
+                OCIAttrSet(stmtp, OCI_HTYPE_STMT, &memory, sizeof(memory), OCI_ATTR_PREFETCH_MEMORY, C->err);
+}
+
+
+/* Watchdog alarm, interrupt the call exceeding the query timeout */
+static void _break(void *args) {
+        T C = args;
+        OCIBreak(C->svc, C->err);
+}
 
 
 /* ----------------------------------------------------- Protected methods */
@@ -172,7 +354,7 @@ WATCHDOG(watchdog, T)
 #pragma GCC visibility push(hidden)
 #endif
 
-T OracleConnection_new(URL_T url, char **error) {
+T OracleConnection_new(URL_T url, void *context, char **error) {
         T C;
         assert(url);
         assert(error);
@@ -185,14 +367,27 @@ T OracleConnection_new(URL_T url, char **error) {
                 return NULL;
         }
         C->txnhp = NULL;
-        C->running = false;
-        Thread_create(C->watchdog, watchdog, C);
+        C->watchdog = Watchdog_new(_break, C);
         return C;
 }
 
 
 void OracleConnection_free(T* C) {
         assert(C && *C);
+        if ((*C)->watchdog)
+                Watchdog_free(&(*C)->watchdog);
+        if ((*C)->sessionPool) {
+                if ((*C)->txnhp)
+                        OCIHandleFree((*C)->txnhp, OCI_HTYPE_TRANS);
+                if ((*C)->svc)
+                        OCISessionRelease((*C)->svc, (*C)->err, NULL, 0, OCI_DEFAULT);
+                if ((*C)->err)
+                        OCIHandleFree((*C)->err, OCI_HTYPE_ERROR);
+                _releaseSessionPool((*C)->sessionPool);
+                StringBuffer_free(&(*C)->sb);
+                FREE(*C);
+                return;
+        }
         if ((*C)->svc) {
                 OCISessionEnd((*C)->svc, (*C)->err, (*C)->usr, OCI_DEFAULT);
                 (*C)->svc = NULL;
@@ -202,8 +397,6 @@ void OracleConnection_free(T* C) {
         if ((*C)->env)
                 OCIHandleFree((*C)->env, OCI_HTYPE_ENV);
         StringBuffer_free(&(*C)->sb);
-        if ((*C)->watchdog)
-            Thread_join((*C)->watchdog);
         FREE(*C);
 }
 
@@ -220,6 +413,12 @@ void OracleConnection_setMaxRows(T C, int max) {
 }
 
 
+void OracleConnection_setFetchSize(T C, int rows) {
+        assert(C);
+        C->fetchSize = rows;
+}
+
+
 int  OracleConnection_ping(T C) {
         assert(C);
         C->lastError = OCIPing(C->svc, C->err, OCI_DEFAULT);
@@ -227,8 +426,19 @@ int  OracleConnection_ping(T C) {
 }
 
 
-int  OracleConnection_beginTransaction(T C) {
+int  OracleConnection_beginTransaction(T C, int type) {
         assert(C);
+        int isolation = type & ~(Transaction_ReadOnly | Transaction_Deferred);
+        int flags = OCI_TRANS_NEW;
+        if (type & Transaction_ReadOnly)
+                flags |= OCI_TRANS_READONLY;
+        else if (isolation == Transaction_Serializable || isolation == Transaction_RepeatableRead)
+                flags |= OCI_TRANS_SERIALIZABLE;
+        // Statements are not auto-committed, the first statement starts a default transaction
+        if (flags == OCI_TRANS_NEW && (type & Transaction_Deferred)) {
+                C->lastError = OCI_SUCCESS;
+                return true;
+        }
         if (C->txnhp == NULL) /* Allocate handler only once, if it is necessary */
         {
             /* allocate transaction handle and set it in the service handle */
@@ -237,7 +447,7 @@ int  OracleConnection_beginTransaction(T C) {
                 return false;
             OCIAttrSet(C->svc, OCI_HTYPE_SVCCTX, (void *)C->txnhp, 0, OCI_ATTR_TRANS, C->err);
         }
-        C->lastError = OCITransStart (C->svc, C->err, ORACLE_TRANSACTION_PERIOD, OCI_TRANS_NEW);
+        C->lastError = OCITransStart (C->svc, C->err, ORACLE_TRANSACTION_PERIOD, flags);
         return (C->lastError == OCI_SUCCESS);
 }
 
@@ -302,32 +512,24 @@ int  OracleConnection_execute(T C, const char *sql, va_list ap) {
         va_end(ap_copy);
         StringBuffer_trim(C->sb);
         /* Build statement */
-        C->lastError = OCIHandleAlloc(C->env, (void **)&stmtp, OCI_HTYPE_STMT, 0, NULL);
-        if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO)
-                return false;
-        C->lastError = OCIStmtPrepare(stmtp, C->err, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), OCI_NTV_SYNTAX, OCI_DEFAULT);
-        if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO) {
-                OCIHandleFree(stmtp, OCI_HTYPE_STMT);
+        if (! _prepare(C, &stmtp))
                 return false;
-        }
         /* Execute */
-        if (C->timeout > 0) {
-                C->countdown = C->timeout;
-                C->running = true;
-        }
+        if (C->timeout > 0)
+                Watchdog_start(C->watchdog, C->timeout);
         C->lastError = OCIStmtExecute(C->svc, stmtp, C->err, 1, 0, NULL, NULL, OCI_DEFAULT);
-        C->running = false;
+        Watchdog_stop(C->watchdog);
         if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO) {
                 ub4 parmcnt = 0;
                 OCIAttrGet(stmtp, OCI_HTYPE_STMT, &parmcnt, NULL, OCI_ATTR_PARSE_ERROR_OFFSET, C->err);
                 DEBUG("Error occured in StmtExecute %d (%s), offset is %d\n", C->lastError, OracleConnection_getLastError(C), parmcnt);
-                OCIHandleFree(stmtp, OCI_HTYPE_STMT);
+                OCIStmtRelease(stmtp, C->err, NULL, 0, OCI_DEFAULT);
                 return false;
         }
         C->lastError = OCIAttrGet(stmtp, OCI_HTYPE_STMT, &C->rowsChanged, 0, OCI_ATTR_ROW_COUNT, C->err);
         if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO)
                 DEBUG("OracleConnection_execute: Error in OCIAttrGet %d (%s)\n", C->lastError, OracleConnection_getLastError(C));
-        OCIHandleFree(stmtp, OCI_HTYPE_STMT);
+        OCIStmtRelease(stmtp, C->err, NULL, 0, OCI_DEFAULT);
         return C->lastError == OCI_SUCCESS;
 }
 
@@ -342,26 +544,19 @@ ResultSet_T OracleConnection_executeQuery(T C, const char *sql, va_list ap) {
         va_end(ap_copy);
         StringBuffer_trim(C->sb);
         /* Build statement */
-        C->lastError = OCIHandleAlloc(C->env, (void **)&stmtp, OCI_HTYPE_STMT, 0, NULL);
-        if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO)
-                return NULL;
-        C->lastError = OCIStmtPrepare(stmtp, C->err, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), OCI_NTV_SYNTAX, OCI_DEFAULT);
-        if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO) {
-                OCIHandleFree(stmtp, OCI_HTYPE_STMT);
+        if (! _prepare(C, &stmtp))
                 return NULL;
-        }
+        _setPrefetch(C, stmtp);
         /* Execute and create Result Set */
-        if (C->timeout > 0) {
-                C->countdown = C->timeout;
-                C->running = true;
-        }
+        if (C->timeout > 0)
+                Watchdog_start(C->watchdog, C->timeout);
         C->lastError = OCIStmtExecute(C->svc, stmtp, C->err, 0, 0, NULL, NULL, OCI_DEFAULT);    
-        C->running = false;
+        Watchdog_stop(C->watchdog);
         if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO) {
                 ub4 parmcnt = 0;
                 OCIAttrGet(stmtp, OCI_HTYPE_STMT, &parmcnt, NULL, OCI_ATTR_PARSE_ERROR_OFFSET, C->err);
                 DEBUG("Error occured in StmtExecute %d (%s), offset is %d\n", C->lastError, OracleConnection_getLastError(C), parmcnt);
-                OCIHandleFree(stmtp, OCI_HTYPE_STMT);
+                OCIStmtRelease(stmtp, C->err, NULL, 0, OCI_DEFAULT);
                 return NULL;
         }
         C->lastError = OCIAttrGet(stmtp, OCI_HTYPE_STMT, &C->rowsChanged, 0, OCI_ATTR_ROW_COUNT, C->err);
@@ -381,14 +576,9 @@ PreparedStatement_T OracleConnection_prepareStatement(T C, const char *sql, va_l
         StringBuffer_trim(C->sb);
         int paramCount = StringBuffer_prepare4oracle(C->sb);
         /* Build statement */
-        C->lastError = OCIHandleAlloc(C->env, (void **)&stmtp, OCI_HTYPE_STMT, 0, 0);
-        if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO)
+        if (! _prepare(C, &stmtp))
                 return NULL;
-        C->lastError = OCIStmtPrepare(stmtp, C->err, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), OCI_NTV_SYNTAX, OCI_DEFAULT);
-        if (C->lastError != OCI_SUCCESS && C->lastError != OCI_SUCCESS_WITH_INFO) {
-                OCIHandleFree(stmtp, OCI_HTYPE_STMT);
-                return NULL;
-        }
+        _setPrefetch(C, stmtp);
         return PreparedStatement_new(OraclePreparedStatement_new(stmtp, C->env, C->usr, C->err, C->svc, C->maxRows, C->timeout), (Pop_T)&oraclepops, paramCount);
 }
 
@@ -428,6 +618,17 @@ const char *OracleConnection_getLastError(T C) {
 }
 
 
+int OracleConnection_isRetryable(T C) {
+        assert(C);
+        // Prepared statements report errors in the connection's error handle too
+        sb4 errcode = 0;
+        char erb[ERB_SIZE];
+        if (OCIErrorGet(C->err, 1, NULL, &errcode, (OraText *)erb, (ub4)ERB_SIZE, OCI_HTYPE_ERROR) != OCI_SUCCESS)
+                return false;
+        return errcode == ORA_DEADLOCK || errcode == ORA_CANNOT_SERIALIZE;
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -25,12 +25,13 @@
 #ifndef ORACLE_CONNECTION_INCLUDED
 #define ORACLE_CONNECTION_INCLUDED
 #define T ConnectionDelegate_T
-T    OracleConnection_new(URL_T url, char **error);
+T    OracleConnection_new(URL_T url, void *context, char **error);
 void OracleConnection_free(T *C);
 void OracleConnection_setQueryTimeout(T C, int ms);
 void OracleConnection_setMaxRows(T C, int max);
+void OracleConnection_setFetchSize(T C, int rows);
 int  OracleConnection_ping(T C);
-int  OracleConnection_beginTransaction(T C);
+int  OracleConnection_beginTransaction(T C, int type);
 int  OracleConnection_commit(T C);
 int  OracleConnection_rollback(T C);
 long long OracleConnection_lastRowId(T C);
@@ -39,5 +40,6 @@ int  OracleConnection_execute(T C, const char *sql, va_list ap);
 ResultSet_T OracleConnection_executeQuery(T C, const char *sql, va_list ap);
 PreparedStatement_T OracleConnection_prepareStatement(T C, const char *sql, va_list ap);
 const char *OracleConnection_getLastError(T C);
+int OracleConnection_isRetryable(T C);
 #undef T
 #endif
@@ -42,7 +42,7 @@
 #include "OraclePreparedStatement.h"
 #include "ConnectionDelegate.h"
 #include "OracleConnection.h"
-#include "OracleWatchdog.h"
+#include "system/Watchdog.h"
 
 
 /**
@@ -66,7 +66,8 @@ const struct Pop_T oraclepops = {
         .setBlob        = OraclePreparedStatement_setBlob,
         .execute        = OraclePreparedStatement_execute,
         .executeQuery   = OraclePreparedStatement_executeQuery,
-        .rowsChanged    = OraclePreparedStatement_rowsChanged
+        .rowsChanged    = OraclePreparedStatement_rowsChanged,
+        .setBlobStream  = OraclePreparedStatement_setBlobStream
 };
 typedef struct param_t {
         union {
@@ -79,12 +80,12 @@ typedef struct param_t {
         } type;
         int length;
         OCIBind* bind;
+        OCILobLocator *lob;     // Temporary LOB holding a blob stream
 } *param_t;
 #define T PreparedStatementDelegate_T
 struct T {
         int         maxRows;
         int         timeout;
-        int         countdown;
         ub4         paramCount;
         OCISession* usr;
         OCIStmt*    stmt;
@@ -93,8 +94,7 @@ struct T {
         OCISvcCtx*  svc;
         param_t     params;
         sword       lastError;
-        Thread_T    watchdog;
-        char        running;
+        Watchdog_T watchdog;
         ub4         rowsChanged;
 };
 
@@ -104,7 +104,19 @@ extern const struct Rop_T oraclerops;
 /* ------------------------------------------------------- Private methods */
 
 
-WATCHDOG(watchdog, T)
+/* Watchdog alarm, interrupt the call exceeding the query timeout */
+static void _break(void *args) {
+        T P = args;
+        OCIBreak(P->svc, P->err);
+}
+
+
+/* Release the temporary LOB of a blob stream parameter, the descriptor is reused */
+static void _freeTemporary(T P, param_t p) {
+        boolean temporary = FALSE;
+        if (p->lob && OCILobIsTemporary(P->env, P->err, p->lob, &temporary) == OCI_SUCCESS && temporary)
+                OCILobFreeTemporary(P->svc, P->err, p->lob);
+}
 
 
 /* ----------------------------------------------------- Protected methods */
@@ -136,21 +148,25 @@ T OraclePreparedStatement_new(OCIStmt *stmt, OCIEnv *env, OCISession* usr, OCIEr
                 P->paramCount = 0; 
         if (P->paramCount)
                 P->params = CALLOC(P->paramCount, sizeof(struct param_t));
-        P->running = false;
-        Thread_create(P->watchdog, watchdog, P);
+        P->watchdog = Watchdog_new(_break, P);
         return P;
 }
 
 
 void OraclePreparedStatement_free(T *P) {
         assert(P && *P);
-        OCIHandleFree((*P)->stmt, OCI_HTYPE_STMT);
+        Watchdog_free(&(*P)->watchdog);
+        OCIStmtRelease((*P)->stmt, (*P)->err, NULL, 0, OCI_DEFAULT);
         if ((*P)->params) {
+                for (ub4 i = 0; i < (*P)->paramCount; i++) {
+                        if ((*P)->params[i].lob) {
+                                _freeTemporary(*P, &(*P)->params[i]);
+                                OCIDescriptorFree((*P)->params[i].lob, OCI_DTYPE_LOB);
+                        }
+                }
                 // (*P)->params[i].bind is freed implicitly when the statement handle is deallocated
                 FREE((*P)->params);
         }
-        (*P)->svc = NULL;
-        Thread_join((*P)->watchdog);
         FREE(*P);
 }
 
@@ -251,15 +267,50 @@ void OraclePreparedStatement_setBlob(T P, int parameterIndex, const void *x, int
 }
 
 
+/* The value is appended to a temporary LOB piece by piece and the LOB locator bound */
+void OraclePreparedStatement_setBlobStream(T P, int parameterIndex, int (*read)(void *buffer, int size, void *context), void *context) {
+        assert(P);
+        int i = checkAndSetParameterIndex(parameterIndex, P->paramCount);
+        param_t p = &P->params[i];
+        if (p->lob)
+                _freeTemporary(P, p);
+        else if ((P->lastError = OCIDescriptorAlloc(P->env, (void **)&p->lob, OCI_DTYPE_LOB, 0, NULL)) != OCI_SUCCESS) {
+                p->lob = NULL;
+                THROW(SQLException, "%s", OraclePreparedStatement_getLastError(P->lastError, P->err));
+        }
+        P->lastError = OCILobCreateTemporary(P->svc, P->err, p->lob, OCI_DEFAULT, SQLCS_IMPLICIT, OCI_TEMP_BLOB, FALSE, OCI_DURATION_SESSION);
+        if (P->lastError != OCI_SUCCESS && P->lastError != OCI_SUCCESS_WITH_INFO)
+                THROW(SQLException, "%s", OraclePreparedStatement_getLastError(P->lastError, P->err));
+        char * volatile chunk = ALLOC(SQL_DEFAULT_LOB_CHUNK_SIZE);
+        TRY
+        {
+                for (int n; (n = read(chunk, SQL_DEFAULT_LOB_CHUNK_SIZE, context)); ) {
+                        if (n < 0)
+                                THROW(SQLException, "Failed to read blob stream for parameter %d", parameterIndex);
+                        oraub8 bytes = n;
+                        P->lastError = OCILobWriteAppend2(P->svc, P->err, p->lob, &bytes, NULL, chunk, n, OCI_ONE_PIECE, NULL, NULL, 0, SQLCS_IMPLICIT);
+                        if (P->lastError != OCI_SUCCESS && P->lastError != OCI_SUCCESS_WITH_INFO)
+                                THROW(SQLException, "%s", OraclePreparedStatement_getLastError(P->lastError, P->err));
+                }
+        }
+        FINALLY
+        {
+                FREE(chunk);
+        }
+        END_TRY;
+        P->lastError = OCIBindByPos(P->stmt, &p->bind, P->err, parameterIndex, &p->lob, sizeof(OCILobLocator *), SQLT_BLOB, 0, 0, 0, 0, 0, OCI_DEFAULT);
+        if (P->lastError != OCI_SUCCESS && P->lastError != OCI_SUCCESS_WITH_INFO)
+                THROW(SQLException, "%s", OraclePreparedStatement_getLastError(P->lastError, P->err));
+}
+
+
 void OraclePreparedStatement_execute(T P) {
         assert(P);
         P->rowsChanged = 0;
-        if (P->timeout > 0) {
-                P->countdown = P->timeout;
-                P->running = true;
-        }
+        if (P->timeout > 0)
+                Watchdog_start(P->watchdog, P->timeout);
         P->lastError = OCIStmtExecute(P->svc, P->stmt, P->err, 1, 0, NULL, NULL, OCI_DEFAULT);
-        P->running = false;
+        Watchdog_stop(P->watchdog);
         if (P->lastError != OCI_SUCCESS && P->lastError != OCI_SUCCESS_WITH_INFO)
                 THROW(SQLException, "%s", OraclePreparedStatement_getLastError(P->lastError, P->err));
         P->lastError = OCIAttrGet( P->stmt, OCI_HTYPE_STMT, &P->rowsChanged, 0, OCI_ATTR_ROW_COUNT, P->err);
@@ -271,12 +322,10 @@ void OraclePreparedStatement_execute(T P) {
 ResultSet_T OraclePreparedStatement_executeQuery(T P) {
         assert(P);
         P->rowsChanged = 0;
-        if (P->timeout > 0) {
-                P->countdown = P->timeout;
-                P->running = true;
-        }
+        if (P->timeout > 0)
+                Watchdog_start(P->watchdog, P->timeout);
         P->lastError = OCIStmtExecute(P->svc, P->stmt, P->err, 0, 0, NULL, NULL, OCI_DEFAULT);
-        P->running = false;
+        Watchdog_stop(P->watchdog);
         if (P->lastError == OCI_SUCCESS || P->lastError == OCI_SUCCESS_WITH_INFO)
                 return ResultSet_new(OracleResultSet_new(P->stmt, P->env, P->usr, P->err, P->svc, false, P->maxRows), (Rop_T)&oraclerops);
         THROW(SQLException, "%s", OraclePreparedStatement_getLastError(P->lastError, P->err));
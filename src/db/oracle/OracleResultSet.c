@@ -60,17 +60,25 @@ const struct Rop_T oraclerops = {
         .next           = OracleResultSet_next,
         .isnull         = OracleResultSet_isnull,
         .getString      = OracleResultSet_getString,
-        .getBlob        = OracleResultSet_getBlob
+        .getBlob        = OracleResultSet_getBlob,
+        .getInt         = OracleResultSet_getInt,
+        .getLLong       = OracleResultSet_getLLong,
+        .getDouble      = OracleResultSet_getDouble,
         // getTimestamp and getDateTime is handled in ResultSet
+        .readBlob       = OracleResultSet_readBlob,
+        .getMemory      = OracleResultSet_getMemory
 };
 typedef struct column_t {
         OCIDefine *def;
         int isNull;
         char *buffer;
+        long capacity;          // Bytes allocated for buffer
         char *name;
         unsigned long length;
         OCILobLocator *lob_loc;
         OCIDateTime   *date; 
+        int isNumber;
+        OCINumber number;
 } *column_t;
 #define T ResultSetDelegate_T
 struct T {
@@ -92,6 +100,7 @@ struct T {
 #endif
 #define LOB_CHUNK_SIZE  2000
 #define DATE_STR_BUF_SIZE   255
+#define NUMBER_STR_BUF_SIZE 64
 
 
 /* ------------------------------------------------------- Private methods */
@@ -153,9 +162,20 @@ static int _initaleDefiningBuffers(T R) {
                                 R->lastError = OCIDefineByPos(R->stmt, &R->columns[i-1].def, R->err, i, 
                                         &(R->columns[i-1].date), sizeof(R->columns[i-1].date), SQLT_TIMESTAMP, &(R->columns[i-1].isNull), 0, 0, OCI_DEFAULT);
                                 break;
+                        case SQLT_NUM:
+                                /* Fetch numbers in Oracle's internal format so typed getters
+                                 can convert them without a round-trip through text */
+                                R->columns[i-1].lob_loc = NULL;
+                                R->columns[i-1].isNumber = true;
+                                R->columns[i-1].buffer = ALLOC(NUMBER_STR_BUF_SIZE + 1);
+                                R->columns[i-1].capacity = NUMBER_STR_BUF_SIZE + 1;
+                                R->lastError = OCIDefineByPos(R->stmt, &R->columns[i-1].def, R->err, i, 
+                                        &(R->columns[i-1].number), sizeof(OCINumber), SQLT_VNU, &(R->columns[i-1].isNull), 0, 0, OCI_DEFAULT);
+                                break;
                         default:
                                 R->columns[i-1].lob_loc = NULL;
                                 R->columns[i-1].buffer = ALLOC(deptlen + 1);
+                                R->columns[i-1].capacity = deptlen + 1;
                                 R->lastError = OCIDefineByPos(R->stmt, &R->columns[i-1].def, R->err, i, 
                                         R->columns[i-1].buffer, deptlen, SQLT_STR, &(R->columns[i-1].isNull), 0, 0, OCI_DEFAULT);
                 }
@@ -196,6 +216,7 @@ static int _toString(T R, int i)
                 FREE(R->columns[i].buffer);
 
         R->columns[i].buffer = ALLOC(R->columns[i].length + 1);
+        R->columns[i].capacity = R->columns[i].length + 1;
         R->lastError = OCIDateTimeToText(R->usr, 
                                          R->err, 
                                          R->columns[i].date,
@@ -207,6 +228,16 @@ static int _toString(T R, int i)
 }
 
 
+static int _numberToString(T R, int i)
+{
+        const char fmt[] = "TM9";
+        ub4 length = NUMBER_STR_BUF_SIZE;
+        R->lastError = OCINumberToText(R->err, &R->columns[i].number, (const OraText *)fmt, strlen(fmt), NULL, 0, &length, (OraText *)R->columns[i].buffer);
+        R->columns[i].length = length;
+        return ((R->lastError == OCI_SUCCESS) || (R->lastError == OCI_SUCCESS_WITH_INFO));
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -249,7 +280,7 @@ T OracleResultSet_new(OCIStmt *stmt, OCIEnv *env, OCISession* usr, OCIError *err
 void OracleResultSet_free(T *R) {
         assert(R && *R);
         if ((*R)->freeStatement)
-                OCIHandleFree((*R)->stmt, OCI_HTYPE_STMT);
+                OCIStmtRelease((*R)->stmt, (*R)->err, NULL, 0, OCI_DEFAULT);
         for (int i = 0; i < (*R)->columnCount; i++) {
                 if ((*R)->columns[i].lob_loc)
                         OCIDescriptorFree((*R)->columns[i].lob_loc, OCI_DTYPE_LOB);
@@ -335,6 +366,13 @@ const char *OracleResultSet_getString(T R, int columnIndex) {
                         THROW(SQLException, "%s", OraclePreparedStatement_getLastError(R->lastError, R->err));
                 }
         }
+        else if (R->columns[i].isNumber)
+        {
+                if (!_numberToString(R, i))
+                {
+                        THROW(SQLException, "%s", OraclePreparedStatement_getLastError(R->lastError, R->err));
+                }
+        }
         if (R->columns[i].buffer)
                 R->columns[i].buffer[R->columns[i].length] = 0;
         return R->columns[i].buffer;
@@ -348,32 +386,110 @@ const void *OracleResultSet_getBlob(T R, int columnIndex, int *size) {
                 return NULL;
         if (R->columns[i].buffer)
                 FREE(R->columns[i].buffer);
+        // Size the buffer to the LOB length, a CLOB length is in characters and may need more bytes
+        oraub8 length = 0;
+        OCILobGetLength2(R->svc, R->err, R->columns[i].lob_loc, &length);
+        oraub8 capacity = length + 1 > LOB_CHUNK_SIZE ? length + 1 : LOB_CHUNK_SIZE;
         oraub8 read_chars = 0;
         oraub8 read_bytes = 0;
         oraub8 total_bytes = 0;
-        R->columns[i].buffer = ALLOC(LOB_CHUNK_SIZE);
+        R->columns[i].buffer = ALLOC((long)capacity);
+        R->columns[i].capacity = (long)capacity;
         *size = 0;
         ub1 piece = OCI_FIRST_PIECE;
         do {
                 read_bytes = 0;
                 read_chars = 0;
                 R->lastError = OCILobRead2(R->svc, R->err, R->columns[i].lob_loc, &read_bytes, &read_chars, 1, 
-                                R->columns[i].buffer + total_bytes, LOB_CHUNK_SIZE, piece, NULL, NULL, 0, SQLCS_IMPLICIT);
+                                R->columns[i].buffer + total_bytes, capacity - total_bytes, piece, NULL, NULL, 0, SQLCS_IMPLICIT);
                 if (read_bytes) {
                         total_bytes += read_bytes;
                         piece = OCI_NEXT_PIECE;
-                        R->columns[i].buffer = RESIZE(R->columns[i].buffer, (long)(total_bytes + LOB_CHUNK_SIZE));
+                        if (R->lastError == OCI_NEED_DATA && total_bytes == capacity) {
+                                capacity *= 2;
+                                R->columns[i].buffer = RESIZE(R->columns[i].buffer, (long)capacity);
+                                R->columns[i].capacity = (long)capacity;
+                        }
                 }
         } while (R->lastError == OCI_NEED_DATA);
         if (R->lastError != OCI_SUCCESS && R->lastError != OCI_SUCCESS_WITH_INFO) {
                 FREE(R->columns[i].buffer);
                 R->columns[i].buffer = NULL;
+                R->columns[i].capacity = 0;
                 THROW(SQLException, "%s", OraclePreparedStatement_getLastError(R->lastError, R->err));
         }
         *size = R->columns[i].length = (int)total_bytes;
         return (const void *)R->columns[i].buffer;
 }
 
+
+int OracleResultSet_readBlob(T R, int columnIndex, long long offset, void *buffer, int length) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (R->columns[i].isNull || length == 0)
+                return 0;
+        if (! R->columns[i].lob_loc) {
+                const char *s = OracleResultSet_getString(R, columnIndex);
+                return copyBlob(s, s ? strlen(s) : 0, offset, buffer, length);
+        }
+        oraub8 read_bytes = length;
+        oraub8 read_chars = 0;
+        // LOB offsets start at 1
+        R->lastError = OCILobRead2(R->svc, R->err, R->columns[i].lob_loc, &read_bytes, &read_chars, (oraub8)offset + 1, 
+                                   buffer, length, OCI_ONE_PIECE, NULL, NULL, 0, SQLCS_IMPLICIT);
+        if (R->lastError == OCI_NO_DATA)
+                return 0;
+        if (R->lastError != OCI_SUCCESS && R->lastError != OCI_SUCCESS_WITH_INFO)
+                THROW(SQLException, "%s", OraclePreparedStatement_getLastError(R->lastError, R->err));
+        return (int)read_bytes;
+}
+
+
+int OracleResultSet_getInt(T R, int columnIndex) {
+        assert(R);
+        return (int)OracleResultSet_getLLong(R, columnIndex);
+}
+
+
+long long OracleResultSet_getLLong(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (R->columns[i].isNull)
+                return 0;
+        if (! R->columns[i].isNumber)
+                return Str_parseLLong(OracleResultSet_getString(R, columnIndex));
+        long long x = 0;
+        R->lastError = OCINumberToInt(R->err, &R->columns[i].number, sizeof(x), OCI_NUMBER_SIGNED, &x);
+        if (R->lastError != OCI_SUCCESS && R->lastError != OCI_SUCCESS_WITH_INFO)
+                THROW(SQLException, "%s", OraclePreparedStatement_getLastError(R->lastError, R->err));
+        return x;
+}
+
+
+double OracleResultSet_getDouble(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (R->columns[i].isNull)
+                return 0.0;
+        if (! R->columns[i].isNumber)
+                return Str_parseDouble(OracleResultSet_getString(R, columnIndex));
+        double x = 0.0;
+        R->lastError = OCINumberToReal(R->err, &R->columns[i].number, sizeof(x), &x);
+        if (R->lastError != OCI_SUCCESS && R->lastError != OCI_SUCCESS_WITH_INFO)
+                THROW(SQLException, "%s", OraclePreparedStatement_getLastError(R->lastError, R->err));
+        return x;
+}
+
+
+long long OracleResultSet_getMemory(T R) {
+        assert(R);
+        long long memory = 0;
+        for (int i = 0; i < R->columnCount; i++)
+                memory += R->columns[i].capacity;
+        return memory;
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
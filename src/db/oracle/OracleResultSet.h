@@ -35,5 +35,10 @@ int  OracleResultSet_next(T R);
 int OracleResultSet_isnull(T R, int columnIndex);
 const char *OracleResultSet_getString(T R, int columnIndex);
 const void *OracleResultSet_getBlob(T R, int columnIndex, int *size);
+int OracleResultSet_readBlob(T R, int columnIndex, long long offset, void *buffer, int length);
+long long OracleResultSet_getMemory(T R);
+int OracleResultSet_getInt(T R, int columnIndex);
+long long OracleResultSet_getLLong(T R, int columnIndex);
+double OracleResultSet_getDouble(T R, int columnIndex);
 #undef T
 #endif
@@ -35,6 +35,7 @@
 #include "PreparedStatement.h"
 #include "PostgresqlResultSet.h"
 #include "PostgresqlPreparedStatement.h"
+#include "Connection.h"
 #include "ConnectionDelegate.h"
 #include "PostgresqlConnection.h"
 
@@ -64,9 +65,33 @@ const struct Cop_T postgresqlcops = {
         .execute		= PostgresqlConnection_execute,
         .executeQuery		= PostgresqlConnection_executeQuery,
         .prepareStatement	= PostgresqlConnection_prepareStatement,
-        .getLastError		= PostgresqlConnection_getLastError
+        .getLastError		= PostgresqlConnection_getLastError,
+        .setFetchSize		= PostgresqlConnection_setFetchSize,
+        .beginCopy		= PostgresqlConnection_beginCopy,
+        .writeCopy		= PostgresqlConnection_writeCopy,
+        .readCopy		= PostgresqlConnection_readCopy,
+        .endCopy		= PostgresqlConnection_endCopy,
+        .getSocket		= PostgresqlConnection_getSocket,
+        .sendQuery		= PostgresqlConnection_sendQuery,
+        .isBusy			= PostgresqlConnection_isBusy,
+        .getResult		= PostgresqlConnection_getResult,
+        .isRetryable		= PostgresqlConnection_isRetryable,
+        .newContext		= PostgresqlConnection_newContext,
+        .freeContext		= PostgresqlConnection_freeContext,
+#ifdef LIBPQ_HAS_PIPELINING
+        .beginPipeline		= PostgresqlConnection_beginPipeline,
+        .endPipeline		= PostgresqlConnection_endPipeline
+#endif
 };
 
+/* Connect settings of a pool, derived from the URL once */
+typedef struct context_t {
+        char *error;                    // Set if the URL is invalid, reported by each connect
+        char *conninfo;
+        int prefetchRows;
+        int binary;                     // Binary format was asked for in the URL
+} *context_t;
+
 #define T ConnectionDelegate_T
 struct T {
         URL_T url;
@@ -74,10 +99,28 @@ struct T {
 	PGresult *res;
 	int maxRows;
 	int timeout;
+        int sessionTimeout;             // statement_timeout once pending commands are sent, -1 if unknown
+        int beginTimeout;               // statement_timeout when the transaction began
+        int binary;
+        int prefetchRows;
+        int fetchSize;
+        int pipeline;
+        int queued;
+        int copy;
+        int copyLength;
+        char *copyBuffer;
+        char *copyData;
 	ExecStatusType lastError;
         StringBuffer_T sb;
+        StringBuffer_T pending;         // SET and deferred BEGIN commands sent before the next command
+        StringBuffer_T deallocate;      // DEALLOCATE commands sent before the next command outside of a transaction
+        int deferred;                   // A deferred BEGIN is queued in pending
+        int deferredAt;                 // Offset of the deferred BEGIN in pending
+        char sqlstate[6];               // SQLSTATE of the last failed statement, also of prepared statements
 };
 static uint32_t statementid = 0;
+#define POSTGRESQL_PREFETCH_ROWS 100
+#define POSTGRESQL_COPY_BUFFER 65536
 extern const struct Rop_T postgresqlrops;
 extern const struct Pop_T postgresqlpops;
 
@@ -85,80 +128,282 @@ extern const struct Pop_T postgresqlpops;
 /* ------------------------------------------------------- Private methods */
 
 
-static int _doConnect(T C, char **error) {
-#define ERROR(e) do {*error = Str_dup(e); goto error;} while (0)
+static int _doConnect(T C, context_t X, char **error) {
+        if (X->error) {
+                *error = Str_dup(X->error);
+                return false;
+        }
+        C->prefetchRows = X->prefetchRows;
+        C->db = PQconnectdb(X->conninfo);
+        if (PQstatus(C->db) == CONNECTION_OK) {
+                // Binary timestamps are only decoded in the integer format used by default since Postgres 8.4
+                C->binary = X->binary && IS(PQparameterStatus(C->db, "integer_datetimes"), "on");
+                return true;
+        }
+        *error = Str_dup(PQerrorMessage(C->db));
+        return false;
+}
+
+
+/* Queue sql in pipeline mode. The result is collected in PostgresqlConnection_endPipeline */
+static int _send(T C, const char *sql) {
+#ifdef LIBPQ_HAS_PIPELINING
+        if (PQsendQueryParams(C->db, sql, 0, NULL, NULL, NULL, NULL, 0)) {
+                C->queued++;
+                C->lastError = PGRES_COMMAND_OK;
+                return true;
+        }
+#endif
+        PQclear(C->res);
+        C->res = PQmakeEmptyPGresult(C->db, PGRES_FATAL_ERROR);
+        C->lastError = PGRES_FATAL_ERROR;
+        return false;
+}
+
+
+static void _setError(T C) {
+        PQclear(C->res);
+        C->res = PQmakeEmptyPGresult(C->db, PGRES_FATAL_ERROR);
+        C->lastError = PGRES_FATAL_ERROR;
+}
+
+
+/* Send buffered COPY data to the server */
+static int _flushCopy(T C) {
+        if (C->copyLength > 0) {
+                int n = C->copyLength;
+                C->copyLength = 0;
+                if (PQputCopyData(C->db, C->copyBuffer, n) != 1) {
+                        _setError(C);
+                        return false;
+                }
+        }
+        return true;
+}
+
+
+/* Read the first result and discard the remaining NULL terminated results */
+static void _getResult(T C) {
+        PGresult *res;
+        PQclear(C->res);
+        C->res = PQgetResult(C->db);
+        while ((res = PQgetResult(C->db)))
+                PQclear(res);
+        C->lastError = C->res ? PQresultStatus(C->res) : PGRES_FATAL_ERROR;
+}
+
+
+/* Rows to prefetch in stream result mode, 0 if results are buffered */
+static inline int _prefetchRows(T C) {
+        return (C->prefetchRows > 0 && C->fetchSize > 0) ? C->fetchSize : C->prefetchRows;
+}
+
+
+static inline void _sendPending(T C) {
+        if (! C->pipeline && ! C->copy)
+                PostgresqlConnection_sendPending(C->db, C->pending, C->deallocate);
+}
+
+
+/* Execute the queued commands in sb. A failure is logged, as the commands are sent on behalf of
+   the next command and not by the caller */
+static void _execPending(PGconn *db, StringBuffer_T sb) {
+        PGresult *res = PQexec(db, StringBuffer_toString(sb));
+        if (PQresultStatus(res) != PGRES_COMMAND_OK)
+                DEBUG("Failed to execute pending commands '%s' -- %s\n", StringBuffer_toString(sb), PQresultErrorMessage(res));
+        PQclear(res);
+        StringBuffer_clear(sb);
+}
+
+
+/* Returns true if a deferred BEGIN has not been sent yet, in which case the server is not in a transaction */
+static inline int _isDeferred(T C) {
+        if (C->deferred && PQtransactionStatus(C->db) == PQTRANS_IDLE && StringBuffer_length(C->pending) > 0)
+                return true;
+        C->deferred = false;
+        return false;
+}
+
+
+/* Remove a deferred BEGIN which was not sent, and the commands queued after it, from
+   pending. A timeout set in the transaction is queued again, as after a rollback */
+static void _dropDeferred(T C) {
+        StringBuffer_delete(C->pending, C->deferredAt);
+        C->deferred = false;
+        if (C->sessionTimeout != C->beginTimeout)
+                StringBuffer_append(C->pending, "SET statement_timeout TO %d;", C->sessionTimeout);
+        C->beginTimeout = C->sessionTimeout;
+}
+
+
+/* Execute the statement in sb. Pending commands with a deferred BEGIN are sent in the same
+   round trip, the result is the statement's. Other pending commands are sent first */
+static PGresult *_exec(T C) {
+        if (! _isDeferred(C)) {
+                _sendPending(C);
+                return PQexec(C->db, StringBuffer_toString(C->sb));
+        }
+        PostgresqlConnection_sendDeallocate(C->db, C->deallocate);
+        StringBuffer_append(C->pending, "%s", StringBuffer_toString(C->sb));
+        PGresult *res = PQexec(C->db, StringBuffer_toString(C->pending));
+        StringBuffer_clear(C->pending);
+        C->deferred = false;
+        return res;
+}
+
+
+/* Query text of a BEGIN, indexed by isolation level and read-only */
+static const char *_begin(int type) {
+        static const char *begin[][2] = {
+                {"BEGIN TRANSACTION;", "BEGIN TRANSACTION READ ONLY;"},
+                {"BEGIN TRANSACTION ISOLATION LEVEL READ COMMITTED;", "BEGIN TRANSACTION ISOLATION LEVEL READ COMMITTED READ ONLY;"},
+                {"BEGIN TRANSACTION ISOLATION LEVEL REPEATABLE READ;", "BEGIN TRANSACTION ISOLATION LEVEL REPEATABLE READ READ ONLY;"},
+                {"BEGIN TRANSACTION ISOLATION LEVEL SERIALIZABLE;", "BEGIN TRANSACTION ISOLATION LEVEL SERIALIZABLE READ ONLY;"}
+        };
+        return begin[type & ~(Transaction_ReadOnly | Transaction_Deferred)][(type & Transaction_ReadOnly) != 0];
+}
+
+
+/* ----------------------------------------------------- Protected methods */
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility push(hidden)
+#endif
+
+/* Keep the SQLSTATE of a failed result, or clear it if the result is not an error */
+void PostgresqlConnection_setSQLState(char sqlstate[6], const PGresult *res) {
+        const char *state = res ? PQresultErrorField(res, PG_DIAG_SQLSTATE) : NULL;
+        snprintf(sqlstate, 6, "%s", state ? state : "");
+}
+
+
+/* Send commands queued for the next command in one round trip. Commands are kept queued
+   while a command is in progress or the transaction is aborted */
+/* A failed DEALLOCATE, e.g. after a DISCARD ALL, would abort the transaction of the caller, so
+   statements are only deallocated outside of a transaction */
+void PostgresqlConnection_sendDeallocate(PGconn *db, StringBuffer_T deallocate) {
+        if (StringBuffer_length(deallocate) > 0) {
+#ifdef LIBPQ_HAS_PIPELINING
+                if (PQpipelineStatus(db) != PQ_PIPELINE_OFF)
+                        return;
+#endif
+                if (PQtransactionStatus(db) == PQTRANS_IDLE)
+                        _execPending(db, deallocate);
+        }
+}
+
+
+void PostgresqlConnection_sendPending(PGconn *db, StringBuffer_T pending, StringBuffer_T deallocate) {
+        PostgresqlConnection_sendDeallocate(db, deallocate);
+        if (StringBuffer_length(pending) > 0) {
+#ifdef LIBPQ_HAS_PIPELINING
+                if (PQpipelineStatus(db) != PQ_PIPELINE_OFF)
+                        return;
+#endif
+                PGTransactionStatusType status = PQtransactionStatus(db);
+                if (status == PQTRANS_IDLE || status == PQTRANS_INTRANS)
+                        _execPending(db, pending);
+        }
+}
+
+
+void *PostgresqlConnection_newContext(URL_T url) {
+#define ERROR(e) do {X->error = Str_dup(e); goto error;} while (0)
+        context_t X;
+        assert(url);
+        NEW(X);
+        StringBuffer_T sb = StringBuffer_create(STRLEN);
         /* User */
-        if (URL_getUser(C->url))
-                StringBuffer_append(C->sb, "user='%s' ", URL_getUser(C->url));
-        else if (URL_getParameter(C->url, "user"))
-                StringBuffer_append(C->sb, "user='%s' ", URL_getParameter(C->url, "user"));
+        if (URL_getUser(url))
+                StringBuffer_append(sb, "user='%s' ", URL_getUser(url));
+        else if (URL_getParameter(url, "user"))
+                StringBuffer_append(sb, "user='%s' ", URL_getParameter(url, "user"));
         else
                 ERROR("no username specified in URL");
         /* Password */
-        if (URL_getPassword(C->url))
-                StringBuffer_append(C->sb, "password='%s' ", URL_getPassword(C->url));
-        else if (URL_getParameter(C->url, "password"))
-                StringBuffer_append(C->sb, "password='%s' ", URL_getParameter(C->url, "password"));
+        if (URL_getPassword(url))
+                StringBuffer_append(sb, "password='%s' ", URL_getPassword(url));
+        else if (URL_getParameter(url, "password"))
+                StringBuffer_append(sb, "password='%s' ", URL_getParameter(url, "password"));
         else
                 ERROR("no password specified in URL");
         /* Host */
-        if (URL_getParameter(C->url, "unix-socket")) {
-                if (URL_getParameter(C->url, "unix-socket")[0] != '/')
+        if (URL_getParameter(url, "unix-socket")) {
+                if (URL_getParameter(url, "unix-socket")[0] != '/')
                         ERROR("invalid unix-socket directory");
-                StringBuffer_append(C->sb, "host='%s' ", URL_getParameter(C->url, "unix-socket"));
-        } else if (URL_getHost(C->url)) {
-                StringBuffer_append(C->sb, "host='%s' ", URL_getHost(C->url));
+                StringBuffer_append(sb, "host='%s' ", URL_getParameter(url, "unix-socket"));
+        } else if (URL_getHost(url)) {
+                StringBuffer_append(sb, "host='%s' ", URL_getHost(url));
                 /* Port */
-                if (URL_getPort(C->url) > 0)
-                        StringBuffer_append(C->sb, "port=%d ", URL_getPort(C->url));
+                if (URL_getPort(url) > 0)
+                        StringBuffer_append(sb, "port=%d ", URL_getPort(url));
                 else
                         ERROR("no port specified in URL");
         } else
                 ERROR("no host specified in URL");
         /* Database name */
-        if (URL_getPath(C->url))
-                StringBuffer_append(C->sb, "dbname='%s' ", URL_getPath(C->url) + 1);
+        if (URL_getPath(url))
+                StringBuffer_append(sb, "dbname='%s' ", URL_getPath(url) + 1);
         else
                 ERROR("no database specified in URL");
         /* Options */
-        StringBuffer_append(C->sb, "sslmode='%s' ", IS(URL_getParameter(C->url, "use-ssl"), "true") ? "require" : "disable");
-        if (URL_getParameter(C->url, "connect-timeout")) {
+        StringBuffer_append(sb, "sslmode='%s' ", IS(URL_getParameter(url, "use-ssl"), "true") ? "require" : "disable");
+        if (URL_getParameter(url, "connect-timeout")) {
                 TRY
-                        StringBuffer_append(C->sb, "connect_timeout=%d ", Str_parseInt(URL_getParameter(C->url, "connect-timeout")));
+                        StringBuffer_append(sb, "connect_timeout=%d ", Str_parseInt(URL_getParameter(url, "connect-timeout")));
                 ELSE
-                        ERROR("invalid connect timeout value");
+                        X->error = Str_dup("invalid connect timeout value");
                 END_TRY;
+                if (X->error)
+                        goto error;
         } else
-                StringBuffer_append(C->sb, "connect_timeout=%d ", SQL_DEFAULT_TCP_TIMEOUT);
-        if (URL_getParameter(C->url, "application-name"))
-                StringBuffer_append(C->sb, "application_name='%s' ", URL_getParameter(C->url, "application-name"));
-        /* Connect */
-        C->db = PQconnectdb(StringBuffer_toString(C->sb));
-        if (PQstatus(C->db) == CONNECTION_OK)
-                return true;
-        *error = Str_dup(PQerrorMessage(C->db));
+                StringBuffer_append(sb, "connect_timeout=%d ", SQL_DEFAULT_TCP_TIMEOUT);
+        if (URL_getParameter(url, "application-name"))
+                StringBuffer_append(sb, "application_name='%s' ", URL_getParameter(url, "application-name"));
+        if (IS(URL_getParameter(url, "result-mode"), "stream")) {
+                X->prefetchRows = POSTGRESQL_PREFETCH_ROWS;
+                if (URL_getParameter(url, "prefetch-rows")) {
+                        TRY X->prefetchRows = Str_parseInt(URL_getParameter(url, "prefetch-rows")); ELSE X->prefetchRows = 0; END_TRY;
+                        if (X->prefetchRows <= 0)
+                                ERROR("invalid prefetch rows value");
+                }
+        }
+        X->binary = IS(URL_getParameter(url, "binary-format"), "true");
+        X->conninfo = Str_dup(StringBuffer_toString(sb));
 error:
-        return false;
+        StringBuffer_free(&sb);
+        return X;
 }
 
 
-/* ----------------------------------------------------- Protected methods */
+void PostgresqlConnection_freeContext(void **context) {
+        assert(context && *context);
+        context_t X = *context;
+        FREE(X->conninfo);
+        FREE(X->error);
+        FREE(X);
+        *context = NULL;
+}
 
 
-#ifdef PACKAGE_PROTECTED
-#pragma GCC visibility push(hidden)
-#endif
-
-T PostgresqlConnection_new(URL_T url, char **error) {
+T PostgresqlConnection_new(URL_T url, void *context, char **error) {
 	T C;
 	assert(url);
+        assert(context);
         assert(error);
         NEW(C);
         C->url = url;
         C->sb = StringBuffer_create(STRLEN);
-        C->timeout = SQL_DEFAULT_TIMEOUT;
-        if (! _doConnect(C, error))
+        C->pending = StringBuffer_create(STRLEN);
+        C->deallocate = StringBuffer_create(STRLEN);
+        if (! _doConnect(C, context, error)) {
                 PostgresqlConnection_free(&C);
+                return NULL;
+        }
+        // The server's or role's statement_timeout applies until a timeout is set, so the first one is always sent
+        C->timeout = SQL_DEFAULT_TIMEOUT;
+        C->sessionTimeout = C->beginTimeout = -1;
 	return C;
 }
 
@@ -169,17 +414,26 @@ void PostgresqlConnection_free(T *C) {
                 PQclear((*C)->res);
         if ((*C)->db)
                 PQfinish((*C)->db);
+        if ((*C)->copyData)
+                PQfreemem((*C)->copyData);
+        FREE((*C)->copyBuffer);
         StringBuffer_free(&(*C)->sb);
+        StringBuffer_free(&(*C)->pending);
+        StringBuffer_free(&(*C)->deallocate);
 	FREE(*C);
 }
 
 
+/* The timeout is set lazily, with the next command, so resetting the timeout when the
+   connection is returned to the pool does not cost a round trip and a timeout set back
+   to the value the server has is not sent at all */
 void PostgresqlConnection_setQueryTimeout(T C, int ms) {
 	assert(C);
         C->timeout = ms;
-        StringBuffer_set(C->sb, "SET statement_timeout TO %d;", C->timeout);
-        PGresult *res = PQexec(C->db, StringBuffer_toString(C->sb));
-        PQclear(res);
+        if (ms != C->sessionTimeout) {
+                StringBuffer_append(C->pending, "SET statement_timeout TO %d;", ms);
+                C->sessionTimeout = ms;
+        }
 }
 
 
@@ -189,6 +443,12 @@ void PostgresqlConnection_setMaxRows(T C, int max) {
 }
 
 
+void PostgresqlConnection_setFetchSize(T C, int rows) {
+        assert(C);
+        C->fetchSize = rows;
+}
+
+
 int PostgresqlConnection_ping(T C) {
         assert(C);
         return (PQstatus(C->db) == CONNECTION_OK);
@@ -196,9 +456,21 @@ int PostgresqlConnection_ping(T C) {
 
 
 
-int PostgresqlConnection_beginTransaction(T C) {
+int PostgresqlConnection_beginTransaction(T C, int type) {
 	assert(C);
-        PGresult *res = PQexec(C->db, "BEGIN TRANSACTION;");
+        C->beginTimeout = C->sessionTimeout;
+        if (C->pipeline)
+                return _send(C, _begin(type));
+        if (type & Transaction_Deferred) {
+                // Sent with the next command, see _exec
+                C->deferredAt = StringBuffer_length(C->pending);
+                StringBuffer_append(C->pending, "%s", _begin(type));
+                C->deferred = true;
+                C->lastError = PGRES_COMMAND_OK;
+                return true;
+        }
+        _sendPending(C);
+        PGresult *res = PQexec(C->db, _begin(type));
         C->lastError = PQresultStatus(res);
         PQclear(res);
         return (C->lastError == PGRES_COMMAND_OK);
@@ -207,8 +479,18 @@ int PostgresqlConnection_beginTransaction(T C) {
 
 int PostgresqlConnection_commit(T C) {
 	assert(C);
+        if (C->pipeline)
+                return _send(C, "COMMIT TRANSACTION;");
+        if (_isDeferred(C)) {
+                // Nothing was sent in the transaction, so nothing is sent for it
+                _dropDeferred(C);
+                C->lastError = PGRES_COMMAND_OK;
+                return true;
+        }
+        _sendPending(C);
         PGresult *res = PQexec(C->db, "COMMIT TRANSACTION;");
         C->lastError = PQresultStatus(res);
+        PostgresqlConnection_setSQLState(C->sqlstate, res);
         PQclear(res);
         return (C->lastError == PGRES_COMMAND_OK);
 }
@@ -216,6 +498,18 @@ int PostgresqlConnection_commit(T C) {
 
 int PostgresqlConnection_rollback(T C) {
 	assert(C);
+        if (_isDeferred(C)) {
+                // Nothing was sent in the transaction, so nothing is sent for it
+                _dropDeferred(C);
+                C->lastError = PGRES_COMMAND_OK;
+                return true;
+        }
+        // A timeout set in the transaction is undone by the rollback, queue it again
+        if (C->sessionTimeout != C->beginTimeout)
+                StringBuffer_append(C->pending, "SET statement_timeout TO %d;", C->sessionTimeout);
+        C->beginTimeout = C->sessionTimeout;
+        if (C->pipeline)
+                return _send(C, "ROLLBACK TRANSACTION;");
         PGresult *res = PQexec(C->db, "ROLLBACK TRANSACTION;");
         C->lastError = PQresultStatus(res);
         PQclear(res);
@@ -243,8 +537,13 @@ int PostgresqlConnection_execute(T C, const char *sql, va_list ap) {
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
-        C->res = PQexec(C->db, StringBuffer_toString(C->sb));
+        if (C->pipeline) {
+                C->res = NULL;
+                return _send(C, StringBuffer_toString(C->sb));
+        }
+        C->res = _exec(C);
         C->lastError = PQresultStatus(C->res);
+        PostgresqlConnection_setSQLState(C->sqlstate, C->res);
         return (C->lastError == PGRES_COMMAND_OK);
 }
 
@@ -256,10 +555,38 @@ ResultSet_T PostgresqlConnection_executeQuery(T C, const char *sql, va_list ap)
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
-        C->res = PQexec(C->db, StringBuffer_toString(C->sb));
+        if (C->prefetchRows || ! _isDeferred(C))
+                _sendPending(C);
+        else {
+                // Send the deferred BEGIN in the same round trip, its result is skipped with the results which are not rows
+                PostgresqlConnection_sendDeallocate(C->db, C->deallocate);
+                StringBuffer_append(C->pending, "%s", StringBuffer_toString(C->sb));
+                StringBuffer_set(C->sb, "%s", StringBuffer_toString(C->pending));
+                StringBuffer_clear(C->pending);
+                C->deferred = false;
+        }
+        if (C->prefetchRows) {
+                // Stream rows as they arrive instead of buffering the whole result
+                C->res = NULL;
+                if (PQsendQuery(C->db, StringBuffer_toString(C->sb))) {
+                        ResultSetDelegate_T R = PostgresqlResultSet_newStream(C->db, C->maxRows, _prefetchRows(C), &C->res);
+                        if (R)
+                                return ResultSet_new(R, (Rop_T)&postgresqlrops);
+                } else
+                        C->res = PQmakeEmptyPGresult(C->db, PGRES_FATAL_ERROR);
+                C->lastError = PQresultStatus(C->res);
+                return NULL;
+        }
+        // Read all results of a multi-statement query, see ResultSet_nextResult()
+        ResultSetDelegate_T R = NULL;
+        if (PQsendQuery(C->db, StringBuffer_toString(C->sb)))
+                R = PostgresqlResultSet_newMulti(C->db, C->maxRows, &C->res);
+        else
+                C->res = PQmakeEmptyPGresult(C->db, PGRES_FATAL_ERROR);
         C->lastError = PQresultStatus(C->res);
-        if (C->lastError == PGRES_TUPLES_OK)
-                return ResultSet_new(PostgresqlResultSet_new(C->res, C->maxRows), (Rop_T)&postgresqlrops);
+        PostgresqlConnection_setSQLState(C->sqlstate, C->res);
+        if (R)
+                return ResultSet_new(R, (Rop_T)&postgresqlrops);
         return NULL;
 }
 
@@ -277,10 +604,213 @@ PreparedStatement_T PostgresqlConnection_prepareStatement(T C, const char *sql,
         paramCount = StringBuffer_prepare4postgres(C->sb);
         uint32_t t = ++statementid; // increment is atomic
         name = Str_cat("%d", t);
+        // Preparing does not need the transaction, a deferred BEGIN is sent when the statement is executed
+        if (_isDeferred(C))
+                PostgresqlConnection_sendDeallocate(C->db, C->deallocate);
+        else
+                _sendPending(C);
         C->res = PQprepare(C->db, name, StringBuffer_toString(C->sb), 0, NULL);
         C->lastError = C->res ? PQresultStatus(C->res) : PGRES_FATAL_ERROR;
         if (C->lastError == PGRES_EMPTY_QUERY || C->lastError == PGRES_COMMAND_OK || C->lastError == PGRES_TUPLES_OK)
-		return PreparedStatement_new(PostgresqlPreparedStatement_new(C->db, C->maxRows, name, paramCount), (Pop_T)&postgresqlpops, paramCount);
+		return PreparedStatement_new(PostgresqlPreparedStatement_new(C->db, C->pending, C->deallocate, C->sqlstate, C->maxRows, name, paramCount, _prefetchRows(C), C->binary), (Pop_T)&postgresqlpops, paramCount);
+        return NULL;
+}
+
+
+int PostgresqlConnection_beginCopy(T C, int in, const char *sql, va_list ap) {
+        va_list ap_copy;
+        assert(C);
+        PQclear(C->res);
+        va_copy(ap_copy, ap);
+        StringBuffer_vset(C->sb, sql, ap_copy);
+        va_end(ap_copy);
+        _sendPending(C);
+        C->res = PQexec(C->db, StringBuffer_toString(C->sb));
+        C->lastError = PQresultStatus(C->res);
+        if (C->lastError != PGRES_COPY_IN && C->lastError != PGRES_COPY_OUT)
+                return false;
+        C->copy = C->lastError;
+        C->copyLength = 0;
+        if (C->copy != (in ? PGRES_COPY_IN : PGRES_COPY_OUT)) {
+                PostgresqlConnection_endCopy(C, true);
+                return -1;
+        }
+        if (in && ! C->copyBuffer)
+                C->copyBuffer = ALLOC(POSTGRESQL_COPY_BUFFER);
+        return true;
+}
+
+
+int PostgresqlConnection_writeCopy(T C, const void *data, int size) {
+        assert(C);
+        if (C->copyLength + size > POSTGRESQL_COPY_BUFFER) {
+                if (! _flushCopy(C))
+                        return false;
+                if (size > POSTGRESQL_COPY_BUFFER) {
+                        // Too large to buffer, hand it over as is
+                        if (PQputCopyData(C->db, data, size) != 1) {
+                                _setError(C);
+                                return false;
+                        }
+                        return true;
+                }
+        }
+        memcpy(C->copyBuffer + C->copyLength, data, size);
+        C->copyLength += size;
+        return true;
+}
+
+
+int PostgresqlConnection_readCopy(T C, const void **data) {
+        assert(C);
+        if (C->copyData) {
+                PQfreemem(C->copyData);
+                C->copyData = NULL;
+        }
+        if (C->copy != PGRES_COPY_OUT)
+                return 0;
+        int size = PQgetCopyData(C->db, &C->copyData, 0);
+        if (size > 0) {
+                *data = C->copyData;
+                return size;
+        }
+        C->copy = 0;
+        _getResult(C);
+        return (size == -1 && C->lastError == PGRES_COMMAND_OK) ? 0 : -1;
+}
+
+
+long long PostgresqlConnection_endCopy(T C, int abort) {
+        assert(C);
+        if (C->copy == PGRES_COPY_IN) {
+                if (abort) {
+                        C->copyLength = 0;
+                        PQputCopyEnd(C->db, "COPY aborted");
+                } else if (C->lastError != PGRES_COPY_IN || ! _flushCopy(C) || PQputCopyEnd(C->db, NULL) != 1) {
+                        // A write failed or the end could not be sent. Keep the error, but still get the server out of the COPY state
+                        if (C->lastError == PGRES_COPY_IN)
+                                _setError(C);
+                        PGresult *error = C->res;
+                        C->res = NULL;
+                        PQputCopyEnd(C->db, "COPY failed");
+                        _getResult(C);
+                        PQclear(C->res);
+                        C->res = error;
+                        C->lastError = PGRES_FATAL_ERROR;
+                        C->copy = 0;
+                        return -1;
+                }
+                C->copy = 0;
+                _getResult(C);
+        } else if (C->copy == PGRES_COPY_OUT) {
+                const void *data;
+                while (PostgresqlConnection_readCopy(C, &data) > 0)
+                        ;
+        }
+        if (C->copyData) {
+                PQfreemem(C->copyData);
+                C->copyData = NULL;
+        }
+        if (C->lastError != PGRES_COMMAND_OK)
+                return -1;
+        return PostgresqlConnection_rowsChanged(C);
+}
+
+
+#ifdef LIBPQ_HAS_PIPELINING
+int PostgresqlConnection_beginPipeline(T C) {
+        assert(C);
+        PQclear(C->res);
+        C->res = NULL;
+        // Pending commands, such as a deferred BEGIN, are not sent in pipeline mode
+        _sendPending(C);
+        if (! PQenterPipelineMode(C->db)) {
+                C->res = PQmakeEmptyPGresult(C->db, PGRES_FATAL_ERROR);
+                C->lastError = PGRES_FATAL_ERROR;
+                return false;
+        }
+        C->pipeline = true;
+        C->queued = 0;
+        return true;
+}
+
+
+int PostgresqlConnection_endPipeline(T C) {
+        assert(C);
+        PGresult *res, *last = NULL, *error = NULL;
+        PQclear(C->res);
+        C->res = NULL;
+        C->pipeline = false;
+        int synced = PQpipelineSync(C->db);
+        // Each queued statement yields its results followed by NULL. Keep the first error, or else the last result
+        for (; C->queued > 0; C->queued--) {
+                while ((res = PQgetResult(C->db))) {
+                        ExecStatusType status = PQresultStatus(res);
+                        if (! error && (status == PGRES_FATAL_ERROR || status == PGRES_BAD_RESPONSE)) {
+                                error = res;
+                        } else if (! error && status != PGRES_PIPELINE_ABORTED) {
+                                PQclear(last);
+                                last = res;
+                        } else
+                                PQclear(res);
+                }
+        }
+        if (synced) {
+                while ((res = PQgetResult(C->db))) {
+                        ExecStatusType status = PQresultStatus(res);
+                        PQclear(res);
+                        if (status == PGRES_PIPELINE_SYNC)
+                                break;
+                }
+        } else if (! error)
+                error = PQmakeEmptyPGresult(C->db, PGRES_FATAL_ERROR);
+        PQexitPipelineMode(C->db);
+        if (error) {
+                PQclear(last);
+                C->res = error;
+        } else
+                C->res = last;
+        C->lastError = C->res ? PQresultStatus(C->res) : PGRES_COMMAND_OK;
+        return (error == NULL);
+}
+#endif
+
+
+int PostgresqlConnection_getSocket(T C) {
+        assert(C);
+        return PQsocket(C->db);
+}
+
+
+int PostgresqlConnection_sendQuery(T C, const char *sql) {
+        assert(C);
+        PQclear(C->res);
+        C->res = NULL;
+        _sendPending(C);
+        if (! PQsendQuery(C->db, sql)) {
+                _setError(C);
+                return false;
+        }
+        return true;
+}
+
+
+int PostgresqlConnection_isBusy(T C) {
+        assert(C);
+        // On a read error the result is not busy and PQgetResult return the error
+        return PQconsumeInput(C->db) && PQisBusy(C->db);
+}
+
+
+/* Read the result of a query sent with PostgresqlConnection_sendQuery, blocking if it has not arrived */
+ResultSet_T PostgresqlConnection_getResult(T C) {
+        assert(C);
+        _getResult(C);
+        // A statement which return no rows yields an empty ResultSet
+        if (C->lastError == PGRES_TUPLES_OK || C->lastError == PGRES_COMMAND_OK)
+                return ResultSet_new(PostgresqlResultSet_new(C->res, C->maxRows), (Rop_T)&postgresqlrops);
+        if (! C->res)
+                _setError(C);
         return NULL;
 }
 
@@ -291,6 +821,13 @@ const char *PostgresqlConnection_getLastError(T C) {
 }
 
 
+int PostgresqlConnection_isRetryable(T C) {
+        assert(C);
+        // serialization_failure and deadlock_detected
+        return Str_isEqual(C->sqlstate, "40001") || Str_isEqual(C->sqlstate, "40P01");
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
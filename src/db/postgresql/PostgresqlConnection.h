@@ -24,12 +24,18 @@
 #ifndef POSTGRESQLCONNECTION_INCLUDED
 #define POSTGRESQLCONNECTION_INCLUDED
 #define T ConnectionDelegate_T
-T PostgresqlConnection_new(URL_T url, char **error);
+void PostgresqlConnection_setSQLState(char sqlstate[6], const PGresult *res);
+void PostgresqlConnection_sendDeallocate(PGconn *db, StringBuffer_T deallocate);
+void PostgresqlConnection_sendPending(PGconn *db, StringBuffer_T pending, StringBuffer_T deallocate);
+void *PostgresqlConnection_newContext(URL_T url);
+void PostgresqlConnection_freeContext(void **context);
+T PostgresqlConnection_new(URL_T url, void *context, char **error);
 void PostgresqlConnection_free(T *C);
 void PostgresqlConnection_setQueryTimeout(T C, int ms);
 void PostgresqlConnection_setMaxRows(T C, int max);
+void PostgresqlConnection_setFetchSize(T C, int rows);
 int PostgresqlConnection_ping(T C);
-int PostgresqlConnection_beginTransaction(T C);
+int PostgresqlConnection_beginTransaction(T C, int type);
 int PostgresqlConnection_commit(T C);
 int PostgresqlConnection_rollback(T C);
 long long PostgresqlConnection_lastRowId(T C);
@@ -38,6 +44,19 @@ int PostgresqlConnection_execute(T C, const char *sql, va_list ap);
 ResultSet_T PostgresqlConnection_executeQuery(T C, const char *sql, va_list ap);
 PreparedStatement_T PostgresqlConnection_prepareStatement(T C, const char *sql, va_list ap);
 const char *PostgresqlConnection_getLastError(T C);
+int PostgresqlConnection_isRetryable(T C);
+int PostgresqlConnection_beginCopy(T C, int in, const char *sql, va_list ap);
+int PostgresqlConnection_writeCopy(T C, const void *data, int size);
+int PostgresqlConnection_readCopy(T C, const void **data);
+long long PostgresqlConnection_endCopy(T C, int abort);
+int PostgresqlConnection_getSocket(T C);
+int PostgresqlConnection_sendQuery(T C, const char *sql);
+int PostgresqlConnection_isBusy(T C);
+ResultSet_T PostgresqlConnection_getResult(T C);
+#ifdef LIBPQ_HAS_PIPELINING
+int PostgresqlConnection_beginPipeline(T C);
+int PostgresqlConnection_endPipeline(T C);
+#endif
 #undef T
 #endif
 
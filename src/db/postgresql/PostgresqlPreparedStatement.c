@@ -27,19 +27,32 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <libpq-fe.h>
 
+#include "URL.h"
 #include "system/Time.h"
 #include "ResultSet.h"
+#include "StringBuffer.h"
+#include "PreparedStatement.h"
 #include "PostgresqlResultSet.h"
 #include "PreparedStatementDelegate.h"
 #include "PostgresqlPreparedStatement.h"
+#include "ConnectionDelegate.h"
+#include "PostgresqlConnection.h"
 
 
 /**
  * Implementation of the PreparedStatement/Delegate interface for postgresql.
  * All parameter values are sent as text except for blobs. Postgres ignore
  * paramLengths for text parameters and it is therefor set to 0, except for blob.
+ * If binary format is enabled, the statement is described once when created
+ * and numeric and timestamp values for parameters of a matching type are
+ * sent in binary format. Results are requested in binary format if all 
+ * columns are of a type PostgresqlResultSet can decode. As a binary
+ * timestamp with time zone is formatted in UTC, a result with such a
+ * column is only requested in binary format while the session TimeZone
+ * is UTC, otherwise the server formats it in the session TimeZone.
  *
  * @file
  */
@@ -59,7 +72,8 @@ const struct Pop_T postgresqlpops = {
         .setBlob        = PostgresqlPreparedStatement_setBlob,
         .execute        = PostgresqlPreparedStatement_execute,
         .executeQuery   = PostgresqlPreparedStatement_executeQuery,
-        .rowsChanged    = PostgresqlPreparedStatement_rowsChanged
+        .rowsChanged    = PostgresqlPreparedStatement_rowsChanged,
+        .executeBatch   = PostgresqlPreparedStatement_executeBatch
 };
 
 typedef struct param_t {
@@ -69,9 +83,16 @@ typedef struct param_t {
 struct T {
         int maxRows;
         int lastError;
+        int prefetchRows;
+        int resultFormat;
+        int hasTimestampTz;     // The result has a timestamp with time zone column
+        Oid *paramTypes;
         char *stmt;
         PGconn *db;
         PGresult *res;
+        StringBuffer_T pending;
+        StringBuffer_T deallocate;
+        char *sqlstate;         // The connection's SQLSTATE of the last failed statement
         int paramCount;
         char **paramValues; 
         int *paramLengths; 
@@ -79,9 +100,99 @@ struct T {
         param_t params;
 };
 
+#define PIPELINE_ROWS 1000
+
 extern const struct Rop_T postgresqlrops;
 
 
+/* ------------------------------------------------------- Private methods */
+
+
+#ifdef LIBPQ_HAS_PIPELINING
+/* Execute a transaction statement, keep the first error in error */
+static void _exec(T P, const char *sql, char error[STRLEN]) {
+        PGresult *res = PQexec(P->db, sql);
+        if (PQresultStatus(res) != PGRES_COMMAND_OK && ! *error)
+                snprintf(error, STRLEN, "%s", PQresultErrorMessage(res));
+        PQclear(res);
+}
+#endif
+
+
+static void _describe(T P) {
+        PGresult *desc = PQdescribePrepared(P->db, P->stmt);
+        if (PQresultStatus(desc) == PGRES_COMMAND_OK) {
+                if (P->paramCount) {
+                        P->paramTypes = CALLOC(P->paramCount, sizeof(Oid));
+                        for (int i = 0; i < P->paramCount && i < PQnparams(desc); i++)
+                                P->paramTypes[i] = PQparamtype(desc, i);
+                }
+                int columns = PQnfields(desc);
+                P->resultFormat = columns > 0;
+                for (int i = 0; i < columns; i++) {
+                        if (! PostgresqlResultSet_isBinaryType(PQftype(desc, i)))
+                                P->resultFormat = 0;
+                        if (PQftype(desc, i) == TIMESTAMPTZOID)
+                                P->hasTimestampTz = true;
+                }
+        }
+        PQclear(desc);
+}
+
+
+/* Returns the result format for the next execute. The TimeZone is reported by the server
+   when it changes, so a SET TIME ZONE on the connection is seen here */
+static inline int _getResultFormat(T P) {
+        if (P->resultFormat && P->hasTimestampTz) {
+                const char *timezone = PQparameterStatus(P->db, "TimeZone");
+                if (! timezone)
+                        return 0;
+                static const char *utc[] = {"UTC", "Etc/UTC", "UCT", "Etc/UCT", "GMT", "Etc/GMT", "Universal", "Zulu"};
+                for (int i = 0; i < (int)(sizeof(utc) / sizeof(utc[0])); i++)
+                        if (Str_isEqual(timezone, utc[i]))
+                                return 1;
+                return 0;
+        }
+        return P->resultFormat;
+}
+
+
+static inline Oid _getParamType(T P, int i) {
+        return P->paramTypes ? P->paramTypes[i] : 0;
+}
+
+
+/* Store x as a big-endian integer of size bytes and send it in binary format */
+static inline void _setBinary(T P, int i, unsigned long long x, int size) {
+        for (int j = size - 1; j >= 0; j--, x >>= 8)
+                P->params[i].s[j] = (char)(x & 0xff);
+        P->paramValues[i] = P->params[i].s;
+        P->paramLengths[i] = size;
+        P->paramFormats[i] = 1;
+}
+
+
+static inline int _setBinaryInteger(T P, int i, long long x) {
+        switch (_getParamType(P, i)) {
+                case INT2OID:
+                        if (x < INT16_MIN || x > INT16_MAX)
+                                return false;
+                        _setBinary(P, i, (unsigned long long)x, 2);
+                        return true;
+                case INT4OID:
+                        if (x < INT32_MIN || x > INT32_MAX)
+                                return false;
+                        _setBinary(P, i, (unsigned long long)x, 4);
+                        return true;
+                case INT8OID:
+                        _setBinary(P, i, (unsigned long long)x, 8);
+                        return true;
+                default:
+                        return false;
+        }
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -89,15 +200,21 @@ extern const struct Rop_T postgresqlrops;
 #pragma GCC visibility push(hidden)
 #endif
 
-T PostgresqlPreparedStatement_new(PGconn *db, int maxRows, char *stmt, int paramCount) {
+T PostgresqlPreparedStatement_new(PGconn *db, StringBuffer_T pending, StringBuffer_T deallocate, char *sqlstate, int maxRows, char *stmt, int paramCount, int prefetchRows, int binary) {
         T P;
         assert(db);
+        assert(pending);
+        assert(deallocate);
         assert(stmt);
         NEW(P);
         P->db = db;
+        P->pending = pending;
+        P->deallocate = deallocate;
+        P->sqlstate = sqlstate;
         P->stmt = stmt;
         P->maxRows = maxRows;
         P->paramCount = paramCount;
+        P->prefetchRows = prefetchRows;
         P->lastError = PGRES_COMMAND_OK;
         if (P->paramCount) {
                 P->paramValues = CALLOC(P->paramCount, sizeof(char *));
@@ -105,19 +222,21 @@ T PostgresqlPreparedStatement_new(PGconn *db, int maxRows, char *stmt, int param
                 P->paramFormats = CALLOC(P->paramCount, sizeof(int));
                 P->params = CALLOC(P->paramCount, sizeof(struct param_t));
         }
+        if (binary)
+                _describe(P);
         return P;
 }
 
 
 void PostgresqlPreparedStatement_free(T *P) {
-        char stmt[STRLEN];
 	assert(P && *P);
         /* NOTE: there is no C API function for explicit statement
          * deallocation (postgres-8.1.x) - the DEALLOCATE statement
          * has to be used. The postgres documentation mentiones such
-         * function as a possible future extension */
-        snprintf(stmt, STRLEN, "DEALLOCATE \"%s\";", (*P)->stmt);
-        PQclear(PQexec((*P)->db, stmt));
+         * function as a possible future extension. The statement is
+         * queued and deallocated with other freed statements in one
+         * round trip before the next command outside of a transaction */
+        StringBuffer_append((*P)->deallocate, "DEALLOCATE \"%s\";", (*P)->stmt);
         PQclear((*P)->res);
 	FREE((*P)->stmt);
         if ((*P)->paramCount) {
@@ -126,6 +245,7 @@ void PostgresqlPreparedStatement_free(T *P) {
 	        FREE((*P)->paramFormats);
 	        FREE((*P)->params);
         }
+        FREE((*P)->paramTypes);
 	FREE(*P);
 }
 
@@ -142,6 +262,8 @@ void PostgresqlPreparedStatement_setString(T P, int parameterIndex, const char *
 void PostgresqlPreparedStatement_setInt(T P, int parameterIndex, int x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->paramCount);
+        if (_setBinaryInteger(P, i, x))
+                return;
         snprintf(P->params[i].s, 64, "%d", x);
         P->paramValues[i] =  P->params[i].s;
         P->paramLengths[i] = 0;
@@ -152,6 +274,8 @@ void PostgresqlPreparedStatement_setInt(T P, int parameterIndex, int x) {
 void PostgresqlPreparedStatement_setLLong(T P, int parameterIndex, long long x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->paramCount);
+        if (_setBinaryInteger(P, i, x))
+                return;
         snprintf(P->params[i].s, 64, "%lld", x);
         P->paramValues[i] =  P->params[i].s;
         P->paramLengths[i] = 0; 
@@ -162,6 +286,12 @@ void PostgresqlPreparedStatement_setLLong(T P, int parameterIndex, long long x)
 void PostgresqlPreparedStatement_setDouble(T P, int parameterIndex, double x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->paramCount);
+        if (_getParamType(P, i) == FLOAT8OID) {
+                uint64_t bits;
+                memcpy(&bits, &x, sizeof(bits));
+                _setBinary(P, i, bits, 8);
+                return;
+        }
         snprintf(P->params[i].s, 64, "%lf", x);
         P->paramValues[i] =  P->params[i].s;
         P->paramLengths[i] = 0;
@@ -172,6 +302,12 @@ void PostgresqlPreparedStatement_setDouble(T P, int parameterIndex, double x) {
 void PostgresqlPreparedStatement_setTimestamp(T P, int parameterIndex, time_t x) {
         assert(P);
         int i = checkAndSetParameterIndex(parameterIndex, P->paramCount);
+        Oid type = _getParamType(P, i);
+        if (type == TIMESTAMPOID || type == TIMESTAMPTZOID) {
+                // Microseconds since the Postgres epoch
+                _setBinary(P, i, (unsigned long long)(((long long)x - POSTGRES_EPOCH) * 1000000), 8);
+                return;
+        }
         P->paramValues[i] = Time_toString(x, P->params[i].s);
         P->paramLengths[i] = 0;
         P->paramFormats[i] = 0;
@@ -190,8 +326,10 @@ void PostgresqlPreparedStatement_setBlob(T P, int parameterIndex, const void *x,
 void PostgresqlPreparedStatement_execute(T P) {
         assert(P);
         PQclear(P->res);
+        PostgresqlConnection_sendPending(P->db, P->pending, P->deallocate);
         P->res = PQexecPrepared(P->db, P->stmt, P->paramCount, (const char **)P->paramValues, P->paramLengths, P->paramFormats, 0);
         P->lastError = P->res ? PQresultStatus(P->res) : PGRES_FATAL_ERROR;
+        PostgresqlConnection_setSQLState(P->sqlstate, P->res);
         if (P->lastError != PGRES_COMMAND_OK)
                 THROW(SQLException, "%s", PQresultErrorMessage(P->res));
 }
@@ -200,8 +338,22 @@ void PostgresqlPreparedStatement_execute(T P) {
 ResultSet_T PostgresqlPreparedStatement_executeQuery(T P) {
         assert(P);
         PQclear(P->res);
-        P->res = PQexecPrepared(P->db, P->stmt, P->paramCount, (const char **)P->paramValues, P->paramLengths, P->paramFormats, 0);
+        PostgresqlConnection_sendPending(P->db, P->pending, P->deallocate);
+        if (P->prefetchRows) {
+                // Stream rows as they arrive instead of buffering the whole result
+                P->res = NULL;
+                if (PQsendQueryPrepared(P->db, P->stmt, P->paramCount, (const char **)P->paramValues, P->paramLengths, P->paramFormats, _getResultFormat(P))) {
+                        ResultSetDelegate_T R = PostgresqlResultSet_newStream(P->db, P->maxRows, P->prefetchRows, &P->res);
+                        if (R)
+                                return ResultSet_new(R, (Rop_T)&postgresqlrops);
+                } else
+                        P->res = PQmakeEmptyPGresult(P->db, PGRES_FATAL_ERROR);
+                P->lastError = PQresultStatus(P->res);
+                THROW(SQLException, "%s", PQresultErrorMessage(P->res));
+        }
+        P->res = PQexecPrepared(P->db, P->stmt, P->paramCount, (const char **)P->paramValues, P->paramLengths, P->paramFormats, _getResultFormat(P));
         P->lastError = P->res ? PQresultStatus(P->res) : PGRES_FATAL_ERROR;
+        PostgresqlConnection_setSQLState(P->sqlstate, P->res);
         if (P->lastError == PGRES_TUPLES_OK)
                 return ResultSet_new(PostgresqlResultSet_new(P->res, P->maxRows), (Rop_T)&postgresqlrops);
         THROW(SQLException, "%s", PQresultErrorMessage(P->res));
@@ -212,7 +364,72 @@ ResultSet_T PostgresqlPreparedStatement_executeQuery(T P) {
 long long PostgresqlPreparedStatement_rowsChanged(T P) {
         assert(P);
         char *changes = PQcmdTuples(P->res);
-        return changes ? Str_parseLLong(changes) : 0;
+        return STR_DEF(changes) ? Str_parseLLong(changes) : 0;
+}
+
+
+long long PostgresqlPreparedStatement_executeBatch(T P, int rows, void (*bind)(void *batch, int row), void *batch) {
+        assert(P);
+        assert(bind);
+        long long changes = 0;
+        PQclear(P->res);
+        P->res = NULL;
+        PostgresqlConnection_sendPending(P->db, P->pending, P->deallocate);
+#ifdef LIBPQ_HAS_PIPELINING
+        /* Send rows in a pipeline and read their results afterwards, one round-trip
+         per PIPELINE_ROWS rows instead of one per row. Results are read between 
+         chunks so neither side blocks on a full socket buffer. Unless called in 
+         a transaction, the batch is run in one so it is applied all or nothing */
+        char error[STRLEN] = {};
+        int transaction = (PQtransactionStatus(P->db) == PQTRANS_IDLE);
+        if (transaction)
+                _exec(P, "BEGIN TRANSACTION;", error);
+        if (! *error && ! PQenterPipelineMode(P->db))
+                snprintf(error, STRLEN, "%s", PQerrorMessage(P->db));
+        for (int row = 0; row < rows && ! *error;) {
+                int sent = 0;
+                for (; sent < PIPELINE_ROWS && row < rows; sent++, row++) {
+                        bind(batch, row);
+                        if (! PQsendQueryPrepared(P->db, P->stmt, P->paramCount, (const char **)P->paramValues, P->paramLengths, P->paramFormats, 0)) {
+                                snprintf(error, STRLEN, "%s", PQerrorMessage(P->db));
+                                break;
+                        }
+                }
+                int synced = PQpipelineSync(P->db);
+                if (! synced && ! *error)
+                        snprintf(error, STRLEN, "%s", PQerrorMessage(P->db));
+                for (int i = 0; i < sent; i++) {
+                        PGresult *res;
+                        while ((res = PQgetResult(P->db))) {
+                                ExecStatusType status = PQresultStatus(res);
+                                if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+                                        char *n = PQcmdTuples(res);
+                                        if (STR_DEF(n))
+                                                changes += Str_parseLLong(n);
+                                } else if (! *error && status != PGRES_PIPELINE_ABORTED) {
+                                        snprintf(error, STRLEN, "%s", PQresultErrorMessage(res));
+                                        PostgresqlConnection_setSQLState(P->sqlstate, res);
+                                }
+                                PQclear(res);
+                        }
+                }
+                if (synced)
+                        PQclear(PQgetResult(P->db)); // PGRES_PIPELINE_SYNC
+        }
+        PQexitPipelineMode(P->db);
+        if (transaction)
+                _exec(P, *error ? "ROLLBACK TRANSACTION;" : "COMMIT TRANSACTION;", error);
+        P->lastError = *error ? PGRES_FATAL_ERROR : PGRES_COMMAND_OK;
+        if (*error)
+                THROW(SQLException, "%s", error);
+#else
+        for (int i = 0; i < rows; i++) {
+                bind(batch, i);
+                PostgresqlPreparedStatement_execute(P);
+                changes += PostgresqlPreparedStatement_rowsChanged(P);
+        }
+#endif
+        return changes;
 }
 
 
@@ -24,7 +24,7 @@
 #ifndef POSTGRESQLPREPAREDSTATEMENT_INCLUDED
 #define POSTGRESQLPREPAREDSTATEMENT_INCLUDED
 #define T PreparedStatementDelegate_T
-T PostgresqlPreparedStatement_new(PGconn *db, int maxRows, char *stmt, int paramCount);
+T PostgresqlPreparedStatement_new(PGconn *db, StringBuffer_T pending, StringBuffer_T deallocate, char *sqlstate, int maxRows, char *stmt, int paramCount, int prefetchRows, int binary);
 void PostgresqlPreparedStatement_free(T *P);
 void PostgresqlPreparedStatement_setString(T P, int parameterIndex, const char *x);
 void PostgresqlPreparedStatement_setInt(T P, int parameterIndex, int x);
@@ -35,5 +35,6 @@ void PostgresqlPreparedStatement_setBlob(T P, int parameterIndex, const void *x,
 void PostgresqlPreparedStatement_execute(T P);
 ResultSet_T PostgresqlPreparedStatement_executeQuery(T P);
 long long PostgresqlPreparedStatement_rowsChanged(T P);
+long long PostgresqlPreparedStatement_executeBatch(T P, int rows, void (*bind)(void *batch, int row), void *batch);
 #undef T
 #endif
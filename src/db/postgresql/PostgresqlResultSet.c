@@ -26,18 +26,35 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/types.h>
 #include <libpq-fe.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HEX_BLOCK 32
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HEX_BLOCK 32
+#endif
 
+#include "system/Time.h"
 #include "ResultSetDelegate.h"
 #include "PostgresqlResultSet.h"
 
 
 /**
  * Implementation of the ResultSet/Delegate interface for postgresql. 
- * Accessing columns with index outside range throws SQLException
+ * Accessing columns with index outside range throws SQLException. 
+ * Columns received in binary format are decoded directly by the typed
+ * getters and formatted as the server would on getString. A timestamp
+ * with time zone is formatted in UTC, so PostgresqlPreparedStatement only
+ * asks for binary format for such columns if the session TimeZone is UTC
  *
  * @file
  */
@@ -55,17 +72,40 @@ const struct Rop_T postgresqlrops = {
         .next           = PostgresqlResultSet_next,
         .isnull         = PostgresqlResultSet_isnull,
         .getString      = PostgresqlResultSet_getString,
-        .getBlob        = PostgresqlResultSet_getBlob
-        // getTimestamp and getDateTime is handled in ResultSet
+        .getBlob        = PostgresqlResultSet_getBlob,
+        .getInt         = PostgresqlResultSet_getInt,
+        .getLLong       = PostgresqlResultSet_getLLong,
+        .getDouble      = PostgresqlResultSet_getDouble,
+        .getTimestamp   = PostgresqlResultSet_getTimestamp,
+        .getDateTime    = PostgresqlResultSet_getDateTime,
+        .getBytes       = PostgresqlResultSet_getBytes,
+        .nextResult     = PostgresqlResultSet_nextResult,
+#ifdef LIBPQ_HAS_PIPELINING
+        .getMemory      = PostgresqlResultSet_getMemory
+#endif
 };
 
+typedef struct column_t {
+        Oid type;
+        int binary;
+        char buffer[64];
+} *column_t;
+
 #define T ResultSetDelegate_T
 struct T {
+        int done;
+        int stream;
         int maxRows;
         int currentRow;
         int columnCount;
         int rowCount;
+        long long rowsFetched;
+        int result;             // Index of the current result in results
+        int resultCount;
+        PGresult **results;     // Results following the first of a multi-statement query
         PGresult *res;
+        PGconn *db;
+        column_t columns;
 };
 
 #define ISFIRSTOCTDIGIT(CH) ((CH) >= '0' && (CH) <= '3')
@@ -76,6 +116,49 @@ struct T {
 /* ------------------------------------------------------- Private methods */
 
 
+#ifdef HEX_BLOCK
+/* Decode the HEX_BLOCK hex digits at s into HEX_BLOCK / 2 bytes at d. All input is read before
+   the output is written, so d may overlap s. Returns false, writing nothing, if any of the
+   characters is not a hex digit, such as whitespace between hex pairs */
+static inline int _decodeHex(const uchar_t *s, uchar_t *d) {
+#if defined(__SSE2__)
+        const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9), a = _mm_set1_epi8('a');
+        const __m128i lower = _mm_set1_epi8(0x20), five = _mm_set1_epi8(5), ten = _mm_set1_epi8(10);
+        __m128i v[2];
+        for (int k = 0; k < 2; k++) {
+                __m128i c = _mm_loadu_si128((const __m128i *)(s + k * 16));
+                __m128i digit = _mm_sub_epi8(c, zero);
+                __m128i alpha = _mm_sub_epi8(_mm_or_si128(c, lower), a);
+                // Unsigned x <= n if min(x, n) == x
+                __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+                __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, five), alpha);
+                if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xFFFF)
+                        return false;
+                __m128i nibble = _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_and_si128(isAlpha, _mm_add_epi8(alpha, ten)));
+                // Each 16 bit lane holds the high nibble in its low byte and the low nibble in its high byte
+                v[k] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibble, _mm_set1_epi16(0x00FF)), 4), _mm_srli_epi16(nibble, 8));
+        }
+        _mm_storeu_si128((__m128i *)d, _mm_packus_epi16(v[0], v[1]));
+        return true;
+#else
+        uint8x16x2_t c = vld2q_u8(s); // Even characters are high nibbles, odd are low
+        uint8x16_t nibble[2];
+        for (int k = 0; k < 2; k++) {
+                uint8x16_t digit = vsubq_u8(c.val[k], vdupq_n_u8('0'));
+                uint8x16_t alpha = vsubq_u8(vorrq_u8(c.val[k], vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+                uint8x16_t isDigit = vcleq_u8(digit, vdupq_n_u8(9));
+                uint8x16_t isAlpha = vcleq_u8(alpha, vdupq_n_u8(5));
+                if (vminvq_u8(vorrq_u8(isDigit, isAlpha)) != 0xFF)
+                        return false;
+                nibble[k] = vbslq_u8(isDigit, digit, vaddq_u8(alpha, vdupq_n_u8(10)));
+        }
+        vst1q_u8(d, vorrq_u8(vshlq_n_u8(nibble[0], 4), nibble[1]));
+        return true;
+#endif
+}
+#endif
+
+
 /* Unescape the buffer pointed to by s 'in-place' using the (un)escape mechanizm
  described at http://www.postgresql.org/docs/9.0/static/datatype-binary.html
  The new size of s is assigned to r. Returns s. See PostgresqlResultSet_getBlob()
@@ -97,6 +180,13 @@ static inline const void *_unescape_bytea(uchar_t *s, int len, int *r) {
                         0,  0,  0,  0,  0,  0,  0, 0, 0, 0, 0, 0, 0, 0, 0, 0
                 };
                 for (i = 0, j = 2; j < len; j++) {
+#ifdef HEX_BLOCK
+                        if (j + HEX_BLOCK <= len && _decodeHex(s + j, s + i)) {
+                                i += HEX_BLOCK / 2;
+                                j += HEX_BLOCK - 1;
+                                continue;
+                        }
+#endif
                         /*
                          According to the doc, whitespace between hex pairs are allowed. Blarg!!
                          */
@@ -132,6 +222,195 @@ static inline const void *_unescape_bytea(uchar_t *s, int len, int *r) {
 }
 
 
+/* Decode a big-endian, two-complement integer of size bytes */
+static inline long long _getInteger(const uchar_t *p, int size) {
+        unsigned long long x = 0;
+        for (int i = 0; i < size; i++)
+                x = (x << 8) | p[i];
+        if (size < 8 && (p[0] & 0x80))
+                x |= ~0ULL << (size * 8);
+        return (long long)x;
+}
+
+
+static inline double _getFloat(const uchar_t *p, int size) {
+        if (size == 4) {
+                float f;
+                uint32_t x = (uint32_t)_getInteger(p, 4);
+                memcpy(&f, &x, sizeof(f));
+                return f;
+        }
+        double d;
+        uint64_t x = (uint64_t)_getInteger(p, 8);
+        memcpy(&d, &x, sizeof(d));
+        return d;
+}
+
+
+/* Returns true if the binary timestamp or date is infinity or -infinity. The sign is stored in sign */
+static inline int _isInfinite(column_t c, const uchar_t *p, int *sign) {
+        long long t = _getInteger(p, c->type == DATEOID ? 4 : 8);
+        long long max = c->type == DATEOID ? INT32_MAX : INT64_MAX;
+        long long min = c->type == DATEOID ? INT32_MIN : INT64_MIN;
+        *sign = t == max ? 1 : t == min ? -1 : 0;
+        return *sign != 0;
+}
+
+
+/* Format value with the fewest digits which read back as the same value, as the server does
+   with the default extra_float_digits. Digits from DBL_DIG or FLT_DIG are tried first, as all
+   values of up to that many digits read back the same */
+static void _formatReal(char *buffer, size_t size, double value, int isFloat) {
+        for (int digits = isFloat ? FLT_DIG : DBL_DIG; ; digits++) {
+                snprintf(buffer, size, "%.*g", digits, value);
+                if (digits >= (isFloat ? 9 : 17))
+                        break;
+                if (isFloat ? strtof(buffer, NULL) == (float)value : strtod(buffer, NULL) == value)
+                        break;
+        }
+}
+
+
+/* Split a binary timestamp or date in seconds since the Unix epoch and microseconds */
+static inline time_t _getTime(column_t c, const uchar_t *p, long *usec) {
+        *usec = 0;
+        if (c->type == DATEOID)
+                return (time_t)(_getInteger(p, 4) * 86400 + POSTGRES_EPOCH);
+        long long t = _getInteger(p, 8);
+        long long s = t / 1000000;
+        if ((*usec = (long)(t % 1000000)) < 0) {
+                *usec += 1000000;
+                s--;
+        }
+        return (time_t)(s + POSTGRES_EPOCH);
+}
+
+
+static inline int _isTextual(Oid type) {
+        return (type == TEXTOID || type == VARCHAROID || type == BPCHAROID || type == NAMEOID || type == BYTEAOID);
+}
+
+
+/* Format a binary value the same way as the server does in text format */
+static const char *_toString(T R, int i) {
+        column_t c = &R->columns[i];
+        const uchar_t *p = (const uchar_t *)PQgetvalue(R->res, R->currentRow, i);
+        switch (c->type) {
+                case BOOLOID:
+                        return p[0] ? "t" : "f";
+                case INT2OID:
+                case INT4OID:
+                case INT8OID:
+                        snprintf(c->buffer, sizeof(c->buffer), "%lld", _getInteger(p, PQgetlength(R->res, R->currentRow, i)));
+                        break;
+                case FLOAT4OID:
+                case FLOAT8OID:
+                {
+                        double d = _getFloat(p, PQgetlength(R->res, R->currentRow, i));
+                        if (isnan(d))
+                                return "NaN";
+                        if (isinf(d))
+                                return d < 0 ? "-Infinity" : "Infinity";
+                        _formatReal(c->buffer, sizeof(c->buffer), d, c->type == FLOAT4OID);
+                        break;
+                }
+                case DATEOID:
+                case TIMESTAMPOID:
+                case TIMESTAMPTZOID:
+                {
+                        long usec;
+                        int sign;
+                        if (_isInfinite(c, p, &sign))
+                                return sign < 0 ? "-infinity" : "infinity";
+                        struct tm tm = {.tm_isdst = -1};
+                        time_t t = _getTime(c, p, &usec);
+                        gmtime_r(&t, &tm);
+                        int n = snprintf(c->buffer, sizeof(c->buffer), "%04d-%02d-%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+                        if (c->type == DATEOID)
+                                break;
+                        n += snprintf(c->buffer + n, sizeof(c->buffer) - n, " %02d:%02d:%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+                        if (usec) {
+                                // Fraction without trailing zeros
+                                int digits = 6;
+                                for (; usec % 10 == 0; digits--)
+                                        usec /= 10;
+                                n += snprintf(c->buffer + n, sizeof(c->buffer) - n, ".%0*ld", digits, usec);
+                        }
+                        if (c->type == TIMESTAMPTZOID)
+                                snprintf(c->buffer + n, sizeof(c->buffer) - n, "+00");
+                        break;
+                }
+                default:
+                        return (const char *)p;
+        }
+        return c->buffer;
+}
+
+
+static inline int _isRows(ExecStatusType status) {
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        if (status == PGRES_TUPLES_CHUNK)
+                return true;
+#endif
+        return (status == PGRES_SINGLE_TUPLE);
+}
+
+
+/* Consume what is left of the query so the connection can be used again */
+static void _drain(PGconn *db) {
+        PGresult *res;
+        while ((res = PQgetResult(db)))
+                PQclear(res);
+}
+
+
+static void _setResult(T R, PGresult *res) {
+        R->res = res;
+        R->currentRow = -1;
+        R->columnCount = PQnfields(R->res);
+        R->rowCount = PQntuples(R->res);
+        FREE(R->columns);
+        for (int i = 0; i < R->columnCount; i++) {
+                if (PQfformat(R->res, i) == 1) {
+                        if (! R->columns)
+                                R->columns = CALLOC(R->columnCount, sizeof (struct column_t));
+                        R->columns[i].binary = true;
+                        R->columns[i].type = PQftype(R->res, i);
+                }
+        }
+}
+
+
+/* Replace the current chunk of a streamed result with the next one from
+ the server. The final, empty, PGRES_TUPLES_OK result is kept so column 
+ meta data is still available after the last row */
+static int _fetch(T R) {
+        PGresult *res = PQgetResult(R->db);
+        if (! res)
+                res = PQmakeEmptyPGresult(R->db, PGRES_FATAL_ERROR);
+        ExecStatusType status = PQresultStatus(res);
+        if (_isRows(status) || status == PGRES_TUPLES_OK) {
+                PQclear(R->res);
+                R->res = res;
+                R->currentRow = 0;
+                R->rowCount = PQntuples(R->res);
+                if (status == PGRES_TUPLES_OK) {
+                        R->done = true;
+                        _drain(R->db);
+                }
+                return (R->rowCount > 0);
+        }
+        // Keep the error result so it is released with the result set
+        PQclear(R->res);
+        R->res = res;
+        R->rowCount = 0;
+        R->done = true;
+        _drain(R->db);
+        THROW(SQLException, "%s", PQresultErrorMessage(res));
+        return false;
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -139,21 +418,132 @@ static inline const void *_unescape_bytea(uchar_t *s, int len, int *r) {
 #pragma GCC visibility push(hidden)
 #endif
 
+int PostgresqlResultSet_isBinaryType(Oid type) {
+        switch (type) {
+                case BOOLOID:
+                case INT2OID:
+                case INT4OID:
+                case INT8OID:
+                case FLOAT4OID:
+                case FLOAT8OID:
+                case DATEOID:
+                case TIMESTAMPOID:
+                case TIMESTAMPTZOID:
+                        return true;
+                default:
+                        return _isTextual(type);
+        }
+}
+
+
 T PostgresqlResultSet_new(void *res, int maxRows) {
         T R;
         assert(res);
         NEW(R);
-        R->res = res;
         R->maxRows = maxRows;
-        R->currentRow = -1;
-        R->columnCount = PQnfields(R->res);
-        R->rowCount = PQntuples(R->res);
+        _setResult(R, res);
+        return R;
+}
+
+
+T PostgresqlResultSet_newMulti(PGconn *db, int maxRows, PGresult **res) {
+        assert(db);
+        assert(res);
+        PGresult *r, *first = NULL, *last = NULL, **results = NULL;
+        int count = 0, size = 0;
+        // As PQexec, stop at an error or a COPY, but start with the first result with rows
+        while ((r = PQgetResult(db))) {
+                ExecStatusType status = PQresultStatus(r);
+                if (status == PGRES_TUPLES_OK) {
+                        if (! first) {
+                                first = r;
+                        } else {
+                                if (count == size) {
+                                        size = size ? size * 2 : 4;
+                                        if (results)
+                                                RESIZE(results, size * sizeof *results);
+                                        else
+                                                results = ALLOC(size * sizeof *results);
+                                }
+                                results[count++] = r;
+                        }
+                        continue;
+                }
+                PQclear(last);
+                last = r;
+                if (status != PGRES_COMMAND_OK && status != PGRES_EMPTY_QUERY) {
+                        // An error or a COPY, the server skips the statements after an error
+                        if (status != PGRES_COPY_IN && status != PGRES_COPY_OUT)
+                                _drain(db);
+                        PQclear(first);
+                        for (int i = 0; i < count; i++)
+                                PQclear(results[i]);
+                        FREE(results);
+                        *res = last;
+                        return NULL;
+                }
+        }
+        if (! first) {
+                // No statement returned rows
+                *res = last ? last : PQmakeEmptyPGresult(db, PGRES_FATAL_ERROR);
+                return NULL;
+        }
+        PQclear(last);
+        *res = first;
+        T R = PostgresqlResultSet_new(first, maxRows);
+        R->results = results;
+        R->resultCount = count;
+        return R;
+}
+
+
+T PostgresqlResultSet_newStream(PGconn *db, int maxRows, int prefetchRows, PGresult **error) {
+        assert(db);
+        assert(error);
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        PQsetChunkedRowsMode(db, prefetchRows);
+#else
+        PQsetSingleRowMode(db);
+#endif
+        PGresult *res = PQgetResult(db);
+        if (! res)
+                res = PQmakeEmptyPGresult(db, PGRES_FATAL_ERROR);
+        ExecStatusType status = PQresultStatus(res);
+        if (! (_isRows(status) || status == PGRES_TUPLES_OK)) {
+                _drain(db);
+                *error = res;
+                return NULL;
+        }
+        T R = PostgresqlResultSet_new(res, maxRows);
+        R->db = db;
+        R->stream = true;
+        if (status == PGRES_TUPLES_OK) {
+                R->done = true;
+                _drain(db);
+        }
         return R;
 }
 
 
 void PostgresqlResultSet_free(T *R) {
         assert(R && *R);
+        if ((*R)->stream) {
+                if (! (*R)->done) {
+                        // Stop the server from sending rows we will not read
+                        PGcancel *cancel = PQgetCancel((*R)->db);
+                        if (cancel) {
+                                char error[256];
+                                PQcancel(cancel, error, sizeof(error));
+                                PQfreeCancel(cancel);
+                        }
+                        _drain((*R)->db);
+                }
+                PQclear((*R)->res);
+        }
+        for (int i = 0; i < (*R)->resultCount; i++)
+                PQclear((*R)->results[i]);
+        FREE((*R)->results);
+        FREE((*R)->columns);
         FREE(*R);
 }
 
@@ -177,12 +567,24 @@ long PostgresqlResultSet_getColumnSize(T R, int columnIndex) {
         int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
         if (PQgetisnull(R->res, R->currentRow, i))
                 return 0;
+        if (R->columns && R->columns[i].binary && ! _isTextual(R->columns[i].type))
+                return strlen(_toString(R, i));
         return PQgetlength(R->res, R->currentRow, i);
 }
 
 
 int PostgresqlResultSet_next(T R) {
         assert(R);
+        if (R->stream) {
+                if (R->maxRows && (R->rowsFetched >= R->maxRows))
+                        return false;
+                if (++R->currentRow >= R->rowCount) {
+                        if (R->done || ! _fetch(R))
+                                return false;
+                }
+                R->rowsFetched++;
+                return true;
+        }
         return (! ((R->currentRow++ >= (R->rowCount - 1)) || (R->maxRows && (R->currentRow >= R->maxRows))));
 }
 
@@ -199,6 +601,8 @@ const char *PostgresqlResultSet_getString(T R, int columnIndex) {
         int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
         if (PQgetisnull(R->res, R->currentRow, i))
                 return NULL; 
+        if (R->columns && R->columns[i].binary)
+                return _toString(R, i);
         return PQgetvalue(R->res, R->currentRow, i);
 }
 
@@ -214,9 +618,176 @@ const void *PostgresqlResultSet_getBlob(T R, int columnIndex, int *size) {
         int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
         if (PQgetisnull(R->res, R->currentRow, i))
                 return NULL; 
+        if (R->columns && R->columns[i].binary) {
+                // Binary bytea is the raw bytes, other types are returned as their text representation
+                if (_isTextual(R->columns[i].type)) {
+                        *size = PQgetlength(R->res, R->currentRow, i);
+                        return PQgetvalue(R->res, R->currentRow, i);
+                }
+                const char *s = _toString(R, i);
+                *size = (int)strlen(s);
+                return s;
+        }
         return _unescape_bytea((uchar_t*)PQgetvalue(R->res, R->currentRow, i), PQgetlength(R->res, R->currentRow, i), size);
 }
 
+
+const void *PostgresqlResultSet_getBytes(T R, int columnIndex, int *size) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (PQgetisnull(R->res, R->currentRow, i))
+                return NULL;
+        if (R->columns && R->columns[i].binary && ! _isTextual(R->columns[i].type)) {
+                const char *s = _toString(R, i);
+                *size = (int)strlen(s);
+                return s;
+        }
+        *size = PQgetlength(R->res, R->currentRow, i);
+        return PQgetvalue(R->res, R->currentRow, i);
+}
+
+
+int PostgresqlResultSet_getInt(T R, int columnIndex) {
+        assert(R);
+        return (int)PostgresqlResultSet_getLLong(R, columnIndex);
+}
+
+
+long long PostgresqlResultSet_getLLong(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (PQgetisnull(R->res, R->currentRow, i))
+                return 0;
+        if (R->columns && R->columns[i].binary) {
+                const uchar_t *p = (const uchar_t *)PQgetvalue(R->res, R->currentRow, i);
+                switch (R->columns[i].type) {
+                        case BOOLOID:
+                                return p[0];
+                        case INT2OID:
+                        case INT4OID:
+                        case INT8OID:
+                                return _getInteger(p, PQgetlength(R->res, R->currentRow, i));
+                        case FLOAT4OID:
+                        case FLOAT8OID:
+                                return (long long)_getFloat(p, PQgetlength(R->res, R->currentRow, i));
+                        default:
+                                break;
+                }
+        }
+        return Str_parseLLong(PostgresqlResultSet_getString(R, columnIndex));
+}
+
+
+double PostgresqlResultSet_getDouble(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (PQgetisnull(R->res, R->currentRow, i))
+                return 0.0;
+        if (R->columns && R->columns[i].binary) {
+                const uchar_t *p = (const uchar_t *)PQgetvalue(R->res, R->currentRow, i);
+                switch (R->columns[i].type) {
+                        case BOOLOID:
+                                return p[0];
+                        case INT2OID:
+                        case INT4OID:
+                        case INT8OID:
+                                return (double)_getInteger(p, PQgetlength(R->res, R->currentRow, i));
+                        case FLOAT4OID:
+                        case FLOAT8OID:
+                                return _getFloat(p, PQgetlength(R->res, R->currentRow, i));
+                        default:
+                                break;
+                }
+        }
+        return Str_parseDouble(PostgresqlResultSet_getString(R, columnIndex));
+}
+
+
+time_t PostgresqlResultSet_getTimestamp(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (PQgetisnull(R->res, R->currentRow, i))
+                return 0;
+        if (R->columns && R->columns[i].binary) {
+                switch (R->columns[i].type) {
+                        case DATEOID:
+                        case TIMESTAMPOID:
+                        case TIMESTAMPTZOID:
+                        {
+                                long usec;
+                                int sign;
+                                const uchar_t *p = (const uchar_t *)PQgetvalue(R->res, R->currentRow, i);
+                                // Infinity is converted from its text as in text format, which fails
+                                if (_isInfinite(&R->columns[i], p, &sign))
+                                        break;
+                                return _getTime(&R->columns[i], p, &usec);
+                        }
+                        default:
+                                break;
+                }
+        }
+        const char *s = PostgresqlResultSet_getString(R, columnIndex);
+        return STR_DEF(s) ? Time_toTimestamp(s) : 0;
+}
+
+
+struct tm *PostgresqlResultSet_getDateTime(T R, int columnIndex, struct tm *tm) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        if (PQgetisnull(R->res, R->currentRow, i))
+                return tm;
+        if (R->columns && R->columns[i].binary) {
+                switch (R->columns[i].type) {
+                        case DATEOID:
+                        case TIMESTAMPOID:
+                        case TIMESTAMPTZOID:
+                        {
+                                long usec;
+                                int sign;
+                                const uchar_t *p = (const uchar_t *)PQgetvalue(R->res, R->currentRow, i);
+                                if (_isInfinite(&R->columns[i], p, &sign))
+                                        break;
+                                time_t t = _getTime(&R->columns[i], p, &usec);
+                                if (gmtime_r(&t, tm)) tm->tm_year += 1900; // Use year literal
+                                return tm;
+                        }
+                        default:
+                                break;
+                }
+        }
+        const char *s = PostgresqlResultSet_getString(R, columnIndex);
+        if (STR_DEF(s))
+                Time_toDateTime(s, tm);
+        return tm;
+}
+
+
+int PostgresqlResultSet_nextResult(T R) {
+        assert(R);
+        // A streamed result is read from the connection and following results are discarded with it
+        if (R->stream || R->result >= R->resultCount) {
+                R->currentRow = -1;
+                R->rowCount = 0;
+                R->columnCount = 0;
+                return false;
+        }
+        _setResult(R, R->results[R->result++]);
+        return true;
+}
+
+
+#ifdef LIBPQ_HAS_PIPELINING
+/* PQresultMemorySize is in libpq 12 and later, which has no feature macro of its own */
+long long PostgresqlResultSet_getMemory(T R) {
+        assert(R);
+        long long memory = R->res ? (long long)PQresultMemorySize(R->res) : 0;
+        for (int i = R->result; i < R->resultCount; i++)
+                memory += PQresultMemorySize(R->results[i]);
+        return memory;
+}
+#endif
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
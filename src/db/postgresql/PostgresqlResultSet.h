@@ -23,8 +23,28 @@
  */
 #ifndef POSTGRESQLRESULTSET_INCLUDED
 #define POSTGRESQLRESULTSET_INCLUDED
+/* Type oids from the server's catalog/pg_type.h */
+#define BOOLOID 16
+#define BYTEAOID 17
+#define NAMEOID 19
+#define INT8OID 20
+#define INT2OID 21
+#define INT4OID 23
+#define TEXTOID 25
+#define FLOAT4OID 700
+#define FLOAT8OID 701
+#define BPCHAROID 1042
+#define VARCHAROID 1043
+#define DATEOID 1082
+#define TIMESTAMPOID 1114
+#define TIMESTAMPTZOID 1184
+/* Seconds from the Unix epoch to the Postgres epoch, 2000-01-01 */
+#define POSTGRES_EPOCH 946684800LL
 #define T ResultSetDelegate_T
+int PostgresqlResultSet_isBinaryType(Oid type);
 T PostgresqlResultSet_new(void *stmt, int maxRows);
+T PostgresqlResultSet_newStream(PGconn *db, int maxRows, int prefetchRows, PGresult **error);
+T PostgresqlResultSet_newMulti(PGconn *db, int maxRows, PGresult **res);
 void PostgresqlResultSet_free(T *R);
 int PostgresqlResultSet_getColumnCount(T R);
 const char *PostgresqlResultSet_getColumnName(T R, int columnIndex);
@@ -33,5 +53,15 @@ int PostgresqlResultSet_next(T R);
 int PostgresqlResultSet_isnull(T R, int columnIndex);
 const char *PostgresqlResultSet_getString(T R, int columnIndex);
 const void *PostgresqlResultSet_getBlob(T R, int columnIndex, int *size);
+const void *PostgresqlResultSet_getBytes(T R, int columnIndex, int *size);
+int PostgresqlResultSet_getInt(T R, int columnIndex);
+long long PostgresqlResultSet_getLLong(T R, int columnIndex);
+double PostgresqlResultSet_getDouble(T R, int columnIndex);
+time_t PostgresqlResultSet_getTimestamp(T R, int columnIndex);
+struct tm *PostgresqlResultSet_getDateTime(T R, int columnIndex, struct tm *tm);
+int PostgresqlResultSet_nextResult(T R);
+#ifdef LIBPQ_HAS_PIPELINING
+long long PostgresqlResultSet_getMemory(T R);
+#endif
 #undef T
 #endif
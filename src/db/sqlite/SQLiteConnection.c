@@ -26,6 +26,8 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <sqlite3.h>
 
 #include "URL.h"
@@ -64,9 +66,13 @@ const struct Cop_T sqlite3cops = {
         .execute		= SQLiteConnection_execute,
         .executeQuery		= SQLiteConnection_executeQuery,
         .prepareStatement	= SQLiteConnection_prepareStatement,
-        .getLastError		= SQLiteConnection_getLastError
+        .getLastError		= SQLiteConnection_getLastError,
+        .isRetryable		= SQLiteConnection_isRetryable
 };
 
+/* Number of statements executeQuery keep prepared per connection */
+#define SQLITE_STATEMENT_CACHE 16
+
 #define T ConnectionDelegate_T
 struct T {
         URL_T url;
@@ -75,8 +81,18 @@ struct T {
 	int timeout;
 	int lastError;
         StringBuffer_T sb;
+        int cached;
+        struct {
+                char *sql;
+                sqlite3_stmt *stmt;
+        } cache[SQLITE_STATEMENT_CACHE]; // Most recently used first
 };
 
+/* WAL lets readers run concurrently with a writer and synchronous=NORMAL is safe with WAL,
+ a commit only syncs at checkpoints. Map up to 256MB of the database file and cache 16MB of pages */
+#define SQLITE_PERFORMANCE_PROFILE "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL; " \
+        "PRAGMA mmap_size = 268435456; PRAGMA cache_size = -16000; PRAGMA temp_store = MEMORY; "
+
 extern const struct Rop_T sqlite3rops;
 extern const struct Pop_T sqlite3pops;
 
@@ -92,10 +108,33 @@ static sqlite3 *_doConnect(URL_T url, char **error) {
                 *error = Str_dup("no database specified in URL");
                 return NULL;
         }
-        /* Shared cache mode help reduce database lock problems if libzdb is used with many threads */
+        // sqlite:///:memory: opens a private in-memory database for each connection
+        if (Str_isEqual(path, "/:memory:"))
+                path++;
 #if SQLITE_VERSION_NUMBER >= 3005000
-        sqlite3_enable_shared_cache(true);
-        status = sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_SHAREDCACHE, NULL);
+        int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        const char *mode = URL_getParameter(url, "mode");
+        if (IS(mode, "ro")) {
+                flags = SQLITE_OPEN_READONLY;
+        } else if (mode && ! IS(mode, "rw")) {
+                *error = Str_cat("unknown mode '%s'", mode);
+                return NULL;
+        }
+        /* Shared cache mode help reduce database lock problems if libzdb is used with many threads.
+         With WAL, private cache connections let readers run in parallel with the writer */
+        const char *cache = URL_getParameter(url, "cache");
+        if (IS(cache, "private")) {
+                // Overrides sqlite3_enable_shared_cache(), which is process wide
+                flags |= SQLITE_OPEN_PRIVATECACHE;
+        } else {
+                if (cache && ! IS(cache, "shared")) {
+                        *error = Str_cat("unknown cache '%s'", cache);
+                        return NULL;
+                }
+                sqlite3_enable_shared_cache(true);
+                flags |= SQLITE_OPEN_SHAREDCACHE;
+        }
+        status = sqlite3_open_v2(path, &db, flags, NULL);
 #else
         status = sqlite3_open(path, &db);
 #endif
@@ -108,6 +147,27 @@ static sqlite3 *_doConnect(URL_T url, char **error) {
 }
 
 
+/* Called by SQLite while the database is locked by another connection. Back off exponentially,
+ from 1ms up to 100ms between tries, until the query timeout is exceeded. A zero timeout means wait forever */
+static int _busyHandler(void *args, int count) {
+        T C = args;
+        long long waited = 0, delay = 1;
+        for (int i = 0; i < count; i++) {
+                waited += delay;
+                if (delay < 100)
+                        delay *= 2;
+        }
+        if (C->timeout > 0) {
+                if (waited >= C->timeout)
+                        return false;
+                if (waited + delay > C->timeout)
+                        delay = C->timeout - waited;
+        }
+        Time_usleep(delay * USEC_PER_MSEC);
+        return true;
+}
+
+
 static inline void _executeSQL(T C, const char *sql) {
 #if defined SQLITEUNLOCK && SQLITE_VERSION_NUMBER >= 3006012
         C->lastError = sqlite3_blocking_exec(C->db, sql, NULL, NULL, NULL);
@@ -121,7 +181,19 @@ static int _setProperties(T C, char **error) {
         const char **properties = URL_getParameterNames(C->url);
         if (properties) {
                 StringBuffer_clear(C->sb);
+                const char *profile = URL_getParameter(C->url, "profile");
+                if (profile) {
+                        // Applied first so pragmas given in the URL override the profile
+                        if (IS(profile, "performance"))
+                                StringBuffer_append(C->sb, "%s", SQLITE_PERFORMANCE_PROFILE);
+                        else {
+                                *error = Str_cat("unknown profile '%s'", profile);
+                                return false;
+                        }
+                }
                 for (int i = 0; properties[i]; i++) {
+                        if (IS(properties[i], "profile") || IS(properties[i], "mode") || IS(properties[i], "cache"))
+                                continue;
                         if (IS(properties[i], "heap_limit")) // There is no PRAGMA for heap limit as of sqlite-3.7.0, so we make it a configurable property using "heap_limit" [kB]
                                 #if defined(HAVE_SQLITE3_SOFT_HEAP_LIMIT64)
                                 sqlite3_soft_heap_limit64(Str_parseInt(URL_getParameter(C->url, properties[i])) * 1024);
@@ -143,6 +215,36 @@ static int _setProperties(T C, char **error) {
 }
 
 
+/* Return the cached statement for sql and move it first, or NULL if sql is not cached */
+static sqlite3_stmt *_getCachedStatement(T C, const char *sql) {
+        for (int i = 0; i < C->cached; i++) {
+                if (Str_isByteEqual(C->cache[i].sql, sql)) {
+                        char *s = C->cache[i].sql;
+                        sqlite3_stmt *stmt = C->cache[i].stmt;
+                        memmove(&C->cache[1], &C->cache[0], i * sizeof C->cache[0]);
+                        C->cache[0].sql = s;
+                        C->cache[0].stmt = stmt;
+                        return stmt;
+                }
+        }
+        return NULL;
+}
+
+
+/* Cache stmt first and finalize the least recently used statement if the cache is full */
+static void _cacheStatement(T C, const char *sql, sqlite3_stmt *stmt) {
+        if (C->cached == SQLITE_STATEMENT_CACHE) {
+                C->cached--;
+                sqlite3_finalize(C->cache[C->cached].stmt);
+                FREE(C->cache[C->cached].sql);
+        }
+        memmove(&C->cache[1], &C->cache[0], C->cached * sizeof C->cache[0]);
+        C->cache[0].sql = Str_dup(sql);
+        C->cache[0].stmt = stmt;
+        C->cached++;
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -150,7 +252,7 @@ static int _setProperties(T C, char **error) {
 #pragma GCC visibility push(hidden)
 #endif
 
-T SQLiteConnection_new(URL_T url, char **error) {
+T SQLiteConnection_new(URL_T url, void *context, char **error) {
 	T C;
         sqlite3 *db;
 	assert(url);
@@ -162,6 +264,7 @@ T SQLiteConnection_new(URL_T url, char **error) {
         C->url = url;
         C->timeout = SQL_DEFAULT_TIMEOUT;
         C->sb = StringBuffer_create(STRLEN);
+        sqlite3_busy_handler(C->db, _busyHandler, C);
         if (! _setProperties(C, error))
                 SQLiteConnection_free(&C);
 	return C;
@@ -170,6 +273,11 @@ T SQLiteConnection_new(URL_T url, char **error) {
 
 void SQLiteConnection_free(T *C) {
 	assert(C && *C);
+        // Cached statements must be finalized or sqlite3_close return SQLITE_BUSY
+        for (int i = 0; i < (*C)->cached; i++) {
+                sqlite3_finalize((*C)->cache[i].stmt);
+                FREE((*C)->cache[i].sql);
+        }
         while (sqlite3_close((*C)->db) == SQLITE_BUSY)
                Time_usleep(10);
         StringBuffer_free(&(*C)->sb);
@@ -179,8 +287,7 @@ void SQLiteConnection_free(T *C) {
 
 void SQLiteConnection_setQueryTimeout(T C, int ms) {
 	assert(C);
-        C->timeout = ms;
-	sqlite3_busy_timeout(C->db, C->timeout);
+        C->timeout = ms; // Used by _busyHandler
 }
 
 
@@ -197,8 +304,9 @@ int SQLiteConnection_ping(T C) {
 }
 
 
-int SQLiteConnection_beginTransaction(T C) {
+int SQLiteConnection_beginTransaction(T C, int type) {
 	assert(C);
+        // SQLite transactions are serializable and deferred until the first statement
         _executeSQL(C, "BEGIN TRANSACTION;");
         return (C->lastError == SQLITE_OK);
 }
@@ -249,6 +357,14 @@ ResultSet_T SQLiteConnection_executeQuery(T C, const char *sql, va_list ap) {
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
+        /* Connection frees its previous ResultSet before a new query is executed, so a cached
+         statement is never in use by another ResultSet here. The ResultSet reset it when freed */
+        if ((stmt = _getCachedStatement(C, StringBuffer_toString(C->sb)))) {
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+                C->lastError = SQLITE_OK;
+                return ResultSet_new(SQLiteResultSet_new(stmt, C->maxRows, true), (Rop_T)&sqlite3rops);
+        }
 #if defined SQLITEUNLOCK && SQLITE_VERSION_NUMBER >= 3006012
         C->lastError = sqlite3_blocking_prepare_v2(C->db, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), &stmt, &tail);
 #elif SQLITE_VERSION_NUMBER >= 3004000
@@ -256,8 +372,15 @@ ResultSet_T SQLiteConnection_executeQuery(T C, const char *sql, va_list ap) {
 #else
         EXEC_SQLITE(C->lastError, sqlite3_prepare(C->db, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), &stmt, &tail), C->timeout);
 #endif
-	if (C->lastError == SQLITE_OK)
-		return ResultSet_new(SQLiteResultSet_new(stmt, C->maxRows, false), (Rop_T)&sqlite3rops);
+	if (C->lastError == SQLITE_OK) {
+                // The following statements of a multi-statement query are prepared by the ResultSet, which is not cached
+                while (isspace((unsigned char)*tail))
+                        tail++;
+                if (*tail)
+                        return ResultSet_new(SQLiteResultSet_newMulti(stmt, C->maxRows, tail), (Rop_T)&sqlite3rops);
+                _cacheStatement(C, StringBuffer_toString(C->sb), stmt);
+		return ResultSet_new(SQLiteResultSet_new(stmt, C->maxRows, true), (Rop_T)&sqlite3rops);
+        }
 	return NULL;
 }
 
@@ -291,6 +414,14 @@ const char *SQLiteConnection_getLastError(T C) {
 }
 
 
+int SQLiteConnection_isRetryable(T C) {
+        assert(C);
+        // The busy handler gave up waiting for a lock, or a table is locked by a shared cache connection
+        int error = sqlite3_errcode(C->db);
+        return error == SQLITE_BUSY || error == SQLITE_LOCKED;
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -24,12 +24,12 @@
 #ifndef SQLITECONNECTION_INCLUDED
 #define SQLITECONNECTION_INCLUDED
 #define T ConnectionDelegate_T
-T SQLiteConnection_new(URL_T url, char **error);
+T SQLiteConnection_new(URL_T url, void *context, char **error);
 void SQLiteConnection_free(T *C);
 void SQLiteConnection_setQueryTimeout(T C, int ms);
 void SQLiteConnection_setMaxRows(T C, int max);
 int SQLiteConnection_ping(T C);
-int SQLiteConnection_beginTransaction(T C);
+int SQLiteConnection_beginTransaction(T C, int type);
 int SQLiteConnection_commit(T C);
 int SQLiteConnection_rollback(T C);
 long long SQLiteConnection_lastRowId(T C);
@@ -38,6 +38,7 @@ int SQLiteConnection_execute(T C, const char *sql, va_list ap);
 ResultSet_T SQLiteConnection_executeQuery(T C, const char *sql, va_list ap);
 PreparedStatement_T SQLiteConnection_prepareStatement(T C, const char *sql, va_list ap);
 const char *SQLiteConnection_getLastError(T C);
+int SQLiteConnection_isRetryable(T C);
 #undef T
 #endif
 
@@ -59,7 +59,8 @@ const struct Pop_T sqlite3pops = {
         .setBlob        = SQLitePreparedStatement_setBlob,
         .execute        = SQLitePreparedStatement_execute,
         .executeQuery   = SQLitePreparedStatement_executeQuery,
-        .rowsChanged    = SQLitePreparedStatement_rowsChanged
+        .rowsChanged    = SQLitePreparedStatement_rowsChanged,
+        .executeBatch   = SQLitePreparedStatement_executeBatch
 };
 
 #define T PreparedStatementDelegate_T
@@ -73,6 +74,18 @@ struct T {
 extern const struct Rop_T sqlite3rops;
 
 
+/* ------------------------------------------------------- Private methods */
+
+
+static inline void _executeSQL(T P, const char *sql) {
+#if defined SQLITEUNLOCK && SQLITE_VERSION_NUMBER >= 3006012
+        P->lastError = sqlite3_blocking_exec(P->db, sql, NULL, NULL, NULL);
+#else
+        EXEC_SQLITE(P->lastError, sqlite3_exec(P->db, sql, NULL, NULL, NULL), SQL_DEFAULT_TIMEOUT);
+#endif
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -192,6 +205,48 @@ long long SQLitePreparedStatement_rowsChanged(T P) {
         return (long long)sqlite3_changes(P->db);
 }
 
+
+long long SQLitePreparedStatement_executeBatch(T P, int rows, void (*bind)(void *batch, int row), void *batch) {
+        assert(P);
+        assert(bind);
+        long long changes = 0;
+        // Unless the caller started a transaction, run the batch in one to avoid a journal sync per row
+        int autocommit = sqlite3_get_autocommit(P->db);
+        if (autocommit) {
+                _executeSQL(P, "BEGIN TRANSACTION;");
+                if (P->lastError != SQLITE_OK)
+                        THROW(SQLException, "%s", sqlite3_errmsg(P->db));
+        }
+        for (int i = 0; i < rows; i++) {
+                bind(batch, i);
+#if defined SQLITEUNLOCK && SQLITE_VERSION_NUMBER >= 3006012
+                P->lastError = sqlite3_blocking_step(P->stmt);
+#else
+                EXEC_SQLITE(P->lastError, sqlite3_step(P->stmt), SQL_DEFAULT_TIMEOUT);
+#endif
+                int status = P->lastError;
+                P->lastError = sqlite3_reset(P->stmt);
+                if (status != SQLITE_DONE) {
+                        char error[STRLEN];
+                        snprintf(error, STRLEN, "%s", status == SQLITE_ROW ? "Select statement not allowed in PreparedStatement_executeBatch()" : sqlite3_errmsg(P->db));
+                        if (autocommit && ! sqlite3_get_autocommit(P->db))
+                                _executeSQL(P, "ROLLBACK TRANSACTION;");
+                        THROW(SQLException, "%s", error);
+                }
+                changes += sqlite3_changes(P->db);
+        }
+        if (autocommit) {
+                _executeSQL(P, "COMMIT TRANSACTION;");
+                if (P->lastError != SQLITE_OK) {
+                        char error[STRLEN];
+                        snprintf(error, STRLEN, "%s", sqlite3_errmsg(P->db));
+                        _executeSQL(P, "ROLLBACK TRANSACTION;");
+                        THROW(SQLException, "%s", error);
+                }
+        }
+        return changes;
+}
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -35,5 +35,6 @@ void SQLitePreparedStatement_setBlob(T P, int parameterIndex, const void *x, int
 void SQLitePreparedStatement_execute(T P);
 ResultSet_T SQLitePreparedStatement_executeQuery(T P);
 long long SQLitePreparedStatement_rowsChanged(T P);
+long long SQLitePreparedStatement_executeBatch(T P, int rows, void (*bind)(void *batch, int row), void *batch);
 #undef T
 #endif
@@ -55,20 +55,102 @@ const struct Rop_T sqlite3rops = {
         .isnull         = SQLiteResultSet_isnull,
         .getString      = SQLiteResultSet_getString,
         .getBlob        = SQLiteResultSet_getBlob,
+        .getInt         = SQLiteResultSet_getInt,
+        .getLLong       = SQLiteResultSet_getLLong,
+        .getDouble      = SQLiteResultSet_getDouble,
         .getTimestamp   = SQLiteResultSet_getTimestamp,
-        .getDateTime    = SQLiteResultSet_getDateTime
+        .getDateTime    = SQLiteResultSet_getDateTime,
+        .getBytes       = SQLiteResultSet_getBlob, // Already a view into the statement
+        .nextResult     = SQLiteResultSet_nextResult
 };
 
 #define T ResultSetDelegate_T
 struct T {
         int keep;
+        int done;
         int maxRows;
 	int currentRow;
 	int columnCount;
+        int lastError;
+        char *sql;              // Statements following stmt in a multi-statement query
+        const char *tail;
+        sqlite3 *db;
 	sqlite3_stmt *stmt;
 };
 
 
+/* ------------------------------------------------------- Private methods */
+
+
+static inline int _step(sqlite3_stmt *stmt) {
+        int status;
+#if defined SQLITEUNLOCK && SQLITE_VERSION_NUMBER >= 3006012
+	status = sqlite3_blocking_step(stmt);
+#else
+        EXEC_SQLITE(status, sqlite3_step(stmt), SQL_DEFAULT_TIMEOUT);
+#endif
+        return status;
+}
+
+
+static inline int _prepare(T R) {
+        int status;
+#if defined SQLITEUNLOCK && SQLITE_VERSION_NUMBER >= 3006012
+        status = sqlite3_blocking_prepare_v2(R->db, R->tail, -1, &R->stmt, &R->tail);
+#elif SQLITE_VERSION_NUMBER >= 3004000
+        EXEC_SQLITE(status, sqlite3_prepare_v2(R->db, R->tail, -1, &R->stmt, &R->tail), SQL_DEFAULT_TIMEOUT);
+#else
+        EXEC_SQLITE(status, sqlite3_prepare(R->db, R->tail, -1, &R->stmt, &R->tail), SQL_DEFAULT_TIMEOUT);
+#endif
+        return status;
+}
+
+
+static inline void _release(T R) {
+        if (R->keep)
+                sqlite3_reset(R->stmt);
+        else
+                sqlite3_finalize(R->stmt);
+        R->stmt = NULL;
+        R->keep = false;
+        R->columnCount = 0;
+}
+
+
+/* Run the current statement to completion and prepare the next statement in the tail which
+   returns rows. Statements which do not return rows are executed on the way. Returns SQLITE_ROW
+   if a statement was prepared, SQLITE_DONE if there are no more statements or an error code */
+static int _nextStatement(T R) {
+        int status;
+        do {
+                if (! R->stmt)
+                        return SQLITE_DONE;
+                if (! R->done) {
+                        // Stepping a finished statement would run it again
+                        R->done = true;
+                        while ((status = _step(R->stmt)) == SQLITE_ROW)
+                                ;
+                        if (status != SQLITE_DONE)
+                                return status;
+                }
+                _release(R);
+                // A tail with only white-space or comments is prepared to a NULL statement
+                while (R->tail && *R->tail && ! R->stmt) {
+                        if ((status = _prepare(R)) != SQLITE_OK) {
+                                R->tail = NULL;
+                                return status;
+                        }
+                }
+                if (! R->stmt)
+                        return SQLITE_DONE;
+                R->done = false;
+                R->currentRow = 0;
+                R->columnCount = sqlite3_column_count(R->stmt);
+        } while (R->columnCount == 0);
+        return SQLITE_ROW;
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -83,17 +165,40 @@ T SQLiteResultSet_new(void *stmt, int maxRows, int keep) {
 	R->stmt = stmt;
         R->keep = keep;
         R->maxRows = maxRows;
+        R->db = sqlite3_db_handle(R->stmt);
         R->columnCount = sqlite3_column_count(R->stmt);
 	return R;
 }
 
 
+T SQLiteResultSet_newMulti(void *stmt, int maxRows, const char *tail) {
+        assert(tail);
+        T R = SQLiteResultSet_new(stmt, maxRows, false);
+        R->sql = Str_dup(tail);
+        R->tail = R->sql;
+        // Start with the first statement returning rows. As with a single statement, errors are reported by ResultSet_next()
+        if (R->columnCount == 0) {
+                int status = _nextStatement(R);
+                if (status != SQLITE_ROW && status != SQLITE_DONE)
+                        R->lastError = status;
+        }
+        return R;
+}
+
+
 void SQLiteResultSet_free(T *R) {
 	assert(R && *R);
-        if ((*R)->keep)
-                sqlite3_reset((*R)->stmt);
-        else
-                sqlite3_finalize((*R)->stmt);
+        // Statements not reached with nextResult are executed, as the whole query is on other systems
+        if ((*R)->sql) {
+                int status;
+                while ((status = _nextStatement(*R)) == SQLITE_ROW)
+                        ;
+                if (status != SQLITE_DONE)
+                        DEBUG("Multi-statement query failed -- %s\n", sqlite3_errmsg((*R)->db));
+        }
+        if ((*R)->stmt)
+                _release(*R);
+        FREE((*R)->sql);
 	FREE(*R);
 }
 
@@ -122,13 +227,14 @@ long SQLiteResultSet_getColumnSize(T R, int columnIndex) {
 int SQLiteResultSet_next(T R) {
         int status;
 	assert(R);
+        if (R->lastError)
+                THROW(SQLException, "%s", sqlite3_errmsg(R->db));
+        if (! R->stmt)
+                return false;
         if (R->maxRows && (R->currentRow++ >= R->maxRows))
                 return false;
-#if defined SQLITEUNLOCK && SQLITE_VERSION_NUMBER >= 3006012
-	status = sqlite3_blocking_step(R->stmt);
-#else
-        EXEC_SQLITE(status, sqlite3_step(R->stmt), SQL_DEFAULT_TIMEOUT);
-#endif
+        status = _step(R->stmt);
+        R->done = (status == SQLITE_DONE);
         if (status != SQLITE_ROW && status != SQLITE_DONE) {
 #ifdef HAVE_SQLITE3_ERRSTR
                 THROW(SQLException, "sqlite3_step -- %s", sqlite3_errstr(status));
@@ -163,6 +269,44 @@ const void *SQLiteResultSet_getBlob(T R, int columnIndex, int *size) {
 }
 
 
+int SQLiteResultSet_getInt(T R, int columnIndex) {
+        assert(R);
+        return (int)SQLiteResultSet_getLLong(R, columnIndex);
+}
+
+
+long long SQLiteResultSet_getLLong(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        switch (sqlite3_column_type(R->stmt, i)) {
+                case SQLITE_NULL:
+                        return 0;
+                case SQLITE_INTEGER:
+                case SQLITE_FLOAT:
+                        return sqlite3_column_int64(R->stmt, i);
+                default:
+                        // Text or blob storage class, parse so invalid numbers throw as before
+                        return Str_parseLLong((const char*)sqlite3_column_text(R->stmt, i));
+        }
+}
+
+
+double SQLiteResultSet_getDouble(T R, int columnIndex) {
+        assert(R);
+        int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
+        switch (sqlite3_column_type(R->stmt, i)) {
+                case SQLITE_NULL:
+                        return 0.0;
+                case SQLITE_INTEGER:
+                case SQLITE_FLOAT:
+                        return sqlite3_column_double(R->stmt, i);
+                default:
+                        // Text or blob storage class, parse so invalid numbers throw as before
+                        return Str_parseDouble((const char*)sqlite3_column_text(R->stmt, i));
+        }
+}
+
+
 time_t SQLiteResultSet_getTimestamp(T R, int columnIndex) {
         assert(R);
         int i = checkAndSetColumnIndex(columnIndex, R->columnCount);
@@ -187,6 +331,15 @@ struct tm *SQLiteResultSet_getDateTime(T R, int columnIndex, struct tm *tm) {
 }
 
 
+int SQLiteResultSet_nextResult(T R) {
+        assert(R);
+        int status = _nextStatement(R);
+        if (status != SQLITE_ROW && status != SQLITE_DONE)
+                THROW(SQLException, "%s", sqlite3_errmsg(R->db));
+        return (status == SQLITE_ROW);
+}
+
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
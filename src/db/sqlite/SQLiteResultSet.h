@@ -101,20 +101,24 @@ static inline int sqlite3_blocking_exec(sqlite3 *db, const char *zSql, int (*cal
         return rc;
 }
 #else
-/* SQLite timed retry macro */
+/* SQLite timed retry macro. SQLITE_BUSY is handled by the connection's busy handler, 
+ but a shared cache table lock, SQLITE_LOCKED, is not, so retry with exponential backoff until timeout [ms] */
 #define EXEC_SQLITE(status, action, timeout) \
         do {\
-                long t = (timeout * USEC_PER_MSEC);\
-                int x = 0;\
-                do {\
-                        status = (action);\
-                } while (((status == SQLITE_BUSY) || (status == SQLITE_LOCKED)) && (x++ <= 9) && ((Time_usleep(t/(rand() % 10 + 100)))));\
+                long _limit = (timeout) * USEC_PER_MSEC, _waited = 0, _delay = 1000;\
+                while (((status = (action)) == SQLITE_LOCKED) && (_waited < _limit)) {\
+                        Time_usleep(_delay);\
+                        _waited += _delay;\
+                        if (_delay < 100000)\
+                                _delay *= 2;\
+                }\
         } while (0)
 #endif
 
 
 #define T ResultSetDelegate_T
 T SQLiteResultSet_new(void *stmt, int maxRows, int keep);
+T SQLiteResultSet_newMulti(void *stmt, int maxRows, const char *tail);
 void SQLiteResultSet_free(T *R);
 int SQLiteResultSet_getColumnCount(T R);
 const char *SQLiteResultSet_getColumnName(T R, int columnIndex);
@@ -123,8 +127,12 @@ int SQLiteResultSet_next(T R);
 int SQLiteResultSet_isnull(T R, int columnIndex);
 const char *SQLiteResultSet_getString(T R, int columnIndex);
 const void *SQLiteResultSet_getBlob(T R, int columnIndex, int *size);
+int SQLiteResultSet_getInt(T R, int columnIndex);
+long long SQLiteResultSet_getLLong(T R, int columnIndex);
+double SQLiteResultSet_getDouble(T R, int columnIndex);
 time_t SQLiteResultSet_getTimestamp(T R, int columnIndex);
 struct tm *SQLiteResultSet_getDateTime(T R, int columnIndex, struct tm *tm);
+int SQLiteResultSet_nextResult(T R);
 
 #undef T
 #endif
@@ -237,11 +237,11 @@ void Exception_throw(const T *e, const char *func, const char *file, int line, c
 
 /**
  * Re-throws an exception. In a CATCH or ELSE block clients can use RETHROW
- * to re-throw the Exception
+ * to re-throw the Exception with its message
  * @hideinitializer
  */
 #define RETHROW Exception_throw(Exception_frame.exception, \
-        Exception_frame.func, Exception_frame.file, Exception_frame.line, NULL)
+        Exception_frame.func, Exception_frame.file, Exception_frame.line, "%s", Exception_frame.message)
 
 
 /**
@@ -40,6 +40,17 @@
  */
 
 
+/* ----------------------------------------------------------- Definitions */
+
+
+static struct {
+        void *(*malloc)(size_t size);
+        void *(*calloc)(size_t count, size_t size);
+        void *(*realloc)(void *p, size_t size);
+        void (*free)(void *p);
+} allocator = {malloc, calloc, realloc, free};
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -47,9 +58,18 @@
 #pragma GCC visibility push(hidden)
 #endif
 
+void Mem_setAllocator(void *(*mallocFunc)(size_t size), void *(*callocFunc)(size_t count, size_t size), void *(*reallocFunc)(void *p, size_t size), void (*freeFunc)(void *p)) {
+        assert(mallocFunc && callocFunc && reallocFunc && freeFunc);
+        allocator.malloc = mallocFunc;
+        allocator.calloc = callocFunc;
+        allocator.realloc = reallocFunc;
+        allocator.free = freeFunc;
+}
+
+
 void *Mem_alloc(long size, const char *func, const char *file, int line){
 	assert(size > 0);
-	void *p = malloc(size);
+	void *p = allocator.malloc(size);
 	if (! p)
 		Exception_throw(&(MemoryException), func, file, line, "%s", System_getLastError());
 	return p;
@@ -59,7 +79,7 @@ void *Mem_alloc(long size, const char *func, const char *file, int line){
 void *Mem_calloc(long count, long size, const char *func, const char *file, int line) {
 	assert(count > 0);
 	assert(size > 0);
-	void *p = calloc(count, size);
+	void *p = allocator.calloc(count, size);
 	if (! p)
 		Exception_throw(&(MemoryException), func, file, line, "%s", System_getLastError());
 	return p;
@@ -68,14 +88,14 @@ void *Mem_calloc(long count, long size, const char *func, const char *file, int
 
 void Mem_free(void *p, const char *func, const char *file, int line) {
 	if (p)
-		free(p);
+		allocator.free(p);
 }
 
 
 void *Mem_resize(void *p, long size, const char *func, const char *file, int line) {
 	assert(p);
 	assert(size > 0);
-	p = realloc(p, size);
+	p = allocator.realloc(p, size);
 	if (! p)
 		Exception_throw(&(MemoryException), func, file, line, "%s", System_getLastError());
 	return p;
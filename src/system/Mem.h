@@ -26,6 +26,8 @@
 #ifndef MEM_INCLUDED
 #define MEM_INCLUDED
 
+#include <stddef.h>
+
 
 /**
  * General purpose memory allocation <b>Class methods</b>.
@@ -88,6 +90,19 @@
 #define RESIZE(p, n) ((p) = Mem_resize((p), (n), __func__, __FILE__, __LINE__))
 
 
+/**
+ * Replace the functions used to allocate and free memory. The default
+ * is the standard C library malloc, calloc, realloc and free. Must be
+ * called before any memory is allocated as memory is always returned
+ * with the free function in use when it is freed.
+ * @param mallocFunc Replaces malloc(3)
+ * @param callocFunc Replaces calloc(3)
+ * @param reallocFunc Replaces realloc(3)
+ * @param freeFunc Replaces free(3)
+ */
+void Mem_setAllocator(void *(*mallocFunc)(size_t size), void *(*callocFunc)(size_t count, size_t size), void *(*reallocFunc)(void *p, size_t size), void (*freeFunc)(void *p));
+
+
 /**
  * Allocate and return <code>size</code> bytes of memory. If 
  * allocation failed this method throws AssertException
@@ -122,6 +122,28 @@ time_t Time_now(void);
 long long Time_milli(void);
 
 
+/**
+ * Returns the time of a monotonic clock measured in milliseconds. The
+ * clock has no relation to the wall-clock time and is not affected if
+ * the system time is set. Use it to measure timeouts and intervals.
+ * @return A 64 bits long representing the monotonic clock in milliseconds
+ * @exception AssertException If time could not be obtained
+ */
+long long Time_monotonic(void);
+
+
+/**
+ * Returns the time of the same clock as Time_monotonic(), updated only
+ * at each system clock tick, that is, with a resolution of a few
+ * milliseconds (CLOCK_MONOTONIC_COARSE on Linux). It is cheaper to read
+ * and meant for bookkeeping where such precision is enough.
+ * @return A 64 bits long representing the coarse monotonic clock in
+ * milliseconds
+ * @exception AssertException If time could not be obtained
+ */
+long long Time_coarse(void);
+
+
 /**
  * This method suspend the calling process or Thread for
  * <code>u</code> micro seconds.
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "Thread.h"
+#include "system/Time.h"
+#include "system/Watchdog.h"
+
+
+/**
+ * Implementation of the Watchdog interface
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define T Watchdog_T
+struct Watchdog_S {
+        int armed;              // Started and not stopped, only used by the owner thread
+        int index;              // Position in the heap or -1 if not in the heap
+        long long deadline;     // Time_monotonic() when the alarm is called
+        int firing;             // Number of alarms running, protected by the timer mutex
+        void (*alarm)(void *args);
+        void *args;
+};
+
+static struct {
+        T *heap;
+        int size;
+        int capacity;
+        Mutex_T mutex;
+        Sem_T cond;
+        Sem_T done;
+        Thread_T thread;
+} timer;
+static Once_T once = PTHREAD_ONCE_INIT;
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+static inline void _place(T W, int i) {
+        timer.heap[i] = W;
+        W->index = i;
+}
+
+
+static void _up(int i) {
+        T W = timer.heap[i];
+        while (i > 0) {
+                int parent = (i - 1) / 2;
+                if (timer.heap[parent]->deadline <= W->deadline)
+                        break;
+                _place(timer.heap[parent], i);
+                i = parent;
+        }
+        _place(W, i);
+}
+
+
+static void _down(int i) {
+        T W = timer.heap[i];
+        while (true) {
+                int child = 2 * i + 1;
+                if (child >= timer.size)
+                        break;
+                if (child + 1 < timer.size && timer.heap[child + 1]->deadline < timer.heap[child]->deadline)
+                        child++;
+                if (W->deadline <= timer.heap[child]->deadline)
+                        break;
+                _place(timer.heap[child], i);
+                i = child;
+        }
+        _place(W, i);
+}
+
+
+static void _insert(T W) {
+        if (timer.size == timer.capacity) {
+                if (timer.heap) {
+                        timer.capacity *= 2;
+                        RESIZE(timer.heap, timer.capacity * sizeof *timer.heap);
+                } else {
+                        timer.capacity = 16;
+                        timer.heap = ALLOC(timer.capacity * sizeof *timer.heap);
+                }
+        }
+        _place(W, timer.size++);
+        _up(W->index);
+}
+
+
+static void _remove(T W) {
+        int i = W->index;
+        W->index = -1;
+        if (--timer.size > i) {
+                // Move the last entry into the hole and restore the heap order
+                T last = timer.heap[timer.size];
+                _place(last, i);
+                _down(i);
+                _up(last->index);
+        }
+}
+
+
+/* Run an alarm on a thread of its own, so an alarm which blocks, e.g. on network I/O,
+   does not delay the alarms of other Watchdogs */
+static void *_fire(void *args) {
+        T W = args;
+        W->alarm(W->args);
+        LOCK(timer.mutex)
+        {
+                W->firing--;
+                Sem_broadcast(timer.done);
+        }
+        END_LOCK;
+        return NULL;
+}
+
+
+static void *_run(void *args) {
+        LOCK(timer.mutex)
+        {
+                while (true) {
+                        if (timer.size == 0) {
+                                Sem_wait(timer.cond, timer.mutex);
+                                continue;
+                        }
+                        T W = timer.heap[0];
+                        long long remaining = W->deadline - Time_monotonic();
+                        if (remaining <= 0) {
+                                Thread_T thread;
+                                _remove(W);
+                                W->firing++;
+                                Thread_create(thread, _fire, W);
+                                Thread_detach(thread);
+                        } else {
+                                // The condition waits on the wall-clock, so the deadline is converted on each wait
+                                long long until = Time_milli() + remaining;
+                                struct timespec wait = {.tv_sec = (time_t)(until / 1000), .tv_nsec = (long)(until % 1000) * 1000000};
+                                Sem_timeWait(timer.cond, timer.mutex, wait);
+                        }
+                }
+        }
+        END_LOCK;
+        return NULL;
+}
+
+
+static void _init(void) {
+        Mutex_init(timer.mutex);
+        Sem_init(timer.cond);
+        Sem_init(timer.done);
+        Thread_create(timer.thread, _run, NULL);
+        Thread_detach(timer.thread);
+}
+
+
+/* ----------------------------------------------------- Protected methods */
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility push(hidden)
+#endif
+
+T Watchdog_new(void (*alarm)(void *args), void *args) {
+        T W;
+        assert(alarm);
+        NEW(W);
+        W->alarm = alarm;
+        W->args = args;
+        W->index = -1;
+        return W;
+}
+
+
+void Watchdog_free(T *W) {
+        assert(W && *W);
+        Watchdog_stop(*W);
+        FREE(*W);
+}
+
+
+void Watchdog_start(T W, int ms) {
+        assert(W);
+        assert(ms > 0);
+        Thread_once(once, _init);
+        long long deadline = Time_monotonic() + ms;
+        LOCK(timer.mutex)
+        {
+                if (W->index >= 0)
+                        _remove(W);
+                W->deadline = deadline;
+                _insert(W);
+                // Wake the timer thread if this is now the earliest deadline
+                if (W->index == 0)
+                        Sem_signal(timer.cond);
+        }
+        END_LOCK;
+        W->armed = true;
+}
+
+
+void Watchdog_stop(T W) {
+        assert(W);
+        if (W->armed) {
+                W->armed = false;
+                LOCK(timer.mutex)
+                {
+                        if (W->index >= 0)
+                                _remove(W);
+                        while (W->firing)
+                                Sem_wait(timer.done, timer.mutex);
+                }
+                END_LOCK;
+        }
+}
+
+
+#ifdef PACKAGE_PROTECTED
+#pragma GCC visibility pop
+#endif
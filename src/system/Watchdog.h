@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef WATCHDOG_INCLUDED
+#define WATCHDOG_INCLUDED
+
+
+/**
+ * A <b>Watchdog</b> calls an alarm function if it is not stopped within
+ * a given time after it was started. It is used by database delegates
+ * to interrupt a query which exceeds the query timeout. All Watchdogs
+ * share one timer thread which keeps armed deadlines in a min-heap and
+ * sleeps until the earliest expire, so an idle Watchdog costs nothing.
+ *
+ * The alarm function is called from a thread of its own, without
+ * holding any lock, and may block without delaying the alarms of other
+ * Watchdogs. Watchdog_stop() waits for an alarm in progress to return
+ * before it returns.
+ *
+ * @file
+ */
+
+
+#define T Watchdog_T
+typedef struct Watchdog_S *T;
+
+
+/**
+ * Create a new Watchdog
+ * @param alarm The function to call when the Watchdog expire
+ * @param args Argument given to the alarm function
+ * @return A new Watchdog, not started
+ */
+T Watchdog_new(void (*alarm)(void *args), void *args);
+
+
+/**
+ * Stop and destroy a Watchdog
+ * @param W A Watchdog object reference
+ */
+void Watchdog_free(T *W);
+
+
+/**
+ * Start the Watchdog. If the Watchdog is already started, the
+ * deadline is reset.
+ * @param W A Watchdog object
+ * @param ms Milliseconds until the alarm is called
+ */
+void Watchdog_start(T W, int ms);
+
+
+/**
+ * Stop the Watchdog. Does nothing if the Watchdog is not started or
+ * has already expired.
+ * @param W A Watchdog object
+ */
+void Watchdog_stop(T W);
+
+
+#undef T
+#endif
@@ -42,6 +42,11 @@
 /* ----------------------------------------------------------- Definitions */
 
 
+/* Maximum number of parameters in a prepared statement. PostgreSQL sends the
+   number of parameters as a 16 bit integer and Oracle has the same limit */
+#define POSTGRESQL_MAX_PARAMETERS 65535
+#define ORACLE_MAX_PARAMETERS 65535
+
 #define T StringBuffer_T
 struct T {
         int used;
@@ -53,46 +58,151 @@ struct T {
 /* ------------------------------------------------------- Private methods */
 
 
+/* Grow the buffer geometrically so it can hold at least size bytes */
+static inline void _ensureCapacity(T S, int size) {
+        if (size > S->length) {
+                S->length = (S->length * 2 > size) ? S->length * 2 : size;
+                RESIZE(S->buffer, S->length);
+        }
+}
+
+
+static inline void _appendBytes(T S, const char *s, int n) {
+        _ensureCapacity(S, S->used + n + 1);
+        memcpy(S->buffer + S->used, s, n);
+        S->used += n;
+        S->buffer[S->used] = 0;
+}
+
+
+/* Strings without conversions and a single "%s" or "%.*s" argument are copied
+ directly, which is what SQL without parameters and the raw Connection methods use */
 static inline void _append(T S, const char *s, va_list ap) {
-        va_list ap_copy;
-        while (true) {
-                va_copy(ap_copy, ap);
-                int n = vsnprintf((char*)(S->buffer + S->used), S->length - S->used, s, ap_copy);
-                va_end(ap_copy);
-                if ((S->used + n) < S->length) {
-                        S->used += n;
-                        break;
+        if (! strchr(s, '%')) {
+                _appendBytes(S, s, (int)strlen(s));
+        } else if (Str_isByteEqual(s, "%s")) {
+                const char *a = va_arg(ap, const char *);
+                a = a ? a : "(null)";
+                _appendBytes(S, a, (int)strlen(a));
+        } else if (Str_isByteEqual(s, "%.*s")) {
+                int n = va_arg(ap, int);
+                const char *a = va_arg(ap, const char *);
+                a = a ? a : "(null)";
+                _appendBytes(S, a, (int)(n < 0 ? strlen(a) : strnlen(a, n)));
+        } else {
+                va_list ap_copy;
+                while (true) {
+                        va_copy(ap_copy, ap);
+                        int n = vsnprintf((char*)(S->buffer + S->used), S->length - S->used, s, ap_copy);
+                        va_end(ap_copy);
+                        if ((S->used + n) < S->length) {
+                                S->used += n;
+                                break;
+                        }
+                        _ensureCapacity(S, S->used + n + 1);
                 }
-                S->length += STRLEN + n;
-                RESIZE(S->buffer, S->length);
         }
 }
 
 
-/* Replace all occurences of ? in this string buffer with prefix[1..99] */
-static int _prepare(T S, char prefix) {
-        int n, i;
-        for (n = i = 0; S->buffer[i]; i++) if (S->buffer[i] == '?') n++;
-        if (n > 99)
-                THROW(SQLException, "Max 99 parameters are allowed in a prepared statement. Found %d parameters in statement", n);
-        else if (n) {
-                int j, xl;
-                char x[3] = {prefix};
-                int required = (n * 2) + S->used;
-                if (required >= S->length) {
-                        S->length = required;
-                        RESIZE(S->buffer, S->length);
+static inline int _isWord(uchar_t c) {
+        return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+
+/* Returns the length of the quoted literal, quoted identifier or comment starting
+   at s, or 0 if s does not start one. A quote inside a literal is doubled. The
+   PostgreSQL escape string E'..', where a backslash escapes the next character,
+   and the dollar-quoted string $tag$..$tag$ are also recognized unless s is part
+   of a word, as given by word */
+static inline int _skipQuoted(const uchar_t *s, int word) {
+        const uchar_t *p = s;
+        if (! word && (*p == 'E' || *p == 'e') && p[1] == '\'') {
+                for (p += 2; *p && ! (*p == '\'' && p[1] != '\''); p++)
+                        if ((*p == '\\' || *p == '\'') && p[1])
+                                p++;
+                return (int)(p - s) + (*p ? 1 : 0);
+        }
+        if (! word && *p == '$' && ! isdigit(p[1])) {
+                const uchar_t *tag = p++;
+                while (_isWord(*p) && *p != '$')
+                        p++;
+                if (*p++ != '$')
+                        return 0;
+                int n = (int)(p - tag);
+                while (*p && strncmp((const char *)p, (const char *)tag, n))
+                        p++;
+                return (int)(p - s) + (*p ? n : 0);
+        }
+        if (*p == '\'' || *p == '"') {
+                uchar_t quote = *p++;
+                while (*p && ! (*p == quote && p[1] != quote))
+                        p += (*p == quote) ? 2 : 1;
+                return (int)(p - s) + (*p ? 1 : 0);
+        }
+        if (*p == '-' && p[1] == '-') {
+                while (*p && *p != '\n')
+                        p++;
+                return (int)(p - s);
+        }
+        if (*p == '/' && p[1] == '*') {
+                for (p += 2; *p && ! (*p == '*' && p[1] == '/'); p++)
+                        ;
+                return (int)(p - s) + (*p ? 2 : 0);
+        }
+        return 0;
+}
+
+
+static inline int _digits(int n) {
+        int d = 1;
+        for (; n >= 10; n /= 10)
+                d++;
+        return d;
+}
+
+
+/* Replace all occurences of ? in this string buffer, outside of quoted literals,
+   quoted identifiers and comments, with prefix[1..max]. The statement is scanned
+   once to count the parameters and once to copy it to a buffer of the final size */
+static int _prepare(T S, char prefix, int max) {
+        int n = 0, length = S->used;
+        for (int i = 0; i < S->used;) {
+                int k = _skipQuoted(S->buffer + i, i && _isWord(S->buffer[i - 1]));
+                if (k) {
+                        i += k;
+                } else if (S->buffer[i++] == '?') {
+                        // The ? is kept for the prefix
+                        length += _digits(++n);
                 }
-                for (i = 0, j = 1; (j <= n); i++) {
-                        if (S->buffer[i] == '?') {
-                                if(j<10){xl=2;x[1]=j+'0';}else{xl=3;x[1]=(j/10)+'0';x[2]=(j%10)+'0';}
-                                memmove(S->buffer + i + xl, S->buffer + i + 1, (S->used - (i + 1)));
-                                memmove(S->buffer + i, x, xl);
-                                S->used += xl - 1;
-                                j++;
+        }
+        if (n > max)
+                THROW(SQLException, "Max %d parameters are allowed in a prepared statement. Found %d parameters in statement", max, n);
+        if (n) {
+                uchar_t *buffer = ALLOC(length + 1);
+                uchar_t *d = buffer;
+                for (int i = 0, j = 0; i < S->used;) {
+                        int k = _skipQuoted(S->buffer + i, i && _isWord(S->buffer[i - 1]));
+                        if (k) {
+                                memcpy(d, S->buffer + i, k);
+                                d += k;
+                                i += k;
+                        } else if (S->buffer[i] == '?') {
+                                *d++ = prefix;
+                                int x = ++j;
+                                d += _digits(x);
+                                for (uchar_t *e = d; x; x /= 10)
+                                        *--e = '0' + (x % 10);
+                                i++;
+                        } else {
+                                *d++ = S->buffer[i++];
                         }
                 }
-                S->buffer[S->used] = 0;
+                *d = 0;
+                FREE(S->buffer);
+                S->buffer = buffer;
+                S->used = length;
+                S->length = length + 1;
         }
         return n;
 }
@@ -198,6 +308,15 @@ T StringBuffer_clear(T S) {
 }
 
 
+T StringBuffer_delete(T S, int index) {
+        assert(S);
+        assert(index >= 0 && index <= S->used);
+        S->used = index;
+        S->buffer[index] = 0;
+        return S;
+}
+
+
 const char *StringBuffer_toString(T S) {
         assert(S);
         return (const char*)S->buffer;
@@ -206,13 +325,13 @@ const char *StringBuffer_toString(T S) {
 
 int StringBuffer_prepare4postgres(T S) {
         assert(S);
-        return _prepare(S, '$');
+        return _prepare(S, '$', POSTGRESQL_MAX_PARAMETERS);
 }
 
 
 int StringBuffer_prepare4oracle(T S) {
         assert(S);
-        return _prepare(S, ':');
+        return _prepare(S, ':', ORACLE_MAX_PARAMETERS);
 }
 
 
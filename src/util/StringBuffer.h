@@ -129,6 +129,16 @@ int StringBuffer_length(T S);
 T StringBuffer_clear(T S);
 
 
+/**
+ * Remove all characters from index to the end of the string buffer.
+ * I.e. set buffer length to index.
+ * @param S StringBuffer object
+ * @param index The first character to remove, 0 <= index <= length
+ * @return a reference to this StringBuffer
+ */
+T StringBuffer_delete(T S, int index);
+
+
 /**
  * Converts to a string representing the data in this string buffer.
  * @param S StringBuffer object
@@ -139,28 +149,31 @@ const char *StringBuffer_toString(T S);
 
 /**
  * Replace all occurences of <code>?</code> in this string buffer with <code>$n</code>.
- * Example: 
+ * A <code>?</code> in a quoted literal, a quoted identifier or a comment is
+ * not a parameter and is kept. Escape strings, <code>E'..'</code>, and
+ * dollar-quoted strings, <code>$tag$..$tag$</code>, are literals too. Example: 
  * <pre>
  * StringBuffer_T b = StringBuffer_new("insert into host values(?, ?, ?);"); 
  * StringBuffer_prepare4postgres(b) -> "insert into host values($1, $2, $3);"
  * </pre>
  * @param S StringBuffer object
  * @return The number of replacements that took place
- * @exception SQLException If there are more than 99 wild card '?' parameters
+ * @exception SQLException If there are more than 65535 wild card '?' parameters
  */
 int StringBuffer_prepare4postgres(T S);
 
 
 /**
  * Replace all occurences of <code>?</code> in this string buffer with <code>:n</code>.
- * Example: 
+ * A <code>?</code> in a quoted literal, a quoted identifier or a comment is
+ * not a parameter and is kept. Example: 
  * <pre>
  * StringBuffer_T b = StringBuffer_new("insert into host values(?, ?, ?);"); 
  * StringBuffer_prepare4oracle(b) -> "insert into host values(:1, :2, :3);"
  * </pre>
  * @param S StringBuffer object
  * @return The number of replacements that took place
- * @exception SQLException If there are more than 99 wild card '?' parameters
+ * @exception SQLException If there are more than 65535 wild card '?' parameters
  */
 int StringBuffer_prepare4oracle(T S);
 
@@ -50,6 +50,7 @@ extern "C" {
 #include <PreparedStatement.h>
 #include <Connection.h>
 #include <ConnectionPool.h>
+#include <Statistics.h>
 
 #ifdef __cplusplus
 }
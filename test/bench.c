@@ -0,0 +1,270 @@
+#include "Config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "URL.h"
+#include "Thread.h"
+#include "system/Time.h"
+#include "StringBuffer.h"
+#include "ResultSet.h"
+#include "PreparedStatement.h"
+#include "Connection.h"
+#include "ConnectionPool.h"
+#include "SQLException.h"
+
+
+/**
+ * libzdb benchmarks. Each benchmark runs a fixed number of operations
+ * and prints one JSON object per line with the throughput and latency
+ * percentiles in nanoseconds, e.g.
+ * <pre>
+ * {"benchmark":"checkout","backend":"sqlite","threads":4,"ops":400000,"ops_per_sec":2350122,"p50_ns":1201,"p99_ns":4650,"p999_ns":20108}
+ * </pre>
+ * Usage: bench [-n operations] [-t max threads] [URL]
+ * The database benchmarks create and drop a table called zild_bench.
+ */
+
+#define ROWS 10000
+#define BATCH 100
+
+typedef struct {
+        long long *nanos;
+        int count;
+        int size;
+} sample_t;
+
+typedef struct {
+        ConnectionPool_T pool;
+        int operations;
+        sample_t sample;
+} worker_t;
+
+static int operations = 100000;
+static const char *backend;
+
+
+static inline long long now(void) {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void add(sample_t *s, long long nanos) {
+        if (! s->nanos) {
+                s->size = 1024;
+                s->nanos = ALLOC(s->size * sizeof *s->nanos);
+        } else if (s->count == s->size) {
+                s->size *= 2;
+                RESIZE(s->nanos, s->size * sizeof *s->nanos);
+        }
+        s->nanos[s->count++] = nanos;
+}
+
+static int compare(const void *a, const void *b) {
+        long long x = *(const long long *)a, y = *(const long long *)b;
+        return (x > y) - (x < y);
+}
+
+static long long percentile(sample_t *s, double percent) {
+        int i = (int)(s->count * percent / 100.0);
+        return s->count ? s->nanos[i < s->count ? i : s->count - 1] : 0;
+}
+
+/* Each sample is the latency of opsPerSample operations */
+static void report(const char *benchmark, int threads, long long ops, long long elapsed, sample_t *s, int opsPerSample) {
+        qsort(s->nanos, s->count, sizeof *s->nanos, compare);
+        printf("{\"benchmark\":\"%s\",\"backend\":\"%s\",\"threads\":%d,\"ops\":%lld,\"ops_per_sec\":%.0f,"
+               "\"p50_ns\":%lld,\"p99_ns\":%lld,\"p999_ns\":%lld}\n",
+               benchmark, backend, threads, ops, elapsed > 0 ? ops * 1e9 / elapsed : 0.0,
+               percentile(s, 50) / opsPerSample, percentile(s, 99) / opsPerSample, percentile(s, 99.9) / opsPerSample);
+        fflush(stdout);
+        FREE(s->nanos);
+        *s = (sample_t){};
+}
+
+
+/* ------------------------------------------------------------ Benchmarks */
+
+
+static void *checkout(void *arg) {
+        worker_t *w = arg;
+        for (int i = 0; i < w->operations; i++) {
+                long long start = now();
+                Connection_T con = ConnectionPool_getConnection(w->pool);
+                assert(con);
+                Connection_close(con);
+                add(&w->sample, now() - start);
+        }
+        return NULL;
+}
+
+static void benchCheckout(URL_T url, int maxThreads) {
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+                ConnectionPool_T pool = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(pool, threads);
+                ConnectionPool_setMaxConnections(pool, threads);
+                ConnectionPool_start(pool);
+                worker_t workers[threads];
+                Thread_T thread[threads];
+                long long start = now();
+                for (int i = 0; i < threads; i++) {
+                        workers[i] = (worker_t){.pool = pool, .operations = operations / threads};
+                        Thread_create(thread[i], checkout, &workers[i]);
+                }
+                sample_t all = {};
+                for (int i = 0; i < threads; i++) {
+                        Thread_join(thread[i]);
+                        for (int j = 0; j < workers[i].sample.count; j++)
+                                add(&all, workers[i].sample.nanos[j]);
+                        FREE(workers[i].sample.nanos);
+                }
+                report("checkout", threads, all.count, now() - start, &all, 1);
+                ConnectionPool_free(&pool);
+        }
+}
+
+static void benchInsert(Connection_T con) {
+        sample_t s = {};
+        PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_bench values(?, ?);");
+        Connection_beginTransaction(con);
+        long long start = now();
+        for (int i = 0; i < ROWS; i++) {
+                long long t = now();
+                PreparedStatement_setInt(p, 1, i);
+                PreparedStatement_setLLong(p, 2, i * 1000LL);
+                PreparedStatement_execute(p);
+                add(&s, now() - t);
+        }
+        long long elapsed = now() - start;
+        Connection_rollback(con);
+        report("prepared_insert", 1, ROWS, elapsed, &s, 1);
+        // Rollback closes the connection's prepared statements
+        p = Connection_prepareStatement(con, "insert into zild_bench values(?, ?);");
+        Connection_beginTransaction(con);
+        start = now();
+        for (int i = 0; i < ROWS; i += BATCH) {
+                long long t = now();
+                for (int j = i; j < i + BATCH; j++) {
+                        PreparedStatement_setInt(p, 1, j);
+                        PreparedStatement_setLLong(p, 2, j * 1000LL);
+                        PreparedStatement_addBatch(p);
+                }
+                PreparedStatement_executeBatch(p);
+                add(&s, now() - t);
+        }
+        elapsed = now() - start;
+        Connection_commit(con);
+        report("prepared_insert_batch", 1, ROWS, elapsed, &s, BATCH);
+}
+
+static void benchNext(Connection_T con) {
+        sample_t s = {};
+        long long rows = 0, sum = 0;
+        long long start = now();
+        while (rows < operations) {
+                ResultSet_T r = Connection_executeQuery(con, "select id, value from zild_bench;");
+                for (long long t = now(); ResultSet_next(r); t = now()) {
+                        sum += ResultSet_getLLong(r, 2);
+                        add(&s, now() - t);
+                        rows++;
+                }
+        }
+        assert(sum > 0);
+        report("resultset_next_getllong", 1, rows, now() - start, &s, 1);
+}
+
+static void benchStringBuffer(void) {
+        sample_t s = {};
+        StringBuffer_T sb = StringBuffer_create(256);
+        long long start = now();
+        for (int i = 0; i < operations; i++) {
+                long long t = now();
+                StringBuffer_set(sb, "select name, value from zild_bench where id = %d and value > %lld;", i, i * 1000LL);
+                add(&s, now() - t);
+        }
+        report("stringbuffer_vset", 1, operations, now() - start, &s, 1);
+        StringBuffer_free(&sb);
+}
+
+static void benchDateTime(void) {
+        sample_t s = {};
+        struct tm tm;
+        long long start = now();
+        for (int i = 0; i < operations; i++) {
+                long long t = now();
+                Time_toDateTime("2013-12-14 19:12:58.123-05:00", &tm);
+                add(&s, now() - t);
+        }
+        assert(tm.tm_year == 2013);
+        report("time_todatetime", 1, operations, now() - start, &s, 1);
+}
+
+static void benchTimestamp(void) {
+        sample_t s = {};
+        time_t sum = 0;
+        long long start = now();
+        for (int i = 0; i < operations; i++) {
+                long long t = now();
+                sum += Time_toTimestamp("2013-12-14 19:12:58");
+                add(&s, now() - t);
+        }
+        assert(sum > 0);
+        report("time_totimestamp", 1, operations, now() - start, &s, 1);
+}
+
+
+int main(int argc, char **argv) {
+        int maxThreads = 8;
+        int opt;
+        while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+                switch (opt) {
+                        case 'n': operations = atoi(optarg); break;
+                        case 't': maxThreads = atoi(optarg); break;
+                        default:
+                                fprintf(stderr, "Usage: %s [-n operations] [-t max threads] [URL]\n", argv[0]);
+                                return 1;
+                }
+        }
+        if (operations < 1 || maxThreads < 1) {
+                fprintf(stderr, "Operations and threads must be positive\n");
+                return 1;
+        }
+        Exception_init();
+        URL_T url = URL_new(optind < argc ? argv[optind] : "sqlite:///tmp/zdb_bench.db?synchronous=off");
+        if (! url) {
+                fprintf(stderr, "Invalid database URL\n");
+                return 1;
+        }
+        backend = URL_getProtocol(url);
+        benchStringBuffer();
+        benchDateTime();
+        benchTimestamp();
+        TRY
+        {
+                benchCheckout(url, maxThreads);
+                ConnectionPool_T pool = ConnectionPool_new(url);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_bench;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_bench(id integer, value bigint);");
+                benchInsert(con);
+                benchNext(con);
+                Connection_execute(con, "drop table zild_bench;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+        }
+        CATCH(SQLException)
+        {
+                fprintf(stderr, "SQLException -- %s\n", Exception_frame.message);
+                URL_free(&url);
+                return 1;
+        }
+        END_TRY;
+        URL_free(&url);
+        return 0;
+}
@@ -300,6 +300,7 @@ int main(void) {
                                 RETHROW;
                         END_TRY;
                 CATCH(A)
+                        assert(Str_isEqual(Exception_frame.message, "A"));
                         printf("\tResult: ok got Exception\n");
                 END_TRY;
         }
@@ -4,10 +4,15 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "URL.h"
 #include "Thread.h"
+#include "system/Time.h"
 #include "Vector.h"
 #include "ResultSet.h"
 #include "PreparedStatement.h"
@@ -15,10 +20,16 @@
 #include "ConnectionPool.h"
 #include "AssertException.h"
 #include "SQLException.h"
+#include "Statistics.h"
+#ifdef HAVE_ARROW
+#include "ResultSetArrow.h"
+#endif
 
 
 /**
  * libzdb connection pool unity tests. 
+ * Run with -s [threads,...] [URL ...] to benchmark pool checkout under
+ * contention instead, by default against an in-memory SQLite database.
  */
 #define BSIZE 2048
 
@@ -39,6 +50,142 @@ static void TabortHandler(const char *error) {
         exit(1);
 }
 
+static void *closeConnection(void *con) {
+        Time_usleep(200 * USEC_PER_MSEC);
+        Connection_close(con);
+        return NULL;
+}
+
+static void *checkoutConnection(void *pool) {
+        int size = ConnectionPool_size(pool);
+        for (int i = 0; i < size; i++)
+                assert(ConnectionPool_getConnection(pool));
+        // All connections, including the parked one, are in use
+        assert(ConnectionPool_size(pool) == size);
+        assert(ConnectionPool_active(pool) == size);
+        return NULL;
+}
+
+static void asyncDone(Connection_T con, ResultSet_T r, void *ctx) {
+        *(int*)ctx = (r && ResultSet_next(r)) ? ResultSet_getInt(r, 1) : -1;
+}
+
+typedef struct {
+        int begins;
+        int ends;
+        char operations[256];
+        char sql[64];
+        long long rows;
+        int errors;
+} trace_t;
+
+static void *traceBegin(void *context, const char *operation, const char *sql) {
+        trace_t *t = context;
+        t->begins++;
+        if (sql)
+                snprintf(t->sql, sizeof(t->sql), "%s", sql);
+        return t;
+}
+
+static void traceEnd(void *context, void *span, const char *operation, long long rows, long long micros, const char *error) {
+        trace_t *t = context;
+        assert(span == t && micros >= 0);
+        t->ends++;
+        t->rows = rows;
+        t->errors += error != NULL;
+        snprintf(t->operations + strlen(t->operations), sizeof(t->operations) - strlen(t->operations), "%s ", operation);
+}
+
+static void slowQuery(const ConnectionPool_SlowQuery_T *query, void *context) {
+        int *reported = context;
+        (*reported)++;
+        assert(query->micros >= 1000 && query->rows == 200000 && query->backend);
+        assert(Str_isEqual(query->sql, "insert into zild_slow with recursive c(x) as (select ? union all select x + ? from c where x < ?) select x from c;"));
+}
+
+static void countRows(ResultSet_T r, void *ctx) {
+        assert(ResultSet_next(r));
+        *(int*)ctx = ResultSet_getInt(r, 1);
+}
+
+static void *statementWorker(void *pool) {
+        for (int i = 0; i < 20; i++) {
+                int one = 0;
+                ConnectionPool_executeQuery(pool, countRows, &one, "select %d;", 1);
+                assert(one == 1);
+                assert(1 == ConnectionPool_execute(pool, "insert into zild_mux values(%d);", i));
+        }
+        return NULL;
+}
+
+static void insertAndFail(Connection_T con, void *ctx) {
+        Connection_execute(con, "insert into zild_mux values(-1);");
+        if (ctx)
+                THROW(SQLException, "rollback");
+}
+
+static void readNames(ResultSet_T r, void *ctx) {
+        char *names = ctx;
+        *names = 0;
+        while (ResultSet_next(r)) {
+                const char *name = ResultSet_getStringByName(r, "name");
+                strcat(names, name ? name : "null");
+                strcat(names, ResultSet_getInt(r, 1) % 2 ? "," : ";");
+        }
+}
+
+static void *readMaterialized(void *r) {
+        long long sum = 0;
+        int nulls = 0;
+        while (ResultSet_next(r)) {
+                sum += ResultSet_getLLong(r, 1);
+                if (ResultSet_isnull(r, 2))
+                        nulls++;
+                else
+                        assert(Str_isEqual(ResultSet_getStringByName(r, "name"), "name"));
+        }
+        assert(sum == 5050 && nulls == 50);
+        return NULL;
+}
+
+typedef struct {
+        const char *data;
+        int size;
+        int offset;
+} blobStream;
+
+static int readBlobStream(void *buffer, int size, void *context) {
+        blobStream *s = context;
+        int n = s->size - s->offset < size ? s->size - s->offset : size;
+        memcpy(buffer, s->data + s->offset, n);
+        s->offset += n;
+        return n;
+}
+
+static int failBlobStream(void *buffer, int size, void *context) {
+        return -1;
+}
+
+typedef struct {
+        Connection_T locker;    // Holds a write lock during the first attempt
+        int release;            // Attempt on which the lock is released, 0 to keep it
+        int attempts;
+} contention;
+
+static void insertContended(Connection_T con, void *ctx) {
+        contention *c = ctx;
+        c->attempts++;
+        if (c->locker) {
+                if (c->attempts == 1) {
+                        Connection_beginTransaction(c->locker);
+                        Connection_execute(c->locker, "insert into zild_retry values(%d);", 100 + c->release);
+                } else if (c->attempts == c->release) {
+                        Connection_commit(c->locker);
+                }
+        }
+        Connection_execute(con, "insert into zild_retry values(%d);", c->attempts);
+}
+
 static void testPool(const char *testURL) {
         URL_T url;
         char *schema;
@@ -257,6 +404,161 @@ static void testPool(const char *testURL) {
                 }
                 printf("success\n");
 
+                printf("\tResult: check getBytes..");
+                rset = Connection_executeQuery(con, "select name, id, image from zild_t where id in(1,2) order by id;");
+                while (ResultSet_next(rset)) {
+                        int size = -1;
+                        const char *name = ResultSet_getString(rset, 1);
+                        const void *bytes = ResultSet_getBytes(rset, 1, &size);
+                        assert(bytes && size == strlen(name) && memcmp(bytes, name, size) == 0);
+                        bytes = ResultSet_getBytesByName(rset, "id", &size);
+                        assert(bytes && size == strlen(ResultSet_getString(rset, 2)));
+                        bytes = ResultSet_getBytes(rset, 3, &size);
+                        if (ResultSet_getInt(rset, 2) == 1)
+                                assert(bytes == NULL && size == 0);
+                }
+                printf("success\n");
+
+                printf("\tResult: check column names..");
+                if (! Str_startsWith(testURL, "oracle")) { // Oracle folds names to upper case and need a from clause
+                        char sql[1024] = "select 0 as c0";
+                        for (int c = 1; c < 40; c++)
+                                snprintf(sql + strlen(sql), sizeof(sql) - strlen(sql), ", %d as c%d", c, c);
+                        strcat(sql, ", 99 as c1;");
+                        rset = Connection_executeQuery(con, "%s", sql);
+                        assert(ResultSet_next(rset));
+                        for (int c = 0; c < 40; c++) {
+                                char name[8];
+                                snprintf(name, sizeof(name), "c%d", c);
+                                assert(c == ResultSet_getIntByName(rset, name));
+                        }
+                        // With duplicate names the first column is used
+                        assert(1 == ResultSet_getIntByName(rset, "c1"));
+                        TRY
+                                ResultSet_getIntByName(rset, "C1");
+                                assert(false);
+                        CATCH(SQLException)
+                        END_TRY;
+                }
+                printf("success\n");
+
+                printf("\tResult: check batch fetch..");
+                {
+                        long long ids[8], images[8];
+                        double percents[8];
+                        int offsets[9];
+                        char names[48];
+                        unsigned char nulls[1];
+                        ResultSet_Column_T columns[4] = {
+                                {.type = ResultSet_LLong, .llongs = ids},
+                                {.type = ResultSet_String, .offsets = offsets, .data = names, .dataSize = sizeof(names)},
+                                {.type = ResultSet_Double, .doubles = percents},
+                                {.type = ResultSet_LLong, .llongs = images, .nulls = nulls}
+                        };
+                        int total = 0, batches = 0;
+                        long long last = 0;
+                        rset = Connection_executeQuery(con, "select id, name, percent, case when image is null then null else 1 end from zild_t order by id;");
+                        for (int rows; (rows = ResultSet_fetchBatch(rset, 8, columns)) > 0; batches++) {
+                                for (int i = 0; i < rows; i++) {
+                                        assert(ids[i] > last);
+                                        last = ids[i];
+                                        assert(offsets[i + 1] >= offsets[i]);
+                                        int isnull = nulls[i / 8] & (1 << (i % 8));
+                                        if (ids[i] == 1 || ids[i] == 5)
+                                                assert(isnull && images[i] == 0);
+                                        else if (ids[i] == 2)
+                                                assert(! isnull && images[i] == 1);
+                                }
+                                assert(offsets[rows] <= (int)sizeof(names));
+                                total += rows;
+                        }
+                        rset = Connection_executeQuery(con, "select count(*) from zild_t;");
+                        assert(ResultSet_next(rset));
+                        assert(total == ResultSet_getInt(rset, 1));
+                        assert(batches > total / 8); // Some batches were cut short by the names buffer
+                }
+                printf("success\n");
+
+#ifdef HAVE_ARROW
+                printf("\tResult: check Arrow export..");
+                {
+                        ResultSet_Type types[4] = {ResultSet_LLong, ResultSet_String, ResultSet_Skip, ResultSet_LLong};
+                        struct ArrowArrayStream stream;
+                        struct ArrowSchema schema;
+                        struct ArrowArray batch;
+                        int total = 0;
+                        rset = Connection_executeQuery(con, "select id, name, percent, case when image is null then null else 1 end as image from zild_t order by id;");
+                        ResultSet_exportArrowStream(rset, 8, types, &stream);
+                        assert(0 == stream.get_schema(&stream, &schema));
+                        assert(Str_isEqual(schema.format, "+s") && schema.n_children == 3);
+                        assert(Str_isEqual(schema.children[0]->format, "l") && Str_isEqual(schema.children[1]->format, "u"));
+                        assert(Str_isEqual(schema.children[2]->name, "image"));
+                        schema.release(&schema);
+                        while (stream.get_next(&stream, &batch) == 0 && batch.release) {
+                                assert(batch.n_children == 3 && batch.length > 0 && batch.length <= 8);
+                                const long long *ids = batch.children[0]->buffers[1];
+                                const int *offsets = batch.children[1]->buffers[1];
+                                const unsigned char *valid = batch.children[2]->buffers[0];
+                                for (int i = 0; i < batch.length; i++) {
+                                        assert(offsets[i + 1] >= offsets[i]);
+                                        if (ids[i] == 1)
+                                                assert(valid && ! (valid[i / 8] & (1 << (i % 8))));
+                                        else if (ids[i] == 2)
+                                                assert(valid[i / 8] & (1 << (i % 8)));
+                                }
+                                total += batch.length;
+                                batch.release(&batch);
+                        }
+                        assert(stream.get_last_error(&stream) == NULL);
+                        stream.release(&stream);
+                        rset = Connection_executeQuery(con, "select count(*) from zild_t;");
+                        assert(ResultSet_next(rset));
+                        assert(total == ResultSet_getInt(rset, 1));
+                        // String buffers grow for values larger than the initial size
+                        char sql[512], value[301] = {};
+                        memset(value, 'x', 300);
+                        snprintf(sql, sizeof(sql), "select name, '%s' from zild_t order by id;", value);
+                        rset = Connection_executeQuery(con, "%s", sql);
+                        ResultSet_exportArrowStream(rset, 2, NULL, &stream);
+                        assert(0 == stream.get_next(&stream, &batch) && batch.release);
+                        const int *offsets = batch.children[1]->buffers[1];
+                        assert(offsets[1] == 300 && strncmp(batch.children[1]->buffers[2], value, 300) == 0);
+                        batch.release(&batch);
+                        stream.release(&stream);
+                }
+                printf("success\n");
+#endif
+
+                printf("\tResult: check status returning accessors..");
+                rset = Connection_executeQuery(con, "select id, name, percent, image from zild_t where id = 1;");
+                assert(ResultSet_next(rset));
+                {
+                        int id = 0;
+                        long long lid = 0;
+                        double percent = -1;
+                        const char *name = NULL;
+                        assert(ResultSet_tryGetInt(rset, 1, &id) && id == 1);
+                        assert(ResultSet_tryGetLLong(rset, 1, &lid) && lid == 1);
+                        assert(ResultSet_tryGetString(rset, 2, &name) && name);
+                        assert(ResultSet_tryGetDouble(rset, 3, &percent));
+                        assert(! ResultSet_tryGetString(rset, 4, &name)); // NULL
+                        assert(! ResultSet_tryGetInt(rset, 0, &id));
+                        assert(! ResultSet_tryGetInt(rset, 5, &id));
+                }
+                assert(Connection_tryExecute(con, "update zild_t set percent = 2.0 where id = %d;", 1));
+                assert(! Connection_tryExecute(con, "update not_a_table set x = 1;"));
+                assert(Connection_getLastError(con));
+                printf("success\n");
+
+                printf("\tResult: check raw execute..");
+                Connection_executeRaw(con, "update zild_t set percent = 1.0 where name like 'Z%';", -1);
+                long long changed = Connection_rowsChanged(con);
+                assert(changed >= 2);
+                rset = Connection_executeQueryRaw(con, "select count(*) from zild_t where name like 'Z%'; ignored", 49);
+                assert(ResultSet_next(rset));
+                assert(ResultSet_getLLong(rset, 1) == changed);
+                printf("success\n");
+
                 printf("\tResult: check max rows..");
                 Connection_setMaxRows(con, 3);
                 rset = Connection_executeQuery(con, "select id from zild_t;");
@@ -326,6 +628,9 @@ static void testPool(const char *testURL) {
                         Vector_push(v, ConnectionPool_getConnection(pool));
                 assert(ConnectionPool_size(pool) == 20);
                 assert(ConnectionPool_active(pool) == 20);
+                ConnectionPool_Snapshot_T snapshot = ConnectionPool_snapshot(pool);
+                assert(snapshot.size == 20 && snapshot.active == 20 && snapshot.idle == 0);
+                assert(snapshot.created == 20 && snapshot.destroyed == 0 && snapshot.waiting == 0);
                 printf("success\n");
                 printf("Closing Connections down to initial..");
                 while (! Vector_isEmpty(v))
@@ -339,6 +644,8 @@ static void testPool(const char *testURL) {
                 sleep(10);
                 assert(5 == ConnectionPool_size(pool)); // 4 initial connections + the one active we got above
                 assert(1 == ConnectionPool_active(pool));
+                snapshot = ConnectionPool_snapshot(pool);
+                assert(snapshot.idle == 4 && snapshot.destroyed == 15);
                 printf("success\n");
                 Connection_close(con);
                 ConnectionPool_stop(pool);
@@ -677,21 +984,1373 @@ static void testPool(const char *testURL) {
         }
         printf("=> Test10: OK\n\n");
 
+        printf("=> Test11: Validation interval\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                assert(ConnectionPool_getValidationInterval(pool) == 0);
+                ConnectionPool_setValidationInterval(pool, 60000);
+                assert(ConnectionPool_getValidationInterval(pool) == 60000);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                Connection_close(con);
+                // The connection just returned is handed out again without a ping
+                assert(con == ConnectionPool_getConnection(pool));
+                assert(1 == ConnectionPool_active(pool));
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test11: OK\n\n");
+
+        printf("=> Test12: Wait for connection with timeout\n");
+        {
+                Thread_T thread;
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMaxConnections(pool, 1);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                long long start = Time_milli();
+                assert(! ConnectionPool_getConnectionWithTimeout(pool, 100));
+                assert(Time_milli() - start >= 100);
+                printf("\tResult: timed out as expected\n");
+                // The connection closed by the thread is handed over to us
+                Thread_create(thread, closeConnection, con);
+                assert(con == ConnectionPool_getConnectionWithTimeout(pool, 5000));
+                Thread_join(thread);
+                printf("\tResult: got connection closed by another thread\n");
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test12: OK\n\n");
 
-        printf("============> Connection Pool Tests: OK\n\n");
-}
+        printf("=> Test13: Parallel and asynchronous start\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 8);
+                ConnectionPool_setFillThreads(pool, 4);
+                assert(4 == ConnectionPool_getFillThreads(pool));
+                ConnectionPool_start(pool);
+                assert(8 == ConnectionPool_size(pool));
+                ConnectionPool_stop(pool);
+                assert(0 == ConnectionPool_size(pool));
+                ConnectionPool_startAsync(pool);
+                assert(ConnectionPool_size(pool) >= 1);
+                for (int i = 0; i < 100 && ConnectionPool_size(pool) < 8; i++)
+                        Time_usleep(50 * USEC_PER_MSEC);
+                assert(8 == ConnectionPool_size(pool));
+                assert(0 == ConnectionPool_active(pool));
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test13: OK\n\n");
 
-int main(void) {
-        URL_T url;
-        char buf[BSIZE];
-        char *help = "Please enter a valid database connection URL and press ENTER\n"
-                    "E.g. sqlite:///tmp/sqlite.db?synchronous=off&heap_limit=2000\n"
-                    "E.g. mysql://localhost:3306/test?user=root&password=root\n"
-                    "E.g. postgresql://localhost:5432/test?user=root&password=root\n"
-                    "E.g. oracle://localhost:1526/test?user=scott&password=tiger\n"
-                    "To exit, enter '.' on a single line\n\nConnection URL> ";
-        ZBDEBUG = true;
-        Exception_init();
+        printf("=> Test14: Statement cache\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setStatementCacheSize(pool, 2);
+                assert(2 == ConnectionPool_getStatementCacheSize(pool));
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                PreparedStatement_T p1 = Connection_prepareStatement(con, "select %d + ?", 1);
+                PreparedStatement_setInt(p1, 1, 1);
+                ResultSet_T r = PreparedStatement_executeQuery(p1);
+                assert(ResultSet_next(r));
+                assert(2 == ResultSet_getInt(r, 1));
+                Connection_close(con);
+                // The statement survives the connection being returned
+                assert(con == ConnectionPool_getConnection(pool));
+                assert(p1 == Connection_prepareStatement(con, "  select 1 +   ?"));
+                PreparedStatement_setInt(p1, 1, 2);
+                r = PreparedStatement_executeQuery(p1);
+                assert(ResultSet_next(r));
+                assert(3 == ResultSet_getInt(r, 1));
+                // Statements in use are not evicted, the cache shrinks on return
+                PreparedStatement_T p2 = Connection_prepareStatement(con, "select 2 + ?");
+                PreparedStatement_T p3 = Connection_prepareStatement(con, "select 3 + ?");
+                assert(p1 != p2 && p2 != p3);
+                Connection_close(con);
+                con = ConnectionPool_getConnection(pool);
+                assert(p3 == Connection_prepareStatement(con, "select 3 + ?"));
+                // The SQL is prepared as given, a comment ends at its newline and literals are kept
+                PreparedStatement_T p4 = Connection_prepareStatement(con, "select ? -- comment\n, 'a  b'");
+                PreparedStatement_setInt(p4, 1, 4);
+                r = PreparedStatement_executeQuery(p4);
+                assert(ResultSet_next(r));
+                assert(2 == ResultSet_getColumnCount(r));
+                assert(Str_isEqual(ResultSet_getString(r, 2), "a  b"));
+                assert(p4 != Connection_prepareStatement(con, "select ? -- comment , 'a  b'"));
+                assert(p4 != Connection_prepareStatement(con, "select ? -- comment\n, 'a b'"));
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test14: OK\n\n");
+
+        printf("=> Test15: Batch execution\n");
+        {
+                char name[32];
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_t;"); ELSE END_TRY;
+                Connection_execute(con, "%s", schema);
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_t (name, percent) values(?, ?);");
+                assert(0 == PreparedStatement_executeBatch(p));
+                for (int i = 0; i < 1000; i++) {
+                        // Values are copied, name is overwritten before the batch is executed
+                        snprintf(name, sizeof(name), "batch %d", i);
+                        PreparedStatement_setString(p, 1, name);
+                        PreparedStatement_setDouble(p, 2, i + 0.5);
+                        PreparedStatement_addBatch(p);
+                }
+                assert(1000 == PreparedStatement_executeBatch(p));
+                ResultSet_T r = Connection_executeQuery(con, "select count(*), sum(percent) from zild_t where name = 'batch 999';");
+                assert(ResultSet_next(r));
+                assert(1 == ResultSet_getInt(r, 1));
+                assert(999.5 == ResultSet_getDouble(r, 2));
+                // The batch is empty after it was executed, also on error
+                assert(0 == PreparedStatement_executeBatch(p));
+                PreparedStatement_T q = Connection_prepareStatement(con, "insert into zild_t (id, name) values(?, ?);");
+                PreparedStatement_setInt(q, 1, 5000);
+                PreparedStatement_setString(q, 2, "duplicate");
+                PreparedStatement_addBatch(q);
+                PreparedStatement_addBatch(q);
+                TRY
+                        PreparedStatement_executeBatch(q);
+                        assert(false);
+                CATCH(SQLException)
+                        printf("\tResult: batch failed as expected -- %s\n", Exception_frame.message);
+                END_TRY;
+                assert(0 == PreparedStatement_executeBatch(q));
+                // SQLite and PostgreSQL apply a batch all or nothing
+                if (IS(URL_getProtocol(url), "sqlite") || IS(URL_getProtocol(url), "postgresql")) {
+                        r = Connection_executeQuery(con, "select count(*) from zild_t where name = 'duplicate';");
+                        assert(ResultSet_next(r));
+                        assert(0 == ResultSet_getInt(r, 1));
+                }
+                Connection_execute(con, "drop table zild_t;");
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test15: OK\n\n");
+
+        printf("=> Test16: Pipeline mode\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_t;"); ELSE END_TRY;
+                Connection_execute(con, "%s", schema);
+                TRY
+                        Connection_beginPipeline(con);
+                        assert(Connection_isInPipeline(con));
+                        Connection_beginTransaction(con);
+                        for (int i = 0; i < 100; i++)
+                                Connection_execute(con, "insert into zild_t (name) values('pipeline %d');", i);
+                        Connection_commit(con);
+                        TRY
+                                Connection_executeQuery(con, "select count(*) from zild_t;");
+                                assert(false);
+                        CATCH(SQLException)
+                        END_TRY;
+                        Connection_endPipeline(con);
+                        assert(! Connection_isInPipeline(con));
+                        ResultSet_T r = Connection_executeQuery(con, "select count(*) from zild_t where name like 'pipeline%%';");
+                        assert(ResultSet_next(r));
+                        assert(100 == ResultSet_getInt(r, 1));
+                        // The first error is reported when the pipeline ends
+                        Connection_beginPipeline(con);
+                        Connection_execute(con, "insert into nonexistingtable values(1);");
+                        Connection_execute(con, "insert into zild_t (name) values('skipped');");
+                        TRY
+                                Connection_endPipeline(con);
+                                assert(false);
+                        CATCH(SQLException)
+                                printf("\tResult: pipeline failed as expected -- %s\n", Exception_frame.message);
+                        END_TRY;
+                        assert(! Connection_isInPipeline(con));
+                        r = Connection_executeQuery(con, "select count(*) from zild_t where name = 'skipped';");
+                        assert(ResultSet_next(r));
+                        assert(0 == ResultSet_getInt(r, 1));
+                CATCH(SQLException)
+                        // Pipeline mode is only supported by PostgreSQL
+                        assert(! IS(URL_getProtocol(url), "postgresql"));
+                        assert(! Connection_isInPipeline(con));
+                        printf("\tResult: pipeline mode not supported -- %s\n", Exception_frame.message);
+                END_TRY;
+                Connection_execute(con, "drop table zild_t;");
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test16: OK\n\n");
+
+        printf("=> Test17: Bulk copy\n");
+        {
+                char row[64];
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_t;"); ELSE END_TRY;
+                Connection_execute(con, "%s", schema);
+                TRY
+                        Connection_copyIn(con, "copy zild_t (name, percent) from stdin;");
+                        for (int i = 0; i < 10000; i++) {
+                                int n = snprintf(row, sizeof(row), "copy %d\t%d.5\n", i, i);
+                                // Write rows in two parts, data need not be written in whole rows
+                                Connection_copyWrite(con, row, 3);
+                                Connection_copyWrite(con, row + 3, n - 3);
+                        }
+                        assert(10000 == Connection_copyEnd(con));
+                        ResultSet_T r = Connection_executeQuery(con, "select percent from zild_t where name = 'copy 9999';");
+                        assert(ResultSet_next(r));
+                        assert(9999.5 == ResultSet_getDouble(r, 1));
+                        int size, rows = 0;
+                        const char *data;
+                        Connection_copyOut(con, "copy (select name from zild_t where name like 'copy 1%%' order by id) to stdout;");
+                        while ((data = Connection_copyRead(con, &size))) {
+                                if (! rows++)
+                                        assert(size == 7 && strncmp(data, "copy 1\n", size) == 0);
+                        }
+                        assert(1111 == rows);
+                        assert(1111 == Connection_copyEnd(con));
+                        // A failed copy leaves the connection usable
+                        Connection_copyIn(con, "copy zild_t (id, name) from stdin;");
+                        Connection_copyWrite(con, "not a number\tx\n", 15);
+                        TRY
+                                Connection_copyEnd(con);
+                                assert(false);
+                        CATCH(SQLException)
+                                printf("\tResult: copy failed as expected -- %s\n", Exception_frame.message);
+                        END_TRY;
+                        TRY
+                                Connection_copyOut(con, "copy zild_t from stdin;");
+                                assert(false);
+                        CATCH(SQLException)
+                        END_TRY;
+                        r = Connection_executeQuery(con, "select count(*) from zild_t;");
+                        assert(ResultSet_next(r));
+                        assert(10000 == ResultSet_getInt(r, 1));
+                CATCH(SQLException)
+                        // COPY is only supported by PostgreSQL
+                        assert(! IS(URL_getProtocol(url), "postgresql"));
+                        printf("\tResult: copy not supported -- %s\n", Exception_frame.message);
+                END_TRY;
+                Connection_execute(con, "drop table zild_t;");
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test17: OK\n\n");
+
+        printf("=> Test18: Read replicas\n");
+        {
+                url = URL_new(testURL);
+                URL_T replica = URL_new(testURL);
+                URL_T unreachable = URL_new("sqlite:///zild/does/not/exist.db");
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_addReplica(pool, replica, 1);
+                ConnectionPool_addReplica(pool, unreachable, 4);
+                assert(2 == ConnectionPool_getReplicaCount(pool));
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(1 == ConnectionPool_active(pool));
+                // Reads go to the replica while the unreachable replica is skipped
+                Connection_T r1 = ConnectionPool_getReadConnection(pool);
+                Connection_T r2 = ConnectionPool_getReadConnection(pool);
+                assert(r1 && r2 && r1 != r2);
+                assert(1 == ConnectionPool_active(pool));
+                assert(Connection_ping(r1));
+                Connection_close(r1);
+                Connection_close(r2);
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&unreachable);
+                URL_free(&replica);
+                URL_free(&url);
+        }
+        printf("=> Test18: OK\n\n");
+
+        printf("=> Test19: Thread affinity\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setThreadAffinity(pool, true);
+                assert(ConnectionPool_getThreadAffinity(pool));
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                Connection_T other = ConnectionPool_getConnection(pool);
+                Connection_close(con);
+                Connection_close(other);
+                // The first connection returned was parked and is handed back to this thread
+                assert(con == ConnectionPool_getConnection(pool));
+                assert(1 == ConnectionPool_active(pool));
+                Connection_close(con);
+                assert(0 == ConnectionPool_active(pool));
+                // A parked connection is taken by other threads too
+                pthread_t thread;
+                Thread_create(thread, checkoutConnection, pool);
+                Thread_join(thread);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test19: OK\n\n");
+
+        printf("=> Test20: Asynchronous query\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                int value = 0;
+                TRY
+                        Connection_executeQueryAsync(con, "select 42;", asyncDone, &value);
+                        assert(Connection_isAsyncPending(con));
+                        TRY
+                                Connection_executeQuery(con, "select 1;");
+                                assert(false);
+                        CATCH(SQLException)
+                        END_TRY;
+                        struct pollfd fd = {.fd = Connection_getSocket(con), .events = POLLIN};
+                        assert(fd.fd >= 0);
+                        while (! Connection_processAsync(con))
+                                poll(&fd, 1, 1000);
+                        assert(value == 42);
+                        assert(! Connection_isAsyncPending(con));
+                        // A failed query calls the callback with NULL
+                        Connection_executeQueryAsync(con, "select * from not_a_table;", asyncDone, &value);
+                        while (! Connection_processAsync(con))
+                                poll(&fd, 1, 1000);
+                        assert(value == -1);
+                        // An unfinished query is discarded when the connection is returned
+                        Connection_executeQueryAsync(con, "select 42;", asyncDone, &value);
+                CATCH(SQLException)
+                        // Asynchronous queries are only supported by PostgreSQL
+                        assert(! IS(URL_getProtocol(url), "postgresql"));
+                        assert(Connection_getSocket(con) == -1);
+                        assert(Connection_processAsync(con));
+                        printf("\tResult: asynchronous query not supported -- %s\n", Exception_frame.message);
+                END_TRY;
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test20: OK\n\n");
+
+        printf("=> Test21: Statistics\n");
+        {
+                Statistics_Histogram_T h;
+                url = URL_new(testURL);
+                const char *backend = URL_getProtocol(url);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Statistics_reset();
+                Statistics_setEnabled(true);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                ResultSet_T r = Connection_executeQuery(con, "select 1;");
+                while (ResultSet_next(r))
+                        ;
+                PreparedStatement_T p = Connection_prepareStatement(con, "select 2;");
+                PreparedStatement_executeQuery(p);
+                Connection_close(con);
+                Statistics_setEnabled(false);
+#ifndef ZDB_NO_STATISTICS
+                assert(Statistics_get(backend, Statistics_Checkout, &h) && h.count == 1);
+                assert(Statistics_get(backend, Statistics_ExecuteQuery, &h) && h.count == 1);
+                assert(h.max >= 0 && h.total >= h.max);
+                assert(Statistics_percentile(&h, 50) == h.max);
+                assert(Statistics_get(backend, Statistics_PreparedExecute, &h) && h.count == 1);
+                assert(Statistics_get(backend, Statistics_Next, &h) && h.count == 2);
+                assert(Statistics_percentile(&h, 100) == h.max);
+                assert(Statistics_percentile(&h, 50) <= h.max);
+#endif
+                // Disabled statistics are not recorded
+                con = ConnectionPool_getConnection(pool);
+                Connection_close(con);
+                Statistics_get(backend, Statistics_Checkout, &h);
+                assert(h.count <= 1);
+                assert(! Statistics_get("unknown", Statistics_Checkout, &h) && h.count == 0);
+                Statistics_reset();
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test21: OK\n\n");
+
+        printf("=> Test22: Tracing\n");
+        {
+                trace_t t = {};
+                ConnectionPool_Tracer_T tracer = {.begin = traceBegin, .end = traceEnd, .context = &t};
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setTracer(pool, &tracer);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                t = (trace_t){};
+                Connection_execute(con, "create table zild_trace(id integer);");
+                assert(Str_isEqual(t.sql, "create table zild_trace(id integer);"));
+                Connection_execute(con, "insert into zild_trace values(%d);", 7);
+                assert(Str_isEqual(t.sql, "insert into zild_trace values(7);") && t.rows == 1);
+                ResultSet_T r = Connection_executeQuery(con, "select id from zild_trace;");
+                assert(ResultSet_next(r) && ! ResultSet_next(r));
+                assert(t.rows == 0);
+                PreparedStatement_T p = Connection_prepareStatement(con, "update zild_trace set id = ?;");
+                PreparedStatement_setInt(p, 1, 8);
+                PreparedStatement_execute(p);
+                assert(Str_isEqual(t.sql, "update zild_trace set id = ?;") && t.rows == 1);
+                TRY
+                        Connection_execute(con, "select * from not_a_table;");
+                        assert(false);
+                CATCH(SQLException)
+                END_TRY;
+                assert(t.errors == 1);
+                Connection_execute(con, "drop table zild_trace;");
+                assert(t.begins == t.ends);
+                assert(Str_isEqual(t.operations, "execute execute executeQuery next next prepareStatement execute execute execute "));
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test22: OK\n\n");
+
+        printf("=> Test23: Slow query log\n");
+        if (! Str_startsWith(testURL, "oracle")) {
+                int reported = 0;
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setSlowQueryThreshold(pool, 1);
+                assert(1 == ConnectionPool_getSlowQueryThreshold(pool));
+                ConnectionPool_setSlowQueryHandler(pool, slowQuery, &reported);
+                ConnectionPool_setSlowQuerySampling(pool, 2, true);
+                ConnectionPool_start(pool);
+                // DDL, which may be slow too, goes through a pool without the slow query log
+                ConnectionPool_T ddl = ConnectionPool_new(url);
+                ConnectionPool_start(ddl);
+                Connection_T admin = ConnectionPool_getConnection(ddl);
+                Connection_execute(admin, "create table zild_slow(x integer);");
+                Connection_T con = ConnectionPool_getConnection(pool);
+                // Every other slow query is reported, starting with the first
+                for (int i = 0; i < 3; i++)
+                        Connection_execute(con, "insert into zild_slow with recursive c(x) as (select 1 union all select x + 1 from c where x < %d) select x from c;", 200000);
+                assert(reported == 2);
+                Connection_close(con);
+                Connection_execute(admin, "drop table zild_slow;");
+                Connection_close(admin);
+                ConnectionPool_free(&ddl);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test23: OK\n\n");
+
+        printf("=> Test24: Statement-level pooling\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 2);
+                assert(SQL_DEFAULT_CHECKOUT_TIMEOUT == ConnectionPool_getCheckoutTimeout(pool));
+                ConnectionPool_start(pool);
+                ConnectionPool_execute(pool, "create table zild_mux(x integer);");
+                // Eight threads share two connections
+                Thread_T threads[8];
+                for (int i = 0; i < 8; i++)
+                        Thread_create(threads[i], statementWorker, pool);
+                for (int i = 0; i < 8; i++)
+                        Thread_join(threads[i]);
+                assert(ConnectionPool_size(pool) <= 2);
+                assert(ConnectionPool_active(pool) == 0);
+                int rows = 0;
+                ConnectionPool_executeQuery(pool, countRows, &rows, "select count(*) from zild_mux;");
+                assert(rows == 160);
+                // A transaction is committed when the callback returns and rolled back if it throws
+                ConnectionPool_executeTransaction(pool, insertAndFail, NULL);
+                TRY
+                {
+                        ConnectionPool_executeTransaction(pool, insertAndFail, "fail");
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        assert(Str_isEqual(Exception_frame.message, "rollback"));
+                }
+                END_TRY;
+                ConnectionPool_executeQuery(pool, countRows, &rows, "select count(*) from zild_mux where x = -1;");
+                assert(rows == 1);
+                assert(ConnectionPool_active(pool) == 0);
+                // Errors are thrown after the connection is returned
+                TRY
+                {
+                        ConnectionPool_execute(pool, "insert into zild_nonexistent values(1);");
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        printf("\tResult: %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                assert(ConnectionPool_active(pool) == 0);
+                // No connection within the checkout timeout
+                ConnectionPool_setCheckoutTimeout(pool, 0);
+                Connection_T a = ConnectionPool_getConnection(pool);
+                Connection_T b = ConnectionPool_getConnection(pool);
+                assert(a && b);
+                TRY
+                {
+                        ConnectionPool_execute(pool, "select 1;");
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        printf("\tResult: %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                Connection_close(a);
+                Connection_close(b);
+                ConnectionPool_execute(pool, "drop table zild_mux;");
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test24: OK\n\n");
+
+        printf("=> Test25: Result cache\n");
+        {
+                char names[256];
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 2);
+                ConnectionPool_setResultCacheSize(pool, 1024 * 1024);
+                ConnectionPool_start(pool);
+                ConnectionPool_execute(pool, "create table zild_cache(id integer, name varchar(255));");
+                ConnectionPool_execute(pool, "insert into zild_cache values(1, 'Ichigo'), (2, NULL), (3, 'it''s');");
+                assert(0 == ConnectionPool_getResultCacheSize(pool));
+                ConnectionPool_executeCachedQuery(pool, 60000, readNames, names, "select id, name from zild_cache where id < %d order by id;", 10);
+                assert(Str_isEqual(names, "Ichigo,null;it's,"));
+                assert(ConnectionPool_getResultCacheSize(pool) > 0);
+                // A cache hit, with whitespace collapsed, does not use a connection
+                ConnectionPool_execute(pool, "insert into zild_cache values(4, 'Rukia');");
+                ConnectionPool_setCheckoutTimeout(pool, 0);
+                Connection_T a = ConnectionPool_getConnection(pool);
+                Connection_T b = ConnectionPool_getConnection(pool);
+                assert(a && b);
+                ConnectionPool_executeCachedQuery(pool, 60000, readNames, names, "select id, name\n  from zild_cache where id < %d order by id;", 10);
+                assert(Str_isEqual(names, "Ichigo,null;it's,"));
+                Connection_close(a);
+                Connection_close(b);
+                // Invalidated by prefix
+                assert(0 == ConnectionPool_invalidateCache(pool, "select id from zild_cache"));
+                assert(1 == ConnectionPool_invalidateCache(pool, "select  id, name from zild_cache"));
+                ConnectionPool_executeCachedQuery(pool, 60000, readNames, names, "select id, name from zild_cache where id < %d order by id;", 10);
+                assert(Str_isEqual(names, "Ichigo,null;it's,Rukia;"));
+                // An expired result is fetched again
+                ConnectionPool_executeCachedQuery(pool, 1, readNames, names, "select id, name from zild_cache where id = %d;", 1);
+                Time_usleep(5 * USEC_PER_MSEC);
+                ConnectionPool_execute(pool, "update zild_cache set name = 'Kurosaki' where id = 1;");
+                ConnectionPool_executeCachedQuery(pool, 1, readNames, names, "select id, name from zild_cache where id = %d;", 1);
+                assert(Str_isEqual(names, "Kurosaki,"));
+                assert(ConnectionPool_invalidateCache(pool, NULL) == 2);
+                assert(0 == ConnectionPool_getResultCacheSize(pool));
+                ConnectionPool_execute(pool, "drop table zild_cache;");
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test25: OK\n\n");
+
+        printf("=> Test26: Materialized ResultSet\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                Connection_execute(con, "create table zild_mat(id integer, name varchar(255));");
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_mat values(?, ?);");
+                for (int i = 1; i <= 100; i++) {
+                        PreparedStatement_setInt(p, 1, i);
+                        PreparedStatement_setString(p, 2, i % 2 ? "name" : NULL);
+                        PreparedStatement_execute(p);
+                }
+                ResultSet_T r = ResultSet_materialize(Connection_executeQuery(con, "select id, name from zild_mat order by id;"));
+                // The rows outlive the connection's ResultSet and the connection
+                Connection_execute(con, "drop table zild_mat;");
+                Connection_close(con);
+                assert(2 == ResultSet_getColumnCount(r));
+                assert(Str_isEqual(ResultSet_getColumnName(r, 2), "name"));
+                assert(NULL == ResultSet_getColumnName(r, 3));
+                Thread_T thread;
+                Thread_create(thread, readMaterialized, r);
+                Thread_join(thread);
+                assert(! ResultSet_next(r));
+                TRY
+                {
+                        ResultSet_getString(r, 1);
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        printf("\tResult: %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                ResultSet_freeMaterialized(&r);
+                assert(r == NULL);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test26: OK\n\n");
+
+        printf("=> Test27: Multiple result sets\n");
+        {
+                url = URL_new(testURL);
+                // MySQL can only send several statements at once with the text protocol
+                if (Str_isEqual(URL_getProtocol(url), "oracle") || (Str_isEqual(URL_getProtocol(url), "mysql") && ! Str_isEqual(URL_getParameter(url, "query-protocol"), "text"))) {
+                        printf("\tResult: multiple result sets not supported by %s\n", URL_getProtocol(url));
+                } else {
+                        pool = ConnectionPool_new(url);
+                        assert(pool);
+                        ConnectionPool_start(pool);
+                        Connection_T con = ConnectionPool_getConnection(pool);
+                        Connection_execute(con, "create table zild_multi(id integer);");
+                        // Statements which do not return rows are executed and skipped
+                        ResultSet_T r = Connection_executeQuery(con, "insert into zild_multi values(1); insert into zild_multi values(2); "
+                                                                "select count(*) from zild_multi; select id from zild_multi order by id; "
+                                                                "update zild_multi set id = id + 10; select max(id) as m from zild_multi;");
+                        assert(ResultSet_next(r));
+                        assert(2 == ResultSet_getInt(r, 1));
+                        assert(ResultSet_nextResult(r));
+                        int sum = 0;
+                        while (ResultSet_next(r))
+                                sum += ResultSet_getIntByName(r, "id");
+                        assert(3 == sum);
+                        assert(ResultSet_nextResult(r));
+                        assert(ResultSet_next(r));
+                        assert(12 == ResultSet_getIntByName(r, "m"));
+                        assert(! ResultSet_nextResult(r));
+                        assert(! ResultSet_next(r));
+                        // Statements after the first result are executed without ResultSet_nextResult()
+                        r = Connection_executeQuery(con, "select count(*) from zild_multi; update zild_multi set id = id + 10;");
+                        assert(ResultSet_next(r));
+                        assert(2 == ResultSet_getInt(r, 1));
+                        r = Connection_executeQuery(con, "select max(id) from zild_multi;");
+                        assert(ResultSet_next(r));
+                        assert(22 == ResultSet_getInt(r, 1));
+                        // A single statement has one result
+                        r = Connection_executeQuery(con, "select id from zild_multi;");
+                        assert(! ResultSet_nextResult(r));
+                        TRY
+                        {
+                                r = Connection_executeQuery(con, "select id from zild_multi; select id from zild_nonexistent;");
+                                ResultSet_nextResult(r);
+                                assert(false);
+                        }
+                        CATCH(SQLException)
+                        {
+                                printf("\tResult: %s\n", Exception_frame.message);
+                        }
+                        END_TRY;
+                        Connection_execute(con, "drop table zild_multi;");
+                        Connection_close(con);
+                        ConnectionPool_free(&pool);
+                        assert(pool==NULL);
+                }
+                URL_free(&url);
+        }
+        printf("=> Test27: OK\n\n");
+
+        printf("=> Test28: Blob streams\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                const char *protocol = URL_getProtocol(url);
+                Connection_execute(con, "create table zild_lob(id integer, data %s);", 
+                                   Str_isEqual(protocol, "postgresql") ? "bytea" : Str_isEqual(protocol, "mysql") ? "longblob" : "blob");
+                int size = 300000;
+                char *data = ALLOC(size);
+                for (int i = 0; i < size; i++)
+                        data[i] = (char)(i % 251);
+                blobStream stream = {.data = data, .size = size};
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_lob values(?, ?);");
+                PreparedStatement_setInt(p, 1, 1);
+                PreparedStatement_setBlobStream(p, 2, readBlobStream, &stream);
+                PreparedStatement_execute(p);
+                assert(stream.offset == size);
+                TRY
+                {
+                        PreparedStatement_setBlobStream(p, 2, failBlobStream, NULL);
+                        PreparedStatement_execute(p);
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        printf("\tResult: %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                ResultSet_T r = Connection_executeQuery(con, "select data from zild_lob where id = 1;");
+                assert(ResultSet_next(r));
+                char chunk[7000];
+                long long offset = 0;
+                for (int n; (n = ResultSet_readBlob(r, 1, offset, chunk, sizeof(chunk))) > 0; offset += n)
+                        assert(memcmp(chunk, data + offset, n) == 0);
+                assert(offset == size);
+                assert(0 == ResultSet_readBlob(r, 1, size + 1, chunk, sizeof(chunk)));
+                Connection_execute(con, "drop table zild_lob;");
+                FREE(data);
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test28: OK\n\n");
+
+        printf("=> Test29: Autoscaling\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 10);
+                ConnectionPool_setAutoScaling(pool, 50);
+                assert(ConnectionPool_getAutoScaling(pool) == 50);
+                ConnectionPool_start(pool);
+                assert(ConnectionPool_size(pool) == 2);
+                Connection_T a = ConnectionPool_getConnection(pool);
+                Connection_T b = ConnectionPool_getConnection(pool);
+                assert(a && b);
+                // Two active connections at 50% should be warmed up to four
+                for (int i = 0; i < 50 && ConnectionPool_size(pool) < 4; i++)
+                        Time_usleep(100 * USEC_PER_MSEC);
+                assert(ConnectionPool_size(pool) == 4);
+                assert(ConnectionPool_active(pool) == 2);
+                Connection_close(a);
+                Connection_close(b);
+                // Idle connections are closed gradually, down to initial connections
+                for (int i = 0; i < 150 && ConnectionPool_size(pool) > 2; i++)
+                        Time_usleep(100 * USEC_PER_MSEC);
+                assert(ConnectionPool_size(pool) == 2);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test29: OK\n\n");
+
+        printf("=> Test30: Circuit breaker\n");
+        {
+                char dir[64], path[128];
+                snprintf(dir, sizeof(dir), "/tmp/zild_breaker_%d", (int)getpid());
+                snprintf(path, sizeof(path), "sqlite://%s/breaker.db", dir);
+                url = URL_new(path);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 0);
+                ConnectionPool_setCircuitBreaker(pool, 2, 200);
+                assert(ConnectionPool_getCircuitBreaker(pool) == 2);
+                ConnectionPool_start(pool);
+                // The database directory does not exist so connects fail until it is created
+                assert(! ConnectionPool_getConnection(pool));
+                assert(! ConnectionPool_snapshot(pool).broken);
+                assert(! ConnectionPool_getConnection(pool));
+                assert(ConnectionPool_snapshot(pool).broken);
+                assert(! ConnectionPool_getConnectionWithTimeout(pool, 5000));
+                TRY
+                {
+                        ConnectionPool_execute(pool, "select 1;");
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        printf("\tResult: %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                assert(mkdir(dir, 0700) == 0);
+                // Fail fast until the cooldown has passed, then a probe closes the breaker
+                assert(! ConnectionPool_getConnection(pool));
+                Time_usleep(250 * USEC_PER_MSEC);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                assert(! ConnectionPool_snapshot(pool).broken);
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+                unlink(path + strlen("sqlite://"));
+                rmdir(dir);
+        }
+        printf("=> Test30: OK\n\n");
+
+
+        printf("=> Test31: Transaction types\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_tx;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_tx(id integer);");
+                // A deferred BEGIN is sent with the first statement of the transaction
+                Connection_beginTransactionType(con, Transaction_Deferred);
+                assert(Connection_isInTransaction(con));
+                Connection_execute(con, "insert into zild_tx values(1);");
+                Connection_rollback(con);
+                ResultSet_T r = Connection_executeQuery(con, "select count(*) from zild_tx;");
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 0);
+                // or with the first prepared statement executed
+                Connection_beginTransactionType(con, Transaction_ReadCommitted | Transaction_Deferred);
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_tx values(?);");
+                PreparedStatement_setInt(p, 1, 2);
+                PreparedStatement_execute(p);
+                Connection_commit(con);
+                r = Connection_executeQuery(con, "select count(*) from zild_tx;");
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 1);
+                // A deferred transaction ended before any statement
+                Connection_beginTransactionType(con, Transaction_Serializable | Transaction_Deferred);
+                Connection_commit(con);
+                Connection_beginTransactionType(con, Transaction_RepeatableRead | Transaction_Deferred);
+                Connection_rollback(con);
+                assert(! Connection_isInTransaction(con));
+                // A read-only transaction, which SQLite does not enforce
+                Connection_beginTransactionType(con, Transaction_ReadOnly | Transaction_Deferred);
+                r = Connection_executeQuery(con, "select id from zild_tx;");
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 2);
+                if (! Str_isEqual(URL_getProtocol(url), "sqlite")) {
+                        TRY
+                        {
+                                Connection_execute(con, "insert into zild_tx values(3);");
+                                assert(false);
+                        }
+                        CATCH(SQLException)
+                        {
+                                printf("\tResult: %s\n", Exception_frame.message);
+                        }
+                        END_TRY;
+                }
+                Connection_rollback(con);
+                Connection_execute(con, "drop table zild_tx;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test31: OK\n\n");
+
+
+        printf("=> Test32: Transaction retry\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_retry;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_retry(id integer primary key);");
+                contention c = {};
+                Connection_runTransaction(con, insertContended, &c, NULL);
+                assert(c.attempts == 1);
+                // Errors which are not caused by contention are not retried
+                c = (contention){};
+                TRY
+                {
+                        Connection_runTransaction(con, insertContended, &c, NULL);
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        printf("\tResult: %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                assert(c.attempts == 1);
+                assert(! Connection_isInTransaction(con));
+                if (Str_isEqual(URL_getProtocol(url), "sqlite")) {
+                        // A write lock held by another connection makes the insert fail with SQLITE_BUSY
+                        Connection_setQueryTimeout(con, 50);
+                        Connection_RetryPolicy_T policy = {.maxAttempts = 3, .initialDelay = 5, .maxDelay = 20};
+                        c = (contention){.locker = ConnectionPool_getConnection(pool), .release = 2};
+                        Connection_runTransaction(con, insertContended, &c, &policy);
+                        assert(c.attempts == 2);
+                        // and is rethrown when the lock is held for all attempts
+                        c = (contention){.locker = c.locker, .release = 0};
+                        TRY
+                        {
+                                Connection_runTransaction(con, insertContended, &c, &policy);
+                                assert(false);
+                        }
+                        CATCH(SQLException)
+                        {
+                                printf("\tResult: %s after %d attempts\n", Exception_frame.message, c.attempts);
+                        }
+                        END_TRY;
+                        assert(c.attempts == 3);
+                        Connection_rollback(c.locker);
+                        Connection_close(c.locker);
+                        ResultSet_T r = Connection_executeQuery(con, "select count(*) from zild_retry;");
+                        assert(ResultSet_next(r));
+                        assert(ResultSet_getInt(r, 1) == 3);
+                }
+                Connection_execute(con, "drop table zild_retry;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test32: OK\n\n");
+
+        printf("=> Test33: Maximum lifetime\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 2);
+                ConnectionPool_setMaxLifetime(pool, 1, 0);
+                assert(ConnectionPool_getMaxLifetime(pool) == 1);
+                ConnectionPool_start(pool);
+                assert(ConnectionPool_snapshot(pool).created == 2);
+                Time_usleep(1100 * USEC_PER_MSEC);
+                // A full pool closes each aged connection before it is replaced
+                ConnectionPool_reapConnections(pool);
+                ConnectionPool_Snapshot_T s = ConnectionPool_snapshot(pool);
+                assert(s.created == 4 && s.destroyed == 2);
+                assert(s.size == 2 && s.idle == 2);
+                // With room in the pool the replacement is established first
+                ConnectionPool_setMaxConnections(pool, 4);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                Time_usleep(1100 * USEC_PER_MSEC);
+                ConnectionPool_reapConnections(pool);
+                s = ConnectionPool_snapshot(pool);
+                assert(s.created == 5 && s.destroyed == 3);
+                assert(s.size == 2 && s.active == 1);
+                // A checked out connection is replaced once it is returned
+                Connection_close(con);
+                ConnectionPool_reapConnections(pool);
+                s = ConnectionPool_snapshot(pool);
+                assert(s.created == 6 && s.destroyed == 4 && s.size == 2);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                // A connection parked for thread affinity is recycled and reaped too
+                pool = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(pool, 0);
+                ConnectionPool_setMaxLifetime(pool, 1, 0);
+                ConnectionPool_setThreadAffinity(pool, true);
+                ConnectionPool_start(pool);
+                Connection_close(ConnectionPool_getConnection(pool));
+                Time_usleep(1100 * USEC_PER_MSEC);
+                ConnectionPool_reapConnections(pool);
+                s = ConnectionPool_snapshot(pool);
+                assert(s.created == 2 && s.destroyed == 1 && s.idle == 1);
+                Connection_close(ConnectionPool_getConnection(pool));
+                ConnectionPool_setMaxLifetime(pool, 0, 0);
+                ConnectionPool_setConnectionTimeout(pool, 1);
+                Time_usleep(1100 * USEC_PER_MSEC);
+                ConnectionPool_reapConnections(pool);
+                s = ConnectionPool_snapshot(pool);
+                assert(s.created == 2 && s.destroyed == 2 && s.size == 0);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test33: OK\n\n");
+
+        printf("=> Test34: Health check\n");
+        {
+                trace_t t = {};
+                ConnectionPool_Tracer_T tracer = {.begin = traceBegin, .end = traceEnd, .context = &t};
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setThreadAffinity(pool, true);
+                ConnectionPool_setHealthCheck(pool, 100);
+                assert(ConnectionPool_getHealthCheck(pool) == 100);
+                ConnectionPool_setConnectionTimeout(pool, 1);
+                ConnectionPool_setReaper(pool, 1);
+                ConnectionPool_setTracer(pool, &tracer);
+                ConnectionPool_start(pool);
+                // Checkout does not ping
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(t.begins == 0);
+                Connection_close(con);
+                // The reaper pings idle connections, also the one parked in the thread's slot
+                Time_usleep(350 * USEC_PER_MSEC);
+                ConnectionPool_Snapshot_T s = ConnectionPool_snapshot(pool);
+                assert(s.created == 2 && s.destroyed == 0);
+                // Pinged connections keep their last accessed time and still time out
+                ConnectionPool_setInitialConnections(pool, 0);
+                Time_usleep(2000 * USEC_PER_MSEC);
+                s = ConnectionPool_snapshot(pool);
+                assert(s.destroyed == 2 && s.size == 0);
+                ConnectionPool_stop(pool);
+                assert(t.begins >= 2 && t.begins == t.ends && t.errors == 0);
+                assert(Str_startsWith(t.operations, "ping ping "));
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test34: OK\n\n");
+
+        printf("=> Test35: SQLite WAL read pool\n");
+        if (Str_startsWith(testURL, "sqlite")) {
+                char path[64], writer[128], reader[128];
+                snprintf(path, sizeof(path), "/tmp/zild_wal_%d.db", (int)getpid());
+                snprintf(writer, sizeof(writer), "sqlite://%s?journal_mode=wal&cache=private", path);
+                snprintf(reader, sizeof(reader), "sqlite://%s?mode=ro&cache=private", path);
+                url = URL_new(writer);
+                URL_T readURL = URL_new(reader);
+                pool = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMaxConnections(pool, 1);
+                ConnectionPool_addReplica(pool, readURL, 1);
+                ConnectionPool_setReadConnections(pool, 4);
+                assert(ConnectionPool_getReadConnections(pool) == 4);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                Connection_execute(con, "create table zild_wal(id integer);");
+                Connection_execute(con, "insert into zild_wal values(1);");
+                // Readers are not blocked by the writer's transaction and see the last commit
+                Connection_beginTransaction(con);
+                Connection_execute(con, "insert into zild_wal values(2);");
+                Connection_T readers[4];
+                for (int i = 0; i < 4; i++) {
+                        readers[i] = ConnectionPool_getReadConnection(pool);
+                        assert(readers[i] && readers[i] != con);
+                        ResultSet_T r = Connection_executeQuery(readers[i], "select count(*) from zild_wal;");
+                        assert(ResultSet_next(r));
+                        assert(ResultSet_getInt(r, 1) == 1);
+                }
+                // Read connections are read-only
+                TRY
+                {
+                        Connection_execute(readers[0], "insert into zild_wal values(3);");
+                        assert(false);
+                }
+                CATCH(SQLException)
+                {
+                        printf("\tResult: %s\n", Exception_frame.message);
+                }
+                END_TRY;
+                Connection_commit(con);
+                for (int i = 0; i < 4; i++)
+                        Connection_close(readers[i]);
+                Connection_T reading = ConnectionPool_getReadConnection(pool);
+                assert(reading != con);
+                ResultSet_T r = Connection_executeQuery(reading, "select count(*) from zild_wal;");
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 2);
+                Connection_close(reading);
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&readURL);
+                URL_free(&url);
+                char file[80];
+                unlink(path);
+                snprintf(file, sizeof(file), "%s-wal", path);
+                unlink(file);
+                snprintf(file, sizeof(file), "%s-shm", path);
+                unlink(file);
+        }
+        printf("=> Test35: OK\n\n");
+
+        printf("=> Test36: Result memory limit\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(ConnectionPool_getResultMemoryLimit(pool) == 0);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_mem;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_mem(id integer, name varchar(255));");
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_mem values(?, ?);");
+                for (int i = 0; i < 100; i++) {
+                        PreparedStatement_setInt(p, 1, i);
+                        PreparedStatement_setString(p, 2, "Memory is accounted for the result sets of a pool");
+                        PreparedStatement_execute(p);
+                }
+                // Result memory is accounted per connection and per pool, and released when the result set is closed
+                ResultSet_T r = Connection_executeQuery(con, "select id, name from zild_mem;");
+                long long memory = ConnectionPool_getResultMemory(pool);
+                assert(memory >= 0 && memory == Connection_getResultMemory(con));
+                assert(ConnectionPool_snapshot(pool).resultMemory == memory);
+                while (ResultSet_next(r));
+                p = Connection_prepareStatement(con, "select id, name from zild_mem where id < ?;");
+                PreparedStatement_setInt(p, 1, 50);
+                r = PreparedStatement_executeQuery(p);
+                assert(ConnectionPool_getResultMemory(pool) == Connection_getResultMemory(con));
+                Connection_close(con);
+                assert(ConnectionPool_getResultMemory(pool) == 0);
+                // A backend which accounts the memory of its results fails a query above the limit cleanly
+                if (memory > 0) {
+                        ConnectionPool_setResultMemoryLimit(pool, memory - 1);
+                        assert(ConnectionPool_getResultMemoryLimit(pool) == memory - 1);
+                        con = ConnectionPool_getConnection(pool);
+                        TRY
+                        {
+                                Connection_executeQuery(con, "select id, name from zild_mem;");
+                                assert(false);
+                        }
+                        CATCH(SQLException)
+                        {
+                                printf("\tResult: %s\n", Exception_frame.message);
+                        }
+                        END_TRY;
+                        assert(Connection_getResultMemory(con) == 0 && ConnectionPool_getResultMemory(pool) == 0);
+                        ConnectionPool_setResultMemoryLimit(pool, 0);
+                        r = Connection_executeQuery(con, "select id, name from zild_mem;");
+                        assert(ResultSet_next(r));
+                        Connection_close(con);
+                }
+                con = ConnectionPool_getConnection(pool);
+                Connection_execute(con, "drop table zild_mem;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test36: OK\n\n");
+
+        printf("=> Test37: Background prefetch\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                TRY Connection_execute(con, "drop table zild_prefetch;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_prefetch(id integer, name varchar(255));");
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_prefetch values(?, ?);");
+                Connection_beginTransaction(con);
+                for (int i = 1; i <= 1000; i++) {
+                        PreparedStatement_setInt(p, 1, i);
+                        PreparedStatement_setString(p, 2, i % 10 ? "row" : NULL);
+                        PreparedStatement_execute(p);
+                }
+                Connection_commit(con);
+                // Rows are read in blocks by a background thread and returned in order
+                ResultSet_T r = Connection_executeQuery(con, "select id, name from zild_prefetch order by id;");
+                ResultSet_setPrefetch(r, 64);
+                ResultSet_setPrefetch(r, 64);
+                assert(ResultSet_getColumnCount(r) == 2);
+                assert(Str_isEqual(ResultSet_getColumnName(r, 2), "name"));
+                int rows = 0;
+                long long sum = 0;
+                while (ResultSet_next(r)) {
+                        rows++;
+                        assert(ResultSet_getInt(r, 1) == rows);
+                        sum += ResultSet_getLLongByName(r, "id");
+                        if (rows % 10)
+                                assert(Str_isEqual(ResultSet_getString(r, 2), "row"));
+                        else
+                                assert(ResultSet_isnull(r, 2));
+                }
+                assert(rows == 1000 && sum == 500500);
+                assert(! ResultSet_next(r));
+                // A block size dividing the row count ends with an empty block
+                r = Connection_executeQuery(con, "select id from zild_prefetch where id <= 128;");
+                ResultSet_setPrefetch(r, 64);
+                for (rows = 0; ResultSet_next(r); rows++);
+                assert(rows == 128);
+                // Closing the result set in the middle stops the background thread
+                r = Connection_executeQuery(con, "select id, name from zild_prefetch;");
+                ResultSet_setPrefetch(r, 16);
+                for (int i = 0; i < 100; i++)
+                        assert(ResultSet_next(r));
+                Connection_close(con);
+                assert(ConnectionPool_getResultMemory(pool) == 0);
+                con = ConnectionPool_getConnection(pool);
+                Connection_execute(con, "drop table zild_prefetch;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test37: OK\n\n");
+
+
+        printf("============> Connection Pool Tests: OK\n\n");
+}
+
+
+/* ------------------------------------------------------- Stress benchmark */
+
+
+#define STRESS_SECONDS 2
+
+typedef struct {
+        ConnectionPool_T pool;
+        volatile int *stop;
+        long long checkouts;
+        long long poolNanos;    // Time spent in getConnection and Connection_close
+        long long *latency;     // Checkout latencies in nanoseconds
+        int size;
+} stress_t;
+
+static long long nowNanos(void) {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int compareLLong(const void *a, const void *b) {
+        long long x = *(const long long *)a, y = *(const long long *)b;
+        return (x > y) - (x < y);
+}
+
+static void *stressWorker(void *arg) {
+        stress_t *s = arg;
+        while (! *s->stop) {
+                long long start = nowNanos();
+                Connection_T con = ConnectionPool_getConnection(s->pool);
+                long long checkout = nowNanos();
+                if (con)
+                        Connection_close(con);
+                s->poolNanos += nowNanos() - start;
+                if (! s->latency) {
+                        s->size = 4096;
+                        s->latency = ALLOC(s->size * sizeof *s->latency);
+                } else if (s->checkouts == s->size) {
+                        s->size *= 2;
+                        RESIZE(s->latency, s->size * sizeof *s->latency);
+                }
+                s->latency[s->checkouts++] = checkout - start;
+        }
+        return NULL;
+}
+
+/* Hammer the pool with each thread count for STRESS_SECONDS. Lock wait is estimated as
+   the time spent in the pool above what the same calls take without contention, i.e.
+   in the first run, which should be with a single thread */
+static void stressPool(const char *testURL, int *threadCounts, int n) {
+        double baseline = 0;
+        printf("============> Pool stress %s\n", testURL);
+        printf("%8s %14s %14s %10s %10s %10s\n", "threads", "checkouts/s", "lock_wait_ms", "p50_us", "p99_us", "p999_us");
+        for (int i = 0; i < n; i++) {
+                int threads = threadCounts[i];
+                URL_T url = URL_new(testURL);
+                ConnectionPool_T pool = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(pool, threads);
+                ConnectionPool_setMaxConnections(pool, threads);
+                ConnectionPool_start(pool);
+                volatile int stop = false;
+                stress_t workers[threads];
+                Thread_T thread[threads];
+                for (int t = 0; t < threads; t++) {
+                        workers[t] = (stress_t){.pool = pool, .stop = &stop};
+                        Thread_create(thread[t], stressWorker, &workers[t]);
+                }
+                Time_usleep(STRESS_SECONDS * USEC_PER_SEC);
+                stop = true;
+                long long checkouts = 0, poolNanos = 0;
+                for (int t = 0; t < threads; t++) {
+                        Thread_join(thread[t]);
+                        checkouts += workers[t].checkouts;
+                        poolNanos += workers[t].poolNanos;
+                }
+                long long *latency = ALLOC((checkouts + 1) * sizeof *latency);
+                for (int t = 0, k = 0; t < threads; t++) {
+                        memcpy(latency + k, workers[t].latency, workers[t].checkouts * sizeof *latency);
+                        k += workers[t].checkouts;
+                        FREE(workers[t].latency);
+                }
+                qsort(latency, checkouts, sizeof *latency, compareLLong);
+#define PERCENTILE(p) (checkouts ? latency[(long long)(checkouts * (p) / 100.0) < checkouts ? (long long)(checkouts * (p) / 100.0) : checkouts - 1] / 1000.0 : 0)
+                if (i == 0)
+                        baseline = checkouts ? (double)poolNanos / checkouts : 0;
+                double wait = poolNanos - baseline * checkouts;
+                printf("%8d %14lld %14.1f %10.1f %10.1f %10.1f\n", threads, checkouts / STRESS_SECONDS, wait > 0 ? wait / 1e6 : 0,
+                       PERCENTILE(50), PERCENTILE(99), PERCENTILE(99.9));
+#undef PERCENTILE
+                FREE(latency);
+                ConnectionPool_free(&pool);
+                URL_free(&url);
+        }
+        printf("\n");
+}
+
+/* pool -s [threads,...] [URL ...] */
+static int stress(int argc, char **argv) {
+        int threadCounts[32] = {1, 2, 4, 8, 16, 32}, n = 6;
+        if (argc > 0 && isdigit((unsigned char)*argv[0])) {
+                n = 0;
+                for (char *t = strtok(argv[0], ","); t && n < 32; t = strtok(NULL, ","))
+                        if ((threadCounts[n] = atoi(t)) > 0)
+                                n++;
+                argc--, argv++;
+        }
+        if (argc == 0) {
+                stressPool("sqlite:///:memory:", threadCounts, n);
+        } else {
+                for (int i = 0; i < argc; i++)
+                        stressPool(argv[i], threadCounts, n);
+        }
+        return 0;
+}
+
+
+int main(int argc, char **argv) {
+        URL_T url;
+        char buf[BSIZE];
+        char *help = "Please enter a valid database connection URL and press ENTER\n"
+                    "E.g. sqlite:///tmp/sqlite.db?synchronous=off&heap_limit=2000\n"
+                    "E.g. mysql://localhost:3306/test?user=root&password=root\n"
+                    "E.g. postgresql://localhost:5432/test?user=root&password=root\n"
+                    "E.g. oracle://localhost:1526/test?user=scott&password=tiger\n"
+                    "To exit, enter '.' on a single line\n\nConnection URL> ";
+        Exception_init();
+        if (argc > 1 && Str_isEqual(argv[1], "-s"))
+                return stress(argc - 2, argv + 2);
+        ZBDEBUG = true;
         printf("============> Start Connection Pool Tests\n\n");
         printf("This test will create and drop a table called zild_t in the database\n");
 	printf("%s", help);
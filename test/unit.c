@@ -8,6 +8,7 @@
 #include "URL.h"
 #include "Vector.h"
 #include "system/Time.h"
+#include "system/Watchdog.h"
 #include "StringBuffer.h"
 
 
@@ -25,6 +26,15 @@ static void abortHandler(const char *error) {
         abortHandlerCalled = 1;
 }
 
+static void slowAlarm(void *args) {
+        Time_usleep(500 * USEC_PER_MSEC);
+        (*(int *)args)++;
+}
+
+static void fastAlarm(void *args) {
+        (*(int *)args)++;
+}
+
 
 static void testStr() {
         printf("============> Start Str Tests\n\n");
@@ -128,6 +138,12 @@ static void testStr() {
 }
 
 
+static int allocations, frees;
+static void *_countMalloc(size_t size) { allocations++; return malloc(size); }
+static void *_countCalloc(size_t count, size_t size) { allocations++; return calloc(count, size); }
+static void *_countRealloc(void *p, size_t size) { allocations++; return realloc(p, size); }
+static void _countFree(void *p) { frees++; free(p); }
+
 static void testMem() {
         printf("============> Start Mem Tests\n\n");
         
@@ -159,6 +175,20 @@ static void testMem() {
         }
         printf("=> Test3: OK\n\n");
         
+        printf("=> Test4: allocator\n");
+        {
+                Mem_setAllocator(_countMalloc, _countCalloc, _countRealloc, _countFree);
+                char *s10 = ALLOC(16);
+                char *s11 = CALLOC(4, 4);
+                RESIZE(s10, 32);
+                FREE(s10);
+                FREE(s11);
+                Mem_setAllocator(malloc, calloc, realloc, free);
+                assert(allocations == 3);
+                assert(frees == 2);
+        }
+        printf("=> Test4: OK\n\n");
+        
         printf("============> Mem Tests: OK\n\n");
 }
 
@@ -323,6 +353,36 @@ static void testTime() {
         }
         printf("=> Test6: OK\n\n");
         
+        printf("=> Test7: monotonic and coarse clock\n");
+        {
+                long long start = Time_monotonic();
+                long long coarse = Time_coarse();
+                Time_usleep(20000);
+                assert(Time_monotonic() - start >= 20);
+                assert(Time_coarse() >= coarse);
+                printf("\tResult: %lld %lld\n", Time_monotonic(), Time_coarse());
+        }
+        printf("=> Test7: OK\n\n");
+        
+        printf("=> Test8: Time_toTimestamp fast path\n");
+        {
+                // Round trip a time of day every 3 days and 17 hours from 1901 to 2100
+                char buf[20];
+                for (long long t = -2145916800LL; t < 4102444800LL; t += 320400 + 61) {
+                        Time_toString((time_t)t, buf);
+                        assert(Time_toTimestamp(buf) == (time_t)t);
+                }
+                // Other layouts take the scanner
+                assert(Time_toTimestamp("2013-12-14T19:12:58") == 1387048378);
+                assert(Time_toTimestamp("2013-12-14 19:12:58Z") == 1387048378);
+                assert(Time_toTimestamp("2013-12-14 19:12:58+01:00") == 1387044778);
+                assert(Time_toTimestamp("2013/12/14 19.12.58") == 1387048378);
+                struct tm tm;
+                assert(Time_toDateTime("2013-12-14 19:1a:58", &tm));
+                assert(tm.tm_year == 2013 && tm.tm_hour == 0);
+        }
+        printf("=> Test8: OK\n\n");
+        
         printf("============> Time Tests: OK\n\n");
 }
 
@@ -354,6 +414,29 @@ static void testSystem() {
                 assert(System_getError(errno));
         }
         printf("=> Test3: OK\n\n");
+
+        printf("=> Test4: Watchdog\n");
+        {
+                int slow = 0, fast = 0;
+                Watchdog_T s = Watchdog_new(slowAlarm, &slow);
+                Watchdog_T f = Watchdog_new(fastAlarm, &fast);
+                Watchdog_start(s, 10);
+                Watchdog_start(f, 50);
+                // A blocking alarm does not delay the alarm of another Watchdog
+                Time_usleep(200 * USEC_PER_MSEC);
+                assert(fast == 1 && slow == 0);
+                // Stop waits for an alarm in progress
+                Watchdog_stop(s);
+                assert(slow == 1);
+                // A stopped Watchdog does not fire
+                Watchdog_start(f, 10);
+                Watchdog_stop(f);
+                Time_usleep(50 * USEC_PER_MSEC);
+                assert(fast == 1);
+                Watchdog_free(&s);
+                Watchdog_free(&f);
+        }
+        printf("=> Test4: OK\n\n");
         
         printf("============> System Tests: OK\n\n");
 }
@@ -824,9 +907,34 @@ static void testStringBuffer() {
                 assert(Str_isEqual(StringBuffer_toString(sb), "insert into host values($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12);"));
                 StringBuffer_free(&sb);
                 assert(sb == NULL);
-                // Replace n > 99, should throw exception
+                // Replace n > 99
                 sb = StringBuffer_new("insert into host values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
-                assert(sb);
+                assert(StringBuffer_prepare4postgres(sb) == 111);
+                assert(strstr(StringBuffer_toString(sb), "$98, $99, $100, $101, $102, $103, $104, $105, $106, $107, $108, $109, $110, $111);"));
+                StringBuffer_free(&sb);
+                assert(sb == NULL);
+                // ? in literals, quoted identifiers and comments are not parameters
+                sb = StringBuffer_new("select '?', 'it''s ?', \"a?\", ? -- ?\nfrom t /* ? */ where x = ?;");
+                assert(StringBuffer_prepare4oracle(sb) == 2);
+                assert(Str_isEqual(StringBuffer_toString(sb), "select '?', 'it''s ?', \"a?\", :1 -- ?\nfrom t /* ? */ where x = :2;"));
+                StringBuffer_free(&sb);
+                assert(sb == NULL);
+                // ? in PostgreSQL escape strings and dollar-quoted strings are not parameters
+                sb = StringBuffer_new("select E'\\'?', e'''?', $$ ? $$, $f$ '?' $f$, ?, a$b?, name?;");
+                assert(StringBuffer_prepare4postgres(sb) == 3);
+                assert(Str_isEqual(StringBuffer_toString(sb), "select E'\\'?', e'''?', $$ ? $$, $f$ '?' $f$, $1, a$b$2, name$3;"));
+                StringBuffer_free(&sb);
+                assert(sb == NULL);
+                // 65535 ?'s, the maximum
+                sb = StringBuffer_create(65536);
+                for (int i = 0; i < 65535; i++)
+                        StringBuffer_append(sb, "?");
+                assert(StringBuffer_prepare4postgres(sb) == 65535);
+                assert(Str_startsWith(StringBuffer_toString(sb), "$1$2$3") && Str_isEqual(StringBuffer_toString(sb) + StringBuffer_length(sb) - 12, "$65534$65535"));
+                // More than 65535 ?'s, should throw exception
+                StringBuffer_set(sb, "?");
+                for (int i = 0; i < 65535; i++)
+                        StringBuffer_append(sb, "?");
                 TRY
                 {
                         StringBuffer_prepare4postgres(sb);
@@ -898,6 +1006,30 @@ static void testStringBuffer() {
         }
         printf("=> Test8: OK\n\n");
 
+        printf("=> Test9: copy without formatting\n");
+        {
+                sb = StringBuffer_create(4);
+                StringBuffer_set(sb, "%s", "select * from t where a like 'x%';");
+                assert(IS(StringBuffer_toString(sb), "select * from t where a like 'x%';"));
+                StringBuffer_set(sb, "%.*s", 6, "select * from t;");
+                assert(IS(StringBuffer_toString(sb), "select"));
+                assert(StringBuffer_length(sb) == 6);
+                StringBuffer_set(sb, "%.*s", -1, "select 1;");
+                assert(IS(StringBuffer_toString(sb), "select 1;"));
+                StringBuffer_append(sb, " -- %s", "raw");
+                assert(IS(StringBuffer_toString(sb), "select 1; -- raw"));
+                StringBuffer_clear(sb);
+                for (int i = 0; i < 1000; i++)
+                        StringBuffer_append(sb, "%d,", i % 10);
+                assert(StringBuffer_length(sb) == 2000);
+                StringBuffer_delete(sb, 4);
+                assert(IS(StringBuffer_toString(sb), "0,1,") && StringBuffer_length(sb) == 4);
+                StringBuffer_delete(sb, 4);
+                assert(StringBuffer_length(sb) == 4);
+                StringBuffer_free(&sb);
+        }
+        printf("=> Test9: OK\n\n");
+
         printf("============> StringBuffer Tests: OK\n\n");
 }
 